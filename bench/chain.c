@@ -0,0 +1,791 @@
+#include "conversion.h"
+#include <dc_c/dc_stdlib.h>
+#include <dc_c/dc_string.h>
+#include <dc_posix/dc_string.h>
+#include <dc_posix/dc_unistd.h>
+#include <dc_posix/sys/dc_socket.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <time.h>
+
+
+struct options
+{
+    bool show_help;
+    const char *binary;
+    const char *file_name;
+    char *extra;
+    size_t relays;
+    size_t buffer_size;
+    size_t generate_size;
+    size_t probes;
+    in_port_t base_port;
+};
+
+
+struct hop
+{
+    pid_t pid;
+    char name[16];
+    struct rusage usage;
+    double cpu_before;
+};
+
+
+static _Noreturn void usage(const struct dc_env *env, struct dc_error *err, const char *binary_path);
+static void parse_arguments(const struct dc_env *env, struct dc_error *err, int argc, char *argv[], struct options *opts);
+static int open_sink(const struct dc_env *env, struct dc_error *err, in_port_t port);
+static int start_chain(const struct dc_env *env, struct dc_error *err, const struct options *opts, struct hop *hops, int listen_fd);
+static void measure_latency(const struct dc_env *env, struct dc_error *err, const struct options *opts, int sink_fd, uint64_t *samples);
+static uint64_t measure_throughput(const struct dc_env *env, struct dc_error *err, const struct options *opts, struct hop *head, int sink_fd, uint64_t size);
+static void stop_chain(struct hop *hops, size_t count, int signal_number);
+static pid_t spawn(const struct dc_env *env, struct dc_error *err, const struct options *opts, const char **args, size_t count, bool relay);
+static bool wait_for_port(in_port_t port);
+static bool listening(in_port_t port);
+static double process_cpu(pid_t pid);
+static void print_report(const struct options *opts, const struct hop *hops, size_t count, uint64_t size, uint64_t elapsed, uint64_t *samples);
+static int compare_samples(const void *a, const void *b);
+static uint64_t now_ns(void);
+
+
+// NOLINTBEGIN(modernize-macro-to-enum)
+#define DEFAULT_BINARY "./dcnetworksnake"
+#define DEFAULT_RELAYS 2
+#define DEFAULT_BUF_SIZE 65536
+#define DEFAULT_GENERATE_SIZE (256 * 1024 * 1024)
+#define DEFAULT_PROBES 200
+#define DEFAULT_BASE_PORT 7100
+#define MAX_ARGS 64
+#define PORT_STRING_SIZE 6
+#define SIZE_STRING_SIZE 24
+#define READY_TIMEOUT_MS 5000
+#define READY_POLL_MS 10
+#define STALL_TIMEOUT_MS 10000
+#define LINE_SIZE 256
+#define TCP_LISTEN 0x0A
+#define SINK_BUF_SIZE (1024 * 1024)
+#define NSEC_PER_SEC 1000000000
+#define NSEC_PER_MSEC 1000000
+#define NSEC_PER_USEC 1000
+#define BYTES_PER_MB 1000000
+#define PERCENT 100
+#define P99 99
+#define EXEC_FAILED 127
+//NOLINTEND(modernize-macro-to-enum)
+
+
+int main(int argc, char *argv[])
+{
+    struct dc_error *err;
+    struct dc_env *env;
+    struct options opts;
+    struct hop *hops;
+    uint64_t *samples;
+    uint64_t size;
+    uint64_t elapsed;
+    int listen_fd;
+    int sink_fd;
+    int exit_code;
+
+    err = dc_error_create(true);
+
+    if(err == NULL)
+    {
+        exit_code = EXIT_FAILURE;
+        goto ERROR_CREATE;
+    }
+
+    env = dc_env_create(err, true, NULL);
+
+    if(dc_error_has_error(err))
+    {
+        goto ENV_CREATE;
+    }
+
+    dc_memset(env, &opts, 0, sizeof(opts));
+    opts.binary        = DEFAULT_BINARY;
+    opts.relays        = DEFAULT_RELAYS;
+    opts.buffer_size   = DEFAULT_BUF_SIZE;
+    opts.generate_size = DEFAULT_GENERATE_SIZE;
+    opts.probes        = DEFAULT_PROBES;
+    opts.base_port     = DEFAULT_BASE_PORT;
+    parse_arguments(env, err, argc, argv, &opts);
+
+    if(opts.show_help)
+    {
+        usage(env, err, argv[0]);
+    }
+
+    if(dc_error_has_no_error(err) && opts.relays == 0)
+    {
+        DC_ERROR_RAISE_USER(err, "the chain needs at least one relay", 2);
+    }
+
+    if(dc_error_has_error(err))
+    {
+        goto ARGS_ERROR;
+    }
+
+    if(opts.file_name)
+    {
+        struct stat file_stat;
+
+        if(stat(opts.file_name, &file_stat) == -1)
+        {
+            DC_ERROR_RAISE_ERRNO(err, errno);
+            goto ARGS_ERROR;
+        }
+
+        size = (uint64_t)file_stat.st_size;
+    }
+    else
+    {
+        size = opts.generate_size;
+    }
+
+    // every relay, tail first, with the head in the last slot
+    hops = dc_calloc(env, err, opts.relays + 1, sizeof(*hops));
+
+    if(dc_error_has_error(err))
+    {
+        goto ARGS_ERROR;
+    }
+
+    samples = dc_calloc(env, err, opts.probes + 1, sizeof(*samples));
+
+    if(dc_error_has_error(err))
+    {
+        goto SAMPLES_ERROR;
+    }
+
+    // the harness is the sink, so nothing but the relayed bytes reaches the measurement
+    listen_fd = open_sink(env, err, opts.base_port);
+
+    if(dc_error_has_error(err))
+    {
+        goto SINK_ERROR;
+    }
+
+    signal(SIGPIPE, SIG_IGN);       // NOLINT(cert-err33-c)
+    sink_fd = start_chain(env, err, &opts, hops, listen_fd);
+    close(listen_fd);
+
+    if(dc_error_has_error(err))
+    {
+        goto CHAIN_ERROR;
+    }
+
+    measure_latency(env, err, &opts, sink_fd, samples);
+
+    if(dc_error_has_error(err))
+    {
+        goto CHAIN_ERROR;
+    }
+
+    // the relays' startup and the latency probes are not part of the throughput figures
+    for(size_t i = 0; i < opts.relays; i++)
+    {
+        hops[i].cpu_before = process_cpu(hops[i].pid);
+    }
+
+    elapsed = measure_throughput(env, err, &opts, &hops[opts.relays], sink_fd, size);
+
+    if(dc_error_has_no_error(err))
+    {
+        stop_chain(hops, opts.relays, SIGTERM);
+        print_report(&opts, hops, opts.relays + 1, size, elapsed, samples);
+    }
+
+    // a failed run may have left a hop wedged, and it would never get through a graceful stop
+    CHAIN_ERROR:
+    stop_chain(hops, opts.relays + 1, dc_error_has_error(err) ? SIGKILL : SIGTERM);
+
+    if(sink_fd != -1)
+    {
+        close(sink_fd);
+    }
+
+    SINK_ERROR:
+    dc_free(env, samples);
+
+    SAMPLES_ERROR:
+    dc_free(env, hops);
+
+    ARGS_ERROR:
+    free(env);
+
+    ENV_CREATE:
+    if(dc_error_has_error(err))
+    {
+        fprintf(stderr, "Error: %s\n", dc_error_get_message(err));      // NOLINT(cert-err33-c)
+        exit_code = EXIT_FAILURE;
+    }
+    else
+    {
+        exit_code = EXIT_SUCCESS;
+    }
+
+    dc_error_reset(err);
+    free(err);
+
+    ERROR_CREATE:
+    return exit_code;
+}
+
+static _Noreturn void usage(const struct dc_env *env, struct dc_error *err, const char *binary_path)
+{
+    DC_TRACE(env);
+
+    // NOLINTBEGIN(cert-err33-c)
+    fprintf(stderr, "%s [OPTIONS] [FILE]\n", binary_path);
+    fprintf(stderr, "-B path            dcnetworksnake binary to chain (default %s)\n", DEFAULT_BINARY);
+    fprintf(stderr, "-n relays          relays after the head, the last one being the tail (default %d)\n", DEFAULT_RELAYS);
+    fprintf(stderr, "-b buffer size     buffer size for every hop (default %d)\n", DEFAULT_BUF_SIZE);
+    fprintf(stderr, "-g size            generate size bytes at the head when no FILE is given (default %d)\n", DEFAULT_GENERATE_SIZE);
+    fprintf(stderr, "-l probes          one byte round trips for the latency figures (default %d)\n", DEFAULT_PROBES);
+    fprintf(stderr, "-p port            sink port, the relays listen on the ports above it (default %d)\n", DEFAULT_BASE_PORT);
+    fprintf(stderr, "-a arguments       extra space separated arguments for every relay, e.g. \"-c 65536\"\n");
+    fprintf(stderr, "-h                 help\n");
+    // NOLINTEND(cert-err33-c)
+
+    exit(dc_error_has_error(err) ? EXIT_FAILURE : EXIT_SUCCESS);     // NOLINT(concurrency-mt-unsafe)
+}
+
+static void parse_arguments(const struct dc_env *env, struct dc_error *err, int argc, char *argv[], struct options *opts)
+{
+    int c;
+
+    DC_TRACE(env);
+
+    while((c = dc_getopt(env, argc, argv, ":B:n:b:g:l:p:a:h")) != -1)   // NOLINT(concurrency-mt-unsafe)
+    {
+        switch(c)
+        {
+            case 'B':
+            {
+                opts->binary = optarg;
+                break;
+            }
+            case 'n':
+            {
+                opts->relays = parse_size_t(env, err, optarg, 10); // NOLINT(cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers)
+                break;
+            }
+            case 'b':
+            {
+                opts->buffer_size = parse_size_t(env, err, optarg, 10); // NOLINT(cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers)
+                break;
+            }
+            case 'g':
+            {
+                opts->generate_size = parse_size_t(env, err, optarg, 10); // NOLINT(cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers)
+                break;
+            }
+            case 'l':
+            {
+                opts->probes = parse_size_t(env, err, optarg, 10); // NOLINT(cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers)
+                break;
+            }
+            case 'p':
+            {
+                opts->base_port = parse_port(env, err, optarg, 10); // NOLINT(cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers)
+                break;
+            }
+            case 'a':
+            {
+                opts->extra = optarg;
+                break;
+            }
+            case 'h':
+            {
+                opts->show_help = true;
+                break;
+            }
+            case ':':
+            case '?':
+            {
+                DC_ERROR_RAISE_USER(err, "", 2);
+                opts->show_help = true;
+                break;
+            }
+            default:
+            {
+                abort();
+            };
+        }
+    }
+
+    if(optind < argc)
+    {
+        opts->file_name = argv[optind];
+    }
+}
+
+static int open_sink(const struct dc_env *env, struct dc_error *err, in_port_t port)
+{
+    struct sockaddr_in addr;
+    int on;
+    int fd;
+
+    DC_TRACE(env);
+    fd = dc_socket(env, err, AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+
+    if(dc_error_has_error(err))
+    {
+        return -1;
+    }
+
+    on = 1;
+    dc_setsockopt(env, err, fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    dc_memset(env, &addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    if(dc_error_has_no_error(err))
+    {
+        dc_bind(env, err, fd, (struct sockaddr *)&addr, sizeof(addr));
+    }
+
+    if(dc_error_has_no_error(err))
+    {
+        dc_listen(env, err, fd, 1);
+    }
+
+    if(dc_error_has_error(err))
+    {
+        close(fd);
+        fd = -1;
+    }
+
+    return fd;
+}
+
+static int start_chain(const struct dc_env *env, struct dc_error *err, const struct options *opts, struct hop *hops, int listen_fd)
+{
+    char buffer_size[SIZE_STRING_SIZE];
+    char listen_port[PORT_STRING_SIZE];
+    char output_port[PORT_STRING_SIZE];
+    const char *args[MAX_ARGS];
+    struct timeval timeout;
+    struct pollfd pfd;
+    int sink_fd;
+
+    DC_TRACE(env);
+    sink_fd = -1;
+    snprintf(buffer_size, sizeof(buffer_size), "%zu", opts->buffer_size);  // NOLINT(cert-err33-c)
+
+    // start from the tail so every hop's output is listening before the hop connects to it
+    for(size_t i = 0; i < opts->relays; i++)
+    {
+        size_t count;
+
+        snprintf(listen_port, sizeof(listen_port), "%u", (unsigned int)(opts->base_port + i + 1));  // NOLINT(cert-err33-c)
+        snprintf(output_port, sizeof(output_port), "%u", (unsigned int)(opts->base_port + i));      // NOLINT(cert-err33-c)
+        snprintf(hops[i].name, sizeof(hops[i].name), i == 0 ? "tail" : "relay %zu", opts->relays - i);  // NOLINT(cert-err33-c)
+        count = 0;
+        args[count++] = opts->binary;
+        args[count++] = "-i";
+        args[count++] = "127.0.0.1";
+        args[count++] = "-p";
+        args[count++] = listen_port;
+        args[count++] = "-o";
+        args[count++] = "127.0.0.1";
+        args[count++] = "-P";
+        args[count++] = output_port;
+        args[count++] = "-b";
+        args[count++] = buffer_size;
+        hops[i].pid = spawn(env, err, opts, args, count, true);
+
+        if(dc_error_has_error(err))
+        {
+            break;
+        }
+
+        // the tail connects to the harness as soon as it starts
+        if(i == 0)
+        {
+            pfd.fd = listen_fd;
+            pfd.events = POLLIN;
+
+            if(poll(&pfd, 1, READY_TIMEOUT_MS) != 1)
+            {
+                DC_ERROR_RAISE_USER(err, "the tail never connected", 2);
+                break;
+            }
+
+            sink_fd = dc_accept(env, err, listen_fd, NULL, NULL);
+
+            if(dc_error_has_error(err))
+            {
+                break;
+            }
+
+            // a hop that wedges would otherwise hang the harness for good, so a stalled chain fails the run
+            timeout.tv_sec = STALL_TIMEOUT_MS / (NSEC_PER_SEC / NSEC_PER_MSEC);
+            timeout.tv_usec = 0;
+            dc_setsockopt(env, err, sink_fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+            if(dc_error_has_error(err))
+            {
+                break;
+            }
+        }
+
+        if(!wait_for_port((in_port_t)(opts->base_port + i + 1)))
+        {
+            DC_ERROR_RAISE_USER(err, "a relay never started listening", 2);
+            break;
+        }
+    }
+
+    return sink_fd;
+}
+
+static void measure_latency(const struct dc_env *env, struct dc_error *err, const struct options *opts, int sink_fd, uint64_t *samples)
+{
+    struct sockaddr_in addr;
+    int on;
+    int fd;
+
+    DC_TRACE(env);
+    fd = dc_socket(env, err, AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+
+    if(dc_error_has_error(err))
+    {
+        return;
+    }
+
+    on = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+    dc_memset(env, &addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons((in_port_t)(opts->base_port + opts->relays));
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    dc_connect(env, err, fd, (struct sockaddr *)&addr, sizeof(addr));
+
+    // one byte at a time, each sent only after the previous one came out of the tail
+    for(size_t i = 0; i < opts->probes && dc_error_has_no_error(err); i++)
+    {
+        uint64_t start;
+        char probe;
+
+        probe = 'p';
+        start = now_ns();
+        dc_write(env, err, fd, &probe, 1);
+
+        if(dc_error_has_no_error(err) && recv(sink_fd, &probe, 1, 0) != 1)
+        {
+            DC_ERROR_RAISE_USER(err, "the tail stopped writing", 2);
+        }
+
+        samples[i] = now_ns() - start;
+    }
+
+    close(fd);
+}
+
+static uint64_t measure_throughput(const struct dc_env *env, struct dc_error *err, const struct options *opts, struct hop *head, int sink_fd, uint64_t size)
+{
+    char generate_size[SIZE_STRING_SIZE];
+    char buffer_size[SIZE_STRING_SIZE];
+    char output_port[PORT_STRING_SIZE];
+    const char *args[MAX_ARGS];
+    char *buffer;
+    uint64_t received;
+    uint64_t start;
+    uint64_t elapsed;
+    size_t count;
+
+    DC_TRACE(env);
+    buffer = dc_malloc(env, err, SINK_BUF_SIZE);
+
+    if(dc_error_has_error(err))
+    {
+        return 0;
+    }
+
+    snprintf(generate_size, sizeof(generate_size), "%" PRIu64, size);          // NOLINT(cert-err33-c)
+    snprintf(buffer_size, sizeof(buffer_size), "%zu", opts->buffer_size);     // NOLINT(cert-err33-c)
+    snprintf(output_port, sizeof(output_port), "%u", (unsigned int)(opts->base_port + opts->relays));  // NOLINT(cert-err33-c)
+    snprintf(head->name, sizeof(head->name), "head");                         // NOLINT(cert-err33-c)
+    count = 0;
+    args[count++] = opts->binary;
+    args[count++] = "-o";
+    args[count++] = "127.0.0.1";
+    args[count++] = "-P";
+    args[count++] = output_port;
+    args[count++] = "-b";
+    args[count++] = buffer_size;
+
+    if(opts->file_name)
+    {
+        args[count++] = opts->file_name;
+    }
+    else
+    {
+        args[count++] = "-g";
+        args[count++] = generate_size;
+    }
+
+    start = now_ns();
+    head->pid = spawn(env, err, opts, args, count, false);
+    received = 0;
+
+    // the clock stops when the last byte leaves the tail, not when the head finishes writing
+    while(dc_error_has_no_error(err) && received < size)
+    {
+        ssize_t rbytes;
+
+        // MSG_TRUNC keeps the harness's own copying out of the figures
+        rbytes = recv(sink_fd, buffer, SINK_BUF_SIZE, MSG_TRUNC);
+
+        if(rbytes == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        {
+            DC_ERROR_RAISE_USER(err, "the chain made no progress within the stall timeout", 2);
+        }
+        else if(rbytes == -1)
+        {
+            DC_ERROR_RAISE_ERRNO(err, errno);
+        }
+        else if(rbytes == 0)
+        {
+            DC_ERROR_RAISE_USER(err, "the tail stopped writing", 2);
+        }
+        else
+        {
+            received += (uint64_t)rbytes;
+        }
+    }
+
+    elapsed = now_ns() - start;
+    dc_free(env, buffer);
+
+    if(head->pid > 0)
+    {
+        // a run that failed leaves the head blocked on a chain that stopped reading
+        if(dc_error_has_error(err))
+        {
+            kill(head->pid, SIGKILL);
+        }
+
+        wait4(head->pid, NULL, 0, &head->usage);
+        head->pid = 0;
+    }
+
+    return elapsed;
+}
+
+static void stop_chain(struct hop *hops, size_t count, int signal_number)
+{
+    for(size_t i = 0; i < count; i++)
+    {
+        if(hops[i].pid > 0)
+        {
+            kill(hops[i].pid, signal_number);
+        }
+    }
+
+    for(size_t i = 0; i < count; i++)
+    {
+        if(hops[i].pid > 0)
+        {
+            wait4(hops[i].pid, NULL, 0, &hops[i].usage);
+            hops[i].pid = 0;
+        }
+    }
+}
+
+static pid_t spawn(const struct dc_env *env, struct dc_error *err, const struct options *opts, const char **args, size_t count, bool relay)
+{
+    char *extra;
+    pid_t pid;
+
+    DC_TRACE(env);
+    extra = NULL;
+
+    if(relay && opts->extra != NULL)
+    {
+        char *saveptr;
+
+        extra = dc_strdup(env, err, opts->extra);
+
+        if(dc_error_has_error(err))
+        {
+            return -1;
+        }
+
+        for(char *token = strtok_r(extra, " ", &saveptr); token != NULL && count < MAX_ARGS - 1; token = strtok_r(NULL, " ", &saveptr))
+        {
+            args[count++] = token;
+        }
+    }
+
+    args[count] = NULL;
+    pid = fork();
+
+    if(pid == 0)
+    {
+        int null_fd;
+
+        // keep each hop's "Accepted from" chatter off the harness's report
+        null_fd = open("/dev/null", O_WRONLY | O_CLOEXEC);
+        dup2(null_fd, STDOUT_FILENO);
+        // execv never writes through argv, it is only declared that way
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wcast-qual"
+        execv(args[0], (char *const *)args);      // NOLINT(cppcoreguidelines-pro-type-cstyle-cast)
+#pragma GCC diagnostic pop
+        _exit(EXEC_FAILED);
+    }
+
+    dc_free(env, extra);
+
+    if(pid == -1)
+    {
+        DC_ERROR_RAISE_ERRNO(err, errno);
+    }
+
+    return pid;
+}
+
+static bool wait_for_port(in_port_t port)
+{
+    for(int waited = 0; waited < READY_TIMEOUT_MS; waited += READY_POLL_MS)
+    {
+        struct timespec pause;
+
+        if(listening(port))
+        {
+            return true;
+        }
+
+        pause.tv_sec = 0;
+        pause.tv_nsec = (long)READY_POLL_MS * NSEC_PER_MSEC;
+        nanosleep(&pause, NULL);
+    }
+
+    return false;
+}
+
+static bool listening(in_port_t port)
+{
+    char line[LINE_SIZE];
+    bool found;
+    FILE *file;
+
+    // the socket table, not a probe connection, which the relay would accept and count as a client
+    file = fopen("/proc/net/tcp", "re");
+    found = false;
+
+    if(file == NULL)
+    {
+        return false;
+    }
+
+    while(!found && fgets(line, sizeof(line), file) != NULL)
+    {
+        unsigned int local_port;
+        unsigned int state;
+
+        if(sscanf(line, " %*u: %*x:%x %*x:%*x %x", &local_port, &state) == 2)     // NOLINT(cert-err34-c)
+        {
+            found = local_port == port && state == TCP_LISTEN;
+        }
+    }
+
+    fclose(file);       // NOLINT(cert-err33-c)
+
+    return found;
+}
+
+static double process_cpu(pid_t pid)
+{
+    char path[LINE_SIZE];
+    char line[LINE_SIZE * 4];
+    unsigned long utime;
+    unsigned long stime;
+    const char *fields;
+    FILE *file;
+
+    snprintf(path, sizeof(path), "/proc/%d/stat", (int)pid);   // NOLINT(cert-err33-c)
+    file = fopen(path, "re");
+
+    if(file == NULL)
+    {
+        return 0.0;
+    }
+
+    fields = fgets(line, sizeof(line), file);
+    fclose(file);       // NOLINT(cert-err33-c)
+
+    // the command name may hold spaces and parentheses, so the fields are counted from its closing one
+    if(fields == NULL || (fields = strrchr(line, ')')) == NULL || sscanf(fields, ") %*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu", &utime, &stime) != 2)     // NOLINT(cert-err34-c)
+    {
+        return 0.0;
+    }
+
+    return (double)(utime + stime) / (double)sysconf(_SC_CLK_TCK);
+}
+
+static void print_report(const struct options *opts, const struct hop *hops, size_t count, uint64_t size, uint64_t elapsed, uint64_t *samples)
+{
+    double seconds;
+
+    seconds = (double)elapsed / NSEC_PER_SEC;
+    qsort(samples, opts->probes, sizeof(*samples), compare_samples);
+
+    // NOLINTBEGIN(cert-err33-c)
+    fprintf(stdout, "relays:             %zu\n", opts->relays);
+    fprintf(stdout, "bytes:              %" PRIu64 "\n", size);
+    fprintf(stdout, "elapsed:            %.3f s\n", seconds);
+    fprintf(stdout, "throughput:         %.1f MB/s\n", seconds > 0 ? (double)size / seconds / BYTES_PER_MB : 0.0);
+
+    if(opts->probes > 0)
+    {
+        fprintf(stdout, "latency min:        %.1f us\n", (double)samples[0] / NSEC_PER_USEC);
+        fprintf(stdout, "latency median:     %.1f us\n", (double)samples[opts->probes / 2] / NSEC_PER_USEC);
+        fprintf(stdout, "latency p99:        %.1f us\n", (double)samples[opts->probes * P99 / PERCENT] / NSEC_PER_USEC);
+    }
+
+    // head first, so the hops read in the order the data flows
+    for(size_t i = count; i > 0; i--)
+    {
+        const struct hop *hop;
+        double cpu;
+
+        hop = &hops[i - 1];
+        cpu = (double)hop->usage.ru_utime.tv_sec + (double)hop->usage.ru_stime.tv_sec + (double)(hop->usage.ru_utime.tv_usec + hop->usage.ru_stime.tv_usec) / (NSEC_PER_SEC / NSEC_PER_USEC) - hop->cpu_before;
+        fprintf(stdout, "%-20s%.3f s cpu (%.0f%%), %.2f ns/byte\n", hop->name, cpu, seconds > 0 ? cpu * PERCENT / seconds : 0.0, size > 0 ? cpu * NSEC_PER_SEC / (double)size : 0.0);
+    }
+    // NOLINTEND(cert-err33-c)
+}
+
+static int compare_samples(const void *a, const void *b)
+{
+    uint64_t left;
+    uint64_t right;
+
+    left = *(const uint64_t *)a;
+    right = *(const uint64_t *)b;
+
+    return (left > right) - (left < right);
+}
+
+static uint64_t now_ns(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (uint64_t)now.tv_sec * NSEC_PER_SEC + (uint64_t)now.tv_nsec;
+}
@@ -0,0 +1,755 @@
+#include "buffer_pool.h"
+#include "coalesce.h"
+#include "conversion.h"
+#include "copy.h"
+#include "endpoint.h"
+#include "mapped.h"
+#include "perf.h"
+#include "zerocopy.h"
+#include <dc_c/dc_stdlib.h>
+#include <dc_c/dc_string.h>
+#include <dc_posix/dc_unistd.h>
+#include <dc_posix/sys/dc_socket.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <netinet/in.h>
+#include <spawn.h>
+#include <stdio.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <time.h>
+#if defined(__x86_64__)
+#include <x86intrin.h>
+#endif
+
+
+enum transport
+{
+    TRANSPORT_SOCKETPAIR,
+    TRANSPORT_PIPE,
+    TRANSPORT_TCP,
+    TRANSPORT_TMPFS,
+    TRANSPORT_COUNT,
+};
+
+
+enum engine
+{
+    ENGINE_COPY,
+    ENGINE_COALESCE,
+    ENGINE_ZEROCOPY,
+    ENGINE_MAPPED,
+    ENGINE_COUNT,
+};
+
+
+struct options
+{
+    bool show_help;
+    bool csv;
+    const char *directory;
+    const char *helper;
+    size_t total;
+    size_t min_size;
+    size_t max_size;
+};
+
+
+struct sample
+{
+    uint64_t ns;
+    uint64_t cycles;
+    uint64_t syscalls;
+    uint64_t faults;
+};
+
+
+struct run
+{
+    struct zerocopy zc;
+    int from_fd;
+    int to_fd;
+    pid_t feeder;
+    pid_t drainer;
+    const char *source;
+    char target[PATH_MAX];
+};
+
+
+static _Noreturn void usage(const struct dc_env *env, struct dc_error *err, const char *binary_path);
+static void parse_arguments(const struct dc_env *env, struct dc_error *err, int argc, char *argv[], struct options *opts);
+static bool applies(enum transport transport, enum engine engine);
+static void prepare_source(const struct dc_env *env, struct dc_error *err, const struct options *opts, const char *path);
+static void open_run(const struct dc_env *env, struct dc_error *err, const struct options *opts, enum transport transport, struct run *run);
+static void close_run(struct run *run);
+static void make_pair(const struct dc_env *env, struct dc_error *err, enum transport transport, int fds[2]);
+static void tcp_pair(const struct dc_env *env, struct dc_error *err, int fds[2]);
+static pid_t spawn_helper(const struct dc_env *env, struct dc_error *err, const struct options *opts, const char *mode, int fd, int target_fd);
+static void run_engine(const struct dc_env *env, struct dc_error *err, enum engine engine, struct run *run, size_t size);
+static void measure(struct sample *sample, int syscalls_fd);
+static uint64_t read_syscalls(int syscalls_fd);
+static uint64_t read_cycles(void);
+static void print_header(const struct options *opts);
+static void print_row(const struct options *opts, enum transport transport, enum engine engine, size_t size, const struct sample *before, const struct sample *after);
+static void print_zerocopy(size_t size, const struct zerocopy *zc);
+
+
+// NOLINTBEGIN(modernize-macro-to-enum)
+#define DEFAULT_TOTAL (64 * 1024 * 1024)
+#define DEFAULT_MIN_SIZE 1024
+#define DEFAULT_MAX_SIZE (4 * 1024 * 1024)
+#define DEFAULT_DIRECTORY "/dev/shm"
+#define TARGET_SUFFIX ".out"
+#define SIZE_STEP 4
+#define COALESCE_FACTOR 4
+#define COALESCE_DEADLINE 500
+#define HELPER_BUF_SIZE (1024 * 1024)
+#define SIZE_STRING_SIZE 24
+#define LINE_SIZE 256
+#define NSEC_PER_SEC 1000000000
+#define BYTES_PER_MB 1000000
+// NOLINTEND(modernize-macro-to-enum)
+
+
+static const char *transport_names[TRANSPORT_COUNT] = { "socketpair", "pipe", "tcp", "tmpfs" };
+static const char *engine_names[ENGINE_COUNT] = { "copy", "coalesce", "zerocopy", "mapped" };
+
+
+int main(int argc, char *argv[])
+{
+    struct dc_error *err;
+    struct dc_env *env;
+    struct options opts;
+    char source[PATH_MAX - sizeof(TARGET_SUFFIX)];
+    int syscalls_fd;
+    int exit_code;
+
+    err = dc_error_create(true);
+
+    if(err == NULL)
+    {
+        exit_code = EXIT_FAILURE;
+        goto ERROR_CREATE;
+    }
+
+    env = dc_env_create(err, true, NULL);
+
+    if(dc_error_has_error(err))
+    {
+        goto ENV_CREATE;
+    }
+
+    dc_memset(env, &opts, 0, sizeof(opts));
+    opts.directory = DEFAULT_DIRECTORY;
+    opts.total     = DEFAULT_TOTAL;
+    opts.min_size  = DEFAULT_MIN_SIZE;
+    opts.max_size  = DEFAULT_MAX_SIZE;
+    parse_arguments(env, err, argc, argv, &opts);
+
+    if(opts.show_help)
+    {
+        usage(env, err, argv[0]);
+    }
+
+    if(dc_error_has_no_error(err) && (opts.min_size == 0 || opts.min_size > opts.max_size))
+    {
+        DC_ERROR_RAISE_USER(err, "the smallest buffer size must be between 1 and the largest", 2);
+    }
+
+    if(dc_error_has_error(err))
+    {
+        goto ARGS_ERROR;
+    }
+
+    // the feeder and drainer are this binary started again, so they never share the engine's counters
+    if(opts.helper != NULL)
+    {
+        struct endpoint_stats stats;
+
+        dc_memset(env, &stats, 0, sizeof(stats));
+        buffer_pool_init(env, HELPER_BUF_SIZE, false, -1);
+
+        if(dc_strcmp(env, opts.helper, "feed") == 0)
+        {
+            generate(env, err, STDOUT_FILENO, HELPER_BUF_SIZE, opts.total, GENERATE_TEXT, 0, &stats);
+        }
+        else
+        {
+            sink(env, err, STDIN_FILENO, HELPER_BUF_SIZE, &stats);
+        }
+
+        goto ARGS_ERROR;
+    }
+
+    buffer_pool_init(env, opts.max_size * COALESCE_FACTOR, false, -1);
+    snprintf(source, sizeof(source), "%s/dcnetworksnake-copybench.%d", opts.directory, (int)getpid());     // NOLINT(cert-err33-c)
+    prepare_source(env, err, &opts, source);
+
+    if(dc_error_has_error(err))
+    {
+        goto ARGS_ERROR;
+    }
+
+    syscalls_fd = perf_syscalls_open();
+
+    if(syscalls_fd == -1)
+    {
+        fprintf(stderr, "syscalls: the raw_syscalls tracepoint is unavailable, so only read- and write-family calls are counted\n");     // NOLINT(cert-err33-c)
+    }
+
+    print_header(&opts);
+
+    for(int transport = 0; transport < TRANSPORT_COUNT && dc_error_has_no_error(err); transport++)
+    {
+        for(int engine = 0; engine < ENGINE_COUNT && dc_error_has_no_error(err); engine++)
+        {
+            if(!applies((enum transport)transport, (enum engine)engine))
+            {
+                continue;
+            }
+
+            for(size_t size = opts.min_size; size <= opts.max_size && dc_error_has_no_error(err); size *= SIZE_STEP)
+            {
+                struct sample before;
+                struct sample after;
+                struct run run;
+
+                dc_memset(env, &run, 0, sizeof(run));
+                run.source = source;
+                open_run(env, err, &opts, (enum transport)transport, &run);
+
+                if(dc_error_has_no_error(err))
+                {
+                    measure(&before, syscalls_fd);
+                    run_engine(env, err, (enum engine)engine, &run, size);
+                    measure(&after, syscalls_fd);
+                }
+
+                close_run(&run);
+
+                if(dc_error_has_no_error(err))
+                {
+                    print_row(&opts, (enum transport)transport, (enum engine)engine, size, &before, &after);
+                }
+
+                if(dc_error_has_no_error(err) && engine == ENGINE_ZEROCOPY)
+                {
+                    print_zerocopy(size, &run.zc);
+                }
+            }
+        }
+    }
+
+    if(syscalls_fd != -1)
+    {
+        close(syscalls_fd);
+    }
+
+    unlink(source);
+
+    ARGS_ERROR:
+    free(env);
+
+    ENV_CREATE:
+    if(dc_error_has_error(err))
+    {
+        fprintf(stderr, "Error: %s\n", dc_error_get_message(err));      // NOLINT(cert-err33-c)
+        exit_code = EXIT_FAILURE;
+    }
+    else
+    {
+        exit_code = EXIT_SUCCESS;
+    }
+
+    dc_error_reset(err);
+    free(err);
+
+    ERROR_CREATE:
+    return exit_code;
+}
+
+static _Noreturn void usage(const struct dc_env *env, struct dc_error *err, const char *binary_path)
+{
+    DC_TRACE(env);
+
+    // NOLINTBEGIN(cert-err33-c)
+    fprintf(stderr, "%s [OPTIONS]\n", binary_path);
+    fprintf(stderr, "-s size            bytes pushed through every combination (default %d)\n", DEFAULT_TOTAL);
+    fprintf(stderr, "-b size            smallest buffer size, multiplied by %d up to -B (default %d)\n", SIZE_STEP, DEFAULT_MIN_SIZE);
+    fprintf(stderr, "-B size            largest buffer size (default %d)\n", DEFAULT_MAX_SIZE);
+    fprintf(stderr, "-d directory       tmpfs directory for the file transport (default %s)\n", DEFAULT_DIRECTORY);
+    fprintf(stderr, "-c                 print comma separated values\n");
+    fprintf(stderr, "-h                 help\n");
+    // NOLINTEND(cert-err33-c)
+
+    exit(dc_error_has_error(err) ? EXIT_FAILURE : EXIT_SUCCESS);     // NOLINT(concurrency-mt-unsafe)
+}
+
+static void parse_arguments(const struct dc_env *env, struct dc_error *err, int argc, char *argv[], struct options *opts)
+{
+    int c;
+
+    DC_TRACE(env);
+
+    while((c = dc_getopt(env, argc, argv, ":s:b:B:d:cH:h")) != -1)   // NOLINT(concurrency-mt-unsafe)
+    {
+        switch(c)
+        {
+            case 's':
+            {
+                opts->total = parse_size_t(env, err, optarg, 10); // NOLINT(cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers)
+                break;
+            }
+            case 'b':
+            {
+                opts->min_size = parse_size_t(env, err, optarg, 10); // NOLINT(cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers)
+                break;
+            }
+            case 'B':
+            {
+                opts->max_size = parse_size_t(env, err, optarg, 10); // NOLINT(cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers)
+                break;
+            }
+            case 'd':
+            {
+                opts->directory = optarg;
+                break;
+            }
+            case 'c':
+            {
+                opts->csv = true;
+                break;
+            }
+            case 'H':
+            {
+                opts->helper = optarg;
+                break;
+            }
+            case 'h':
+            {
+                opts->show_help = true;
+                break;
+            }
+            case ':':
+            case '?':
+            {
+                DC_ERROR_RAISE_USER(err, "", 2);
+                opts->show_help = true;
+                break;
+            }
+            default:
+            {
+                abort();
+            };
+        }
+    }
+}
+
+static bool applies(enum transport transport, enum engine engine)
+{
+    // zerocopy quietly falls back to write() off TCP, and only a file can be mapped
+    switch(engine)
+    {
+        case ENGINE_ZEROCOPY:
+        {
+            return transport == TRANSPORT_TCP;
+        }
+        case ENGINE_MAPPED:
+        {
+            return transport == TRANSPORT_TMPFS;
+        }
+        case ENGINE_COPY:
+        case ENGINE_COALESCE:
+        case ENGINE_COUNT:
+        default:
+        {
+            return true;
+        }
+    }
+}
+
+static void prepare_source(const struct dc_env *env, struct dc_error *err, const struct options *opts, const char *path)
+{
+    struct endpoint_stats stats;
+    int fd;
+
+    DC_TRACE(env);
+    fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, S_IRUSR | S_IWUSR);
+
+    if(fd == -1)
+    {
+        DC_ERROR_RAISE_ERRNO(err, errno);
+        return;
+    }
+
+    dc_memset(env, &stats, 0, sizeof(stats));
+    generate(env, err, fd, HELPER_BUF_SIZE, opts->total, GENERATE_TEXT, 0, &stats);
+    close(fd);
+
+    if(dc_error_has_error(err))
+    {
+        unlink(path);
+    }
+}
+
+static void open_run(const struct dc_env *env, struct dc_error *err, const struct options *opts, enum transport transport, struct run *run)
+{
+    int in_fds[2];
+    int out_fds[2];
+
+    DC_TRACE(env);
+    run->from_fd = -1;
+    run->to_fd = -1;
+
+    if(transport == TRANSPORT_TMPFS)
+    {
+        snprintf(run->target, sizeof(run->target), "%s" TARGET_SUFFIX, run->source);     // NOLINT(cert-err33-c)
+        run->from_fd = open(run->source, O_RDONLY | O_CLOEXEC);
+        run->to_fd = open(run->target, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, S_IRUSR | S_IWUSR);
+
+        if(run->from_fd == -1 || run->to_fd == -1)
+        {
+            DC_ERROR_RAISE_ERRNO(err, errno);
+        }
+
+        return;
+    }
+
+    // index 0 is the end the engine reads from, index 1 the end it writes to
+    make_pair(env, err, transport, in_fds);
+
+    if(dc_error_has_error(err))
+    {
+        return;
+    }
+
+    run->from_fd = in_fds[0];
+    run->feeder = spawn_helper(env, err, opts, "feed", in_fds[1], STDOUT_FILENO);
+    close(in_fds[1]);
+
+    if(dc_error_has_error(err))
+    {
+        return;
+    }
+
+    make_pair(env, err, transport, out_fds);
+
+    if(dc_error_has_error(err))
+    {
+        return;
+    }
+
+    run->to_fd = out_fds[1];
+    run->drainer = spawn_helper(env, err, opts, "drain", out_fds[0], STDIN_FILENO);
+    close(out_fds[0]);
+}
+
+static void close_run(struct run *run)
+{
+    if(run->from_fd != -1)
+    {
+        close(run->from_fd);
+    }
+
+    if(run->to_fd != -1)
+    {
+        close(run->to_fd);
+    }
+
+    if(run->feeder > 0)
+    {
+        waitpid(run->feeder, NULL, 0);
+    }
+
+    if(run->drainer > 0)
+    {
+        waitpid(run->drainer, NULL, 0);
+    }
+
+    if(run->target[0] != '\0')
+    {
+        unlink(run->target);
+    }
+}
+
+static void make_pair(const struct dc_env *env, struct dc_error *err, enum transport transport, int fds[2])
+{
+    DC_TRACE(env);
+
+    switch(transport)
+    {
+        case TRANSPORT_SOCKETPAIR:
+        {
+            if(socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds) == -1)
+            {
+                DC_ERROR_RAISE_ERRNO(err, errno);
+            }
+
+            break;
+        }
+        case TRANSPORT_PIPE:
+        {
+            if(pipe2(fds, O_CLOEXEC) == -1)
+            {
+                DC_ERROR_RAISE_ERRNO(err, errno);
+            }
+
+            break;
+        }
+        case TRANSPORT_TCP:
+        {
+            tcp_pair(env, err, fds);
+            break;
+        }
+        case TRANSPORT_TMPFS:
+        case TRANSPORT_COUNT:
+        default:
+        {
+            DC_ERROR_RAISE_USER(err, "the transport has no descriptor pair", 2);
+            break;
+        }
+    }
+}
+
+static void tcp_pair(const struct dc_env *env, struct dc_error *err, int fds[2])
+{
+    struct sockaddr_in addr;
+    socklen_t length;
+    int listen_fd;
+
+    DC_TRACE(env);
+    fds[0] = -1;
+    fds[1] = -1;
+    listen_fd = dc_socket(env, err, AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+
+    if(dc_error_has_error(err))
+    {
+        return;
+    }
+
+    // an ephemeral loopback port, so nothing else needs to be free
+    dc_memset(env, &addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    length = sizeof(addr);
+    dc_bind(env, err, listen_fd, (struct sockaddr *)&addr, sizeof(addr));
+
+    if(dc_error_has_no_error(err))
+    {
+        dc_listen(env, err, listen_fd, 1);
+    }
+
+    if(dc_error_has_no_error(err) && getsockname(listen_fd, (struct sockaddr *)&addr, &length) == -1)
+    {
+        DC_ERROR_RAISE_ERRNO(err, errno);
+    }
+
+    if(dc_error_has_no_error(err))
+    {
+        fds[1] = dc_socket(env, err, AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    }
+
+    if(dc_error_has_no_error(err))
+    {
+        dc_connect(env, err, fds[1], (struct sockaddr *)&addr, sizeof(addr));
+    }
+
+    if(dc_error_has_no_error(err))
+    {
+        fds[0] = accept4(listen_fd, NULL, NULL, SOCK_CLOEXEC);
+
+        if(fds[0] == -1)
+        {
+            DC_ERROR_RAISE_ERRNO(err, errno);
+        }
+    }
+
+    if(dc_error_has_error(err) && fds[1] != -1)
+    {
+        close(fds[1]);
+    }
+
+    close(listen_fd);
+}
+
+static pid_t spawn_helper(const struct dc_env *env, struct dc_error *err, const struct options *opts, const char *mode, int fd, int target_fd)
+{
+    posix_spawn_file_actions_t actions;
+    char total[SIZE_STRING_SIZE];
+    const char *args[6];
+    pid_t pid;
+    int status;
+
+    DC_TRACE(env);
+    snprintf(total, sizeof(total), "%zu", opts->total);        // NOLINT(cert-err33-c)
+    args[0] = "dcnetworksnake-copybench";
+    args[1] = "-H";
+    args[2] = mode;
+    args[3] = "-s";
+    args[4] = total;
+    args[5] = NULL;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_adddup2(&actions, fd, target_fd);
+
+    // posix_spawn uses vfork, so the engine's pages are not made copy-on-write behind its back
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wcast-qual"
+    status = posix_spawn(&pid, "/proc/self/exe", &actions, NULL, (char *const *)args, NULL);     // NOLINT(cppcoreguidelines-pro-type-cstyle-cast)
+#pragma GCC diagnostic pop
+    posix_spawn_file_actions_destroy(&actions);
+
+    if(status != 0)
+    {
+        DC_ERROR_RAISE_ERRNO(err, status);
+        return -1;
+    }
+
+    return pid;
+}
+
+static void run_engine(const struct dc_env *env, struct dc_error *err, enum engine engine, struct run *run, size_t size)
+{
+    DC_TRACE(env);
+
+    switch(engine)
+    {
+        case ENGINE_COPY:
+        {
+            copy(env, err, run->from_fd, run->to_fd, size);
+            break;
+        }
+        case ENGINE_COALESCE:
+        {
+            copy_coalesce(env, err, run->from_fd, run->to_fd, size, size * COALESCE_FACTOR, COALESCE_DEADLINE);
+            break;
+        }
+        case ENGINE_ZEROCOPY:
+        {
+            copy_zerocopy(env, err, run->from_fd, run->to_fd, size, &run->zc);
+            break;
+        }
+        case ENGINE_MAPPED:
+        {
+            copy_mapped(env, err, run->from_fd, run->to_fd, size, size, false);
+            break;
+        }
+        case ENGINE_COUNT:
+        default:
+        {
+            break;
+        }
+    }
+}
+
+static void measure(struct sample *sample, int syscalls_fd)
+{
+    struct rusage usage;
+    struct timespec now;
+
+    getrusage(RUSAGE_SELF, &usage);
+    sample->syscalls = read_syscalls(syscalls_fd);
+    sample->faults = (uint64_t)usage.ru_minflt + (uint64_t)usage.ru_majflt;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    sample->ns = (uint64_t)now.tv_sec * NSEC_PER_SEC + (uint64_t)now.tv_nsec;
+    sample->cycles = read_cycles();
+}
+
+static uint64_t read_syscalls(int syscalls_fd)
+{
+    char line[LINE_SIZE];
+    uint64_t total;
+    FILE *file;
+
+    if(syscalls_fd != -1)
+    {
+        return perf_syscalls_read(syscalls_fd);
+    }
+
+    // syscr and syscw count only read- and write-family calls; sendmsg, poll, the errqueue reads, mmap and timerfd all go unseen
+    file = fopen("/proc/self/io", "re");
+    total = 0;
+
+    if(file == NULL)
+    {
+        return 0;
+    }
+
+    while(fgets(line, sizeof(line), file) != NULL)
+    {
+        uint64_t value;
+
+        if(sscanf(line, "syscr: %" SCNu64, &value) == 1 || sscanf(line, "syscw: %" SCNu64, &value) == 1)  // NOLINT(cert-err34-c)
+        {
+            total += value;
+        }
+    }
+
+    fclose(file);       // NOLINT(cert-err33-c)
+
+    return total;
+}
+
+static uint64_t read_cycles(void)
+{
+#if defined(__x86_64__)
+    // reference cycles from the TSC, which tick at a constant rate whatever the core clock does
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
+
+static void print_header(const struct options *opts)
+{
+    // NOLINTBEGIN(cert-err33-c)
+    if(opts->csv)
+    {
+        fprintf(stdout, "transport,engine,buffer,bytes_per_sec,syscalls_per_byte,cycles_per_byte,page_faults\n");
+    }
+    else
+    {
+        fprintf(stdout, "%-12s%-10s%10s%12s%16s%14s%12s\n", "transport", "engine", "buffer", "MB/s", "syscalls/byte", "cycles/byte", "faults");
+    }
+    // NOLINTEND(cert-err33-c)
+}
+
+static void print_row(const struct options *opts, enum transport transport, enum engine engine, size_t size, const struct sample *before, const struct sample *after)
+{
+    double seconds;
+    double rate;
+    double syscalls;
+    double cycles;
+    uint64_t faults;
+
+    seconds = (double)(after->ns - before->ns) / NSEC_PER_SEC;
+    rate = seconds > 0 ? (double)opts->total / seconds : 0.0;
+    syscalls = (double)(after->syscalls - before->syscalls) / (double)opts->total;
+    cycles = (double)(after->cycles - before->cycles) / (double)opts->total;
+    faults = after->faults - before->faults;
+
+    // NOLINTBEGIN(cert-err33-c)
+    if(opts->csv)
+    {
+        fprintf(stdout, "%s,%s,%zu,%.0f,%.6g,%.4f,%" PRIu64 "\n", transport_names[transport], engine_names[engine], size, rate, syscalls, cycles, faults);
+    }
+    else
+    {
+        fprintf(stdout, "%-12s%-10s%10zu%12.1f%16.3g%14.3f%12" PRIu64 "\n", transport_names[transport], engine_names[engine], size, rate / BYTES_PER_MB, syscalls, cycles, faults);
+    }
+    // NOLINTEND(cert-err33-c)
+}
+
+static void print_zerocopy(size_t size, const struct zerocopy *zc)
+{
+    // NOLINTBEGIN(cert-err33-c)
+    if(zc->completions == 0)
+    {
+        fprintf(stderr, "zerocopy %zu: no completions, every send went through write()\n", size);
+        return;
+    }
+
+    // loopback delivers by copying into the receiver, so every send completes as copied and the engine soon gives up on MSG_ZEROCOPY
+    fprintf(stderr, "zerocopy %zu: %zu of %zu completions copied by the kernel%s\n", size, zc->copied, zc->completions, zc->enabled ? "" : ", then fell back to write()");
+    // NOLINTEND(cert-err33-c)
+}
@@ -0,0 +1,25 @@
+#ifndef DC_NETWORK_SNAKE_BUFFER_POOL_H
+#define DC_NETWORK_SNAKE_BUFFER_POOL_H
+
+
+#include <dc_env/env.h>
+
+
+struct buffer_pool_stats
+{
+    size_t slab_size;
+    size_t hits;
+    size_t misses;
+    size_t in_use;
+    size_t high_water;
+};
+
+
+void buffer_pool_init(const struct dc_env *env, size_t slab_size, bool huge_pages, int node);
+void *buffer_pool_acquire(const struct dc_env *env, struct dc_error *err, size_t size);
+void buffer_pool_release(const struct dc_env *env, void *buffer, size_t size);
+void buffer_pool_trim(const struct dc_env *env);
+void buffer_pool_get_stats(struct buffer_pool_stats *stats);
+
+
+#endif //DC_NETWORK_SNAKE_BUFFER_POOL_H
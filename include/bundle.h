@@ -0,0 +1,79 @@
+#ifndef DC_NETWORK_SNAKE_BUNDLE_H
+#define DC_NETWORK_SNAKE_BUNDLE_H
+
+
+#include <dc_env/env.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <time.h>
+
+
+// NOLINTBEGIN(modernize-macro-to-enum)
+#define BUNDLE_MAGIC_SIZE 8
+#define BUNDLE_HEADER_SIZE 27
+#define BUNDLE_MAX_THREADS 32
+//NOLINTEND(modernize-macro-to-enum)
+
+
+struct bundle_stats
+{
+    size_t files;
+    size_t directories;
+    uint64_t bytes;
+    size_t skipped;
+    size_t changed;
+    size_t prefetched;
+    size_t bundles;
+    size_t rejected;
+    size_t refused;
+};
+
+
+enum bundle_state
+{
+    BUNDLE_MAGIC,
+    BUNDLE_HEADER,
+    BUNDLE_PATH,
+    BUNDLE_CONTENT,
+    BUNDLE_SKIP,
+    BUNDLE_DISCARD,
+};
+
+
+struct bundle_directory
+{
+    char *path;
+    uint32_t mode;
+    struct timespec mtime;
+};
+
+
+struct bundle_writer
+{
+    int dir_fd;
+    int file_fd;
+    enum bundle_state state;
+    char header[BUNDLE_HEADER_SIZE + PATH_MAX];
+    size_t have;
+    size_t need;
+    uint64_t remaining;
+    struct bundle_directory *directories;
+    size_t directory_count;
+    size_t directory_capacity;
+    mode_t mask;
+    struct bundle_stats stats;
+};
+
+
+bool bundle_wanted(const struct dc_env *env, char *const *paths, size_t count);
+void bundle_send(const struct dc_env *env, struct dc_error *err, char *const *paths, size_t count, int to_fd, size_t buffer_size, size_t threads, struct bundle_stats *stats);
+void bundle_writer_init(const struct dc_env *env, struct dc_error *err, struct bundle_writer *writer, const char *directory);
+void bundle_writer_write(const struct dc_env *env, struct bundle_writer *writer, const char *data, size_t length);
+void bundle_writer_finish(const struct dc_env *env, struct bundle_writer *writer);
+void bundle_writer_destroy(const struct dc_env *env, struct dc_error *err, struct bundle_writer *writer);
+
+
+#endif //DC_NETWORK_SNAKE_BUNDLE_H
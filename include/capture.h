@@ -0,0 +1,30 @@
+#ifndef DC_NETWORK_SNAKE_CAPTURE_H
+#define DC_NETWORK_SNAKE_CAPTURE_H
+
+
+#include <dc_env/env.h>
+#include <stdint.h>
+#include <time.h>
+
+
+struct capture
+{
+    const char *path;
+    int fd;
+    int index_fd;
+    uint64_t offset;
+    uint64_t segment_size;
+    uint64_t indexed_offset;
+    uint64_t written_ns;
+    struct timespec start;
+};
+
+
+void capture_open(const struct dc_env *env, struct dc_error *err, struct capture *capture, const char *path, uint64_t segment_size);
+void capture_write(const struct dc_env *env, struct dc_error *err, struct capture *capture, const void *buffer, size_t count);
+void capture_close(const struct dc_env *env, struct dc_error *err, struct capture *capture);
+void copy_capture(const struct dc_env *env, struct dc_error *err, int from_fd, int to_fd, size_t count, struct capture *capture);
+void replay(const struct dc_env *env, struct dc_error *err, const char *path, int to_fd, size_t count, size_t speed, uint64_t start_ms);
+
+
+#endif //DC_NETWORK_SNAKE_CAPTURE_H
@@ -0,0 +1,28 @@
+#ifndef DC_NETWORK_SNAKE_COALESCE_H
+#define DC_NETWORK_SNAKE_COALESCE_H
+
+
+#include <dc_env/env.h>
+
+
+struct coalescer
+{
+    int to_fd;
+    int timer_fd;
+    char *buffer;
+    size_t used;
+    size_t threshold;
+    size_t deadline_us;
+};
+
+
+void coalescer_init(const struct dc_env *env, struct dc_error *err, struct coalescer *coalescer, int to_fd, size_t threshold, size_t deadline_us);
+char *coalescer_reserve(struct coalescer *coalescer, size_t *available);
+void coalescer_commit(const struct dc_env *env, struct dc_error *err, struct coalescer *coalescer, size_t count);
+void coalescer_expire(const struct dc_env *env, struct dc_error *err, struct coalescer *coalescer);
+void coalescer_flush(const struct dc_env *env, struct dc_error *err, struct coalescer *coalescer);
+void coalescer_destroy(const struct dc_env *env, struct dc_error *err, struct coalescer *coalescer);
+void copy_coalesce(const struct dc_env *env, struct dc_error *err, int from_fd, int to_fd, size_t count, size_t threshold, size_t deadline_us);
+
+
+#endif //DC_NETWORK_SNAKE_COALESCE_H
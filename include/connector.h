@@ -0,0 +1,39 @@
+#ifndef DC_NETWORK_SNAKE_CONNECTOR_H
+#define DC_NETWORK_SNAKE_CONNECTOR_H
+
+
+#include <dc_env/env.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+
+// NOLINTBEGIN(modernize-macro-to-enum)
+#define CONNECT_MAX_ADDRESSES 8
+//NOLINTEND(modernize-macro-to-enum)
+
+
+struct connect_options
+{
+    const char *host;
+    const char *from;
+    in_port_t port;
+    int timeout_ms;
+    bool fast_open;
+};
+
+
+struct connect_address
+{
+    struct sockaddr_storage addr;
+    socklen_t addr_len;
+};
+
+
+int connect_output(const struct dc_env *env, struct dc_error *err, const struct connect_options *options);
+size_t connect_resolve(const struct dc_env *env, struct dc_error *err, const struct connect_options *options, struct connect_address *addresses, size_t max);
+int connect_start(const struct dc_env *env, const struct connect_options *options, const struct connect_address *address, int *error);
+int connect_result(int fd);
+void enable_listen_fast_open(const struct dc_env *env, struct dc_error *err, int fd, int queue_length);
+
+
+#endif //DC_NETWORK_SNAKE_CONNECTOR_H
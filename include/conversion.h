@@ -8,6 +8,9 @@
 
 in_port_t parse_port(const struct dc_env *env, struct dc_error *err, const char *buff, int radix);
 size_t parse_size_t(const struct dc_env *env, struct dc_error *err, const char *buff, int radix);
+int parse_int(const struct dc_env *env, struct dc_error *err, const char *buff, int radix);
+int parse_cpu(const struct dc_env *env, struct dc_error *err, const char *buff, int radix);
+char parse_delimiter(const struct dc_env *env, struct dc_error *err, const char *buff);
 
 
 #endif //DC_NETWORK_SNAKE_CONVERSION_H
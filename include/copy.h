@@ -6,6 +6,7 @@
 
 
 void copy(const struct dc_env *env, struct dc_error *err, int from_fd, int to_fd, size_t count);
+void write_fully(const struct dc_env *env, struct dc_error *err, int fd, const void *buffer, size_t count);
 
 
 #endif //DC_NETWORK_SNAKE_COPY_H
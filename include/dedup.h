@@ -0,0 +1,21 @@
+#ifndef DC_NETWORK_SNAKE_DEDUP_H
+#define DC_NETWORK_SNAKE_DEDUP_H
+
+
+#include "transform.h"
+#include <stdio.h>
+
+
+void dedup_init(const struct dc_env *env, struct dc_error *err, struct transform_stage *stage, const char *arg);
+void dedup_process(const struct dc_env *env, struct dc_error *err, struct transform_stage *stage, struct transform_span *span);
+void dedup_flush(const struct dc_env *env, struct dc_error *err, struct transform_stage *stage, struct transform_span *span);
+void dedup_discard(const struct dc_env *env, struct transform_stage *stage);
+void undedup_init(const struct dc_env *env, struct dc_error *err, struct transform_stage *stage, const char *arg);
+void undedup_process(const struct dc_env *env, struct dc_error *err, struct transform_stage *stage, struct transform_span *span);
+void undedup_flush(const struct dc_env *env, struct dc_error *err, struct transform_stage *stage, struct transform_span *span);
+void undedup_discard(const struct dc_env *env, struct transform_stage *stage);
+void dedup_destroy(const struct dc_env *env, struct transform_stage *stage);
+void dedup_report(FILE *stream, const struct transform_stage *stage);
+
+
+#endif //DC_NETWORK_SNAKE_DEDUP_H
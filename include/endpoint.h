@@ -0,0 +1,30 @@
+#ifndef DC_NETWORK_SNAKE_ENDPOINT_H
+#define DC_NETWORK_SNAKE_ENDPOINT_H
+
+
+#include <dc_env/env.h>
+#include <stdint.h>
+
+
+enum generator_pattern
+{
+    GENERATE_ZERO,
+    GENERATE_TEXT,
+    GENERATE_RANDOM,
+};
+
+
+struct endpoint_stats
+{
+    uint64_t bytes;
+    size_t calls;
+    uint64_t elapsed_ns;
+};
+
+
+enum generator_pattern parse_pattern(const struct dc_env *env, struct dc_error *err, const char *name);
+void generate(const struct dc_env *env, struct dc_error *err, int to_fd, size_t count, uint64_t size, enum generator_pattern pattern, uint64_t rate, struct endpoint_stats *stats);
+void sink(const struct dc_env *env, struct dc_error *err, int from_fd, size_t count, struct endpoint_stats *stats);
+
+
+#endif //DC_NETWORK_SNAKE_ENDPOINT_H
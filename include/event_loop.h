@@ -0,0 +1,39 @@
+#ifndef DC_NETWORK_SNAKE_EVENT_LOOP_H
+#define DC_NETWORK_SNAKE_EVENT_LOOP_H
+
+
+#include <dc_env/env.h>
+#include <stdint.h>
+
+
+struct event_loop;
+struct event_source;
+
+
+typedef void (*event_handler)(const struct dc_env *env, struct dc_error *err, struct event_loop *loop, struct event_source *source, uint32_t events);
+
+
+struct event_source
+{
+    int fd;
+    event_handler handler;
+    void *data;
+};
+
+
+struct event_loop
+{
+    int epoll_fd;
+    bool running;
+};
+
+
+void event_loop_init(const struct dc_env *env, struct dc_error *err, struct event_loop *loop);
+void event_loop_add(const struct dc_env *env, struct dc_error *err, struct event_loop *loop, struct event_source *source, uint32_t events);
+void event_loop_modify(const struct dc_env *env, struct dc_error *err, struct event_loop *loop, struct event_source *source, uint32_t events);
+void event_loop_remove(const struct dc_env *env, struct dc_error *err, struct event_loop *loop, struct event_source *source);
+void event_loop_poll(const struct dc_env *env, struct dc_error *err, struct event_loop *loop, int timeout_ms);
+void event_loop_destroy(const struct dc_env *env, struct dc_error *err, struct event_loop *loop);
+
+
+#endif //DC_NETWORK_SNAKE_EVENT_LOOP_H
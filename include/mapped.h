@@ -0,0 +1,11 @@
+#ifndef DC_NETWORK_SNAKE_MAPPED_H
+#define DC_NETWORK_SNAKE_MAPPED_H
+
+
+#include <dc_env/env.h>
+
+
+void copy_mapped(const struct dc_env *env, struct dc_error *err, int from_fd, int to_fd, size_t count, size_t window, bool zerocopy);
+
+
+#endif //DC_NETWORK_SNAKE_MAPPED_H
@@ -0,0 +1,47 @@
+#ifndef DC_NETWORK_SNAKE_OUTPUT_FILE_H
+#define DC_NETWORK_SNAKE_OUTPUT_FILE_H
+
+
+#include <dc_env/env.h>
+#include <stdint.h>
+#include <stdio.h>
+
+
+struct output_file_stats
+{
+    uint64_t bytes;
+    size_t writes;
+    size_t direct_writes;
+    uint64_t preallocated;
+    size_t writebacks;
+    size_t waits;
+    uint64_t wait_ns;
+};
+
+
+struct output_file
+{
+    int fd;
+    bool direct;
+    bool preallocate;
+    char *buffer;
+    size_t size;
+    size_t used;
+    uint64_t offset;
+    uint64_t allocated;
+    uint64_t written_back;
+    uint64_t dropped;
+    struct output_file_stats stats;
+};
+
+
+void output_file_open(const struct dc_env *env, struct dc_error *err, struct output_file *file, const char *path, size_t buffer_size, bool direct, uint64_t expected);
+char *output_file_reserve(struct output_file *file, size_t *available);
+void output_file_commit(const struct dc_env *env, struct dc_error *err, struct output_file *file, size_t count);
+void output_file_flush(const struct dc_env *env, struct dc_error *err, struct output_file *file);
+void output_file_close(const struct dc_env *env, struct dc_error *err, struct output_file *file);
+void output_file_print(FILE *stream, const struct output_file *file);
+void copy_output_file(const struct dc_env *env, struct dc_error *err, int from_fd, struct output_file *file);
+
+
+#endif //DC_NETWORK_SNAKE_OUTPUT_FILE_H
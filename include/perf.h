@@ -0,0 +1,54 @@
+#ifndef DC_NETWORK_SNAKE_PERF_H
+#define DC_NETWORK_SNAKE_PERF_H
+
+
+#include <dc_env/env.h>
+#include <stdint.h>
+#include <stdio.h>
+
+
+enum perf_event_index
+{
+    PERF_CYCLES,
+    PERF_INSTRUCTIONS,
+    PERF_CACHE_MISSES,
+    PERF_CONTEXT_SWITCHES,
+    PERF_EVENT_COUNT,
+};
+
+
+struct perf_sample
+{
+    uint64_t values[PERF_EVENT_COUNT];
+};
+
+
+struct perf_totals
+{
+    struct perf_sample counts;
+    uint64_t bytes;
+    size_t spans;
+    unsigned int available;
+};
+
+
+struct perf_counters
+{
+    int fds[PERF_EVENT_COUNT];
+    int slots[PERF_EVENT_COUNT];
+    int leader;
+    size_t opened;
+    unsigned int available;
+};
+
+
+void perf_counters_open(const struct dc_env *env, struct dc_error *err, struct perf_counters *counters);
+void perf_counters_read(const struct perf_counters *counters, struct perf_sample *sample);
+void perf_counters_close(struct perf_counters *counters);
+void perf_totals_add(struct perf_totals *totals, const struct perf_counters *counters, const struct perf_sample *before, const struct perf_sample *after, uint64_t bytes);
+void perf_totals_print(FILE *stream, const char *label, const struct perf_totals *totals);
+int perf_syscalls_open(void);
+uint64_t perf_syscalls_read(int fd);
+
+
+#endif //DC_NETWORK_SNAKE_PERF_H
@@ -0,0 +1,111 @@
+#ifndef DC_NETWORK_SNAKE_PROXY_H
+#define DC_NETWORK_SNAKE_PROXY_H
+
+
+#include "connector.h"
+#include "event_loop.h"
+#include "timer_wheel.h"
+#include <dc_env/env.h>
+#include <netinet/in.h>
+#include <signal.h>
+
+
+struct proxy_stats
+{
+    size_t sessions;
+    size_t max_sessions;
+    size_t connect_failures;
+    size_t dropped;
+    size_t accept_pauses;
+    size_t half_closes;
+    size_t resets;
+    uint64_t upstream_bytes;
+    uint64_t downstream_bytes;
+};
+
+
+struct proxy_flow
+{
+    int from_fd;
+    int to_fd;
+    int pipe_fds[2];
+    size_t pending;
+    size_t capacity;
+    uint64_t *bytes;
+    bool eof;
+    bool shut;
+};
+
+
+struct proxy_target
+{
+    struct connect_options options;
+    struct connect_address addresses[CONNECT_MAX_ADDRESSES];
+    size_t address_count;
+};
+
+
+struct proxy_route
+{
+    struct event_source listener;
+    struct proxy *proxy;
+    char *spec;
+    const char *listen_ip;
+    in_port_t listen_port;
+    struct proxy_target *targets;
+    size_t target_count;
+    size_t next;
+    size_t sessions;
+    bool accepting;
+};
+
+
+struct proxy_session
+{
+    struct event_source client;
+    struct event_source upstream;
+    struct proxy_flow flows[2];
+    struct timer connect_timer;
+    struct proxy *proxy;
+    struct proxy_route *route;
+    struct proxy_session *next;
+    struct proxy_session *prev;
+    struct sockaddr_in addr;
+    size_t target;
+    size_t address;
+    size_t tried;
+    int error;
+    bool connected;
+    bool closed;
+};
+
+
+struct proxy
+{
+    struct event_loop loop;
+    struct timer_wheel wheel;
+    struct event_source listener;
+    struct event_source clock;
+    struct event_source signals;
+    struct timer accept_retry;
+    sigset_t saved_mask;
+    struct sigaction saved_pipe;
+    struct proxy_route *routes;
+    size_t route_count;
+    size_t pipe_size;
+    size_t active;
+    bool paused;
+    struct proxy_session *sessions;
+    struct proxy_session *closed;
+    struct proxy_stats stats;
+};
+
+
+void proxy_route_parse(const struct dc_env *env, struct dc_error *err, struct proxy_route *route, const char *spec, const struct connect_options *defaults);
+void proxy_route_destroy(const struct dc_env *env, struct dc_error *err, struct proxy_route *route);
+void proxy_init(const struct dc_env *env, struct dc_error *err, struct proxy *proxy, struct proxy_route *routes, size_t route_count, size_t pipe_size);
+void proxy_run(const struct dc_env *env, struct dc_error *err, struct proxy *proxy);
+void proxy_destroy(const struct dc_env *env, struct dc_error *err, struct proxy *proxy);
+
+
+#endif //DC_NETWORK_SNAKE_PROXY_H
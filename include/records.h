@@ -0,0 +1,41 @@
+#ifndef DC_NETWORK_SNAKE_RECORDS_H
+#define DC_NETWORK_SNAKE_RECORDS_H
+
+
+#include <dc_env/env.h>
+
+
+typedef size_t (*record_scanner)(const char *buffer, size_t start, size_t length, char delimiter, size_t *end);
+
+
+struct record_stats
+{
+    size_t records;
+    size_t batches;
+    size_t oversized;
+    size_t discarded;
+};
+
+
+struct record_framer
+{
+    int to_fd;
+    char delimiter;
+    char *buffer;
+    size_t used;
+    size_t size;
+    record_scanner scan;
+    struct record_stats stats;
+};
+
+
+void record_framer_init(const struct dc_env *env, struct dc_error *err, struct record_framer *framer, int to_fd, size_t size, char delimiter);
+char *record_framer_reserve(struct record_framer *framer, size_t *available);
+void record_framer_commit(const struct dc_env *env, struct dc_error *err, struct record_framer *framer, size_t count);
+void record_framer_finish(const struct dc_env *env, struct dc_error *err, struct record_framer *framer);
+void record_framer_discard(struct record_framer *framer);
+void record_framer_destroy(const struct dc_env *env, struct record_framer *framer);
+void copy_records(const struct dc_env *env, struct dc_error *err, int from_fd, int to_fd, size_t count, char delimiter, struct record_stats *stats);
+
+
+#endif //DC_NETWORK_SNAKE_RECORDS_H
@@ -0,0 +1,48 @@
+#ifndef DC_NETWORK_SNAKE_RESUME_H
+#define DC_NETWORK_SNAKE_RESUME_H
+
+
+#include "connector.h"
+#include <dc_env/env.h>
+#include <stdint.h>
+
+
+// NOLINTBEGIN(modernize-macro-to-enum)
+#define RESUME_HELLO_SIZE 24
+//NOLINTEND(modernize-macro-to-enum)
+
+
+struct transfer
+{
+    struct transfer *next;
+    uint64_t id;
+    uint64_t committed;
+};
+
+
+struct resume_tail
+{
+    char hello[RESUME_HELLO_SIZE];
+    size_t have;
+    bool ready;
+    uint64_t total;
+    uint64_t offset;
+    uint64_t acked;
+    char ack[sizeof(uint64_t)];
+    size_t ack_unsent;
+    bool ack_queued;
+    struct transfer *transfer;
+};
+
+
+void copy_resumable(const struct dc_env *env, struct dc_error *err, int from_fd, const char *path, int *to_fd, const struct connect_options *connect, size_t attempts);
+bool resume_accept(const struct dc_env *env, struct dc_error *err, struct resume_tail *tail, struct transfer **transfers, int fd);
+size_t resume_limit(const struct resume_tail *tail, size_t count);
+bool resume_advance(struct resume_tail *tail, size_t count);
+void resume_ack(const struct dc_env *env, struct dc_error *err, struct resume_tail *tail, int fd);
+void resume_flush(const struct dc_env *env, struct dc_error *err, struct resume_tail *tail, int fd);
+bool resume_ack_pending(const struct resume_tail *tail);
+void resume_destroy(const struct dc_env *env, struct transfer **transfers);
+
+
+#endif //DC_NETWORK_SNAKE_RESUME_H
@@ -0,0 +1,133 @@
+#ifndef DC_NETWORK_SNAKE_SERVER_H
+#define DC_NETWORK_SNAKE_SERVER_H
+
+
+#include "bundle.h"
+#include "capture.h"
+#include "coalesce.h"
+#include "event_loop.h"
+#include "output_file.h"
+#include "perf.h"
+#include "records.h"
+#include "resume.h"
+#include "telemetry.h"
+#include "tls.h"
+#include "timer_wheel.h"
+#include "transform.h"
+#include "zerocopy.h"
+#include <dc_env/env.h>
+#include <netinet/in.h>
+#include <signal.h>
+
+
+struct server_config
+{
+    int listen_fd;
+    int fd_out;
+    size_t buffer_size;
+    size_t coalesce_size;
+    size_t coalesce_deadline;
+    size_t idle_timeout;
+    size_t read_stall_timeout;
+    size_t write_stall_timeout;
+    size_t drain_timeout;
+    size_t tune_interval;
+    bool zerocopy;
+    bool handoff_connections;
+    bool resumable;
+    bool records;
+    bool sink;
+    char delimiter;
+    char **argv;
+    const int *inherited;
+    size_t inherited_count;
+    struct capture *capture;
+    struct transform_pipeline *transforms;
+    struct perf_counters *perf;
+    struct tls_context *tls;
+    struct bundle_writer *unpack;
+    struct output_file *file_out;
+};
+
+
+struct server_stats
+{
+    size_t accepted;
+    size_t accept_wakeups;
+    size_t max_accept_batch;
+    unsigned int accept_queue_max;
+    unsigned int backlog;
+    uint64_t listen_overflows;
+    uint64_t listen_drops;
+    size_t idle_timeouts;
+    size_t read_stalls;
+    size_t write_stalls;
+    size_t drained;
+    size_t abandoned;
+    size_t inherited;
+    size_t handed_off;
+    bool output_handed_off;
+    size_t accept_pauses;
+    struct record_stats records;
+    uint64_t sunk;
+    struct perf_totals perf;
+    struct tcp_telemetry output_tcp;
+    size_t buffer_size;
+    size_t buffer_resizes;
+};
+
+
+struct connection
+{
+    struct event_source source;
+    struct timer timer;
+    struct server *server;
+    struct connection *next;
+    struct sockaddr_in addr;
+    struct resume_tail resume;
+    struct perf_totals perf;
+    struct tcp_telemetry tcp;
+    struct tls_session tls;
+    bool received;
+    bool ack_wait;
+    bool closed;
+};
+
+
+struct server
+{
+    struct server_config config;
+    struct server_stats stats;
+    struct event_loop loop;
+    struct event_source listener;
+    struct event_source timer;
+    struct event_source clock;
+    struct event_source signals;
+    struct timer_wheel wheel;
+    struct timer drain_deadline;
+    struct timer tune_timer;
+    struct timer accept_retry;
+    sigset_t saved_mask;
+    struct connection *head;
+    struct connection *tail;
+    struct connection *closed;
+    struct transfer *transfers;
+    size_t queued;
+    bool accepting;
+    bool active;
+    bool draining;
+    char *buffer;
+    struct coalescer coalescer;
+    struct zerocopy_ring ring;
+    struct record_framer framer;
+    uint64_t start_overflows;
+    uint64_t start_drops;
+};
+
+
+void server_init(const struct dc_env *env, struct dc_error *err, struct server *server, const struct server_config *config);
+void server_run(const struct dc_env *env, struct dc_error *err, struct server *server);
+void server_destroy(const struct dc_env *env, struct dc_error *err, struct server *server);
+
+
+#endif //DC_NETWORK_SNAKE_SERVER_H
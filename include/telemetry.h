@@ -0,0 +1,52 @@
+#ifndef DC_NETWORK_SNAKE_TELEMETRY_H
+#define DC_NETWORK_SNAKE_TELEMETRY_H
+
+
+#include <dc_env/env.h>
+#include <stdint.h>
+#include <stdio.h>
+
+
+enum tcp_limit
+{
+    TCP_LIMIT_IDLE,
+    TCP_LIMIT_APPLICATION,
+    TCP_LIMIT_CWND,
+    TCP_LIMIT_RWND,
+    TCP_LIMIT_SNDBUF,
+    TCP_LIMIT_SENDER,
+    TCP_LIMIT_RCVBUF,
+    TCP_LIMIT_READER,
+    TCP_LIMIT_COUNT,
+};
+
+
+struct tcp_telemetry
+{
+    int fd;
+    bool sending;
+    uint64_t sampled_at;
+    uint64_t busy_time;
+    uint64_t rwnd_limited;
+    uint64_t sndbuf_limited;
+    uint64_t bytes;
+    uint32_t rtt;
+    uint32_t cwnd;
+    uint32_t retransmits;
+    uint64_t delivery_rate;
+    uint64_t bdp;
+    int buffer;
+    enum tcp_limit limit;
+    size_t limited[TCP_LIMIT_COUNT];
+    size_t samples;
+    size_t resizes;
+};
+
+
+void tcp_telemetry_init(struct tcp_telemetry *telemetry, int fd, bool sending);
+bool tcp_telemetry_sample(const struct dc_env *env, struct dc_error *err, struct tcp_telemetry *telemetry);
+void tcp_telemetry_tune(const struct dc_env *env, struct dc_error *err, struct tcp_telemetry *telemetry);
+void tcp_telemetry_print(FILE *stream, const char *label, const struct tcp_telemetry *telemetry);
+
+
+#endif //DC_NETWORK_SNAKE_TELEMETRY_H
@@ -0,0 +1,50 @@
+#ifndef DC_NETWORK_SNAKE_TIMER_WHEEL_H
+#define DC_NETWORK_SNAKE_TIMER_WHEEL_H
+
+
+#include <dc_env/env.h>
+#include <stdint.h>
+
+
+// NOLINTBEGIN(modernize-macro-to-enum)
+#define TIMER_WHEEL_LEVELS 4
+#define TIMER_WHEEL_SLOTS 64
+//NOLINTEND(modernize-macro-to-enum)
+
+
+struct timer;
+
+
+typedef void (*timer_handler)(const struct dc_env *env, struct dc_error *err, struct timer *timer);
+
+
+struct timer
+{
+    struct timer *next;
+    struct timer *prev;
+    uint64_t expires;
+    timer_handler handler;
+    void *data;
+};
+
+
+struct timer_wheel
+{
+    struct timer slots[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SLOTS];
+    uint64_t now;
+    size_t tick_ms;
+    size_t pending;
+    int timer_fd;
+};
+
+
+void timer_init(struct timer *timer, timer_handler handler, void *data);
+bool timer_pending(const struct timer *timer);
+void timer_wheel_init(const struct dc_env *env, struct dc_error *err, struct timer_wheel *wheel, size_t tick_ms);
+void timer_wheel_schedule(const struct dc_env *env, struct dc_error *err, struct timer_wheel *wheel, struct timer *timer, size_t timeout_ms);
+void timer_wheel_cancel(const struct dc_env *env, struct dc_error *err, struct timer_wheel *wheel, struct timer *timer);
+void timer_wheel_expire(const struct dc_env *env, struct dc_error *err, struct timer_wheel *wheel);
+void timer_wheel_destroy(const struct dc_env *env, struct dc_error *err, struct timer_wheel *wheel);
+
+
+#endif //DC_NETWORK_SNAKE_TIMER_WHEEL_H
@@ -0,0 +1,35 @@
+#ifndef DC_NETWORK_SNAKE_TLS_H
+#define DC_NETWORK_SNAKE_TLS_H
+
+
+#include <dc_env/env.h>
+#include <openssl/ssl.h>
+#include <sys/types.h>
+
+
+struct tls_context
+{
+    SSL_CTX *ctx;
+};
+
+
+struct tls_session
+{
+    SSL *ssl;
+    bool ready;
+    bool want_write;
+    bool closed;
+};
+
+
+void tls_server_init(const struct dc_env *env, struct dc_error *err, struct tls_context *tls, const char *pem_path);
+void tls_client_init(const struct dc_env *env, struct dc_error *err, struct tls_context *tls, const char *ca_path);
+void tls_context_destroy(struct tls_context *tls);
+bool tls_accept(const struct dc_env *env, struct dc_error *err, const struct tls_context *tls, struct tls_session *session, int fd);
+void tls_connect(const struct dc_env *env, struct dc_error *err, const struct tls_context *tls, int fd, const char *host, int timeout_ms);
+ssize_t tls_read(struct tls_session *session, int fd, void *buffer, size_t count);
+void tls_close_notify(const struct dc_env *env, struct dc_error *err, int fd);
+void tls_session_destroy(struct tls_session *session);
+
+
+#endif //DC_NETWORK_SNAKE_TLS_H
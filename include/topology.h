@@ -0,0 +1,20 @@
+#ifndef DC_NETWORK_SNAKE_TOPOLOGY_H
+#define DC_NETWORK_SNAKE_TOPOLOGY_H
+
+
+#include <dc_env/env.h>
+
+
+struct topology
+{
+    int cpu;
+    int node;
+    int nodes;
+    bool pinned;
+};
+
+
+void topology_pin(const struct dc_env *env, struct dc_error *err, struct topology *topo, int cpu);
+
+
+#endif //DC_NETWORK_SNAKE_TOPOLOGY_H
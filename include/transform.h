@@ -0,0 +1,62 @@
+#ifndef DC_NETWORK_SNAKE_TRANSFORM_H
+#define DC_NETWORK_SNAKE_TRANSFORM_H
+
+
+#include <dc_env/env.h>
+#include <stdio.h>
+
+
+// NOLINTBEGIN(modernize-macro-to-enum)
+#define TRANSFORM_MAX_STAGES 8
+//NOLINTEND(modernize-macro-to-enum)
+
+
+struct transform_span
+{
+    char *data;
+    size_t length;
+};
+
+
+struct transform_stage;
+
+
+struct transform_ops
+{
+    const char *name;
+    void (*init)(const struct dc_env *env, struct dc_error *err, struct transform_stage *stage, const char *arg);
+    void (*process)(const struct dc_env *env, struct dc_error *err, struct transform_stage *stage, struct transform_span *span);
+    void (*flush)(const struct dc_env *env, struct dc_error *err, struct transform_stage *stage, struct transform_span *span);
+    void (*discard)(const struct dc_env *env, struct transform_stage *stage);
+    void (*destroy)(const struct dc_env *env, struct transform_stage *stage);
+    void (*report)(FILE *stream, const struct transform_stage *stage);
+};
+
+
+struct transform_stage
+{
+    const struct transform_ops *ops;
+    void *state;
+    size_t spans;
+    size_t bytes_in;
+    size_t bytes_out;
+};
+
+
+struct transform_pipeline
+{
+    struct transform_stage stages[TRANSFORM_MAX_STAGES];
+    size_t count;
+};
+
+
+void transform_pipeline_add(const struct dc_env *env, struct dc_error *err, struct transform_pipeline *pipeline, const char *spec);
+void transform_pipeline_process(const struct dc_env *env, struct dc_error *err, struct transform_pipeline *pipeline, struct transform_span *span);
+void transform_pipeline_flush(const struct dc_env *env, struct dc_error *err, struct transform_pipeline *pipeline, int to_fd);
+void transform_pipeline_discard(const struct dc_env *env, struct transform_pipeline *pipeline);
+void transform_pipeline_destroy(const struct dc_env *env, struct transform_pipeline *pipeline);
+void transform_buffer_grow(const struct dc_env *env, struct dc_error *err, char **buffer, size_t *capacity, size_t needed);
+void copy_transform(const struct dc_env *env, struct dc_error *err, int from_fd, int to_fd, size_t count, struct transform_pipeline *pipeline);
+
+
+#endif //DC_NETWORK_SNAKE_TRANSFORM_H
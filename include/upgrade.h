@@ -0,0 +1,25 @@
+#ifndef DC_NETWORK_SNAKE_UPGRADE_H
+#define DC_NETWORK_SNAKE_UPGRADE_H
+
+
+#include <dc_env/env.h>
+#include <signal.h>
+#include <sys/types.h>
+
+
+struct handoff
+{
+    int listen_fd;
+    int output_fd;
+    int *connections;
+    size_t count;
+};
+
+
+int upgrade_channel(void);
+pid_t upgrade_spawn(const struct dc_env *env, struct dc_error *err, char *argv[], const sigset_t *mask, int *channel);
+void upgrade_send(const struct dc_env *env, struct dc_error *err, int channel, const struct handoff *handoff);
+void upgrade_receive(const struct dc_env *env, struct dc_error *err, int channel, struct handoff *handoff);
+
+
+#endif //DC_NETWORK_SNAKE_UPGRADE_H
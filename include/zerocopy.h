@@ -0,0 +1,42 @@
+#ifndef DC_NETWORK_SNAKE_ZEROCOPY_H
+#define DC_NETWORK_SNAKE_ZEROCOPY_H
+
+
+#include <dc_env/env.h>
+#include <stdint.h>
+
+
+struct zerocopy
+{
+    int fd;
+    int timeout_ms;
+    bool enabled;
+    uint32_t next_seq;
+    uint32_t completed;
+    size_t completions;
+    size_t copied;
+};
+
+
+struct zerocopy_ring
+{
+    struct zerocopy zc;
+    char **buffers;
+    uint32_t *fences;
+    size_t slots;
+    size_t slot;
+    size_t count;
+};
+
+
+void zerocopy_init(const struct dc_env *env, struct dc_error *err, struct zerocopy *zc, int fd);
+uint32_t zerocopy_send(const struct dc_env *env, struct dc_error *err, struct zerocopy *zc, const void *buffer, size_t count);
+void zerocopy_wait(const struct dc_env *env, struct dc_error *err, struct zerocopy *zc, uint32_t fence);
+void zerocopy_ring_init(const struct dc_env *env, struct dc_error *err, struct zerocopy_ring *ring, int fd, size_t count);
+char *zerocopy_ring_next(const struct dc_env *env, struct dc_error *err, struct zerocopy_ring *ring);
+void zerocopy_ring_send(const struct dc_env *env, struct dc_error *err, struct zerocopy_ring *ring, size_t count);
+void zerocopy_ring_destroy(const struct dc_env *env, struct dc_error *err, struct zerocopy_ring *ring);
+void copy_zerocopy(const struct dc_env *env, struct dc_error *err, int from_fd, int to_fd, size_t count, struct zerocopy *result);
+
+
+#endif //DC_NETWORK_SNAKE_ZEROCOPY_H
@@ -0,0 +1,235 @@
+#include "buffer_pool.h"
+#include <dc_posix/dc_unistd.h>
+#include <limits.h>
+#include <linux/mempolicy.h>
+#include <stdatomic.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+
+struct slab
+{
+    struct slab *next;
+};
+
+
+static size_t round_up(size_t size, size_t alignment);
+static size_t mapping_size(size_t size);
+static void *map_slab(const struct dc_env *env, struct dc_error *err, size_t size);
+static void place_slab(const struct dc_env *env, void *buffer, size_t size);
+static void count_acquire(void);
+
+
+// NOLINTBEGIN(modernize-macro-to-enum)
+#define MAX_FREE_SLABS 64
+#define HUGE_PAGE_SIZE (2 * 1024 * 1024)
+//NOLINTEND(modernize-macro-to-enum)
+
+
+// NOLINTBEGIN(cppcoreguidelines-avoid-non-const-global-variables)
+static size_t pool_slab_size;
+static size_t pool_alignment;
+static bool pool_huge_pages;
+static int pool_node;
+static _Thread_local struct slab *free_list;
+static _Thread_local size_t free_count;
+static atomic_size_t pool_hits;
+static atomic_size_t pool_misses;
+static atomic_size_t pool_in_use;
+static atomic_size_t pool_high_water;
+// NOLINTEND(cppcoreguidelines-avoid-non-const-global-variables)
+
+
+void buffer_pool_init(const struct dc_env *env, size_t slab_size, bool huge_pages, int node)
+{
+    size_t alignment;
+
+    DC_TRACE(env);
+
+    if(huge_pages)
+    {
+        alignment = HUGE_PAGE_SIZE;
+    }
+    else
+    {
+        alignment = (size_t)sysconf(_SC_PAGESIZE);
+    }
+
+    pool_alignment = alignment;
+    pool_slab_size = round_up(slab_size, alignment);
+    pool_huge_pages = huge_pages;
+    pool_node = node;
+}
+
+void *buffer_pool_acquire(const struct dc_env *env, struct dc_error *err, size_t size)
+{
+    void *buffer;
+
+    DC_TRACE(env);
+
+    if(size <= pool_slab_size && free_list != NULL)
+    {
+        buffer = free_list;
+        free_list = free_list->next;
+        free_count--;
+        atomic_fetch_add_explicit(&pool_hits, 1, memory_order_relaxed);
+    }
+    else
+    {
+        buffer = map_slab(env, err, mapping_size(size));
+
+        if(dc_error_has_error(err))
+        {
+            return NULL;
+        }
+
+        atomic_fetch_add_explicit(&pool_misses, 1, memory_order_relaxed);
+    }
+
+    count_acquire();
+
+    return buffer;
+}
+
+void buffer_pool_release(const struct dc_env *env, void *buffer, size_t size)
+{
+    DC_TRACE(env);
+
+    if(buffer == NULL)
+    {
+        return;
+    }
+
+    atomic_fetch_sub_explicit(&pool_in_use, 1, memory_order_relaxed);
+
+    if(size <= pool_slab_size && free_count < MAX_FREE_SLABS)
+    {
+        struct slab *slab;
+
+        slab = buffer;
+        slab->next = free_list;
+        free_list = slab;
+        free_count++;
+    }
+    else
+    {
+        munmap(buffer, mapping_size(size));
+    }
+}
+
+void buffer_pool_trim(const struct dc_env *env)
+{
+    DC_TRACE(env);
+
+    while(free_list != NULL)
+    {
+        struct slab *slab;
+
+        slab = free_list;
+        free_list = slab->next;
+        munmap(slab, pool_slab_size);
+    }
+
+    free_count = 0;
+}
+
+void buffer_pool_get_stats(struct buffer_pool_stats *stats)
+{
+    stats->slab_size  = pool_slab_size;
+    stats->hits       = atomic_load(&pool_hits);
+    stats->misses     = atomic_load(&pool_misses);
+    stats->in_use     = atomic_load(&pool_in_use);
+    stats->high_water = atomic_load(&pool_high_water);
+}
+
+static size_t round_up(size_t size, size_t alignment)
+{
+    if(size == 0)
+    {
+        return alignment;
+    }
+
+    return ((size + alignment - 1) / alignment) * alignment;
+}
+
+static size_t mapping_size(size_t size)
+{
+    if(size <= pool_slab_size)
+    {
+        return pool_slab_size;
+    }
+
+    return round_up(size, pool_alignment);
+}
+
+static void *map_slab(const struct dc_env *env, struct dc_error *err, size_t size)
+{
+    void *buffer;
+
+    DC_TRACE(env);
+
+    if(pool_huge_pages)
+    {
+        buffer = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+
+        if(buffer != MAP_FAILED)
+        {
+            place_slab(env, buffer, size);
+
+            return buffer;
+        }
+    }
+
+    buffer = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+    if(buffer == MAP_FAILED)
+    {
+        DC_ERROR_RAISE_ERRNO(err, errno);
+        return NULL;
+    }
+
+    if(pool_huge_pages || size >= HUGE_PAGE_SIZE)
+    {
+        madvise(buffer, size, MADV_HUGEPAGE);
+    }
+
+    place_slab(env, buffer, size);
+
+    return buffer;
+}
+
+static void place_slab(const struct dc_env *env, void *buffer, size_t size)
+{
+    unsigned long mask;
+    size_t page_size;
+    size_t offset;
+
+    DC_TRACE(env);
+
+    if(pool_node < 0 || (size_t)pool_node >= sizeof(mask) * CHAR_BIT)
+    {
+        return;
+    }
+
+    mask = 1UL << (unsigned int)pool_node;
+    syscall(SYS_mbind, buffer, size, MPOL_PREFERRED, &mask, sizeof(mask) * CHAR_BIT + 1, 0);
+    page_size = (size_t)sysconf(_SC_PAGESIZE);
+
+    for(offset = 0; offset < size; offset += page_size)
+    {
+        ((volatile char *)buffer)[offset] = 0;
+    }
+}
+
+static void count_acquire(void)
+{
+    size_t in_use;
+    size_t high_water;
+
+    in_use = atomic_fetch_add_explicit(&pool_in_use, 1, memory_order_relaxed) + 1;
+    high_water = atomic_load_explicit(&pool_high_water, memory_order_relaxed);
+
+    while(in_use > high_water && !atomic_compare_exchange_weak(&pool_high_water, &high_water, in_use))
+    {
+    }
+}
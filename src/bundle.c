@@ -0,0 +1,1134 @@
+#include "bundle.h"
+#include "buffer_pool.h"
+#include <dc_c/dc_stdlib.h>
+#include <dc_c/dc_string.h>
+#include <dc_posix/dc_fcntl.h>
+#include <dc_posix/dc_string.h>
+#include <dc_posix/dc_unistd.h>
+#include <endian.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <fts.h>
+#include <linux/openat2.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+
+struct entry
+{
+    char *path;
+    size_t name_offset;
+    size_t name_length;
+    char type;
+    uint32_t mode;
+    uint64_t size;
+    struct timespec mtime;
+};
+
+
+struct entry_list
+{
+    struct entry *entries;
+    size_t count;
+    size_t capacity;
+};
+
+
+struct prefetcher
+{
+    pthread_t threads[BUNDLE_MAX_THREADS];
+    size_t thread_count;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    const struct entry *entries;
+    size_t count;
+    size_t next;
+    size_t sending;
+    uint64_t ahead;
+    bool stop;
+    atomic_size_t prefetched;
+};
+
+
+struct staging
+{
+    char *data;
+    size_t used;
+    size_t size;
+    int fd;
+};
+
+
+static void collect(const struct dc_env *env, struct dc_error *err, const char *root, struct entry_list *list, struct bundle_stats *stats);
+static void add_entry(const struct dc_env *env, struct dc_error *err, struct entry_list *list, const FTSENT *node, char type, size_t name_offset, size_t name_length);
+static void send_entry(const struct dc_env *env, struct dc_error *err, struct staging *staging, const struct entry *entry, struct bundle_stats *stats);
+static void send_content(const struct dc_env *env, struct dc_error *err, struct staging *staging, const struct entry *entry, struct bundle_stats *stats);
+static void put_header(char *header, char type, uint32_t mode, uint64_t size, const struct timespec *mtime, uint16_t name_length);
+static void stage(const struct dc_env *env, struct dc_error *err, struct staging *staging, const void *data, size_t length);
+static void stage_flush(const struct dc_env *env, struct dc_error *err, struct staging *staging);
+static void prefetcher_start(const struct dc_env *env, struct dc_error *err, struct prefetcher *prefetcher, const struct entry_list *list, size_t threads);
+static void prefetcher_advance(struct prefetcher *prefetcher, size_t index);
+static void prefetcher_stop(struct prefetcher *prefetcher);
+static void *prefetch_worker(void *arg);
+static uint64_t prefetch_size(const struct entry *entry);
+static void writer_advance(struct bundle_writer *writer);
+static void writer_open(struct bundle_writer *writer, char type, uint32_t mode, uint64_t size, char *path);
+static void writer_close_file(struct bundle_writer *writer);
+static void writer_reject(struct bundle_writer *writer, const char *path, const char *reason);
+static void writer_refuse(struct bundle_writer *writer, const char *path, const char *reason, uint64_t size);
+static void writer_expect(struct bundle_writer *writer, enum bundle_state state, size_t need);
+static bool writer_defer_directory(struct bundle_writer *writer, const char *path, uint32_t mode);
+static void writer_apply_directories(struct bundle_writer *writer);
+static struct timespec header_mtime(const struct bundle_writer *writer);
+static bool safe_path(const char *path);
+static int open_parent(int dir_fd, char *path, const char **name);
+static int open_beneath(int dir_fd, const char *path, int flags, mode_t mode);
+static bool write_all(int fd, const char *data, size_t length);
+
+
+// NOLINTBEGIN(modernize-macro-to-enum)
+#define TYPE_FILE 'F'
+#define TYPE_DIRECTORY 'D'
+#define TYPE_END 'E'
+#define PREFETCH_WINDOW_FILES 256
+#define PREFETCH_WINDOW_BYTES (64 * 1024 * 1024)
+#define MODE_BITS 07777
+#define PERMISSION_BITS 0777
+#define DIRECTORY_MODE 0777
+#define PRIVATE_DIRECTORY_MODE 0700
+#define DIRECTORY_LIST_SIZE 64
+//NOLINTEND(modernize-macro-to-enum)
+
+
+static const char bundle_magic[BUNDLE_MAGIC_SIZE] = { 'S', 'N', 'K', 'B', 'N', 'D', 'L', '1' };
+
+
+bool bundle_wanted(const struct dc_env *env, char *const *paths, size_t count)
+{
+    struct stat info;
+
+    DC_TRACE(env);
+
+    // a single regular file keeps the raw stream it always had
+    return count > 1 || (count == 1 && stat(paths[0], &info) == 0 && S_ISDIR(info.st_mode));
+}
+
+void bundle_send(const struct dc_env *env, struct dc_error *err, char *const *paths, size_t count, int to_fd, size_t buffer_size, size_t threads, struct bundle_stats *stats)
+{
+    struct entry_list list;
+    struct prefetcher prefetcher;
+    struct staging staging;
+    char trailer[BUNDLE_HEADER_SIZE];
+    struct timespec none;
+
+    DC_TRACE(env);
+    dc_memset(env, &list, 0, sizeof(list));
+
+    // the whole walk comes first so the prefetchers can see what is coming
+    for(size_t i = 0; i < count && dc_error_has_no_error(err); i++)
+    {
+        collect(env, err, paths[i], &list, stats);
+    }
+
+    if(dc_error_has_error(err))
+    {
+        goto COLLECT_FAIL;
+    }
+
+    // headers and small files share this buffer, so thousands of them still leave in large writes
+    staging.size = buffer_size < BUNDLE_HEADER_SIZE + PATH_MAX ? BUNDLE_HEADER_SIZE + PATH_MAX : buffer_size;
+    staging.used = 0;
+    staging.fd = to_fd;
+    staging.data = buffer_pool_acquire(env, err, staging.size);
+
+    if(dc_error_has_error(err))
+    {
+        goto BUFFER_FAIL;
+    }
+
+    prefetcher_start(env, err, &prefetcher, &list, threads);
+
+    if(dc_error_has_error(err))
+    {
+        goto PREFETCH_FAIL;
+    }
+
+    stage(env, err, &staging, bundle_magic, sizeof(bundle_magic));
+
+    for(size_t i = 0; i < list.count && dc_error_has_no_error(err); i++)
+    {
+        prefetcher_advance(&prefetcher, i);
+        send_entry(env, err, &staging, &list.entries[i], stats);
+    }
+
+    none.tv_sec = 0;
+    none.tv_nsec = 0;
+    put_header(trailer, TYPE_END, 0, 0, &none, 0);
+    stage(env, err, &staging, trailer, sizeof(trailer));
+    stage_flush(env, err, &staging);
+    prefetcher_stop(&prefetcher);
+    stats->prefetched += atomic_load(&prefetcher.prefetched);
+
+    if(dc_error_has_no_error(err))
+    {
+        stats->bundles++;
+    }
+
+    PREFETCH_FAIL:
+    buffer_pool_release(env, staging.data, staging.size);
+
+    BUFFER_FAIL:
+    COLLECT_FAIL:
+    for(size_t i = 0; i < list.count; i++)
+    {
+        dc_free(env, list.entries[i].path);
+    }
+
+    dc_free(env, list.entries);
+}
+
+void bundle_writer_init(const struct dc_env *env, struct dc_error *err, struct bundle_writer *writer, const char *directory)
+{
+    DC_TRACE(env);
+    dc_memset(env, writer, 0, sizeof(*writer));
+    writer->file_fd = -1;
+    writer->mask = umask(0);
+    umask(writer->mask);
+    writer_expect(writer, BUNDLE_MAGIC, BUNDLE_MAGIC_SIZE);
+
+    if(mkdir(directory, DIRECTORY_MODE) == -1 && errno != EEXIST)
+    {
+        DC_ERROR_RAISE_ERRNO(err, errno);
+        writer->dir_fd = -1;
+        return;
+    }
+
+    writer->dir_fd = dc_open(env, err, directory, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+}
+
+void bundle_writer_write(const struct dc_env *env, struct bundle_writer *writer, const char *data, size_t length)
+{
+    DC_TRACE(env);
+
+    while(length > 0)
+    {
+        size_t take;
+
+        if(writer->state == BUNDLE_DISCARD)
+        {
+            return;
+        }
+
+        if(writer->state == BUNDLE_CONTENT || writer->state == BUNDLE_SKIP)
+        {
+            take = length < writer->remaining ? length : (size_t)writer->remaining;
+
+            // a failed write loses this file, and the rest of its content is read past
+            if(writer->state == BUNDLE_CONTENT && !write_all(writer->file_fd, data, take))
+            {
+                writer_refuse(writer, &writer->header[BUNDLE_HEADER_SIZE], strerror(errno), writer->remaining);    // NOLINT(concurrency-mt-unsafe)
+                continue;
+            }
+
+            writer->remaining -= take;
+
+            if(writer->remaining == 0)
+            {
+                writer_close_file(writer);
+                writer_expect(writer, BUNDLE_HEADER, BUNDLE_HEADER_SIZE);
+            }
+        }
+        else
+        {
+            take = writer->need - writer->have < length ? writer->need - writer->have : length;
+            dc_memcpy(env, &writer->header[writer->have], data, take);
+            writer->have += take;
+
+            if(writer->have == writer->need)
+            {
+                writer_advance(writer);
+            }
+        }
+
+        data += take;
+        length -= take;
+    }
+}
+
+void bundle_writer_finish(const struct dc_env *env, struct bundle_writer *writer)
+{
+    DC_TRACE(env);
+
+    // a sender that disconnects mid-bundle leaves its last file short, and the next one starts afresh
+    if(writer->state != BUNDLE_DISCARD && !(writer->state == BUNDLE_MAGIC && writer->have == 0))
+    {
+        writer_reject(writer, writer->state == BUNDLE_CONTENT ? &writer->header[BUNDLE_HEADER_SIZE] : "", "the bundle was cut off");
+    }
+
+    writer_close_file(writer);
+    writer_apply_directories(writer);
+    writer_expect(writer, BUNDLE_MAGIC, BUNDLE_MAGIC_SIZE);
+}
+
+void bundle_writer_destroy(const struct dc_env *env, struct dc_error *err, struct bundle_writer *writer)
+{
+    DC_TRACE(env);
+    writer_close_file(writer);
+    writer_apply_directories(writer);
+    free(writer->directories);
+    writer->directories = NULL;
+
+    if(writer->dir_fd != -1)
+    {
+        dc_close(env, err, writer->dir_fd);
+        writer->dir_fd = -1;
+    }
+}
+
+static void collect(const struct dc_env *env, struct dc_error *err, const char *root, struct entry_list *list, struct bundle_stats *stats)
+{
+    char *roots[2];
+    FTSENT *node;
+    FTS *tree;
+    size_t root_length;
+    size_t base;
+    size_t child_offset;
+    bool skip_root;
+
+    DC_TRACE(env);
+    root_length = dc_strlen(env, root);
+
+    while(root_length > 1 && root[root_length - 1] == '/')
+    {
+        root_length--;
+    }
+
+    base = root_length;
+
+    while(base > 0 && root[base - 1] != '/')
+    {
+        base--;
+    }
+
+    // like tar, entries are named from the operand's last component; ".", ".." and "/" only contribute their contents
+    skip_root = (root_length - base == 1 && root[base] == '.') || (root_length - base == 2 && root[base] == '.' && root[base + 1] == '.') || root_length == base;
+    child_offset = skip_root ? (root_length == 1 && root[0] == '/' ? 1 : root_length + 1) : base;
+
+    // fts_open wants a mutable array but never writes through it
+    roots[0] = dc_strdup(env, err, root);
+    roots[1] = NULL;
+
+    if(dc_error_has_error(err))
+    {
+        return;
+    }
+
+    tree = fts_open(roots, FTS_PHYSICAL | FTS_NOCHDIR, NULL);
+
+    if(tree == NULL)
+    {
+        DC_ERROR_RAISE_ERRNO(err, errno);
+        dc_free(env, roots[0]);
+        return;
+    }
+
+    while(dc_error_has_no_error(err) && (node = fts_read(tree)) != NULL)
+    {
+        size_t offset;
+        size_t length;
+
+        offset = node->fts_level == FTS_ROOTLEVEL ? base : child_offset;
+        length = node->fts_level == FTS_ROOTLEVEL ? root_length - base : node->fts_pathlen - offset;
+
+        switch(node->fts_info)
+        {
+            case FTS_D:
+            {
+                if(node->fts_level != FTS_ROOTLEVEL || !skip_root)
+                {
+                    add_entry(env, err, list, node, TYPE_DIRECTORY, offset, length);
+                }
+
+                break;
+            }
+            case FTS_F:
+            {
+                add_entry(env, err, list, node, TYPE_FILE, offset, length);
+                break;
+            }
+            case FTS_DNR:
+            case FTS_ERR:
+            case FTS_NS:
+            {
+                DC_ERROR_RAISE_ERRNO(err, node->fts_errno);
+                break;
+            }
+            case FTS_DP:
+            {
+                break;
+            }
+            case FTS_DC:
+            case FTS_DEFAULT:
+            case FTS_DOT:
+            case FTS_NSOK:
+            case FTS_SL:
+            case FTS_SLNONE:
+            case FTS_W:
+            default:
+            {
+                // symlinks, devices, sockets and fifos have no content to ship
+                stats->skipped++;
+                break;
+            }
+        }
+    }
+
+    fts_close(tree);
+    dc_free(env, roots[0]);
+}
+
+static void add_entry(const struct dc_env *env, struct dc_error *err, struct entry_list *list, const FTSENT *node, char type, size_t name_offset, size_t name_length)
+{
+    struct entry *entry;
+
+    DC_TRACE(env);
+
+    if(name_length == 0 || name_length >= PATH_MAX)
+    {
+        return;
+    }
+
+    if(list->count == list->capacity)
+    {
+        struct entry *grown;
+        size_t capacity;
+
+        capacity = list->capacity ? list->capacity * 2 : PREFETCH_WINDOW_FILES;
+        grown = dc_realloc(env, err, list->entries, capacity * sizeof(*grown));
+
+        if(dc_error_has_error(err))
+        {
+            return;
+        }
+
+        list->entries = grown;
+        list->capacity = capacity;
+    }
+
+    entry = &list->entries[list->count];
+    entry->path = dc_strdup(env, err, node->fts_path);
+
+    if(dc_error_has_error(err))
+    {
+        return;
+    }
+
+    entry->name_offset = name_offset;
+    entry->name_length = name_length;
+    entry->type = type;
+    entry->mode = (uint32_t)(node->fts_statp->st_mode & MODE_BITS);
+    entry->size = type == TYPE_FILE ? (uint64_t)node->fts_statp->st_size : 0;
+    entry->mtime = node->fts_statp->st_mtim;
+    list->count++;
+}
+
+static void send_entry(const struct dc_env *env, struct dc_error *err, struct staging *staging, const struct entry *entry, struct bundle_stats *stats)
+{
+    char header[BUNDLE_HEADER_SIZE];
+
+    DC_TRACE(env);
+    put_header(header, entry->type, entry->mode, entry->size, &entry->mtime, (uint16_t)entry->name_length);
+    stage(env, err, staging, header, sizeof(header));
+    stage(env, err, staging, &entry->path[entry->name_offset], entry->name_length);
+
+    if(dc_error_has_error(err))
+    {
+        return;
+    }
+
+    if(entry->type == TYPE_DIRECTORY)
+    {
+        stats->directories++;
+        return;
+    }
+
+    send_content(env, err, staging, entry, stats);
+
+    if(dc_error_has_no_error(err))
+    {
+        stats->files++;
+        stats->bytes += entry->size;
+    }
+}
+
+static void send_content(const struct dc_env *env, struct dc_error *err, struct staging *staging, const struct entry *entry, struct bundle_stats *stats)
+{
+    uint64_t remaining;
+    bool use_sendfile;
+    int fd;
+
+    DC_TRACE(env);
+
+    if(entry->size == 0)
+    {
+        return;
+    }
+
+    fd = dc_open(env, err, entry->path, O_RDONLY | O_CLOEXEC);
+
+    if(dc_error_has_error(err))
+    {
+        return;
+    }
+
+    remaining = entry->size;
+    use_sendfile = true;
+
+    while(remaining > 0)
+    {
+        ssize_t nbytes;
+
+        // a file bigger than the buffer goes file-to-socket in the kernel once the headers ahead of it are out
+        if(use_sendfile && remaining >= staging->size)
+        {
+            stage_flush(env, err, staging);
+
+            if(dc_error_has_error(err))
+            {
+                break;
+            }
+
+            nbytes = sendfile(staging->fd, fd, NULL, (size_t)remaining);
+
+            if(nbytes == -1 && (errno == EINVAL || errno == ENOSYS))
+            {
+                use_sendfile = false;
+                continue;
+            }
+        }
+        else
+        {
+            if(staging->used == staging->size)
+            {
+                stage_flush(env, err, staging);
+
+                if(dc_error_has_error(err))
+                {
+                    break;
+                }
+            }
+
+            nbytes = read(fd, &staging->data[staging->used], remaining < staging->size - staging->used ? (size_t)remaining : staging->size - staging->used);
+
+            if(nbytes > 0)
+            {
+                staging->used += (size_t)nbytes;
+            }
+        }
+
+        if(nbytes == -1)
+        {
+            if(errno == EINTR)
+            {
+                continue;
+            }
+
+            DC_ERROR_RAISE_ERRNO(err, errno);
+            break;
+        }
+
+        // the file shrank since the walk; the header already promised its size, so zeros make up the rest
+        if(nbytes == 0)
+        {
+            stats->changed++;
+
+            while(remaining > 0 && dc_error_has_no_error(err))
+            {
+                size_t fill;
+
+                if(staging->used == staging->size)
+                {
+                    stage_flush(env, err, staging);
+                    continue;
+                }
+
+                fill = remaining < staging->size - staging->used ? (size_t)remaining : staging->size - staging->used;
+                dc_memset(env, &staging->data[staging->used], 0, fill);
+                staging->used += fill;
+                remaining -= fill;
+            }
+
+            break;
+        }
+
+        remaining -= (uint64_t)nbytes;
+    }
+
+    dc_close(env, err, fd);
+}
+
+static void put_header(char *header, char type, uint32_t mode, uint64_t size, const struct timespec *mtime, uint16_t name_length)
+{
+    uint64_t value64;
+    uint32_t value32;
+    uint16_t value16;
+
+    header[0] = type;
+    value32 = htobe32(mode);
+    memcpy(&header[1], &value32, sizeof(value32));
+    value64 = htobe64(size);
+    memcpy(&header[5], &value64, sizeof(value64));                          // NOLINT(cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers)
+    value64 = htobe64((uint64_t)mtime->tv_sec);
+    memcpy(&header[13], &value64, sizeof(value64));                         // NOLINT(cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers)
+    value32 = htobe32((uint32_t)mtime->tv_nsec);
+    memcpy(&header[21], &value32, sizeof(value32));                         // NOLINT(cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers)
+    value16 = htobe16(name_length);
+    memcpy(&header[25], &value16, sizeof(value16));                         // NOLINT(cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers)
+}
+
+static void stage(const struct dc_env *env, struct dc_error *err, struct staging *staging, const void *data, size_t length)
+{
+    DC_TRACE(env);
+
+    if(dc_error_has_error(err))
+    {
+        return;
+    }
+
+    if(staging->used + length > staging->size)
+    {
+        stage_flush(env, err, staging);
+
+        if(dc_error_has_error(err))
+        {
+            return;
+        }
+    }
+
+    dc_memcpy(env, &staging->data[staging->used], data, length);
+    staging->used += length;
+}
+
+static void stage_flush(const struct dc_env *env, struct dc_error *err, struct staging *staging)
+{
+    DC_TRACE(env);
+
+    if(staging->used == 0 || dc_error_has_error(err))
+    {
+        return;
+    }
+
+    if(!write_all(staging->fd, staging->data, staging->used))
+    {
+        DC_ERROR_RAISE_ERRNO(err, errno);
+    }
+
+    staging->used = 0;
+}
+
+static void prefetcher_start(const struct dc_env *env, struct dc_error *err, struct prefetcher *prefetcher, const struct entry_list *list, size_t threads)
+{
+    DC_TRACE(env);
+    dc_memset(env, prefetcher, 0, sizeof(*prefetcher));
+    prefetcher->entries = list->entries;
+    prefetcher->count = list->count;
+    atomic_init(&prefetcher->prefetched, 0);
+    pthread_mutex_init(&prefetcher->lock, NULL);
+    pthread_cond_init(&prefetcher->wake, NULL);
+
+    for(size_t i = 0; i < threads && i < BUNDLE_MAX_THREADS; i++)
+    {
+        int result;
+
+        result = pthread_create(&prefetcher->threads[i], NULL, prefetch_worker, prefetcher);
+
+        if(result != 0)
+        {
+            DC_ERROR_RAISE_ERRNO(err, result);
+            prefetcher_stop(prefetcher);
+            return;
+        }
+
+        prefetcher->thread_count++;
+    }
+}
+
+static void prefetcher_advance(struct prefetcher *prefetcher, size_t index)
+{
+    if(prefetcher->thread_count == 0)
+    {
+        return;
+    }
+
+    pthread_mutex_lock(&prefetcher->lock);
+
+    // the entry now being sent stops counting against the window; one the workers never reached is not worth warming now
+    if(index < prefetcher->next)
+    {
+        prefetcher->ahead -= prefetch_size(&prefetcher->entries[index]);
+    }
+    else
+    {
+        prefetcher->next = index + 1;
+    }
+
+    prefetcher->sending = index;
+    pthread_cond_broadcast(&prefetcher->wake);
+    pthread_mutex_unlock(&prefetcher->lock);
+}
+
+static void prefetcher_stop(struct prefetcher *prefetcher)
+{
+    pthread_mutex_lock(&prefetcher->lock);
+    prefetcher->stop = true;
+    pthread_cond_broadcast(&prefetcher->wake);
+    pthread_mutex_unlock(&prefetcher->lock);
+
+    for(size_t i = 0; i < prefetcher->thread_count; i++)
+    {
+        pthread_join(prefetcher->threads[i], NULL);
+    }
+
+    pthread_cond_destroy(&prefetcher->wake);
+    pthread_mutex_destroy(&prefetcher->lock);
+}
+
+static void *prefetch_worker(void *arg)
+{
+    struct prefetcher *prefetcher;
+
+    prefetcher = arg;
+    pthread_mutex_lock(&prefetcher->lock);
+
+    while(!prefetcher->stop)
+    {
+        const struct entry *entry;
+        uint64_t size;
+        int fd;
+
+        // stay a bounded distance ahead, or the files read first would be evicted before they are sent
+        if(prefetcher->next >= prefetcher->count || prefetcher->next > prefetcher->sending + PREFETCH_WINDOW_FILES || prefetcher->ahead >= PREFETCH_WINDOW_BYTES)
+        {
+            pthread_cond_wait(&prefetcher->wake, &prefetcher->lock);
+            continue;
+        }
+
+        entry = &prefetcher->entries[prefetcher->next++];
+        size = prefetch_size(entry);
+        prefetcher->ahead += size;
+
+        if(size == 0)
+        {
+            continue;
+        }
+
+        pthread_mutex_unlock(&prefetcher->lock);
+
+        // readahead blocks until the pages are in, which is the point: it happens here and not in the sender
+        fd = open(entry->path, O_RDONLY | O_CLOEXEC);
+
+        if(fd != -1)
+        {
+            if(readahead(fd, 0, (size_t)size) == 0)
+            {
+                atomic_fetch_add_explicit(&prefetcher->prefetched, 1, memory_order_relaxed);
+            }
+
+            close(fd);
+        }
+
+        pthread_mutex_lock(&prefetcher->lock);
+    }
+
+    pthread_mutex_unlock(&prefetcher->lock);
+
+    return NULL;
+}
+
+static uint64_t prefetch_size(const struct entry *entry)
+{
+    if(entry->type != TYPE_FILE)
+    {
+        return 0;
+    }
+
+    return entry->size < PREFETCH_WINDOW_BYTES ? entry->size : PREFETCH_WINDOW_BYTES;
+}
+
+static void writer_advance(struct bundle_writer *writer)
+{
+    uint64_t value64;
+    uint32_t value32;
+    uint16_t value16;
+    size_t name_length;
+
+    switch(writer->state)
+    {
+        case BUNDLE_MAGIC:
+        {
+            if(memcmp(writer->header, bundle_magic, sizeof(bundle_magic)) != 0)
+            {
+                writer_reject(writer, "", "the input is not a bundle");
+                return;
+            }
+
+            writer_expect(writer, BUNDLE_HEADER, BUNDLE_HEADER_SIZE);
+            return;
+        }
+        case BUNDLE_HEADER:
+        {
+            if(writer->header[0] == TYPE_END)
+            {
+                writer_apply_directories(writer);
+                writer->stats.bundles++;
+                writer_expect(writer, BUNDLE_MAGIC, BUNDLE_MAGIC_SIZE);
+                return;
+            }
+
+            memcpy(&value16, &writer->header[25], sizeof(value16));     // NOLINT(cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers)
+            name_length = be16toh(value16);
+
+            if(name_length == 0 || name_length >= PATH_MAX)
+            {
+                writer_reject(writer, "", "an entry has no usable name");
+                return;
+            }
+
+            writer->state = BUNDLE_PATH;
+            writer->need = BUNDLE_HEADER_SIZE + name_length;
+            return;
+        }
+        case BUNDLE_PATH:
+        {
+            writer->header[writer->need] = '\0';
+            memcpy(&value32, &writer->header[1], sizeof(value32));
+            memcpy(&value64, &writer->header[5], sizeof(value64));      // NOLINT(cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers)
+            writer_open(writer, writer->header[0], be32toh(value32), be64toh(value64), &writer->header[BUNDLE_HEADER_SIZE]);
+            return;
+        }
+        case BUNDLE_CONTENT:
+        case BUNDLE_SKIP:
+        case BUNDLE_DISCARD:
+        default:
+        {
+            return;
+        }
+    }
+}
+
+static void writer_open(struct bundle_writer *writer, char type, uint32_t mode, uint64_t size, char *path)
+{
+    const char *name;
+    int parent_fd;
+
+    // an entry that can't be written costs only itself; its content is read past and the bundle goes on
+    if(type != TYPE_FILE && type != TYPE_DIRECTORY)
+    {
+        writer_refuse(writer, path, "unknown entry type", size);
+        return;
+    }
+
+    if(!safe_path(path))
+    {
+        writer_refuse(writer, path, "the name leaves the target directory", size);
+        return;
+    }
+
+    parent_fd = open_parent(writer->dir_fd, path, &name);
+
+    if(parent_fd == -1)
+    {
+        writer_refuse(writer, path, strerror(errno), size);     // NOLINT(concurrency-mt-unsafe)
+        return;
+    }
+
+    if(type == TYPE_DIRECTORY)
+    {
+        // as tar does, a directory stays private and writable until the bundle ends, and only then gets its own mode
+        if((mkdirat(parent_fd, name, PRIVATE_DIRECTORY_MODE) == -1 && errno != EEXIST) || !writer_defer_directory(writer, path, mode))
+        {
+            writer_refuse(writer, path, strerror(errno), size); // NOLINT(concurrency-mt-unsafe)
+        }
+        else
+        {
+            writer->stats.directories++;
+            writer_expect(writer, BUNDLE_HEADER, BUNDLE_HEADER_SIZE);
+        }
+    }
+    else
+    {
+        writer->file_fd = open_beneath(parent_fd, name, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, mode & PERMISSION_BITS);
+
+        if(writer->file_fd == -1)
+        {
+            writer_refuse(writer, path, strerror(errno), size); // NOLINT(concurrency-mt-unsafe)
+        }
+        else
+        {
+            writer->stats.files++;
+            writer->stats.bytes += size;
+            writer->remaining = size;
+            writer->state = BUNDLE_CONTENT;
+
+            if(size == 0)
+            {
+                writer_close_file(writer);
+                writer_expect(writer, BUNDLE_HEADER, BUNDLE_HEADER_SIZE);
+            }
+        }
+    }
+
+    if(parent_fd != writer->dir_fd)
+    {
+        close(parent_fd);
+    }
+}
+
+static void writer_close_file(struct bundle_writer *writer)
+{
+    struct timespec times[2];
+
+    if(writer->file_fd == -1)
+    {
+        return;
+    }
+
+    // a finished file gets the sender's mtime, so tools that compare timestamps see it as unchanged
+    if(writer->state == BUNDLE_CONTENT && writer->remaining == 0)
+    {
+        times[0].tv_sec = 0;
+        times[0].tv_nsec = UTIME_OMIT;
+        times[1] = header_mtime(writer);
+        futimens(writer->file_fd, times);
+    }
+
+    close(writer->file_fd);
+    writer->file_fd = -1;
+}
+
+static void writer_reject(struct bundle_writer *writer, const char *path, const char *reason)
+{
+    fprintf(stderr, "Rejected bundle: %s%s%s\n", path, *path != '\0' ? ": " : "", reason);     // NOLINT(cert-err33-c)
+    writer->stats.rejected++;
+    writer_close_file(writer);
+    writer->state = BUNDLE_DISCARD;
+}
+
+static void writer_refuse(struct bundle_writer *writer, const char *path, const char *reason, uint64_t size)
+{
+    fprintf(stderr, "Skipped bundle entry: %s: %s\n", path, reason);     // NOLINT(cert-err33-c)
+    writer->stats.refused++;
+    writer_close_file(writer);
+
+    if(size == 0)
+    {
+        writer_expect(writer, BUNDLE_HEADER, BUNDLE_HEADER_SIZE);
+        return;
+    }
+
+    writer->state = BUNDLE_SKIP;
+    writer->remaining = size;
+}
+
+static void writer_expect(struct bundle_writer *writer, enum bundle_state state, size_t need)
+{
+    writer->state = state;
+    writer->have = 0;
+    writer->need = need;
+}
+
+static bool writer_defer_directory(struct bundle_writer *writer, const char *path, uint32_t mode)
+{
+    struct bundle_directory *directory;
+
+    if(writer->directory_count == writer->directory_capacity)
+    {
+        struct bundle_directory *grown;
+        size_t capacity;
+
+        capacity = writer->directory_capacity ? writer->directory_capacity * 2 : DIRECTORY_LIST_SIZE;
+        grown = realloc(writer->directories, capacity * sizeof(*grown));
+
+        if(grown == NULL)
+        {
+            return false;
+        }
+
+        writer->directories = grown;
+        writer->directory_capacity = capacity;
+    }
+
+    directory = &writer->directories[writer->directory_count];
+    directory->path = strdup(path);
+
+    if(directory->path == NULL)
+    {
+        return false;
+    }
+
+    directory->mode = mode & PERMISSION_BITS & ~(uint32_t)writer->mask;
+    directory->mtime = header_mtime(writer);
+    writer->directory_count++;
+
+    return true;
+}
+
+static void writer_apply_directories(struct bundle_writer *writer)
+{
+    // deepest first, so a parent that loses its write or search bit can't stand in the way of its children
+    while(writer->directory_count > 0)
+    {
+        struct bundle_directory *directory;
+        struct timespec times[2];
+        int fd;
+
+        directory = &writer->directories[--writer->directory_count];
+        fd = open_beneath(writer->dir_fd, directory->path, O_RDONLY | O_DIRECTORY | O_CLOEXEC, 0);
+
+        if(fd != -1)
+        {
+            times[0].tv_sec = 0;
+            times[0].tv_nsec = UTIME_OMIT;
+            times[1] = directory->mtime;
+            fchmod(fd, directory->mode);
+            futimens(fd, times);
+            close(fd);
+        }
+
+        free(directory->path);
+    }
+}
+
+static struct timespec header_mtime(const struct bundle_writer *writer)
+{
+    struct timespec mtime;
+    uint64_t value64;
+    uint32_t value32;
+
+    memcpy(&value64, &writer->header[13], sizeof(value64));     // NOLINT(cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers)
+    memcpy(&value32, &writer->header[21], sizeof(value32));     // NOLINT(cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers)
+    mtime.tv_sec = (time_t)be64toh(value64);
+    mtime.tv_nsec = (long)be32toh(value32);
+
+    return mtime;
+}
+
+static bool safe_path(const char *path)
+{
+    const char *component;
+
+    if(*path == '/')
+    {
+        return false;
+    }
+
+    component = path;
+
+    while(component != NULL)
+    {
+        const char *slash;
+        size_t length;
+
+        slash = strchr(component, '/');
+        length = slash ? (size_t)(slash - component) : strlen(component);
+
+        if(length == 0 || (length == 1 && component[0] == '.') || (length == 2 && component[0] == '.' && component[1] == '.'))
+        {
+            return false;
+        }
+
+        component = slash ? slash + 1 : NULL;
+    }
+
+    return true;
+}
+
+static int open_parent(int dir_fd, char *path, const char **name)
+{
+    char *component;
+    int fd;
+
+    fd = dir_fd;
+    component = path;
+
+    // each level is opened from the one above it and never through a link, so nothing planted or swapped in can lead outside the target
+    for(char *slash = strchr(component, '/'); slash != NULL; slash = strchr(component, '/'))
+    {
+        int next;
+        int error;
+
+        *slash = '\0';
+        next = -1;
+
+        // a level the bundle never named gets the default mode, as tar gives it
+        if(mkdirat(fd, component, DIRECTORY_MODE) == 0 || errno == EEXIST)
+        {
+            next = open_beneath(fd, component, O_PATH | O_DIRECTORY | O_CLOEXEC, 0);
+        }
+
+        error = errno;
+        *slash = '/';
+
+        if(fd != dir_fd)
+        {
+            close(fd);
+        }
+
+        if(next == -1)
+        {
+            errno = error;
+            return -1;
+        }
+
+        fd = next;
+        component = slash + 1;
+    }
+
+    *name = component;
+
+    return fd;
+}
+
+static int open_beneath(int dir_fd, const char *path, int flags, mode_t mode)
+{
+    struct open_how how;
+
+    memset(&how, 0, sizeof(how));
+    how.flags = (uint64_t)flags;
+    how.mode = mode;
+    how.resolve = RESOLVE_BENEATH | RESOLVE_NO_SYMLINKS;
+
+    return (int)syscall(SYS_openat2, dir_fd, path, &how, sizeof(how));
+}
+
+static bool write_all(int fd, const char *data, size_t length)
+{
+    while(length > 0)
+    {
+        ssize_t nbytes;
+
+        nbytes = write(fd, data, length);
+
+        if(nbytes == -1)
+        {
+            if(errno == EINTR)
+            {
+                continue;
+            }
+
+            return false;
+        }
+
+        data += nbytes;
+        length -= (size_t)nbytes;
+    }
+
+    return true;
+}
@@ -0,0 +1,593 @@
+#include "capture.h"
+#include "buffer_pool.h"
+#include "copy.h"
+#include <dc_c/dc_stdlib.h>
+#include <dc_c/dc_string.h>
+#include <dc_posix/dc_fcntl.h>
+#include <dc_posix/dc_unistd.h>
+#include <dc_posix/sys/dc_stat.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/sendfile.h>
+
+
+struct capture_header
+{
+    char magic[8];
+    uint64_t segment_size;
+};
+
+
+struct capture_entry
+{
+    uint64_t offset;
+    uint64_t time_ns;
+};
+
+
+struct segment_reader
+{
+    const char *path;
+    uint64_t segment_size;
+    uint64_t segment;
+    int fd;
+    bool use_sendfile;
+    char *buffer;
+    size_t count;
+};
+
+
+static uint64_t elapsed_ns(const struct timespec *start);
+static void open_segment(const struct dc_env *env, struct dc_error *err, struct capture *capture);
+static void remove_segments(const char *path);
+static struct capture_entry *load_index(const struct dc_env *env, struct dc_error *err, const char *path, uint64_t *segment_size, uint64_t *end, size_t *count);
+static size_t seek_index(const struct capture_entry *entries, size_t count, uint64_t time_ns);
+static bool wait_until(const struct timespec *origin, uint64_t delay_ns);
+static bool send_range(const struct dc_env *env, struct dc_error *err, struct segment_reader *reader, int to_fd, uint64_t from, uint64_t to);
+
+
+// NOLINTBEGIN(modernize-macro-to-enum)
+#define CAPTURE_MAGIC "DCSNCAP1"
+#define INDEX_INTERVAL_BYTES (1024 * 1024)
+#define INDEX_PAUSE_NS 10000000
+#define CAPTURE_END_NS UINT64_MAX
+#define NSEC_PER_SEC 1000000000
+#define NSEC_PER_MSEC 1000000
+#define CAPTURE_MODE 0644
+//NOLINTEND(modernize-macro-to-enum)
+
+
+void capture_open(const struct dc_env *env, struct dc_error *err, struct capture *capture, const char *path, uint64_t segment_size)
+{
+    struct capture_header header;
+    char name[PATH_MAX];
+
+    DC_TRACE(env);
+    capture->path = path;
+    capture->fd = -1;
+    capture->offset = 0;
+    capture->segment_size = segment_size;
+    capture->indexed_offset = 0;
+    capture->written_ns = 0;
+    snprintf(name, sizeof(name), "%s.idx", path);     // NOLINT(cert-err33-c)
+    capture->index_fd = dc_open(env, err, name, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, CAPTURE_MODE);
+
+    if(dc_error_has_error(err))
+    {
+        capture->index_fd = -1;
+        return;
+    }
+
+    // the lock is held until close, so an upgraded process started while this one drains cannot truncate its capture
+    if(flock(capture->index_fd, LOCK_EX | LOCK_NB) == -1)
+    {
+        if(errno == EWOULDBLOCK)
+        {
+            DC_ERROR_RAISE_USER(err, "the capture is still being written by another process", 2);
+        }
+        else
+        {
+            DC_ERROR_RAISE_ERRNO(err, errno);
+        }
+
+        goto LOCK_ERROR;
+    }
+
+    remove_segments(path);
+    dc_ftruncate(env, err, capture->index_fd, 0);
+
+    if(dc_error_has_error(err))
+    {
+        goto LOCK_ERROR;
+    }
+
+    dc_memset(env, &header, 0, sizeof(header));
+    memcpy(header.magic, CAPTURE_MAGIC, sizeof(header.magic));
+    header.segment_size = segment_size;
+    dc_write(env, err, capture->index_fd, &header, sizeof(header));
+    clock_gettime(CLOCK_MONOTONIC, &capture->start);
+    return;
+
+    LOCK_ERROR:
+    dc_close(env, err, capture->index_fd);
+    capture->index_fd = -1;
+}
+
+void capture_write(const struct dc_env *env, struct dc_error *err, struct capture *capture, const void *buffer, size_t count)
+{
+    const char *position;
+    uint64_t now;
+
+    DC_TRACE(env);
+    now = elapsed_ns(&capture->start);
+
+    // index sparsely: every megabyte, and wherever the stream resumes after a pause, so replay can keep the gaps
+    if(capture->offset == 0 || capture->offset - capture->indexed_offset >= INDEX_INTERVAL_BYTES || now - capture->written_ns >= INDEX_PAUSE_NS)
+    {
+        struct capture_entry entry;
+
+        entry.offset = capture->offset;
+        entry.time_ns = now;
+        dc_write(env, err, capture->index_fd, &entry, sizeof(entry));
+
+        if(dc_error_has_error(err))
+        {
+            return;
+        }
+
+        capture->indexed_offset = capture->offset;
+    }
+
+    capture->written_ns = now;
+    position = buffer;
+
+    while(count > 0)
+    {
+        size_t length;
+
+        if(capture->fd == -1)
+        {
+            open_segment(env, err, capture);
+
+            if(dc_error_has_error(err))
+            {
+                return;
+            }
+        }
+
+        length = (size_t)(capture->segment_size - capture->offset % capture->segment_size);
+
+        if(length > count)
+        {
+            length = count;
+        }
+
+        dc_write(env, err, capture->fd, position, length);
+
+        if(dc_error_has_error(err))
+        {
+            return;
+        }
+
+        position += length;
+        count -= length;
+        capture->offset += length;
+
+        if(capture->offset % capture->segment_size == 0)
+        {
+            dc_close(env, err, capture->fd);
+            capture->fd = -1;
+        }
+    }
+}
+
+void capture_close(const struct dc_env *env, struct dc_error *err, struct capture *capture)
+{
+    DC_TRACE(env);
+
+    if(capture->fd != -1)
+    {
+        dc_close(env, err, capture->fd);
+        capture->fd = -1;
+    }
+
+    // the end marker tells replay where this capture stops, whatever an earlier one left behind
+    if(capture->index_fd != -1)
+    {
+        struct capture_entry entry;
+
+        entry.offset = capture->offset;
+        entry.time_ns = CAPTURE_END_NS;
+
+        if(dc_error_has_no_error(err))
+        {
+            dc_write(env, err, capture->index_fd, &entry, sizeof(entry));
+        }
+
+        dc_close(env, err, capture->index_fd);
+        capture->index_fd = -1;
+    }
+}
+
+void copy_capture(const struct dc_env *env, struct dc_error *err, int from_fd, int to_fd, size_t count, struct capture *capture)
+{
+    char *buffer;
+    ssize_t rbytes;
+
+    DC_TRACE(env);
+    buffer = buffer_pool_acquire(env, err, count);
+
+    if(dc_error_has_error(err))
+    {
+        goto MALLOC_FAIL;
+    }
+
+    while((rbytes = dc_read(env, err, from_fd, buffer, count)) > 0)
+    {
+        write_fully(env, err, to_fd, buffer, (size_t)rbytes);
+
+        if(dc_error_has_error(err))
+        {
+            goto WRITE_FAIL;
+        }
+
+        capture_write(env, err, capture, buffer, (size_t)rbytes);
+
+        if(dc_error_has_error(err))
+        {
+            goto CAPTURE_FAIL;
+        }
+    }
+
+    if(dc_error_is_errno(err, EINTR))
+    {
+        dc_error_reset(err);
+    }
+
+    CAPTURE_FAIL:
+    WRITE_FAIL:
+    buffer_pool_release(env, buffer, count);
+
+    MALLOC_FAIL:
+    {
+    }
+}
+
+void replay(const struct dc_env *env, struct dc_error *err, const char *path, int to_fd, size_t count, size_t speed, uint64_t start_ms)
+{
+    struct segment_reader reader;
+    struct capture_entry *entries;
+    struct timespec origin;
+    uint64_t capture_end;
+    size_t entry_count;
+    size_t first;
+
+    DC_TRACE(env);
+    entries = load_index(env, err, path, &reader.segment_size, &capture_end, &entry_count);
+
+    if(dc_error_has_error(err) || entry_count == 0)
+    {
+        goto INDEX_FAIL;
+    }
+
+    reader.path = path;
+    reader.segment = 0;
+    reader.fd = -1;
+    reader.use_sendfile = true;
+    reader.buffer = NULL;
+    reader.count = count;
+    first = seek_index(entries, entry_count, start_ms * NSEC_PER_MSEC);
+
+    if(speed == 0)
+    {
+        send_range(env, err, &reader, to_fd, entries[first].offset, capture_end);
+        goto REPLAY_DONE;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &origin);
+
+    for(size_t i = first; i < entry_count; i++)
+    {
+        uint64_t end;
+
+        end = i + 1 < entry_count ? entries[i + 1].offset : capture_end;
+
+        if(!wait_until(&origin, (entries[i].time_ns - entries[first].time_ns) / speed))
+        {
+            break;
+        }
+
+        if(!send_range(env, err, &reader, to_fd, entries[i].offset, end))
+        {
+            break;
+        }
+    }
+
+    REPLAY_DONE:
+    if(reader.fd != -1)
+    {
+        dc_close(env, err, reader.fd);
+    }
+
+    buffer_pool_release(env, reader.buffer, count);
+
+    INDEX_FAIL:
+    dc_free(env, entries);
+}
+
+static uint64_t elapsed_ns(const struct timespec *start)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (uint64_t)(now.tv_sec - start->tv_sec) * NSEC_PER_SEC + (uint64_t)now.tv_nsec - (uint64_t)start->tv_nsec;
+}
+
+static void open_segment(const struct dc_env *env, struct dc_error *err, struct capture *capture)
+{
+    char name[PATH_MAX];
+
+    DC_TRACE(env);
+    snprintf(name, sizeof(name), "%s.%06" PRIu64, capture->path, capture->offset / capture->segment_size);     // NOLINT(cert-err33-c)
+    capture->fd = dc_open(env, err, name, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, CAPTURE_MODE);
+
+    if(dc_error_has_error(err))
+    {
+        capture->fd = -1;
+    }
+}
+
+static void remove_segments(const char *path)
+{
+    char name[PATH_MAX];
+
+    // a shorter capture over an old one would otherwise replay into the old one's tail
+    for(uint64_t segment = 0;; segment++)
+    {
+        snprintf(name, sizeof(name), "%s.%06" PRIu64, path, segment);     // NOLINT(cert-err33-c)
+
+        if(unlink(name) == -1)
+        {
+            break;
+        }
+    }
+}
+
+static struct capture_entry *load_index(const struct dc_env *env, struct dc_error *err, const char *path, uint64_t *segment_size, uint64_t *end, size_t *count)
+{
+    struct capture_header header;
+    struct capture_entry *entries;
+    struct stat index_stat;
+    char name[PATH_MAX];
+    size_t size;
+    int fd;
+
+    DC_TRACE(env);
+    entries = NULL;
+    *count = 0;
+    *end = UINT64_MAX;
+    snprintf(name, sizeof(name), "%s.idx", path);     // NOLINT(cert-err33-c)
+    fd = dc_open(env, err, name, O_RDONLY | O_CLOEXEC);
+
+    if(dc_error_has_error(err))
+    {
+        return NULL;
+    }
+
+    dc_fstat(env, err, fd, &index_stat);
+
+    if(dc_error_has_error(err))
+    {
+        goto READ_FAIL;
+    }
+
+    if((size_t)index_stat.st_size < sizeof(header) ||
+       dc_pread(env, err, fd, &header, sizeof(header), 0) != (ssize_t)sizeof(header) ||
+       memcmp(header.magic, CAPTURE_MAGIC, sizeof(header.magic)) != 0 || header.segment_size == 0)
+    {
+        if(dc_error_has_no_error(err))
+        {
+            DC_ERROR_RAISE_USER(err, "not a capture index", 2);
+        }
+
+        goto READ_FAIL;
+    }
+
+    *segment_size = header.segment_size;
+    *count = ((size_t)index_stat.st_size - sizeof(header)) / sizeof(*entries);
+
+    if(*count == 0)
+    {
+        goto READ_FAIL;
+    }
+
+    size = *count * sizeof(*entries);
+    entries = dc_malloc(env, err, size);
+
+    if(dc_error_has_error(err))
+    {
+        *count = 0;
+        goto READ_FAIL;
+    }
+
+    if(dc_pread(env, err, fd, entries, size, sizeof(header)) != (ssize_t)size && dc_error_has_no_error(err))
+    {
+        DC_ERROR_RAISE_USER(err, "truncated capture index", 2);
+    }
+
+    // a capture that was never closed has no end marker, and ends where its segments do
+    if(dc_error_has_no_error(err) && entries[*count - 1].time_ns == CAPTURE_END_NS)
+    {
+        *end = entries[*count - 1].offset;
+        (*count)--;
+    }
+
+    READ_FAIL:
+    dc_close(env, err, fd);
+
+    return entries;
+}
+
+static size_t seek_index(const struct capture_entry *entries, size_t count, uint64_t time_ns)
+{
+    size_t low;
+    size_t high;
+
+    // last entry at or before time_ns; entries are written in time order
+    low = 0;
+    high = count;
+
+    while(high - low > 1)
+    {
+        size_t middle;
+
+        middle = low + (high - low) / 2;
+
+        if(entries[middle].time_ns <= time_ns)
+        {
+            low = middle;
+        }
+        else
+        {
+            high = middle;
+        }
+    }
+
+    return low;
+}
+
+static bool wait_until(const struct timespec *origin, uint64_t delay_ns)
+{
+    struct timespec deadline;
+
+    deadline.tv_sec = origin->tv_sec + (time_t)(delay_ns / NSEC_PER_SEC);
+    deadline.tv_nsec = origin->tv_nsec + (long)(delay_ns % NSEC_PER_SEC);
+
+    if(deadline.tv_nsec >= NSEC_PER_SEC)
+    {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= NSEC_PER_SEC;
+    }
+
+    return clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL) == 0;
+}
+
+static bool send_range(const struct dc_env *env, struct dc_error *err, struct segment_reader *reader, int to_fd, uint64_t from, uint64_t to)
+{
+    DC_TRACE(env);
+
+    while(from < to)
+    {
+        uint64_t segment;
+        off_t offset;
+        size_t length;
+        ssize_t sent;
+
+        segment = from / reader->segment_size;
+
+        if(reader->fd == -1 || reader->segment != segment)
+        {
+            char name[PATH_MAX];
+
+            if(reader->fd != -1)
+            {
+                dc_close(env, err, reader->fd);
+            }
+
+            snprintf(name, sizeof(name), "%s.%06" PRIu64, reader->path, segment);     // NOLINT(cert-err33-c)
+            reader->segment = segment;
+            reader->fd = open(name, O_RDONLY | O_CLOEXEC);
+
+            // the stream ends where the segments do
+            if(reader->fd == -1)
+            {
+                if(errno != ENOENT)
+                {
+                    DC_ERROR_RAISE_ERRNO(err, errno);
+                }
+
+                return false;
+            }
+
+            posix_fadvise(reader->fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+        }
+
+        offset = (off_t)(from % reader->segment_size);
+        length = (size_t)(reader->segment_size - (uint64_t)offset);
+
+        if(to - from < length)
+        {
+            length = (size_t)(to - from);
+        }
+
+        if(reader->use_sendfile)
+        {
+            sent = sendfile(to_fd, reader->fd, &offset, length);
+
+            if(sent == -1 && (errno == EINVAL || errno == ENOSYS))
+            {
+                reader->use_sendfile = false;
+                continue;
+            }
+
+            if(sent == -1)
+            {
+                if(errno != EINTR)
+                {
+                    DC_ERROR_RAISE_ERRNO(err, errno);
+                }
+
+                return false;
+            }
+        }
+        else
+        {
+            if(reader->buffer == NULL)
+            {
+                reader->buffer = buffer_pool_acquire(env, err, reader->count);
+
+                if(dc_error_has_error(err))
+                {
+                    return false;
+                }
+            }
+
+            if(length > reader->count)
+            {
+                length = reader->count;
+            }
+
+            sent = dc_pread(env, err, reader->fd, reader->buffer, length, offset);
+
+            if(sent > 0)
+            {
+                write_fully(env, err, to_fd, reader->buffer, (size_t)sent);
+            }
+
+            if(dc_error_has_error(err))
+            {
+                if(dc_error_is_errno(err, EINTR))
+                {
+                    dc_error_reset(err);
+                }
+
+                return false;
+            }
+        }
+
+        if(sent == 0)
+        {
+            return false;
+        }
+
+        from += (uint64_t)sent;
+    }
+
+    return true;
+}
@@ -0,0 +1,246 @@
+#include "coalesce.h"
+#include "buffer_pool.h"
+#include "copy.h"
+#include <dc_posix/dc_unistd.h>
+#include <poll.h>
+#include <stdint.h>
+#include <sys/timerfd.h>
+
+
+static void arm_deadline(const struct dc_env *env, struct dc_error *err, const struct coalescer *coalescer);
+
+
+// NOLINTBEGIN(modernize-macro-to-enum)
+#define USEC_PER_SEC 1000000
+#define NSEC_PER_USEC 1000
+//NOLINTEND(modernize-macro-to-enum)
+
+
+void coalescer_init(const struct dc_env *env, struct dc_error *err, struct coalescer *coalescer, int to_fd, size_t threshold, size_t deadline_us)
+{
+    DC_TRACE(env);
+    coalescer->to_fd = to_fd;
+    coalescer->used = 0;
+    coalescer->threshold = threshold;
+    coalescer->deadline_us = deadline_us;
+    coalescer->timer_fd = -1;
+    coalescer->buffer = buffer_pool_acquire(env, err, threshold);
+
+    if(dc_error_has_error(err))
+    {
+        return;
+    }
+
+    coalescer->timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+
+    if(coalescer->timer_fd == -1)
+    {
+        DC_ERROR_RAISE_ERRNO(err, errno);
+        buffer_pool_release(env, coalescer->buffer, threshold);
+        coalescer->buffer = NULL;
+    }
+}
+
+char *coalescer_reserve(struct coalescer *coalescer, size_t *available)
+{
+    *available = coalescer->threshold - coalescer->used;
+
+    return &coalescer->buffer[coalescer->used];
+}
+
+void coalescer_commit(const struct dc_env *env, struct dc_error *err, struct coalescer *coalescer, size_t count)
+{
+    DC_TRACE(env);
+
+    if(count == 0)
+    {
+        return;
+    }
+
+    if(coalescer->used == 0)
+    {
+        arm_deadline(env, err, coalescer);
+
+        if(dc_error_has_error(err))
+        {
+            return;
+        }
+    }
+
+    coalescer->used += count;
+
+    // a zero deadline means no data is ever held back, so each read goes out as it arrives
+    if(coalescer->used >= coalescer->threshold || coalescer->deadline_us == 0)
+    {
+        coalescer_flush(env, err, coalescer);
+    }
+}
+
+void coalescer_expire(const struct dc_env *env, struct dc_error *err, struct coalescer *coalescer)
+{
+    uint64_t expirations;
+
+    DC_TRACE(env);
+
+    if(read(coalescer->timer_fd, &expirations, sizeof(expirations)) == -1)
+    {
+        if(errno != EAGAIN)
+        {
+            DC_ERROR_RAISE_ERRNO(err, errno);
+        }
+
+        return;
+    }
+
+    coalescer_flush(env, err, coalescer);
+}
+
+void coalescer_flush(const struct dc_env *env, struct dc_error *err, struct coalescer *coalescer)
+{
+    static const struct itimerspec disarm = { { 0, 0 }, { 0, 0 } };
+
+    DC_TRACE(env);
+
+    if(coalescer->used == 0)
+    {
+        return;
+    }
+
+    write_fully(env, err, coalescer->to_fd, coalescer->buffer, coalescer->used);
+    coalescer->used = 0;
+
+    if(timerfd_settime(coalescer->timer_fd, 0, &disarm, NULL) == -1 && dc_error_has_no_error(err))
+    {
+        DC_ERROR_RAISE_ERRNO(err, errno);
+    }
+}
+
+void coalescer_destroy(const struct dc_env *env, struct dc_error *err, struct coalescer *coalescer)
+{
+    DC_TRACE(env);
+
+    if(coalescer->timer_fd != -1)
+    {
+        dc_close(env, err, coalescer->timer_fd);
+        coalescer->timer_fd = -1;
+    }
+
+    buffer_pool_release(env, coalescer->buffer, coalescer->threshold);
+    coalescer->buffer = NULL;
+}
+
+void copy_coalesce(const struct dc_env *env, struct dc_error *err, int from_fd, int to_fd, size_t count, size_t threshold, size_t deadline_us)
+{
+    struct coalescer coalescer;
+    struct pollfd fds[2];
+
+    DC_TRACE(env);
+    coalescer_init(env, err, &coalescer, to_fd, threshold, deadline_us);
+
+    if(dc_error_has_error(err))
+    {
+        goto INIT_FAIL;
+    }
+
+    fds[0].fd = from_fd;
+    fds[0].events = POLLIN;
+    fds[1].fd = coalescer.timer_fd;
+    fds[1].events = POLLIN;
+
+    for(;;)
+    {
+        if(poll(fds, 2, -1) == -1)
+        {
+            if(errno != EINTR)
+            {
+                DC_ERROR_RAISE_ERRNO(err, errno);
+            }
+
+            goto POLL_FAIL;
+        }
+
+        if(fds[1].revents & POLLIN)
+        {
+            coalescer_expire(env, err, &coalescer);
+
+            if(dc_error_has_error(err))
+            {
+                goto WRITE_FAIL;
+            }
+        }
+
+        if(fds[0].revents & (POLLIN | POLLHUP | POLLERR))
+        {
+            char *buffer;
+            size_t nbytes;
+            ssize_t rbytes;
+
+            buffer = coalescer_reserve(&coalescer, &nbytes);
+
+            if(nbytes > count)
+            {
+                nbytes = count;
+            }
+
+            rbytes = dc_read(env, err, from_fd, buffer, nbytes);
+
+            if(dc_error_has_error(err))
+            {
+                if(dc_error_is_errno(err, EINTR))
+                {
+                    dc_error_reset(err);
+                }
+
+                goto READ_FAIL;
+            }
+
+            if(rbytes == 0)
+            {
+                break;
+            }
+
+            coalescer_commit(env, err, &coalescer, (size_t)rbytes);
+
+            if(dc_error_has_error(err))
+            {
+                goto WRITE_FAIL;
+            }
+        }
+    }
+
+    READ_FAIL:
+    POLL_FAIL:
+    if(dc_error_has_no_error(err))
+    {
+        coalescer_flush(env, err, &coalescer);
+    }
+
+    WRITE_FAIL:
+    coalescer_destroy(env, err, &coalescer);
+
+    INIT_FAIL:
+    {
+    }
+}
+
+static void arm_deadline(const struct dc_env *env, struct dc_error *err, const struct coalescer *coalescer)
+{
+    struct itimerspec spec;
+
+    DC_TRACE(env);
+
+    if(coalescer->deadline_us == 0)
+    {
+        return;
+    }
+
+    spec.it_interval.tv_sec = 0;
+    spec.it_interval.tv_nsec = 0;
+    spec.it_value.tv_sec = (time_t)(coalescer->deadline_us / USEC_PER_SEC);
+    spec.it_value.tv_nsec = (long)(coalescer->deadline_us % USEC_PER_SEC) * NSEC_PER_USEC;
+
+    if(timerfd_settime(coalescer->timer_fd, 0, &spec, NULL) == -1)
+    {
+        DC_ERROR_RAISE_ERRNO(err, errno);
+    }
+}
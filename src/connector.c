@@ -0,0 +1,340 @@
+#include "connector.h"
+#include <dc_c/dc_string.h>
+#include <dc_posix/dc_fcntl.h>
+#include <dc_posix/dc_unistd.h>
+#include <dc_posix/sys/dc_socket.h>
+#include <netdb.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <stdio.h>
+#include <time.h>
+
+
+static int start_attempt(const struct dc_env *env, const struct sockaddr *addr, socklen_t addr_len, const struct connect_options *options, int *error);
+static bool bind_from(const struct dc_env *env, int fd, int family, const char *from);
+static int wait_for_connection(const struct dc_env *env, struct dc_error *err, struct pollfd *fds, nfds_t count, int timeout_ms, int *error);
+static int remaining_ms(const struct timespec *deadline);
+static void set_blocking(const struct dc_env *env, struct dc_error *err, int fd);
+
+
+// NOLINTBEGIN(modernize-macro-to-enum)
+#define PORT_STRING_SIZE 6
+#define MSEC_PER_SEC 1000
+#define NSEC_PER_MSEC 1000000
+//NOLINTEND(modernize-macro-to-enum)
+
+
+int connect_output(const struct dc_env *env, struct dc_error *err, const struct connect_options *options)
+{
+    struct addrinfo hints;
+    struct addrinfo *results;
+    const struct addrinfo *ai;
+    struct pollfd fds[CONNECT_MAX_ADDRESSES];
+    char port[PORT_STRING_SIZE];
+    nfds_t count;
+    int status;
+    int error;
+    int fd;
+
+    DC_TRACE(env);
+    dc_memset(env, &hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    snprintf(port, sizeof(port), "%u", (unsigned int)options->port);      // NOLINT(cert-err33-c)
+    status = getaddrinfo(options->host, port, &hints, &results);
+
+    if(status != 0)
+    {
+        DC_ERROR_RAISE_USER(err, gai_strerror(status), 3);
+        return -1;
+    }
+
+    count = 0;
+    error = ECONNREFUSED;
+
+    for(ai = results; ai != NULL && count < CONNECT_MAX_ADDRESSES; ai = ai->ai_next)
+    {
+        int candidate;
+
+        candidate = start_attempt(env, ai->ai_addr, ai->ai_addrlen, options, &error);
+
+        if(candidate == -1)
+        {
+            continue;
+        }
+
+        fds[count].fd = candidate;
+        fds[count].events = POLLOUT;
+        fds[count].revents = 0;
+        count++;
+
+        // with TCP_FASTOPEN_CONNECT the handshake is deferred to the first write, so racing addresses is meaningless
+        if(options->fast_open)
+        {
+            break;
+        }
+    }
+
+    freeaddrinfo(results);
+
+    if(count == 0)
+    {
+        DC_ERROR_RAISE_ERRNO(err, error);
+        return -1;
+    }
+
+    fd = wait_for_connection(env, err, fds, count, options->timeout_ms, &error);
+
+    for(nfds_t i = 0; i < count; i++)
+    {
+        if(fds[i].fd >= 0 && fds[i].fd != fd)
+        {
+            close(fds[i].fd);
+        }
+    }
+
+    if(fd == -1)
+    {
+        if(dc_error_has_no_error(err))
+        {
+            DC_ERROR_RAISE_ERRNO(err, error);
+        }
+
+        return -1;
+    }
+
+    set_blocking(env, err, fd);
+
+    if(dc_error_has_error(err))
+    {
+        close(fd);
+        fd = -1;
+    }
+
+    return fd;
+}
+
+size_t connect_resolve(const struct dc_env *env, struct dc_error *err, const struct connect_options *options, struct connect_address *addresses, size_t max)
+{
+    struct addrinfo hints;
+    struct addrinfo *results;
+    const struct addrinfo *ai;
+    char port[PORT_STRING_SIZE];
+    size_t count;
+    int status;
+
+    DC_TRACE(env);
+    dc_memset(env, &hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    snprintf(port, sizeof(port), "%u", (unsigned int)options->port);      // NOLINT(cert-err33-c)
+    status = getaddrinfo(options->host, port, &hints, &results);
+
+    if(status != 0)
+    {
+        DC_ERROR_RAISE_USER(err, gai_strerror(status), 3);
+        return 0;
+    }
+
+    count = 0;
+
+    for(ai = results; ai != NULL && count < max; ai = ai->ai_next)
+    {
+        if(ai->ai_addrlen > sizeof(addresses[count].addr))
+        {
+            continue;
+        }
+
+        dc_memcpy(env, &addresses[count].addr, ai->ai_addr, ai->ai_addrlen);
+        addresses[count].addr_len = ai->ai_addrlen;
+        count++;
+    }
+
+    freeaddrinfo(results);
+
+    return count;
+}
+
+int connect_start(const struct dc_env *env, const struct connect_options *options, const struct connect_address *address, int *error)
+{
+    DC_TRACE(env);
+
+    // the caller waits for EPOLLOUT and asks connect_result how it went
+    return start_attempt(env, (const struct sockaddr *)&address->addr, address->addr_len, options, error);     // NOLINT(cppcoreguidelines-pro-type-cstyle-cast)
+}
+
+int connect_result(int fd)
+{
+    int so_error;
+    socklen_t len;
+
+    len = sizeof(so_error);
+
+    if(getsockopt(fd, SOL_SOCKET, SO_ERROR, &so_error, &len) == -1)
+    {
+        return errno;
+    }
+
+    return so_error;
+}
+
+void enable_listen_fast_open(const struct dc_env *env, struct dc_error *err, int fd, int queue_length)
+{
+    DC_TRACE(env);
+    dc_setsockopt(env, err, fd, IPPROTO_TCP, TCP_FASTOPEN, &queue_length, sizeof(queue_length));
+}
+
+static int start_attempt(const struct dc_env *env, const struct sockaddr *addr, socklen_t addr_len, const struct connect_options *options, int *error)
+{
+    int fd;
+
+    DC_TRACE(env);
+    fd = socket(addr->sa_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+
+    if(fd == -1)
+    {
+        *error = errno;
+        return -1;
+    }
+
+    if(options->from && !bind_from(env, fd, addr->sa_family, options->from))
+    {
+        *error = errno;
+        close(fd);
+        return -1;
+    }
+
+    if(options->fast_open)
+    {
+        int on;
+
+        on = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_FASTOPEN_CONNECT, &on, sizeof(on));
+    }
+
+    if(connect(fd, addr, addr_len) == -1 && errno != EINPROGRESS)
+    {
+        *error = errno;
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+static bool bind_from(const struct dc_env *env, int fd, int family, const char *from)
+{
+    struct addrinfo hints;
+    struct addrinfo *results;
+    bool bound;
+
+    DC_TRACE(env);
+    dc_memset(env, &hints, 0, sizeof(hints));
+    hints.ai_family = family;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_NUMERICHOST;
+
+    if(getaddrinfo(from, NULL, &hints, &results) != 0)
+    {
+        errno = EADDRNOTAVAIL;
+        return false;
+    }
+
+    bound = bind(fd, results->ai_addr, results->ai_addrlen) == 0;
+    freeaddrinfo(results);
+
+    return bound;
+}
+
+static int wait_for_connection(const struct dc_env *env, struct dc_error *err, struct pollfd *fds, nfds_t count, int timeout_ms, int *error)
+{
+    struct timespec deadline;
+    nfds_t pending;
+
+    DC_TRACE(env);
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    deadline.tv_sec += timeout_ms / MSEC_PER_SEC;
+    deadline.tv_nsec += (long)(timeout_ms % MSEC_PER_SEC) * NSEC_PER_MSEC;
+
+    if(deadline.tv_nsec >= NSEC_PER_MSEC * MSEC_PER_SEC)
+    {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= NSEC_PER_MSEC * MSEC_PER_SEC;
+    }
+
+    pending = count;
+
+    while(pending > 0)
+    {
+        int ready;
+
+        ready = poll(fds, count, timeout_ms > 0 ? remaining_ms(&deadline) : -1);
+
+        if(ready == -1)
+        {
+            DC_ERROR_RAISE_ERRNO(err, errno);
+            return -1;
+        }
+
+        if(ready == 0)
+        {
+            *error = ETIMEDOUT;
+            return -1;
+        }
+
+        for(nfds_t i = 0; i < count; i++)
+        {
+            int so_error;
+
+            if(fds[i].fd < 0 || fds[i].revents == 0)
+            {
+                continue;
+            }
+
+            so_error = connect_result(fds[i].fd);
+
+            if(so_error == 0)
+            {
+                return fds[i].fd;
+            }
+
+            *error = so_error;
+            close(fds[i].fd);
+            fds[i].fd = -1;
+            pending--;
+        }
+    }
+
+    return -1;
+}
+
+static int remaining_ms(const struct timespec *deadline)
+{
+    struct timespec now;
+    long remaining;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    remaining = (deadline->tv_sec - now.tv_sec) * MSEC_PER_SEC + (deadline->tv_nsec - now.tv_nsec) / NSEC_PER_MSEC;
+
+    if(remaining < 0)
+    {
+        remaining = 0;
+    }
+
+    return (int)remaining;
+}
+
+static void set_blocking(const struct dc_env *env, struct dc_error *err, int fd)
+{
+    int flags;
+
+    DC_TRACE(env);
+    flags = dc_fcntl(env, err, fd, F_GETFL);
+
+    if(dc_error_has_error(err))
+    {
+        return;
+    }
+
+    dc_fcntl(env, err, fd, F_SETFL, flags & ~O_NONBLOCK);
+}
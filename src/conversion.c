@@ -2,6 +2,7 @@
 #include <dc_c/dc_inttypes.h>
 #include <dc_c/dc_stdlib.h>
 #include <limits.h>
+#include <sched.h>
 
 
 in_port_t parse_port(const struct dc_env *env, struct dc_error *err, const char *buff, int radix)
@@ -87,3 +88,135 @@ size_t parse_size_t(const struct dc_env *env, struct dc_error *err, const char *
 
     return ret_val;
 }
+
+
+int parse_int(const struct dc_env *env, struct dc_error *err, const char *buff, int radix)
+{
+    char *end;
+    long sl;
+    const char *msg;
+
+    DC_TRACE(env);
+    sl = dc_strtol(env, err, buff, &end, radix);
+
+    if(end == buff)
+    {
+        msg = "not a decimal number";
+    }
+    else if(*end != '\0')
+    {
+        msg = "%s: extra characters at end of input";
+    }
+    else if((sl == LONG_MIN || sl == LONG_MAX) && ERANGE == errno)
+    {
+        msg = "out of range of type long";
+    }
+    else if(sl > INT_MAX)
+    {
+        msg = "greater than INT_MAX";
+    }
+    else if(sl < 0)
+    {
+        msg = "less than 0";
+    }
+    else
+    {
+        msg = NULL;
+    }
+
+    if(msg)
+    {
+        DC_ERROR_RAISE_USER(err, msg, 3);
+    }
+
+    return (int)sl;
+}
+
+
+int parse_cpu(const struct dc_env *env, struct dc_error *err, const char *buff, int radix)
+{
+    char *end;
+    long sl;
+    const char *msg;
+
+    DC_TRACE(env);
+    sl = dc_strtol(env, err, buff, &end, radix);
+
+    if(end == buff)
+    {
+        msg = "not a decimal number";
+    }
+    else if(*end != '\0')
+    {
+        msg = "%s: extra characters at end of input";
+    }
+    else if((sl == LONG_MIN || sl == LONG_MAX) && ERANGE == errno)
+    {
+        msg = "out of range of type long";
+    }
+    else if(sl >= CPU_SETSIZE)
+    {
+        msg = "not less than CPU_SETSIZE";
+    }
+    else if(sl < 0)
+    {
+        msg = "less than 0";
+    }
+    else
+    {
+        msg = NULL;
+    }
+
+    if(msg)
+    {
+        DC_ERROR_RAISE_USER(err, msg, 3);
+    }
+
+    return (int)sl;
+}
+
+
+char parse_delimiter(const struct dc_env *env, struct dc_error *err, const char *buff)
+{
+    DC_TRACE(env);
+
+    if(buff[0] != '\0' && buff[1] == '\0')
+    {
+        return buff[0];
+    }
+
+    if(buff[0] == '\\' && buff[1] != '\0' && buff[2] == '\0')
+    {
+        switch(buff[1])
+        {
+            case 'n':
+            {
+                return '\n';
+            }
+            case 'r':
+            {
+                return '\r';
+            }
+            case 't':
+            {
+                return '\t';
+            }
+            case '0':
+            {
+                return '\0';
+            }
+            case '\\':
+            {
+                return '\\';
+            }
+            default:
+            {
+                break;
+            }
+        }
+    }
+
+    DC_ERROR_RAISE_USER(err, "not a single character or one of \\n, \\r, \\t, \\0", 3);
+
+    return '\0';
+}
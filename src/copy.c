@@ -1,5 +1,5 @@
 #include "copy.h"
-#include <dc_c/dc_stdlib.h>
+#include "buffer_pool.h"
 #include <dc_posix/dc_unistd.h>
 
 
@@ -9,7 +9,7 @@ void copy(const struct dc_env *env, struct dc_error *err, int from_fd, int to_fd
     ssize_t rbytes;
 
     DC_TRACE(env);
-    buffer = dc_malloc(env, err, count);
+    buffer = buffer_pool_acquire(env, err, count);
 
     if(dc_error_has_error(err))
     {
@@ -39,9 +39,39 @@ void copy(const struct dc_env *env, struct dc_error *err, int from_fd, int to_fd
 
     READ_FAIL:
     WRITE_FAIL:
-    dc_free(env, buffer);
+    buffer_pool_release(env, buffer, count);
 
     MALLOC_FAIL:
     {
     }
 }
+
+void write_fully(const struct dc_env *env, struct dc_error *err, int fd, const void *buffer, size_t count)
+{
+    const char *position;
+
+    DC_TRACE(env);
+    position = buffer;
+
+    // a send timeout or a signal can cut a write short, and the rest still has to follow it in order
+    while(count > 0)
+    {
+        ssize_t wbytes;
+
+        wbytes = dc_write(env, err, fd, position, count);
+
+        if(dc_error_has_error(err))
+        {
+            if(!dc_error_is_errno(err, EINTR))
+            {
+                return;
+            }
+
+            dc_error_reset(err);
+            continue;
+        }
+
+        position += wbytes;
+        count -= (size_t)wbytes;
+    }
+}
@@ -0,0 +1,895 @@
+#include "dedup.h"
+#include "conversion.h"
+#include <dc_c/dc_stdlib.h>
+#include <dc_c/dc_string.h>
+#include <limits.h>
+#include <openssl/evp.h>
+#include <openssl/sha.h>
+#include <stdint.h>
+#include <string.h>
+
+
+// NOLINTBEGIN(modernize-macro-to-enum)
+#define MIN_CHUNK 2048
+#define MAX_CHUNK 65536
+#define AVERAGE_BITS 13
+#define GEAR_SIZE 256
+#define GEAR_WINDOW 64
+#define GEAR_SEED 0x736e616b65ULL
+#define GOLDEN_GAMMA 0x9E3779B97F4A7C15ULL
+#define MIX_MULTIPLIER_1 0xBF58476D1CE4E5B9ULL
+#define MIX_MULTIPLIER_2 0x94D049BB133111EBULL
+#define BOUNDARY_MASK (((UINT64_C(1) << AVERAGE_BITS) - 1) << (GEAR_WINDOW - AVERAGE_BITS))
+#define DEFAULT_CACHE_MB 64
+#define BYTES_PER_MB (1024 * 1024)
+#define MIN_BUCKETS 64
+#define TAG_HEADER 'H'
+#define TAG_LITERAL 'L'
+#define TAG_REFERENCE 'R'
+#define HEADER_SIZE (1 + sizeof(uint64_t))
+#define LITERAL_HEADER_SIZE (1 + sizeof(uint32_t))
+#define REFERENCE_SIZE (1 + SHA256_DIGEST_LENGTH)
+#define PERCENT 100.0
+#define LABEL_SIZE 32
+//NOLINTEND(modernize-macro-to-enum)
+
+
+struct chunk
+{
+    unsigned char fingerprint[SHA256_DIGEST_LENGTH];
+    size_t length;
+    char *data;
+    struct chunk *next;
+    struct chunk *newer;
+    struct chunk *older;
+};
+
+
+struct chunk_cache
+{
+    struct chunk **buckets;
+    size_t bucket_mask;
+    struct chunk *newest;
+    struct chunk *oldest;
+    size_t capacity;
+    size_t used;
+    size_t entries;
+};
+
+
+struct dedup
+{
+    struct chunk_cache cache;
+    size_t max_cache;
+    bool keep_data;
+    bool header_done;
+    uint64_t gear[GEAR_SIZE];
+    uint64_t hash;
+    char *chunk;
+    size_t chunk_length;
+    char *frame;
+    size_t frame_length;
+    size_t frame_capacity;
+    char *out;
+    size_t out_length;
+    size_t out_capacity;
+    size_t chunks;
+    size_t hits;
+    size_t bytes_saved;
+};
+
+
+static struct dedup *dedup_create(const struct dc_env *env, struct dc_error *err, struct transform_stage *stage, bool keep_data);
+static size_t parse_cache_size(const struct dc_env *env, struct dc_error *err, const char *arg);
+static size_t find_boundary(struct dedup *dedup, const char *data, size_t length, bool *boundary);
+static void emit_chunk(const struct dc_env *env, struct dc_error *err, struct dedup *dedup, const char *data, size_t length);
+static size_t read_frame(const struct dc_env *env, struct dc_error *err, struct dedup *dedup, const char *data, size_t length);
+static char *reserve(const struct dc_env *env, struct dc_error *err, struct dedup *dedup, size_t size);
+static void fingerprint(const char *data, size_t length, unsigned char *digest);
+static void cache_reset(const struct dc_env *env, struct dc_error *err, struct chunk_cache *cache, size_t capacity);
+static void cache_clear(const struct dc_env *env, struct chunk_cache *cache);
+static struct chunk *cache_find(const struct chunk_cache *cache, const unsigned char *digest);
+static void cache_insert(const struct dc_env *env, struct dc_error *err, struct chunk_cache *cache, const unsigned char *digest, const char *data, size_t length, bool keep_data);
+static void cache_touch(struct chunk_cache *cache, struct chunk *chunk);
+static void cache_evict(const struct dc_env *env, struct chunk_cache *cache);
+static void lru_unlink(struct chunk_cache *cache, struct chunk *chunk);
+static void lru_push(struct chunk_cache *cache, struct chunk *chunk);
+static size_t bucket_of(const struct chunk_cache *cache, const unsigned char *digest);
+static void put_be(char *out, uint64_t value, size_t size);
+static uint64_t get_be(const char *in, size_t size);
+
+
+void dedup_init(const struct dc_env *env, struct dc_error *err, struct transform_stage *stage, const char *arg)
+{
+    struct dedup *dedup;
+    size_t capacity;
+    uint64_t seed;
+
+    DC_TRACE(env);
+    capacity = parse_cache_size(env, err, arg);
+
+    if(dc_error_has_error(err))
+    {
+        return;
+    }
+
+    dedup = dedup_create(env, err, stage, false);
+
+    if(dc_error_has_error(err))
+    {
+        return;
+    }
+
+    dedup->chunk = dc_malloc(env, err, MAX_CHUNK);
+
+    if(dc_error_has_error(err))
+    {
+        dedup_destroy(env, stage);
+        return;
+    }
+
+    // splitmix64 from a fixed seed: only the sender chunks, so the table just has to look random
+    seed = GEAR_SEED;
+
+    for(size_t i = 0; i < GEAR_SIZE; i++)
+    {
+        uint64_t mixed;
+
+        seed += GOLDEN_GAMMA;
+        mixed = seed;
+        mixed = (mixed ^ (mixed >> 30U)) * MIX_MULTIPLIER_1;    // NOLINT(cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers)
+        mixed = (mixed ^ (mixed >> 27U)) * MIX_MULTIPLIER_2;    // NOLINT(cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers)
+        dedup->gear[i] = mixed ^ (mixed >> 31U);                // NOLINT(cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers)
+    }
+
+    cache_reset(env, err, &dedup->cache, capacity);
+
+    if(dc_error_has_error(err))
+    {
+        dedup_destroy(env, stage);
+    }
+}
+
+void dedup_process(const struct dc_env *env, struct dc_error *err, struct transform_stage *stage, struct transform_span *span)
+{
+    struct dedup *dedup;
+    const char *position;
+    const char *end;
+
+    DC_TRACE(env);
+    dedup = stage->state;
+    dedup->out_length = 0;
+
+    // the receiver sizes its cache from this, and a fresh one (after a restart or -x) empties it
+    if(!dedup->header_done)
+    {
+        char *frame;
+
+        frame = reserve(env, err, dedup, HEADER_SIZE);
+
+        if(dc_error_has_error(err))
+        {
+            return;
+        }
+
+        frame[0] = TAG_HEADER;
+        put_be(&frame[1], dedup->cache.capacity, sizeof(uint64_t));
+        dedup->header_done = true;
+    }
+
+    position = span->data;
+    end = span->data + span->length;
+
+    while(position < end)
+    {
+        bool boundary;
+        size_t length;
+
+        length = find_boundary(dedup, position, (size_t)(end - position), &boundary);
+
+        // a chunk that lies wholly inside the span is fingerprinted where it is
+        if(boundary && dedup->chunk_length == 0)
+        {
+            emit_chunk(env, err, dedup, position, length);
+        }
+        else
+        {
+            dc_memcpy(env, &dedup->chunk[dedup->chunk_length], position, length);
+            dedup->chunk_length += length;
+
+            if(boundary)
+            {
+                emit_chunk(env, err, dedup, dedup->chunk, dedup->chunk_length);
+                dedup->chunk_length = 0;
+            }
+        }
+
+        if(dc_error_has_error(err))
+        {
+            return;
+        }
+
+        position += length;
+    }
+
+    span->data = dedup->out;
+    span->length = dedup->out_length;
+}
+
+void dedup_flush(const struct dc_env *env, struct dc_error *err, struct transform_stage *stage, struct transform_span *span)
+{
+    struct dedup *dedup;
+
+    DC_TRACE(env);
+    dedup = stage->state;
+
+    if(dedup->chunk_length == 0)
+    {
+        return;
+    }
+
+    dedup->out_length = 0;
+    emit_chunk(env, err, dedup, dedup->chunk, dedup->chunk_length);
+    dedup->chunk_length = 0;
+    dedup->hash = 0;
+
+    if(dc_error_has_no_error(err))
+    {
+        span->data = dedup->out;
+        span->length = dedup->out_length;
+    }
+}
+
+void dedup_discard(const struct dc_env *env, struct transform_stage *stage)
+{
+    struct dedup *dedup;
+
+    DC_TRACE(env);
+    dedup = stage->state;
+
+    // the held bytes never reached the cache, so dropping them leaves both ends agreeing on what it holds
+    dedup->chunk_length = 0;
+    dedup->hash = 0;
+}
+
+void undedup_init(const struct dc_env *env, struct dc_error *err, struct transform_stage *stage, const char *arg)
+{
+    struct dedup *dedup;
+    size_t capacity;
+
+    DC_TRACE(env);
+    capacity = parse_cache_size(env, err, arg);
+
+    if(dc_error_has_error(err))
+    {
+        return;
+    }
+
+    dedup = dedup_create(env, err, stage, true);
+
+    // the sender sizes the cache, but only up to what this side agreed to hold in memory
+    if(dedup != NULL)
+    {
+        dedup->max_cache = capacity;
+    }
+}
+
+void undedup_process(const struct dc_env *env, struct dc_error *err, struct transform_stage *stage, struct transform_span *span)
+{
+    struct dedup *dedup;
+    const char *data;
+    size_t length;
+    size_t used;
+
+    DC_TRACE(env);
+    dedup = stage->state;
+    dedup->out_length = 0;
+    data = span->data;
+    length = span->length;
+
+    // a frame cut off by the previous read is finished from the front of this one
+    if(dedup->frame_length > 0)
+    {
+        transform_buffer_grow(env, err, &dedup->frame, &dedup->frame_capacity, dedup->frame_length + length);
+
+        if(dc_error_has_error(err))
+        {
+            return;
+        }
+
+        dc_memcpy(env, &dedup->frame[dedup->frame_length], data, length);
+        dedup->frame_length += length;
+        data = dedup->frame;
+        length = dedup->frame_length;
+    }
+
+    used = 0;
+
+    while(used < length)
+    {
+        size_t size;
+
+        size = read_frame(env, err, dedup, &data[used], length - used);
+
+        if(dc_error_has_error(err))
+        {
+            return;
+        }
+
+        if(size == 0)
+        {
+            break;
+        }
+
+        used += size;
+    }
+
+    if(data == dedup->frame)
+    {
+        dc_memmove(env, dedup->frame, &dedup->frame[used], length - used);
+    }
+    else if(used < length)
+    {
+        transform_buffer_grow(env, err, &dedup->frame, &dedup->frame_capacity, length - used);
+
+        if(dc_error_has_error(err))
+        {
+            return;
+        }
+
+        dc_memcpy(env, dedup->frame, &data[used], length - used);
+    }
+
+    dedup->frame_length = length - used;
+    span->data = dedup->out;
+    span->length = dedup->out_length;
+}
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wunused-parameter"
+void undedup_flush(const struct dc_env *env, struct dc_error *err, struct transform_stage *stage, struct transform_span *span)
+{
+    struct dedup *dedup;
+
+    DC_TRACE(env);
+    dedup = stage->state;
+
+    // the sender's stream ended, and whoever connects next has to start with a header of its own
+    dedup->frame_length = 0;
+    dedup->header_done = false;
+}
+#pragma GCC diagnostic pop
+
+void undedup_discard(const struct dc_env *env, struct transform_stage *stage)
+{
+    struct dedup *dedup;
+
+    DC_TRACE(env);
+    dedup = stage->state;
+
+    // a cut-off frame is worthless, and the next sender starts from its own header
+    dedup->frame_length = 0;
+    dedup->header_done = false;
+}
+
+void dedup_destroy(const struct dc_env *env, struct transform_stage *stage)
+{
+    struct dedup *dedup;
+
+    DC_TRACE(env);
+    dedup = stage->state;
+
+    if(dedup != NULL)
+    {
+        cache_clear(env, &dedup->cache);
+        dc_free(env, dedup->cache.buckets);
+        dc_free(env, dedup->chunk);
+        dc_free(env, dedup->frame);
+        dc_free(env, dedup->out);
+        dc_free(env, dedup);
+    }
+
+    stage->state = NULL;
+}
+
+void dedup_report(FILE *stream, const struct transform_stage *stage)
+{
+    const struct dedup *dedup;
+    char label[LABEL_SIZE];
+
+    dedup = stage->state;
+
+    // NOLINTBEGIN(cert-err33-c)
+    snprintf(label, sizeof(label), "%s hit rate:", stage->ops->name);
+    fprintf(stream, "%-20s%.1f%% of %zu chunks\n", label, dedup->chunks > 0 ? (double)dedup->hits * PERCENT / (double)dedup->chunks : 0.0, dedup->chunks);
+    snprintf(label, sizeof(label), "%s saved:", stage->ops->name);
+    fprintf(stream, "%-20s%zu bytes\n", label, dedup->bytes_saved);
+    snprintf(label, sizeof(label), "%s cache:", stage->ops->name);
+    fprintf(stream, "%-20s%zu of %zu bytes in %zu chunks\n", label, dedup->cache.used, dedup->cache.capacity, dedup->cache.entries);
+    // NOLINTEND(cert-err33-c)
+}
+
+static struct dedup *dedup_create(const struct dc_env *env, struct dc_error *err, struct transform_stage *stage, bool keep_data)
+{
+    struct dedup *dedup;
+
+    DC_TRACE(env);
+    dedup = dc_calloc(env, err, 1, sizeof(*dedup));
+
+    if(dc_error_has_error(err))
+    {
+        return NULL;
+    }
+
+    // the receiver rebuilds the stream from the bytes, the sender only needs to know what they were
+    dedup->keep_data = keep_data;
+    stage->state = dedup;
+
+    return dedup;
+}
+
+static size_t parse_cache_size(const struct dc_env *env, struct dc_error *err, const char *arg)
+{
+    size_t megabytes;
+
+    DC_TRACE(env);
+
+    if(arg == NULL)
+    {
+        return (size_t)DEFAULT_CACHE_MB * BYTES_PER_MB;
+    }
+
+    megabytes = parse_size_t(env, err, arg, 10);  // NOLINT(cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers)
+
+    if(dc_error_has_error(err))
+    {
+        return 0;
+    }
+
+    if(megabytes == 0 || megabytes > SIZE_MAX / BYTES_PER_MB)
+    {
+        DC_ERROR_RAISE_USER(err, "dedup cache size must be at least 1 MB", 2);
+        return 0;
+    }
+
+    return megabytes * BYTES_PER_MB;
+}
+
+static size_t find_boundary(struct dedup *dedup, const char *data, size_t length, bool *boundary)
+{
+    uint64_t hash;
+    size_t have;
+    size_t scan;
+    size_t start;
+
+    have = dedup->chunk_length;
+    scan = length < MAX_CHUNK - have ? length : MAX_CHUNK - have;
+    hash = dedup->hash;
+
+    // the gear hash forgets a byte after 64 shifts, so nothing before the minimum size needs hashing
+    start = have + GEAR_WINDOW < MIN_CHUNK ? MIN_CHUNK - GEAR_WINDOW - have : 0;
+    *boundary = true;
+
+    for(size_t i = start; i < scan; i++)
+    {
+        hash = (hash << 1U) + dedup->gear[(unsigned char)data[i]];
+
+        if(have + i + 1 >= MIN_CHUNK && (hash & BOUNDARY_MASK) == 0)
+        {
+            dedup->hash = 0;
+            return i + 1;
+        }
+    }
+
+    if(have + scan == MAX_CHUNK)
+    {
+        dedup->hash = 0;
+        return scan;
+    }
+
+    *boundary = false;
+    dedup->hash = hash;
+
+    return scan;
+}
+
+static void emit_chunk(const struct dc_env *env, struct dc_error *err, struct dedup *dedup, const char *data, size_t length)
+{
+    unsigned char digest[SHA256_DIGEST_LENGTH];
+    struct chunk *chunk;
+    char *frame;
+
+    DC_TRACE(env);
+    fingerprint(data, length, digest);
+    chunk = cache_find(&dedup->cache, digest);
+    dedup->chunks++;
+
+    // a tail shorter than a reference is cheaper to send again
+    if(chunk != NULL && length > REFERENCE_SIZE)
+    {
+        frame = reserve(env, err, dedup, REFERENCE_SIZE);
+
+        if(dc_error_has_error(err))
+        {
+            return;
+        }
+
+        frame[0] = TAG_REFERENCE;
+        dc_memcpy(env, &frame[1], digest, sizeof(digest));
+        cache_touch(&dedup->cache, chunk);
+        dedup->hits++;
+        dedup->bytes_saved += length - REFERENCE_SIZE;
+        return;
+    }
+
+    frame = reserve(env, err, dedup, LITERAL_HEADER_SIZE + length);
+
+    if(dc_error_has_error(err))
+    {
+        return;
+    }
+
+    frame[0] = TAG_LITERAL;
+    put_be(&frame[1], length, sizeof(uint32_t));
+    dc_memcpy(env, &frame[LITERAL_HEADER_SIZE], data, length);
+
+    // the receiver makes exactly the same move for this literal, which keeps both caches identical
+    if(chunk != NULL)
+    {
+        cache_touch(&dedup->cache, chunk);
+    }
+    else
+    {
+        cache_insert(env, err, &dedup->cache, digest, data, length, dedup->keep_data);
+    }
+}
+
+static size_t read_frame(const struct dc_env *env, struct dc_error *err, struct dedup *dedup, const char *data, size_t length)
+{
+    unsigned char digest[SHA256_DIGEST_LENGTH];
+    struct chunk *chunk;
+    size_t size;
+    char *out;
+
+    DC_TRACE(env);
+
+    if(data[0] != TAG_HEADER && !dedup->header_done)
+    {
+        DC_ERROR_RAISE_USER(err, "the stream has no dedup header (is the sender running -a dedup?)", 2);
+        return 0;
+    }
+
+    switch(data[0])
+    {
+        case TAG_HEADER:
+        {
+            if(length < HEADER_SIZE)
+            {
+                return 0;
+            }
+
+            size = get_be(&data[1], sizeof(uint64_t));
+
+            // shrinking the cache would make it evict what the sender still references, so a larger one is refused outright
+            if(size == 0 || size > dedup->max_cache)
+            {
+                DC_ERROR_RAISE_USER(err, "the sender's dedup cache is larger than undedup allows (raise it with undedup=MB)", 2);
+                return 0;
+            }
+
+            cache_reset(env, err, &dedup->cache, size);
+            dedup->header_done = true;
+
+            return HEADER_SIZE;
+        }
+        case TAG_LITERAL:
+        {
+            if(length < LITERAL_HEADER_SIZE)
+            {
+                return 0;
+            }
+
+            size = get_be(&data[1], sizeof(uint32_t));
+
+            if(size == 0 || size > MAX_CHUNK)
+            {
+                DC_ERROR_RAISE_USER(err, "the dedup stream is corrupt", 2);
+                return 0;
+            }
+
+            if(length < LITERAL_HEADER_SIZE + size)
+            {
+                return 0;
+            }
+
+            out = reserve(env, err, dedup, size);
+
+            if(dc_error_has_error(err))
+            {
+                return 0;
+            }
+
+            dc_memcpy(env, out, &data[LITERAL_HEADER_SIZE], size);
+            fingerprint(out, size, digest);
+            chunk = cache_find(&dedup->cache, digest);
+            dedup->chunks++;
+
+            if(chunk != NULL)
+            {
+                cache_touch(&dedup->cache, chunk);
+            }
+            else
+            {
+                cache_insert(env, err, &dedup->cache, digest, out, size, dedup->keep_data);
+            }
+
+            return LITERAL_HEADER_SIZE + size;
+        }
+        case TAG_REFERENCE:
+        {
+            if(length < REFERENCE_SIZE)
+            {
+                return 0;
+            }
+
+            chunk = cache_find(&dedup->cache, (const unsigned char *)&data[1]);
+
+            if(chunk == NULL)
+            {
+                DC_ERROR_RAISE_USER(err, "the dedup stream refers to a chunk this cache does not hold", 2);
+                return 0;
+            }
+
+            out = reserve(env, err, dedup, chunk->length);
+
+            if(dc_error_has_error(err))
+            {
+                return 0;
+            }
+
+            dc_memcpy(env, out, chunk->data, chunk->length);
+            cache_touch(&dedup->cache, chunk);
+            dedup->chunks++;
+            dedup->hits++;
+            dedup->bytes_saved += chunk->length - REFERENCE_SIZE;
+
+            return REFERENCE_SIZE;
+        }
+        default:
+        {
+            DC_ERROR_RAISE_USER(err, "the dedup stream is corrupt", 2);
+            return 0;
+        }
+    }
+}
+
+static char *reserve(const struct dc_env *env, struct dc_error *err, struct dedup *dedup, size_t size)
+{
+    char *space;
+
+    DC_TRACE(env);
+    transform_buffer_grow(env, err, &dedup->out, &dedup->out_capacity, dedup->out_length + size);
+
+    if(dc_error_has_error(err))
+    {
+        return NULL;
+    }
+
+    space = &dedup->out[dedup->out_length];
+    dedup->out_length += size;
+
+    return space;
+}
+
+static void fingerprint(const char *data, size_t length, unsigned char *digest)
+{
+    // a reference is trusted without comparing bytes, so the fingerprint has to be collision resistant
+    EVP_Digest(data, length, digest, NULL, EVP_sha256(), NULL);
+}
+
+static void cache_reset(const struct dc_env *env, struct dc_error *err, struct chunk_cache *cache, size_t capacity)
+{
+    size_t buckets;
+
+    DC_TRACE(env);
+    cache_clear(env, cache);
+    dc_free(env, cache->buckets);
+    cache->buckets = NULL;
+    cache->bucket_mask = 0;
+    cache->capacity = 0;
+    buckets = MIN_BUCKETS;
+
+    // about one chunk per bucket once the cache is full of average-sized chunks
+    while(buckets < capacity >> AVERAGE_BITS)
+    {
+        buckets *= 2;
+    }
+
+    cache->buckets = dc_calloc(env, err, buckets, sizeof(*cache->buckets));
+
+    if(dc_error_has_error(err))
+    {
+        return;
+    }
+
+    cache->bucket_mask = buckets - 1;
+    cache->capacity = capacity;
+}
+
+static void cache_clear(const struct dc_env *env, struct chunk_cache *cache)
+{
+    DC_TRACE(env);
+
+    while(cache->oldest != NULL)
+    {
+        cache_evict(env, cache);
+    }
+}
+
+static struct chunk *cache_find(const struct chunk_cache *cache, const unsigned char *digest)
+{
+    struct chunk *chunk;
+
+    if(cache->buckets == NULL)
+    {
+        return NULL;
+    }
+
+    for(chunk = cache->buckets[bucket_of(cache, digest)]; chunk != NULL; chunk = chunk->next)
+    {
+        if(memcmp(chunk->fingerprint, digest, SHA256_DIGEST_LENGTH) == 0)
+        {
+            return chunk;
+        }
+    }
+
+    return NULL;
+}
+
+static void cache_insert(const struct dc_env *env, struct dc_error *err, struct chunk_cache *cache, const unsigned char *digest, const char *data, size_t length, bool keep_data)
+{
+    struct chunk *chunk;
+    size_t bucket;
+
+    DC_TRACE(env);
+
+    // both ends skip the same oversized chunks and evict the same ones, so they never disagree
+    if(length > cache->capacity)
+    {
+        return;
+    }
+
+    while(cache->used + length > cache->capacity)
+    {
+        cache_evict(env, cache);
+    }
+
+    chunk = dc_calloc(env, err, 1, sizeof(*chunk));
+
+    if(dc_error_has_error(err))
+    {
+        return;
+    }
+
+    if(keep_data)
+    {
+        chunk->data = dc_malloc(env, err, length);
+
+        if(dc_error_has_error(err))
+        {
+            dc_free(env, chunk);
+            return;
+        }
+
+        dc_memcpy(env, chunk->data, data, length);
+    }
+
+    dc_memcpy(env, chunk->fingerprint, digest, SHA256_DIGEST_LENGTH);
+    chunk->length = length;
+    bucket = bucket_of(cache, digest);
+    chunk->next = cache->buckets[bucket];
+    cache->buckets[bucket] = chunk;
+    lru_push(cache, chunk);
+    cache->used += length;
+    cache->entries++;
+}
+
+static void cache_touch(struct chunk_cache *cache, struct chunk *chunk)
+{
+    lru_unlink(cache, chunk);
+    lru_push(cache, chunk);
+}
+
+static void cache_evict(const struct dc_env *env, struct chunk_cache *cache)
+{
+    struct chunk **link;
+    struct chunk *chunk;
+
+    DC_TRACE(env);
+    chunk = cache->oldest;
+    lru_unlink(cache, chunk);
+
+    for(link = &cache->buckets[bucket_of(cache, chunk->fingerprint)]; *link != chunk; link = &(*link)->next)
+    {
+    }
+
+    *link = chunk->next;
+    cache->used -= chunk->length;
+    cache->entries--;
+    dc_free(env, chunk->data);
+    dc_free(env, chunk);
+}
+
+static void lru_unlink(struct chunk_cache *cache, struct chunk *chunk)
+{
+    if(chunk->newer != NULL)
+    {
+        chunk->newer->older = chunk->older;
+    }
+    else
+    {
+        cache->newest = chunk->older;
+    }
+
+    if(chunk->older != NULL)
+    {
+        chunk->older->newer = chunk->newer;
+    }
+    else
+    {
+        cache->oldest = chunk->newer;
+    }
+
+    chunk->newer = NULL;
+    chunk->older = NULL;
+}
+
+static void lru_push(struct chunk_cache *cache, struct chunk *chunk)
+{
+    chunk->older = cache->newest;
+    chunk->newer = NULL;
+
+    if(cache->newest != NULL)
+    {
+        cache->newest->newer = chunk;
+    }
+    else
+    {
+        cache->oldest = chunk;
+    }
+
+    cache->newest = chunk;
+}
+
+static size_t bucket_of(const struct chunk_cache *cache, const unsigned char *digest)
+{
+    uint64_t prefix;
+
+    // the digest is already uniformly spread, so its first bytes are as good as any hash
+    memcpy(&prefix, digest, sizeof(prefix));
+
+    return (size_t)prefix & cache->bucket_mask;
+}
+
+static void put_be(char *out, uint64_t value, size_t size)
+{
+    for(size_t i = size; i > 0; i--)
+    {
+        out[i - 1] = (char)(value & UCHAR_MAX);
+        value >>= CHAR_BIT;
+    }
+}
+
+static uint64_t get_be(const char *in, size_t size)
+{
+    uint64_t value;
+
+    value = 0;
+
+    for(size_t i = 0; i < size; i++)
+    {
+        value = (value << CHAR_BIT) | (unsigned char)in[i];
+    }
+
+    return value;
+}
@@ -0,0 +1,257 @@
+#include "endpoint.h"
+#include "buffer_pool.h"
+#include <dc_c/dc_string.h>
+#include <dc_posix/dc_unistd.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <time.h>
+
+
+static void fill(const struct dc_env *env, char *buffer, size_t count, enum generator_pattern pattern, uint64_t *seed);
+static void pace(uint64_t sent, uint64_t rate, const struct timespec *start);
+static uint64_t elapsed_ns(const struct timespec *start);
+
+
+// NOLINTBEGIN(modernize-macro-to-enum)
+#define GENERATOR_BUFFERS 4
+#define NSEC_PER_SEC 1000000000
+//NOLINTEND(modernize-macro-to-enum)
+
+
+static const char text_line[] = "the quick brown fox jumps over the lazy dog 0123456789\n";
+
+
+enum generator_pattern parse_pattern(const struct dc_env *env, struct dc_error *err, const char *name)
+{
+    DC_TRACE(env);
+
+    if(dc_strcmp(env, name, "zero") == 0)
+    {
+        return GENERATE_ZERO;
+    }
+
+    if(dc_strcmp(env, name, "text") == 0)
+    {
+        return GENERATE_TEXT;
+    }
+
+    if(dc_strcmp(env, name, "random") == 0)
+    {
+        return GENERATE_RANDOM;
+    }
+
+    DC_ERROR_RAISE_USER(err, "pattern must be zero, text or random", 2);
+
+    return GENERATE_ZERO;
+}
+
+void generate(const struct dc_env *env, struct dc_error *err, int to_fd, size_t count, uint64_t size, enum generator_pattern pattern, uint64_t rate, struct endpoint_stats *stats)
+{
+    char *buffers[GENERATOR_BUFFERS];
+    struct sigaction ignore;
+    struct sigaction saved;
+    struct timespec start;
+    uint64_t seed;
+    size_t filled;
+
+    DC_TRACE(env);
+    seed = (uint64_t)time(NULL) | 1;
+
+    // all the pattern work happens up front so the loop below only measures the writes
+    for(filled = 0; filled < GENERATOR_BUFFERS; filled++)
+    {
+        buffers[filled] = buffer_pool_acquire(env, err, count);
+
+        if(dc_error_has_error(err))
+        {
+            goto FILL_FAIL;
+        }
+
+        fill(env, buffers[filled], count, pattern, &seed);
+    }
+
+    // a reader that goes away has to end the run with its stats, not kill the process
+    dc_memset(env, &ignore, 0, sizeof(ignore));
+    ignore.sa_handler = SIG_IGN;
+    sigaction(SIGPIPE, &ignore, &saved);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    // a size of 0 runs until the output goes away or a signal arrives
+    while(size == 0 || stats->bytes < size)
+    {
+        const char *position;
+        size_t nbytes;
+
+        nbytes = count;
+
+        if(size > 0 && size - stats->bytes < nbytes)
+        {
+            nbytes = (size_t)(size - stats->bytes);
+        }
+
+        if(rate > 0)
+        {
+            pace(stats->bytes, rate, &start);
+        }
+
+        position = buffers[stats->calls % GENERATOR_BUFFERS];
+
+        // the rest of a short write goes out before the next buffer, and only what was written is counted
+        while(nbytes > 0)
+        {
+            ssize_t wbytes;
+
+            wbytes = dc_write(env, err, to_fd, position, nbytes);
+
+            if(dc_error_has_error(err))
+            {
+                break;
+            }
+
+            position += wbytes;
+            nbytes -= (size_t)wbytes;
+            stats->bytes += (uint64_t)wbytes;
+        }
+
+        if(dc_error_has_error(err))
+        {
+            if(dc_error_is_errno(err, EINTR) || dc_error_is_errno(err, EPIPE))
+            {
+                dc_error_reset(err);
+            }
+
+            break;
+        }
+
+        stats->calls++;
+    }
+
+    stats->elapsed_ns = elapsed_ns(&start);
+    sigaction(SIGPIPE, &saved, NULL);
+
+    FILL_FAIL:
+    while(filled > 0)
+    {
+        filled--;
+        buffer_pool_release(env, buffers[filled], count);
+    }
+}
+
+void sink(const struct dc_env *env, struct dc_error *err, int from_fd, size_t count, struct endpoint_stats *stats)
+{
+    struct timespec start;
+    char *buffer;
+    bool is_socket;
+
+    DC_TRACE(env);
+    buffer = buffer_pool_acquire(env, err, count);
+
+    if(dc_error_has_error(err))
+    {
+        return;
+    }
+
+    is_socket = true;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    for(;;)
+    {
+        ssize_t rbytes;
+
+        // MSG_TRUNC has TCP drop the data in the kernel instead of copying it out
+        rbytes = is_socket ? recv(from_fd, buffer, count, MSG_TRUNC) : read(from_fd, buffer, count);
+
+        if(rbytes == -1 && is_socket && errno == ENOTSOCK)
+        {
+            is_socket = false;
+            continue;
+        }
+
+        if(rbytes == -1)
+        {
+            if(errno != EINTR)
+            {
+                DC_ERROR_RAISE_ERRNO(err, errno);
+            }
+
+            break;
+        }
+
+        if(rbytes == 0)
+        {
+            break;
+        }
+
+        stats->bytes += (uint64_t)rbytes;
+        stats->calls++;
+    }
+
+    stats->elapsed_ns = elapsed_ns(&start);
+    buffer_pool_release(env, buffer, count);
+}
+
+static void fill(const struct dc_env *env, char *buffer, size_t count, enum generator_pattern pattern, uint64_t *seed)
+{
+    DC_TRACE(env);
+
+    switch(pattern)
+    {
+        case GENERATE_ZERO:
+        {
+            dc_memset(env, buffer, 0, count);
+            break;
+        }
+        case GENERATE_TEXT:
+        {
+            for(size_t i = 0; i < count; i++)
+            {
+                buffer[i] = text_line[i % (sizeof(text_line) - 1)];
+            }
+
+            break;
+        }
+        case GENERATE_RANDOM:
+        {
+            for(size_t i = 0; i < count; i++)
+            {
+                *seed ^= *seed << 13U;     // NOLINT(cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers)
+                *seed ^= *seed >> 7U;      // NOLINT(cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers)
+                *seed ^= *seed << 17U;     // NOLINT(cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers)
+                buffer[i] = (char)*seed;
+            }
+
+            break;
+        }
+        default:
+        {
+            break;
+        }
+    }
+}
+
+static void pace(uint64_t sent, uint64_t rate, const struct timespec *start)
+{
+    struct timespec deadline;
+    uint64_t due_ns;
+
+    due_ns = (sent / rate) * NSEC_PER_SEC + (sent % rate) * NSEC_PER_SEC / rate;
+    deadline.tv_sec = start->tv_sec + (time_t)(due_ns / NSEC_PER_SEC);
+    deadline.tv_nsec = start->tv_nsec + (long)(due_ns % NSEC_PER_SEC);
+
+    if(deadline.tv_nsec >= NSEC_PER_SEC)
+    {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= NSEC_PER_SEC;
+    }
+
+    clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL);
+}
+
+static uint64_t elapsed_ns(const struct timespec *start)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (uint64_t)(now.tv_sec - start->tv_sec) * NSEC_PER_SEC + (uint64_t)now.tv_nsec - (uint64_t)start->tv_nsec;
+}
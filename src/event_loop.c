@@ -0,0 +1,106 @@
+#include "event_loop.h"
+#include <dc_posix/dc_unistd.h>
+#include <sys/epoll.h>
+
+
+// NOLINTBEGIN(modernize-macro-to-enum)
+#define MAX_EVENTS 64
+//NOLINTEND(modernize-macro-to-enum)
+
+
+void event_loop_init(const struct dc_env *env, struct dc_error *err, struct event_loop *loop)
+{
+    DC_TRACE(env);
+    loop->running = false;
+    loop->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+
+    if(loop->epoll_fd == -1)
+    {
+        DC_ERROR_RAISE_ERRNO(err, errno);
+        return;
+    }
+
+    loop->running = true;
+}
+
+void event_loop_add(const struct dc_env *env, struct dc_error *err, struct event_loop *loop, struct event_source *source, uint32_t events)
+{
+    struct epoll_event event;
+
+    DC_TRACE(env);
+    event.events = events;
+    event.data.ptr = source;
+
+    if(epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, source->fd, &event) == -1)
+    {
+        DC_ERROR_RAISE_ERRNO(err, errno);
+    }
+}
+
+void event_loop_modify(const struct dc_env *env, struct dc_error *err, struct event_loop *loop, struct event_source *source, uint32_t events)
+{
+    struct epoll_event event;
+
+    DC_TRACE(env);
+    event.events = events;
+    event.data.ptr = source;
+
+    if(epoll_ctl(loop->epoll_fd, EPOLL_CTL_MOD, source->fd, &event) == -1)
+    {
+        DC_ERROR_RAISE_ERRNO(err, errno);
+    }
+}
+
+void event_loop_remove(const struct dc_env *env, struct dc_error *err, struct event_loop *loop, struct event_source *source)
+{
+    DC_TRACE(env);
+
+    if(epoll_ctl(loop->epoll_fd, EPOLL_CTL_DEL, source->fd, NULL) == -1)
+    {
+        DC_ERROR_RAISE_ERRNO(err, errno);
+    }
+}
+
+void event_loop_poll(const struct dc_env *env, struct dc_error *err, struct event_loop *loop, int timeout_ms)
+{
+    struct epoll_event events[MAX_EVENTS];
+    int count;
+
+    DC_TRACE(env);
+    count = epoll_wait(loop->epoll_fd, events, MAX_EVENTS, timeout_ms);
+
+    if(count == -1)
+    {
+        if(errno != EINTR)
+        {
+            DC_ERROR_RAISE_ERRNO(err, errno);
+        }
+
+        return;
+    }
+
+    for(int i = 0; i < count && loop->running; i++)
+    {
+        struct event_source *source;
+
+        source = events[i].data.ptr;
+        source->handler(env, err, loop, source, events[i].events);
+
+        if(dc_error_has_error(err))
+        {
+            break;
+        }
+    }
+}
+
+void event_loop_destroy(const struct dc_env *env, struct dc_error *err, struct event_loop *loop)
+{
+    DC_TRACE(env);
+    loop->running = false;
+
+    if(loop->epoll_fd != -1)
+    {
+        dc_close(env, err, loop->epoll_fd);
+        loop->epoll_fd = -1;
+    }
+}
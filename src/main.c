@@ -1,5 +1,23 @@
+#include "buffer_pool.h"
+#include "bundle.h"
+#include "capture.h"
+#include "coalesce.h"
+#include "connector.h"
 #include "copy.h"
+#include "endpoint.h"
 #include "conversion.h"
+#include "mapped.h"
+#include "output_file.h"
+#include "perf.h"
+#include "proxy.h"
+#include "records.h"
+#include "resume.h"
+#include "server.h"
+#include "tls.h"
+#include "topology.h"
+#include "transform.h"
+#include "upgrade.h"
+#include "zerocopy.h"
 #include <dc_c/dc_stdlib.h>
 #include <dc_c/dc_string.h>
 #include <dc_posix/arpa/dc_inet.h>
@@ -11,14 +29,42 @@
 #include <dc_posix_xsi/dc_libgen.h>
 #include <dc_util/networking.h>
 #include <fcntl.h>
+#include <inttypes.h>
 #include <stdio.h>
+#include <sys/stat.h>
 
 
 struct options
 {
     bool verbose;
     bool show_help;
+    bool zerocopy;
+    bool huge_pages;
+    bool show_stats;
+    bool fast_open;
+    bool handoff_connections;
+    bool records;
+    bool generate;
+    bool sink;
+    bool proxy;
+    bool perf_events;
+    bool bundle;
+    bool direct;
+    char delimiter;
+    char **argv;
+    char **route_specs;
+    size_t route_spec_count;
+    struct proxy_route *routes;
+    size_t route_count;
     char *file_name;
+    char **file_names;
+    size_t file_count;
+    char *unpack_dir;
+    char *output_path;
+    char *capture_path;
+    char *replay_path;
+    char *tls_cert;
+    char *tls_ca;
     char *ip_in;
     char *ip_out;
     char *ip_from;
@@ -27,6 +73,40 @@ struct options
     int fd_in;
     int fd_out;
     size_t buffer_size;
+    size_t coalesce_size;
+    size_t coalesce_deadline;
+    size_t map_window;
+    int backlog;
+    int connect_timeout;
+    size_t idle_timeout;
+    size_t read_stall_timeout;
+    size_t write_stall_timeout;
+    size_t drain_timeout;
+    size_t tune_interval;
+    size_t replay_speed;
+    size_t resume_attempts;
+    size_t prefetch_threads;
+    uint64_t replay_start;
+    uint64_t generate_size;
+    uint64_t generate_rate;
+    enum generator_pattern pattern;
+    int cpu;
+    struct topology topology;
+    struct server_stats server_stats;
+    struct record_stats record_stats;
+    struct transform_pipeline transforms;
+    struct endpoint_stats endpoint_stats;
+    struct proxy_stats proxy_stats;
+    struct perf_counters perf;
+    struct perf_totals perf_totals;
+    struct handoff handoff;
+    struct capture capture;
+    struct connect_options connect;
+    struct tls_context tls_in;
+    struct tls_context tls_out;
+    struct bundle_writer unpack;
+    struct bundle_stats bundle_stats;
+    struct output_file output_file;
 };
 
 
@@ -36,23 +116,42 @@ static void parse_arguments(const struct dc_env *env, struct dc_error *err, int
 static void options_process(const struct dc_env *env, struct dc_error *err, struct options *opts);
 static void open_input_file(const struct dc_env *env, struct dc_error *err, struct options *opts);
 static void open_input_socket(const struct dc_env *env, struct dc_error *err, struct options *opts);
+static int open_listener(const struct dc_env *env, struct dc_error *err, const struct options *opts, const char *ip, in_port_t port);
+static void open_routes(const struct dc_env *env, struct dc_error *err, struct options *opts);
 static void open_output_socket(const struct dc_env *env, struct dc_error *err, struct options *opts);
+static void open_output_file(const struct dc_env *env, struct dc_error *err, struct options *opts);
 static void handle_client(const struct dc_env *env, struct dc_error *err, struct options *opts);
-static void cleanup(const struct dc_env *env, struct dc_error *err, const struct options *opts);
+static void handle_proxy(const struct dc_env *env, struct dc_error *err, struct options *opts);
+static void relay(const struct dc_env *env, struct dc_error *err, struct options *opts, int from_fd);
+static void run_engine(const struct dc_env *env, struct dc_error *err, struct options *opts, int from_fd);
+static const char *engine_name(const struct options *opts);
+static void read_io(uint64_t *rchar, uint64_t *wchar);
+static void cleanup(const struct dc_env *env, struct dc_error *err, struct options *opts);
+static void print_stats(const struct dc_env *env, const struct options *opts);
+static void print_topology(const struct dc_env *env, const struct options *opts);
 static void set_signal_handling(const struct dc_env *env, struct dc_error *err, struct sigaction *sa);
 static void signal_handler(int sig);
+static int somaxconn(void);
 
 
 // NOLINTBEGIN(modernize-macro-to-enum)
 #define DEFAULT_BUF_SIZE 1024
 #define DEFAULT_PORT 5000
-#define BACKLOG 5
+#define DEFAULT_COALESCE_DEADLINE 500
+#define DEFAULT_BACKLOG 5
+#define DEFAULT_CONNECT_TIMEOUT 10000
+#define DEFAULT_DRAIN_TIMEOUT 5000
+#define DEFAULT_PREFETCH_THREADS 4
+#define DEFAULT_SEGMENT_SIZE (64 * 1024 * 1024)
+#define NSEC_PER_SEC 1000000000
+#define BYTES_PER_MB 1000000
+#define SOMAXCONN_PATH "/proc/sys/net/core/somaxconn"
+#define IO_PATH "/proc/thread-self/io"
+#define IO_LINE_SIZE 128
+#define PERF_LABEL_SIZE 32
 //NOLINTEND(modernize-macro-to-enum)
 
 
-static volatile sig_atomic_t running;   // NOLINT(cppcoreguidelines-avoid-non-const-global-variables)
-
-
 int main(int argc, char *argv[])
 {
     struct dc_error *err;
@@ -77,6 +176,7 @@ int main(int argc, char *argv[])
     }
 
     options_init(env, &opts);
+    opts.argv = argv;
     parse_arguments(env, err, argc, argv, &opts);
 
     if(opts.verbose)
@@ -89,6 +189,25 @@ int main(int argc, char *argv[])
         usage(env, err, argv[0]);
     }
 
+    if(dc_error_has_error(err))
+    {
+        goto PROCESS_ERROR;
+    }
+
+    topology_pin(env, err, &opts.topology, opts.cpu);
+
+    if(dc_error_has_error(err))
+    {
+        goto PROCESS_ERROR;
+    }
+
+    if(opts.verbose)
+    {
+        print_topology(env, &opts);
+    }
+
+    // placing and pre-touching slabs only pays off for a process that was pinned to a node's CPU
+    buffer_pool_init(env, opts.buffer_size, opts.huge_pages, opts.topology.pinned ? opts.topology.node : -1);
     options_process(env, err, &opts);
 
     if(dc_error_has_error(err))
@@ -96,16 +215,46 @@ int main(int argc, char *argv[])
         goto PROCESS_ERROR;
     }
 
+    if(opts.perf_events)
+    {
+        perf_counters_open(env, err, &opts.perf);
+
+        if(dc_error_has_error(err))
+        {
+            goto PROCESS_ERROR;
+        }
+    }
+
     set_signal_handling(env, err, &sa);
-    running = 1;
 
-    if(opts.ip_in)
+    if(opts.proxy)
+    {
+        handle_proxy(env, err, &opts);
+    }
+    else if(opts.ip_in)
     {
         handle_client(env, err, &opts);
     }
     else
     {
-        copy(env, err, opts.fd_in, opts.fd_out, opts.buffer_size);
+        relay(env, err, &opts, opts.fd_in);
+    }
+
+    // only a stream that really ended says so; the new binary owns an output that was handed off
+    if(opts.tls_ca && dc_error_has_no_error(err) && !opts.server_stats.output_handed_off)
+    {
+        tls_close_notify(env, err, opts.fd_out);
+    }
+
+    // the tail of the output is still staged until the file is closed, and the statistics should count it
+    if(opts.output_path)
+    {
+        output_file_close(env, err, &opts.output_file);
+    }
+
+    if(opts.show_stats)
+    {
+        print_stats(env, &opts);
     }
 
     PROCESS_ERROR:
@@ -134,38 +283,302 @@ int main(int argc, char *argv[])
 }
 
 static void handle_client(const struct dc_env *env, struct dc_error *err, struct options *opts)
+{
+    struct server_config config;
+    struct server server;
+
+    DC_TRACE(env);
+    config.listen_fd           = opts->fd_in;
+    config.fd_out              = opts->fd_out;
+    config.buffer_size         = opts->buffer_size;
+    config.coalesce_size       = opts->coalesce_size;
+    config.coalesce_deadline   = opts->coalesce_deadline;
+    config.idle_timeout        = opts->idle_timeout;
+    config.read_stall_timeout  = opts->read_stall_timeout;
+    config.write_stall_timeout = opts->write_stall_timeout;
+    config.drain_timeout       = opts->drain_timeout;
+    config.tune_interval       = opts->tune_interval;
+    config.zerocopy            = opts->zerocopy;
+    config.handoff_connections = opts->handoff_connections;
+    config.argv                = opts->argv;
+    config.inherited           = opts->handoff.connections;
+    config.inherited_count     = opts->handoff.count;
+    config.capture             = opts->capture_path ? &opts->capture : NULL;
+    config.resumable           = opts->resume_attempts > 0;
+    config.records             = opts->records;
+    config.sink                = opts->sink;
+    config.delimiter           = opts->delimiter;
+    config.transforms          = opts->transforms.count > 0 ? &opts->transforms : NULL;
+    config.perf                = opts->perf_events ? &opts->perf : NULL;
+    config.tls                 = opts->tls_cert ? &opts->tls_in : NULL;
+    config.unpack              = opts->unpack_dir ? &opts->unpack : NULL;
+    config.file_out            = opts->output_path ? &opts->output_file : NULL;
+    server_init(env, err, &server, &config);
+
+    if(dc_error_has_error(err))
+    {
+        return;
+    }
+
+    server_run(env, err, &server);
+    server_destroy(env, err, &server);
+    opts->server_stats = server.stats;
+}
+
+static void handle_proxy(const struct dc_env *env, struct dc_error *err, struct options *opts)
+{
+    struct proxy proxy;
+    struct perf_sample before;
+    struct perf_sample after;
+
+    DC_TRACE(env);
+    proxy_init(env, err, &proxy, opts->routes, opts->route_count, opts->buffer_size);
+
+    if(dc_error_has_error(err))
+    {
+        return;
+    }
+
+    // splice keeps the proxy's bytes in the kernel, so only the run as a whole is worth charging
+    if(opts->perf_events)
+    {
+        perf_counters_read(&opts->perf, &before);
+    }
+
+    proxy_run(env, err, &proxy);
+
+    if(opts->perf_events)
+    {
+        perf_counters_read(&opts->perf, &after);
+        perf_totals_add(&opts->perf_totals, &opts->perf, &before, &after, proxy.stats.upstream_bytes + proxy.stats.downstream_bytes);
+    }
+
+    proxy_destroy(env, err, &proxy);
+    opts->proxy_stats = proxy.stats;
+}
+
+static void relay(const struct dc_env *env, struct dc_error *err, struct options *opts, int from_fd)
+{
+    struct perf_sample before;
+    struct perf_sample after;
+    uint64_t start_read;
+    uint64_t start_written;
+    uint64_t end_read;
+    uint64_t end_written;
+    uint64_t bytes;
+
+    DC_TRACE(env);
+
+    if(!opts->perf_events)
+    {
+        run_engine(env, err, opts, from_fd);
+        return;
+    }
+
+    read_io(&start_read, &start_written);
+    perf_counters_read(&opts->perf, &before);
+    run_engine(env, err, opts, from_fd);
+    perf_counters_read(&opts->perf, &after);
+    read_io(&end_read, &end_written);
+
+    // the engines do not count bytes, but every one of them reads or writes them through the VFS
+    bytes = end_read - start_read;
+
+    if(end_written - start_written > bytes)
+    {
+        bytes = end_written - start_written;
+    }
+
+    if(opts->endpoint_stats.bytes > bytes)
+    {
+        bytes = opts->endpoint_stats.bytes;
+    }
+
+    perf_totals_add(&opts->perf_totals, &opts->perf, &before, &after, bytes);
+}
+
+static void run_engine(const struct dc_env *env, struct dc_error *err, struct options *opts, int from_fd)
 {
     DC_TRACE(env);
 
-    while(running)
+    if(opts->generate)
+    {
+        generate(env, err, opts->fd_out, opts->buffer_size, opts->generate_size, opts->pattern, opts->generate_rate, &opts->endpoint_stats);
+    }
+    else if(opts->bundle)
+    {
+        bundle_send(env, err, opts->file_names, opts->file_count, opts->fd_out, opts->buffer_size, opts->prefetch_threads, &opts->bundle_stats);
+    }
+    else if(opts->sink)
+    {
+        sink(env, err, from_fd, opts->buffer_size, &opts->endpoint_stats);
+    }
+    else if(opts->output_path)
+    {
+        copy_output_file(env, err, from_fd, &opts->output_file);
+    }
+    else if(opts->resume_attempts > 0)
+    {
+        copy_resumable(env, err, from_fd, opts->file_name, &opts->fd_out, &opts->connect, opts->resume_attempts);
+    }
+    else if(opts->replay_path)
+    {
+        replay(env, err, opts->replay_path, opts->fd_out, opts->buffer_size, opts->replay_speed, opts->replay_start);
+    }
+    else if(opts->capture_path)
+    {
+        copy_capture(env, err, from_fd, opts->fd_out, opts->buffer_size, &opts->capture);
+    }
+    else if(opts->map_window > 0)
+    {
+        copy_mapped(env, err, from_fd, opts->fd_out, opts->buffer_size, opts->map_window, opts->zerocopy);
+    }
+    else if(opts->coalesce_size > 0)
+    {
+        copy_coalesce(env, err, from_fd, opts->fd_out, opts->buffer_size, opts->coalesce_size, opts->coalesce_deadline);
+    }
+    else if(opts->zerocopy)
+    {
+        copy_zerocopy(env, err, from_fd, opts->fd_out, opts->buffer_size, NULL);
+    }
+    else if(opts->records)
+    {
+        copy_records(env, err, from_fd, opts->fd_out, opts->buffer_size, opts->delimiter, &opts->record_stats);
+    }
+    else if(opts->transforms.count > 0)
+    {
+        copy_transform(env, err, from_fd, opts->fd_out, opts->buffer_size, &opts->transforms);
+    }
+    else
+    {
+        copy(env, err, from_fd, opts->fd_out, opts->buffer_size);
+    }
+}
+
+static const char *engine_name(const struct options *opts)
+{
+    // the same precedence run_engine and the server's output_commit use
+    if(opts->proxy)
+    {
+        return "proxy";
+    }
+
+    if(opts->ip_in)
     {
-        int fd;
-        socklen_t accept_addr_len;
-        struct sockaddr_in accept_addr;
+        if(opts->coalesce_size > 0)
+        {
+            return "coalesce";
+        }
 
-        accept_addr_len = sizeof(accept_addr);
-        fd = dc_accept(env, err, opts->fd_in, (struct sockaddr *)&accept_addr, &accept_addr_len);
+        if(opts->zerocopy)
+        {
+            return "zerocopy";
+        }
 
-        if(dc_error_has_no_error(err))
+        if(opts->records)
         {
-            char *accept_addr_str;
-            in_port_t accept_port;
-
-            accept_addr_str = dc_inet_ntoa(env, accept_addr.sin_addr);  // NOLINT(concurrency-mt-unsafe)
-            accept_port = dc_ntohs(env, accept_addr.sin_port);
-            printf("Accepted from %s:%d\n", accept_addr_str, accept_port);
-            copy(env, err, fd, opts->fd_out, opts->buffer_size);
-            printf("Closing %s:%d\n", accept_addr_str, accept_port);
-            dc_close(env, err, fd);
+            return "records";
         }
-        else
+
+        if(opts->sink)
         {
-            if(dc_error_is_errno(err, EINTR))
-            {
-                dc_error_reset(err);
-            }
+            return "sink";
+        }
+
+        if(opts->unpack_dir)
+        {
+            return "unpack";
+        }
+
+        if(opts->output_path)
+        {
+            return "file";
+        }
+
+        return opts->transforms.count > 0 ? "transform" : "copy";
+    }
+
+    if(opts->generate)
+    {
+        return "generate";
+    }
+
+    if(opts->bundle)
+    {
+        return "bundle";
+    }
+
+    if(opts->sink)
+    {
+        return "sink";
+    }
+
+    if(opts->output_path)
+    {
+        return "file";
+    }
+
+    if(opts->resume_attempts > 0)
+    {
+        return "resumable";
+    }
+
+    if(opts->replay_path)
+    {
+        return "replay";
+    }
+
+    if(opts->capture_path)
+    {
+        return "capture";
+    }
+
+    if(opts->map_window > 0)
+    {
+        return "mapped";
+    }
+
+    if(opts->coalesce_size > 0)
+    {
+        return "coalesce";
+    }
+
+    if(opts->zerocopy)
+    {
+        return "zerocopy";
+    }
+
+    if(opts->records)
+    {
+        return "records";
+    }
+
+    return opts->transforms.count > 0 ? "transform" : "copy";
+}
+
+static void read_io(uint64_t *rchar, uint64_t *wchar)
+{
+    char line[IO_LINE_SIZE];
+    FILE *stream;
+
+    *rchar = 0;
+    *wchar = 0;
+    stream = fopen(IO_PATH, "re");
+
+    if(stream == NULL)
+    {
+        return;
+    }
+
+    while(fgets(line, sizeof(line), stream) != NULL)
+    {
+        if(sscanf(line, "rchar: %" SCNu64, rchar) != 1)  // NOLINT(cert-err34-c)
+        {
+            sscanf(line, "wchar: %" SCNu64, wchar);     // NOLINT(cert-err34-c,cert-err33-c)
         }
     }
+
+    fclose(stream);     // NOLINT(cert-err33-c)
 }
 
 static _Noreturn void usage(const struct dc_env *env, struct dc_error *err, const char *binary_path)
@@ -178,13 +591,49 @@ static _Noreturn void usage(const struct dc_env *env, struct dc_error *err, cons
     binary_name = dc_basename(env, dup_path);
 
     // NOLINTBEGIN(cert-err33-c)
-    fprintf(stderr, "%s [OPTIONS] [FILE]\n", binary_name);
+    fprintf(stderr, "%s [OPTIONS] [FILE...]\n", binary_name);
     fprintf(stderr, "-i ip address      input IP address\n");
     fprintf(stderr, "-o ip address      output IP address\n");
     fprintf(stderr, "-e ip address      from IP address\n");
     fprintf(stderr, "-p port            input port\n");
     fprintf(stderr, "-P port            output port\n");
+    fprintf(stderr, "-B backlog         listen backlog (capped at net.core.somaxconn)\n");
+    fprintf(stderr, "-t milliseconds    output connect timeout (0 waits forever)\n");
+    fprintf(stderr, "-f                 full-duplex proxy: give each client its own output connection and relay both ways\n");
+    fprintf(stderr, "-n route           also proxy [ip:]port to host:port[,host:port...], round robin (implies -f, repeatable)\n");
+    fprintf(stderr, "-O path            write the output to the file at path, preallocated and written back as it goes\n");
+    fprintf(stderr, "-N                 with -O, write with O_DIRECT, bypassing the page cache\n");
+    fprintf(stderr, "-F                 use TCP Fast Open on the input and output sockets\n");
+    fprintf(stderr, "-K path            TLS on the input with the certificate and key in path (PEM), decrypted by the kernel\n");
+    fprintf(stderr, "-A path            TLS on the output, trusting the CA certificates in path (PEM), encrypted by the kernel\n");
+    fprintf(stderr, "-I milliseconds    close a client that sends nothing for this long\n");
+    fprintf(stderr, "-R milliseconds    close a client whose data stops for this long\n");
+    fprintf(stderr, "-W milliseconds    give up on an output that makes no progress for this long\n");
+    fprintf(stderr, "-D milliseconds    on SIGINT/SIGTERM, relay queued clients for up to this long (0 waits forever)\n");
+    fprintf(stderr, "-x                 on SIGUSR2, hand queued clients and the output to the new binary too\n");
+    fprintf(stderr, "-T path            tee the relayed stream into a capture at path\n");
+    fprintf(stderr, "-r path            replay the capture at path instead of reading input\n");
+    fprintf(stderr, "-X speed           replay at speed times the original rate (0 sends as fast as possible)\n");
+    fprintf(stderr, "-S milliseconds    start the replay this far into the capture\n");
+    fprintf(stderr, "-Q attempts        resumable transfer: send FILE, reconnecting up to attempts times (with -i, accept them; one hop, no relay between)\n");
+    fprintf(stderr, "-g size            generate size bytes instead of reading input (0 runs until interrupted)\n");
+    fprintf(stderr, "-G pattern         generated data: zero, text or random\n");
+    fprintf(stderr, "-w rate            generate at most rate bytes per second (0 is unlimited)\n");
+    fprintf(stderr, "-j threads         warm the page cache this many files ahead when sending several FILEs or a directory\n");
+    fprintf(stderr, "-U directory       unpack the bundles received into directory\n");
+    fprintf(stderr, "-k                 discard the input instead of writing it anywhere\n");
     fprintf(stderr, "-b buffer size     size of the read/write buffer\n");
+    fprintf(stderr, "-c size            coalesce small reads into writes of up to size bytes\n");
+    fprintf(stderr, "-d microseconds    maximum time coalesced data is held before flushing (0 flushes every read)\n");
+    fprintf(stderr, "-m window size     memory map FILE in windows of window size bytes\n");
+    fprintf(stderr, "-z                 send to the output socket with MSG_ZEROCOPY\n");
+    fprintf(stderr, "-L delimiter       only forward whole records ending in delimiter (a character, \\n, \\r, \\t or \\0)\n");
+    fprintf(stderr, "-a stage           pass the stream through stage, in the order given (count, sample=N, filter=TEXT, drop=TEXT, dedup[=MB], undedup[=MB])\n");
+    fprintf(stderr, "-H                 back buffers with huge pages\n");
+    fprintf(stderr, "-C cpu             pin to cpu and place buffers on its NUMA node\n");
+    fprintf(stderr, "-s                 print statistics on exit\n");
+    fprintf(stderr, "-E                 count cycles, instructions, cache misses and context switches per client and engine\n");
+    fprintf(stderr, "-u milliseconds    sample TCP_INFO this often and grow socket and copy buffers to the bandwidth-delay product\n");
     fprintf(stderr, "-v                 verbose\n");
     fprintf(stderr, "-h                 help\n");
     // NOLINTEND(cert-err33-c)
@@ -201,6 +650,20 @@ static void options_init(const struct dc_env *env, struct options *opts)
     opts->port_in     = DEFAULT_PORT;
     opts->port_out    = DEFAULT_PORT;
     opts->buffer_size = DEFAULT_BUF_SIZE;
+    opts->coalesce_deadline = DEFAULT_COALESCE_DEADLINE;
+    opts->backlog     = DEFAULT_BACKLOG;
+    opts->connect_timeout = DEFAULT_CONNECT_TIMEOUT;
+    opts->drain_timeout = DEFAULT_DRAIN_TIMEOUT;
+    opts->prefetch_threads = DEFAULT_PREFETCH_THREADS;
+    opts->cpu         = -1;
+    opts->handoff.listen_fd = -1;
+    opts->handoff.output_fd = -1;
+    opts->capture.fd = -1;
+    opts->capture.index_fd = -1;
+    opts->replay_speed = 1;
+    opts->unpack.dir_fd = -1;
+    opts->unpack.file_fd = -1;
+    opts->output_file.fd = -1;
 }
 
 
@@ -210,7 +673,7 @@ static void parse_arguments(const struct dc_env *env, struct dc_error *err, int
 
     DC_TRACE(env);
 
-    while((c = dc_getopt(env, argc, argv, ":i:o:e:p:P:b:vh")) != -1)   // NOLINT(concurrency-mt-unsafe)
+    while((c = dc_getopt(env, argc, argv, ":i:o:O:Ne:p:P:B:t:fn:FK:A:I:R:W:D:xT:r:X:S:Q:g:G:w:kj:U:b:c:d:m:zL:a:HC:Eu:svh")) != -1)   // NOLINT(concurrency-mt-unsafe)
     {
         switch(c)
         {
@@ -224,6 +687,16 @@ static void parse_arguments(const struct dc_env *env, struct dc_error *err, int
                 opts->ip_out = optarg;
                 break;
             }
+            case 'O':
+            {
+                opts->output_path = optarg;
+                break;
+            }
+            case 'N':
+            {
+                opts->direct = true;
+                break;
+            }
             case 'e':
             {
                 opts->ip_from = optarg;
@@ -249,9 +722,9 @@ static void parse_arguments(const struct dc_env *env, struct dc_error *err, int
 
                 break;
             }
-            case 'b':
+            case 'B':
             {
-                opts->buffer_size = parse_size_t(env, err, optarg, 10); // NOLINT(cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers)
+                opts->backlog = parse_int(env, err, optarg, 10); // NOLINT(cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers)
 
                 if(dc_error_has_error(err))
                 {
@@ -259,71 +732,522 @@ static void parse_arguments(const struct dc_env *env, struct dc_error *err, int
 
                 break;
             }
-            case 'v':
+            case 't':
             {
-                opts->verbose = true;
+                opts->connect_timeout = parse_int(env, err, optarg, 10); // NOLINT(cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers)
+
+                if(dc_error_has_error(err))
+                {
+                }
+
                 break;
             }
-            case 'h':
+            case 'f':
             {
-                opts->show_help = true;
+                opts->proxy = true;
                 break;
             }
-            case ':':
+            case 'n':
             {
-                DC_ERROR_RAISE_USER(err, "", 1);
+                char **specs;
+
+                specs = dc_realloc(env, err, opts->route_specs, (opts->route_spec_count + 1) * sizeof(*specs));
+
+                if(dc_error_has_error(err))
+                {
+                    break;
+                }
+
+                specs[opts->route_spec_count++] = optarg;
+                opts->route_specs = specs;
                 break;
             }
-            case '?':
+            case 'F':
             {
-                DC_ERROR_RAISE_USER(err, "", 2);
+                opts->fast_open = true;
                 break;
             }
-            default:
+            case 'I':
             {
-                abort();
-            };
-        }
-    }
-
-    if(optind < argc)
-    {
-        opts->file_name = argv[optind];
-    }
-}
+                opts->idle_timeout = parse_size_t(env, err, optarg, 10); // NOLINT(cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers)
 
+                if(dc_error_has_error(err))
+                {
+                }
 
-static void options_process(const struct dc_env *env, struct dc_error *err, struct options *opts)
-{
-    DC_TRACE(env);
+                break;
+            }
+            case 'R':
+            {
+                opts->read_stall_timeout = parse_size_t(env, err, optarg, 10); // NOLINT(cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers)
 
-    if(opts->file_name && opts->ip_in)
-    {
-        DC_ERROR_RAISE_USER(err, "", 2);
-        goto INPUT_ERROR;
-    }
+                if(dc_error_has_error(err))
+                {
+                }
 
-    if(opts->file_name)
-    {
-        open_input_file(env, err, opts);
+                break;
+            }
+            case 'W':
+            {
+                opts->write_stall_timeout = parse_size_t(env, err, optarg, 10); // NOLINT(cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers)
 
-        if(dc_error_has_error(err))
-        {
-            goto INPUT_FILE_ERROR;
-        }
-    }
+                if(dc_error_has_error(err))
+                {
+                }
 
-    if(opts->ip_in)
-    {
-        open_input_socket(env, err, opts);
+                break;
+            }
+            case 'D':
+            {
+                opts->drain_timeout = parse_size_t(env, err, optarg, 10); // NOLINT(cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers)
 
-        if(dc_error_has_error(err))
-        {
-            goto INPUT_SOCKET_ERROR;
-        }
-    }
+                if(dc_error_has_error(err))
+                {
+                }
 
-    if(opts->ip_out)
+                break;
+            }
+            case 'x':
+            {
+                opts->handoff_connections = true;
+                break;
+            }
+            case 'T':
+            {
+                opts->capture_path = optarg;
+                break;
+            }
+            case 'r':
+            {
+                opts->replay_path = optarg;
+                break;
+            }
+            case 'X':
+            {
+                opts->replay_speed = parse_size_t(env, err, optarg, 10); // NOLINT(cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers)
+
+                if(dc_error_has_error(err))
+                {
+                }
+
+                break;
+            }
+            case 'S':
+            {
+                opts->replay_start = parse_size_t(env, err, optarg, 10); // NOLINT(cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers)
+
+                if(dc_error_has_error(err))
+                {
+                }
+
+                break;
+            }
+            case 'Q':
+            {
+                opts->resume_attempts = parse_size_t(env, err, optarg, 10); // NOLINT(cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers)
+
+                if(dc_error_has_error(err))
+                {
+                }
+
+                break;
+            }
+            case 'g':
+            {
+                opts->generate = true;
+                opts->generate_size = parse_size_t(env, err, optarg, 10); // NOLINT(cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers)
+
+                if(dc_error_has_error(err))
+                {
+                }
+
+                break;
+            }
+            case 'G':
+            {
+                opts->pattern = parse_pattern(env, err, optarg);
+
+                if(dc_error_has_error(err))
+                {
+                }
+
+                break;
+            }
+            case 'w':
+            {
+                opts->generate_rate = parse_size_t(env, err, optarg, 10); // NOLINT(cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers)
+
+                if(dc_error_has_error(err))
+                {
+                }
+
+                break;
+            }
+            case 'k':
+            {
+                opts->sink = true;
+                break;
+            }
+            case 'j':
+            {
+                opts->prefetch_threads = parse_size_t(env, err, optarg, 10); // NOLINT(cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers)
+
+                if(dc_error_has_error(err))
+                {
+                }
+
+                break;
+            }
+            case 'U':
+            {
+                opts->unpack_dir = optarg;
+                break;
+            }
+            case 'K':
+            {
+                opts->tls_cert = optarg;
+                break;
+            }
+            case 'A':
+            {
+                opts->tls_ca = optarg;
+                break;
+            }
+            case 'u':
+            {
+                opts->tune_interval = parse_size_t(env, err, optarg, 10); // NOLINT(cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers)
+
+                if(dc_error_has_error(err))
+                {
+                }
+
+                break;
+            }
+            case 'E':
+            {
+                opts->perf_events = true;
+                break;
+            }
+            case 'b':
+            {
+                opts->buffer_size = parse_size_t(env, err, optarg, 10); // NOLINT(cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers)
+
+                if(dc_error_has_error(err))
+                {
+                }
+
+                break;
+            }
+            case 'c':
+            {
+                opts->coalesce_size = parse_size_t(env, err, optarg, 10); // NOLINT(cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers)
+
+                if(dc_error_has_error(err))
+                {
+                }
+
+                break;
+            }
+            case 'd':
+            {
+                opts->coalesce_deadline = parse_size_t(env, err, optarg, 10); // NOLINT(cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers)
+
+                if(dc_error_has_error(err))
+                {
+                }
+
+                break;
+            }
+            case 'm':
+            {
+                opts->map_window = parse_size_t(env, err, optarg, 10); // NOLINT(cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers)
+
+                if(dc_error_has_error(err))
+                {
+                }
+
+                break;
+            }
+            case 'z':
+            {
+                opts->zerocopy = true;
+                break;
+            }
+            case 'L':
+            {
+                opts->records = true;
+                opts->delimiter = parse_delimiter(env, err, optarg);
+
+                if(dc_error_has_error(err))
+                {
+                }
+
+                break;
+            }
+            case 'a':
+            {
+                transform_pipeline_add(env, err, &opts->transforms, optarg);
+
+                if(dc_error_has_error(err))
+                {
+                }
+
+                break;
+            }
+            case 'H':
+            {
+                opts->huge_pages = true;
+                break;
+            }
+            case 'C':
+            {
+                opts->cpu = parse_cpu(env, err, optarg, 10); // NOLINT(cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers)
+
+                if(dc_error_has_error(err))
+                {
+                }
+
+                break;
+            }
+            case 's':
+            {
+                opts->show_stats = true;
+                break;
+            }
+            case 'v':
+            {
+                opts->verbose = true;
+                break;
+            }
+            case 'h':
+            {
+                opts->show_help = true;
+                break;
+            }
+            case ':':
+            {
+                DC_ERROR_RAISE_USER(err, "", 1);
+                break;
+            }
+            case '?':
+            {
+                DC_ERROR_RAISE_USER(err, "", 2);
+                break;
+            }
+            default:
+            {
+                abort();
+            };
+        }
+    }
+
+    if(optind < argc)
+    {
+        opts->file_name = argv[optind];
+        opts->file_names = &argv[optind];
+        opts->file_count = (size_t)(argc - optind);
+    }
+}
+
+
+static void options_process(const struct dc_env *env, struct dc_error *err, struct options *opts)
+{
+    int channel;
+
+    DC_TRACE(env);
+
+    if(opts->file_name && opts->ip_in)
+    {
+        DC_ERROR_RAISE_USER(err, "", 2);
+        goto INPUT_ERROR;
+    }
+
+    if(opts->map_window > 0 && (opts->file_name == NULL || opts->coalesce_size > 0))
+    {
+        DC_ERROR_RAISE_USER(err, "-m requires a FILE and cannot be combined with -c", 2);
+        goto INPUT_ERROR;
+    }
+
+    if(opts->zerocopy && (opts->ip_out == NULL || opts->coalesce_size > 0))
+    {
+        DC_ERROR_RAISE_USER(err, "-z requires an output socket and cannot be combined with -c", 2);
+        goto INPUT_ERROR;
+    }
+
+    if(opts->replay_path && (opts->file_name || opts->ip_in || opts->capture_path || opts->map_window > 0 || opts->coalesce_size > 0 || opts->zerocopy))
+    {
+        DC_ERROR_RAISE_USER(err, "-r replaces the input and cannot be combined with FILE, -i, -T, -m, -c or -z", 2);
+        goto INPUT_ERROR;
+    }
+
+    if(opts->capture_path && opts->ip_in == NULL && (opts->map_window > 0 || opts->coalesce_size > 0 || opts->zerocopy))
+    {
+        DC_ERROR_RAISE_USER(err, "-T without -i cannot be combined with -m, -c or -z", 2);
+        goto INPUT_ERROR;
+    }
+
+    if(opts->resume_attempts > 0 && opts->ip_in == NULL && (opts->file_name == NULL || opts->ip_out == NULL || opts->replay_path || opts->capture_path || opts->map_window > 0 || opts->coalesce_size > 0 || opts->zerocopy))
+    {
+        DC_ERROR_RAISE_USER(err, "-Q without -i requires a FILE and -o, and cannot be combined with -r, -T, -m, -c or -z", 2);
+        goto INPUT_ERROR;
+    }
+
+    if(opts->records && (opts->map_window > 0 || opts->coalesce_size > 0 || opts->zerocopy || opts->resume_attempts > 0 || opts->replay_path || (opts->capture_path && opts->ip_in == NULL)))
+    {
+        DC_ERROR_RAISE_USER(err, "-L cannot be combined with -m, -c, -z, -Q or -r, nor with -T without -i", 2);
+        goto INPUT_ERROR;
+    }
+
+    if(opts->transforms.count > 0 && (opts->map_window > 0 || opts->coalesce_size > 0 || opts->zerocopy || opts->records || opts->resume_attempts > 0 || opts->replay_path || (opts->capture_path && opts->ip_in == NULL)))
+    {
+        DC_ERROR_RAISE_USER(err, "-a cannot be combined with -m, -c, -z, -L, -Q or -r, nor with -T without -i", 2);
+        goto INPUT_ERROR;
+    }
+
+    if(opts->generate && (opts->file_name || opts->ip_in || opts->sink || opts->map_window > 0 || opts->coalesce_size > 0 || opts->zerocopy || opts->records || opts->transforms.count > 0 || opts->resume_attempts > 0 || opts->replay_path || opts->capture_path))
+    {
+        DC_ERROR_RAISE_USER(err, "-g replaces the input and cannot be combined with FILE, -i, -k, -m, -c, -z, -L, -a, -Q, -r or -T", 2);
+        goto INPUT_ERROR;
+    }
+
+    if(opts->sink && (opts->ip_out || opts->map_window > 0 || opts->coalesce_size > 0 || opts->zerocopy || opts->records || opts->transforms.count > 0 || opts->resume_attempts > 0 || opts->replay_path || (opts->capture_path && opts->ip_in == NULL)))
+    {
+        DC_ERROR_RAISE_USER(err, "-k replaces the output and cannot be combined with -o, -m, -c, -z, -L, -a, -Q or -r, nor with -T without -i", 2);
+        goto INPUT_ERROR;
+    }
+
+    opts->bundle = opts->file_name && bundle_wanted(env, opts->file_names, opts->file_count);
+
+    if(opts->bundle && (opts->sink || opts->map_window > 0 || opts->coalesce_size > 0 || opts->zerocopy || opts->records || opts->transforms.count > 0 || opts->resume_attempts > 0 || opts->capture_path))
+    {
+        DC_ERROR_RAISE_USER(err, "several FILEs or a directory cannot be combined with -k, -m, -c, -z, -L, -a, -Q or -T", 2);
+        goto INPUT_ERROR;
+    }
+
+    if(opts->prefetch_threads > BUNDLE_MAX_THREADS)
+    {
+        DC_ERROR_RAISE_USER(err, "-j allows at most 32 threads", 2);
+        goto INPUT_ERROR;
+    }
+
+    if(opts->route_spec_count > 0)
+    {
+        opts->proxy = true;
+    }
+
+    if(opts->proxy && ((opts->ip_in == NULL && opts->route_spec_count == 0) || (opts->ip_in && opts->ip_out == NULL) || opts->file_name || opts->handoff_connections || opts->sink || opts->map_window > 0 || opts->coalesce_size > 0 || opts->zerocopy || opts->records || opts->transforms.count > 0 || opts->resume_attempts > 0 || opts->capture_path))
+    {
+        DC_ERROR_RAISE_USER(err, "-f requires -i and -o or a -n route, and cannot be combined with FILE, -x, -k, -m, -c, -z, -L, -a, -Q or -T", 2);
+        goto INPUT_ERROR;
+    }
+
+    // only descriptors cross the upgrade, so a held record or chunk, the resume transfers and the capture would all be lost
+    if(opts->handoff_connections && (opts->records || opts->transforms.count > 0 || opts->resume_attempts > 0 || opts->capture_path))
+    {
+        DC_ERROR_RAISE_USER(err, "-x cannot be combined with -L, -a, -Q or -T", 2);
+        goto INPUT_ERROR;
+    }
+
+    // a handed-off client may be mid-handshake, and the kernel cannot send MSG_ZEROCOPY through TLS
+    if(opts->tls_cert && (opts->ip_in == NULL || opts->proxy || opts->handoff_connections || opts->resume_attempts > 0))
+    {
+        DC_ERROR_RAISE_USER(err, "-K requires -i and cannot be combined with -f, -n, -x or -Q", 2);
+        goto INPUT_ERROR;
+    }
+
+    if(opts->tls_ca && (opts->ip_out == NULL || opts->proxy || opts->zerocopy || opts->resume_attempts > 0))
+    {
+        DC_ERROR_RAISE_USER(err, "-A requires -o and cannot be combined with -f, -n, -z or -Q", 2);
+        goto INPUT_ERROR;
+    }
+
+    if(opts->tune_interval > 0 && (opts->ip_in == NULL || opts->proxy))
+    {
+        DC_ERROR_RAISE_USER(err, "-u requires -i and cannot be combined with -f or -n", 2);
+        goto INPUT_ERROR;
+    }
+
+    // the files are the output, so nothing else may claim the stream or hand it to another process
+    if(opts->unpack_dir && (opts->ip_in == NULL || opts->ip_out || opts->proxy || opts->handoff_connections || opts->sink || opts->coalesce_size > 0 || opts->zerocopy || opts->records || opts->transforms.count > 0 || opts->resume_attempts > 0 || opts->capture_path))
+    {
+        DC_ERROR_RAISE_USER(err, "-U requires -i and cannot be combined with -o, -f, -n, -x, -k, -c, -z, -L, -a, -Q or -T", 2);
+        goto INPUT_ERROR;
+    }
+
+    if(opts->output_path && (opts->ip_out || opts->proxy || opts->handoff_connections || opts->sink || opts->unpack_dir || opts->generate || opts->replay_path || opts->bundle || opts->map_window > 0 || opts->coalesce_size > 0 || opts->zerocopy || opts->records || opts->transforms.count > 0 || opts->resume_attempts > 0 || (opts->capture_path && opts->ip_in == NULL)))
+    {
+        DC_ERROR_RAISE_USER(err, "-O replaces the output and cannot be combined with -o, -f, -n, -x, -k, -U, -g, -r, -m, -c, -z, -L, -a, -Q or several FILEs, nor with -T without -i", 2);
+        goto INPUT_ERROR;
+    }
+
+    if(opts->direct && opts->output_path == NULL)
+    {
+        DC_ERROR_RAISE_USER(err, "-N requires -O", 2);
+        goto INPUT_ERROR;
+    }
+
+    channel = upgrade_channel();
+
+    if(channel != -1)
+    {
+        upgrade_receive(env, err, channel, &opts->handoff);
+
+        if(dc_error_has_error(err))
+        {
+            goto UPGRADE_ERROR;
+        }
+    }
+
+    if(opts->tls_cert)
+    {
+        tls_server_init(env, err, &opts->tls_in, opts->tls_cert);
+
+        if(dc_error_has_error(err))
+        {
+            goto TLS_ERROR;
+        }
+    }
+
+    if(opts->tls_ca)
+    {
+        tls_client_init(env, err, &opts->tls_out, opts->tls_ca);
+
+        if(dc_error_has_error(err))
+        {
+            goto TLS_ERROR;
+        }
+    }
+
+    // a bundle opens each file itself as it goes
+    if(opts->file_name && !opts->bundle)
+    {
+        open_input_file(env, err, opts);
+
+        if(dc_error_has_error(err))
+        {
+            goto INPUT_FILE_ERROR;
+        }
+    }
+
+    if(opts->ip_in && opts->handoff.listen_fd != -1)
+    {
+        opts->fd_in = opts->handoff.listen_fd;
+    }
+    else if(opts->ip_in)
+    {
+        open_input_socket(env, err, opts);
+
+        if(dc_error_has_error(err))
+        {
+            goto INPUT_SOCKET_ERROR;
+        }
+    }
+
+    if(opts->ip_out && opts->handoff.output_fd != -1)
+    {
+        opts->fd_out = opts->handoff.output_fd;
+    }
+    else if(opts->ip_out)
     {
         open_output_socket(env, err, opts);
 
@@ -331,11 +1255,68 @@ static void options_process(const struct dc_env *env, struct dc_error *err, stru
         {
             goto OUTPUT_SOCKET_ERROR;
         }
+
+        // an inherited output is already encrypted, so only a fresh connection shakes hands
+        if(opts->tls_ca)
+        {
+            tls_connect(env, err, &opts->tls_out, opts->fd_out, opts->ip_out, opts->connect_timeout);
+
+            if(dc_error_has_error(err))
+            {
+                goto OUTPUT_SOCKET_ERROR;
+            }
+        }
     }
 
+    if(opts->proxy)
+    {
+        open_routes(env, err, opts);
+
+        if(dc_error_has_error(err))
+        {
+            goto ROUTE_ERROR;
+        }
+    }
+
+    if(opts->capture_path)
+    {
+        capture_open(env, err, &opts->capture, opts->capture_path, DEFAULT_SEGMENT_SIZE);
+
+        if(dc_error_has_error(err))
+        {
+            goto CAPTURE_ERROR;
+        }
+    }
+
+    if(opts->unpack_dir)
+    {
+        bundle_writer_init(env, err, &opts->unpack, opts->unpack_dir);
+
+        if(dc_error_has_error(err))
+        {
+            goto UNPACK_ERROR;
+        }
+    }
+
+    if(opts->output_path)
+    {
+        open_output_file(env, err, opts);
+
+        if(dc_error_has_error(err))
+        {
+            goto OUTPUT_FILE_ERROR;
+        }
+    }
+
+    OUTPUT_FILE_ERROR:
+    UNPACK_ERROR:
+    CAPTURE_ERROR:
+    ROUTE_ERROR:
     OUTPUT_SOCKET_ERROR:
     INPUT_SOCKET_ERROR:
     INPUT_FILE_ERROR:
+    TLS_ERROR:
+    UPGRADE_ERROR:
     INPUT_ERROR:
     {
     }
@@ -347,19 +1328,45 @@ static void open_input_file(const struct dc_env *env, struct dc_error *err, stru
     opts->fd_in = dc_open(env, err, opts->file_name, O_RDONLY);
 }
 
+static void open_output_file(const struct dc_env *env, struct dc_error *err, struct options *opts)
+{
+    struct stat info;
+    uint64_t expected;
+
+    DC_TRACE(env);
+    expected = 0;
+
+    // a FILE, or stdin redirected from one, says up front how much is coming
+    if(opts->ip_in == NULL && fstat(opts->fd_in, &info) == 0 && S_ISREG(info.st_mode))
+    {
+        expected = (uint64_t)info.st_size;
+    }
+
+    output_file_open(env, err, &opts->output_file, opts->output_path, opts->buffer_size, opts->direct, expected);
+    opts->fd_out = opts->output_file.fd;
+}
+
 static void open_input_socket(const struct dc_env *env, struct dc_error *err, struct options *opts)
+{
+    DC_TRACE(env);
+    opts->fd_in = open_listener(env, err, opts, opts->ip_in, opts->port_in);
+}
+
+static int open_listener(const struct dc_env *env, struct dc_error *err, const struct options *opts, const char *ip, in_port_t port)
 {
     struct sockaddr_in addr;
+    int backlog;
+    int fd;
 
     DC_TRACE(env);
-    opts->fd_in = dc_socket(env, err, AF_INET, SOCK_STREAM, 0);
+    fd = dc_socket(env, err, AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
 
     if(dc_error_has_error(err))
     {
         goto SOCKET_ERROR;
     }
 
-    dc_setsockopt_socket_REUSEADDR(env, err, opts->fd_in, true);
+    dc_setsockopt_socket_REUSEADDR(env, err, fd, true);
 
     if(dc_error_has_error(err))
     {
@@ -367,112 +1374,326 @@ static void open_input_socket(const struct dc_env *env, struct dc_error *err, st
     }
 
     addr.sin_family = AF_INET;
-    addr.sin_port = dc_htons(env, opts->port_in);
-    addr.sin_addr.s_addr = dc_inet_addr(env, err, opts->ip_in);
+    addr.sin_port = dc_htons(env, port);
+    addr.sin_addr.s_addr = dc_inet_addr(env, err, ip);
 
     if(dc_error_has_error(err))
     {
         goto ADDRESS_ERROR;
     }
 
-    dc_bind(env, err, opts->fd_in, (struct sockaddr *)&addr, sizeof(struct sockaddr_in));
+    dc_bind(env, err, fd, (struct sockaddr *)&addr, sizeof(struct sockaddr_in));
 
     if(dc_error_has_error(err))
     {
         goto BIND_ERROR;
     }
 
-    dc_listen(env, err, opts->fd_in, BACKLOG);
+    backlog = somaxconn();
+
+    if(opts->backlog < backlog)
+    {
+        backlog = opts->backlog;
+    }
+
+    if(opts->fast_open)
+    {
+        enable_listen_fast_open(env, err, fd, backlog);
+
+        if(dc_error_has_error(err))
+        {
+            goto FAST_OPEN_ERROR;
+        }
+    }
+
+    dc_listen(env, err, fd, backlog);
 
     if(dc_error_has_error(err))
     {
         goto LISTEN_ERROR;
     }
 
+    return fd;
+
     LISTEN_ERROR:
+    FAST_OPEN_ERROR:
     BIND_ERROR:
     SOCKOPT_ERROR:
     ADDRESS_ERROR:
+    close(fd);
+
     SOCKET_ERROR:
-    {
-    }
+    return -1;
 }
 
-static void open_output_socket(const struct dc_env *env, struct dc_error *err, struct options *opts)
+static void open_routes(const struct dc_env *env, struct dc_error *err, struct options *opts)
 {
-    struct sockaddr_in addr;
+    struct connect_options defaults;
 
     DC_TRACE(env);
-    opts->fd_out = socket(AF_INET, SOCK_STREAM, 0);
+    opts->routes = dc_calloc(env, err, opts->route_spec_count + 1, sizeof(*opts->routes));
 
     if(dc_error_has_error(err))
     {
-        goto SOCKET_ERROR;
+        return;
     }
 
-    if(opts->ip_from)
+    // -i/-p to -o/-P is just the first route, and the route table now owns its listener
+    if(opts->ip_in)
     {
-        struct sockaddr_in from_addr;
-        socklen_t from_addr_len;
+        struct proxy_route *route;
 
-        from_addr_len = sizeof(from_addr);
-        from_addr.sin_family = AF_INET;
-        addr.sin_addr.s_addr = dc_inet_addr(env, err, opts->ip_from);
+        route = &opts->routes[opts->route_count++];
+        route->listener.fd = opts->fd_in;
+        route->listen_ip = opts->ip_in;
+        route->listen_port = opts->port_in;
+        opts->fd_in = -1;
+        route->targets = dc_calloc(env, err, 1, sizeof(*route->targets));
 
         if(dc_error_has_error(err))
         {
-            goto BIND_INET_ADDR_ERROR;
+            return;
         }
 
-        dc_bind(env, err, opts->fd_out, (struct sockaddr *)&from_addr, from_addr_len);
+        route->targets[0].options = opts->connect;
+        route->target_count = 1;
+    }
+
+    defaults.host       = NULL;
+    defaults.from       = opts->ip_from;
+    defaults.port       = 0;
+    defaults.timeout_ms = opts->connect_timeout;
+    defaults.fast_open  = opts->fast_open;
+
+    for(size_t i = 0; i < opts->route_spec_count; i++)
+    {
+        struct proxy_route *route;
+
+        route = &opts->routes[opts->route_count++];
+        proxy_route_parse(env, err, route, opts->route_specs[i], &defaults);
 
         if(dc_error_has_error(err))
         {
-            goto BIND_ERROR;
+            return;
+        }
+
+        route->listener.fd = open_listener(env, err, opts, route->listen_ip, route->listen_port);
+
+        if(dc_error_has_error(err))
+        {
+            return;
         }
     }
+}
 
-    addr.sin_family = AF_INET;
-    addr.sin_port = dc_htons(env, opts->port_out);
-    addr.sin_addr.s_addr = dc_inet_addr(env, err, opts->ip_out);
+static void open_output_socket(const struct dc_env *env, struct dc_error *err, struct options *opts)
+{
+    DC_TRACE(env);
+    opts->connect.host       = opts->ip_out;
+    opts->connect.from       = opts->ip_from;
+    opts->connect.port       = opts->port_out;
+    opts->connect.timeout_ms = opts->connect_timeout;
+    opts->connect.fast_open  = opts->fast_open;
+
+    // the proxy connects once per client instead
+    if(opts->proxy)
+    {
+        opts->fd_out = -1;
+        return;
+    }
 
-    if(dc_error_has_error(err))
+    opts->fd_out = connect_output(env, err, &opts->connect);
+}
+
+static void cleanup(const struct dc_env *env, struct dc_error *err, struct options *opts)
+{
+    DC_TRACE(env);
+
+    if(((opts->file_name && !opts->bundle) || opts->ip_in) && opts->fd_in != -1)
     {
-        goto INET_ADDR_ERROR;
+        dc_close(env, err, opts->fd_in);
     }
 
-    dc_connect(env, err, opts->fd_out, (struct sockaddr *)&addr, sizeof(struct sockaddr_in));
+    if(opts->ip_out && opts->fd_out != -1)
+    {
+        dc_close(env, err, opts->fd_out);
+    }
 
-    if(dc_error_has_error(err))
+    capture_close(env, err, &opts->capture);
+    bundle_writer_destroy(env, err, &opts->unpack);
+    output_file_close(env, err, &opts->output_file);
+    transform_pipeline_destroy(env, &opts->transforms);
+    tls_context_destroy(&opts->tls_in);
+    tls_context_destroy(&opts->tls_out);
+
+    if(opts->perf.opened > 0)
     {
-        goto CONNECT_ERROR;
+        perf_counters_close(&opts->perf);
     }
 
-    return;
-    
-    CONNECT_ERROR:
-    INET_ADDR_ERROR:
-    BIND_ERROR:
-    BIND_INET_ADDR_ERROR:
-    dc_close(env, err, opts->fd_out);
-    SOCKET_ERROR:
+    for(size_t i = 0; i < opts->route_count; i++)
     {
+        proxy_route_destroy(env, err, &opts->routes[i]);
     }
+
+    dc_free(env, opts->routes);
+    dc_free(env, opts->route_specs);
+    dc_free(env, opts->handoff.connections);
+    buffer_pool_trim(env);
+}
+
+static void print_topology(const struct dc_env *env, const struct options *opts)
+{
+    const struct topology *topo;
+
+    DC_TRACE(env);
+    topo = &opts->topology;
+
+    // NOLINTBEGIN(cert-err33-c)
+    fprintf(stderr, "cpu:                %d%s\n", topo->cpu, topo->pinned ? " (pinned)" : "");
+    fprintf(stderr, "numa node:          %d of %d\n", topo->node, topo->nodes);
+    fprintf(stderr, "huge pages:         %s\n", opts->huge_pages ? "MAP_HUGETLB" : "THP for large buffers");
+    // NOLINTEND(cert-err33-c)
 }
 
-static void cleanup(const struct dc_env *env, struct dc_error *err, const struct options *opts)
+static void print_stats(const struct dc_env *env, const struct options *opts)
 {
+    struct buffer_pool_stats pool;
+
     DC_TRACE(env);
+    buffer_pool_get_stats(&pool);
 
-    if((opts->file_name || opts->ip_in) && opts->fd_in != -1)
+    // NOLINTBEGIN(cert-err33-c)
+    if(opts->proxy)
     {
-        dc_close(env, err, opts->fd_in);
+        const struct proxy_stats *proxy;
+
+        proxy = &opts->proxy_stats;
+        fprintf(stderr, "sessions:           %zu\n", proxy->sessions);
+        fprintf(stderr, "max sessions:       %zu\n", proxy->max_sessions);
+        fprintf(stderr, "connect failures:   %zu\n", proxy->connect_failures);
+        fprintf(stderr, "dropped:            %zu\n", proxy->dropped);
+        fprintf(stderr, "accept pauses:      %zu\n", proxy->accept_pauses);
+        fprintf(stderr, "half closes:        %zu\n", proxy->half_closes);
+        fprintf(stderr, "resets:             %zu\n", proxy->resets);
+        fprintf(stderr, "upstream bytes:     %" PRIu64 "\n", proxy->upstream_bytes);
+        fprintf(stderr, "downstream bytes:   %" PRIu64 "\n", proxy->downstream_bytes);
+
+        for(size_t i = 0; i < opts->route_count; i++)
+        {
+            const struct proxy_route *route;
+
+            route = &opts->routes[i];
+            fprintf(stderr, "route port %-8u %zu sessions over %zu targets\n", (unsigned int)route->listen_port, route->sessions, route->target_count);
+        }
     }
+    else if(opts->ip_in)
+    {
+        const struct server_stats *server;
+
+        server = &opts->server_stats;
+        fprintf(stderr, "accepted:           %zu\n", server->accepted);
+        fprintf(stderr, "accept wakeups:     %zu\n", server->accept_wakeups);
+        fprintf(stderr, "max accept batch:   %zu\n", server->max_accept_batch);
+        fprintf(stderr, "accept queue max:   %u of %u\n", server->accept_queue_max, server->backlog);
+        fprintf(stderr, "listen overflows:   %" PRIu64 "\n", server->listen_overflows);
+        fprintf(stderr, "listen drops:       %" PRIu64 "\n", server->listen_drops);
+        fprintf(stderr, "accept pauses:      %zu\n", server->accept_pauses);
+        fprintf(stderr, "idle timeouts:      %zu\n", server->idle_timeouts);
+        fprintf(stderr, "read stalls:        %zu\n", server->read_stalls);
+        fprintf(stderr, "write stalls:       %zu\n", server->write_stalls);
+        fprintf(stderr, "drained:            %zu\n", server->drained);
+        fprintf(stderr, "abandoned:          %zu\n", server->abandoned);
+        fprintf(stderr, "inherited:          %zu\n", server->inherited);
+        fprintf(stderr, "handed off:         %zu\n", server->handed_off);
+
+        if(opts->sink)
+        {
+            fprintf(stderr, "sunk:               %" PRIu64 " bytes\n", server->sunk);
+        }
 
-    if(opts->ip_out && opts->fd_out != -1)
+        if(opts->tune_interval > 0)
+        {
+            tcp_telemetry_print(stderr, "output tcp:", &server->output_tcp);
+            fprintf(stderr, "copy buffer:        %zu bytes after %zu resizes\n", server->buffer_size, server->buffer_resizes);
+        }
+
+        if(opts->unpack_dir)
+        {
+            const struct bundle_stats *unpacked;
+
+            unpacked = &opts->unpack.stats;
+            fprintf(stderr, "unpacked:           %zu files, %zu directories, %" PRIu64 " bytes\n", unpacked->files, unpacked->directories, unpacked->bytes);
+            fprintf(stderr, "bundles:            %zu complete, %zu rejected, %zu entries refused\n", unpacked->bundles, unpacked->rejected, unpacked->refused);
+        }
+    }
+
+    if(opts->output_path)
     {
-        dc_close(env, err, opts->fd_out);
+        output_file_print(stderr, &opts->output_file);
     }
+
+    if(opts->bundle)
+    {
+        const struct bundle_stats *bundled;
+
+        bundled = &opts->bundle_stats;
+        fprintf(stderr, "bundled:            %zu files, %zu directories, %" PRIu64 " bytes\n", bundled->files, bundled->directories, bundled->bytes);
+        fprintf(stderr, "skipped:            %zu (not regular files or directories)\n", bundled->skipped);
+        fprintf(stderr, "changed while sent: %zu\n", bundled->changed);
+        fprintf(stderr, "prefetched:         %zu files\n", bundled->prefetched);
+    }
+
+    if(opts->generate || (opts->sink && opts->ip_in == NULL))
+    {
+        const struct endpoint_stats *endpoint;
+        double seconds;
+
+        endpoint = &opts->endpoint_stats;
+        seconds = (double)endpoint->elapsed_ns / NSEC_PER_SEC;
+        fprintf(stderr, "%s%" PRIu64 " bytes in %zu calls\n", opts->generate ? "generated:          " : "sunk:               ", endpoint->bytes, endpoint->calls);
+        fprintf(stderr, "elapsed:            %.3f s\n", seconds);
+        fprintf(stderr, "throughput:         %.1f MB/s\n", seconds > 0 ? (double)endpoint->bytes / seconds / BYTES_PER_MB : 0.0);
+    }
+
+    if(opts->records)
+    {
+        const struct record_stats *records;
+
+        records = opts->ip_in ? &opts->server_stats.records : &opts->record_stats;
+        fprintf(stderr, "records:            %zu\n", records->records);
+        fprintf(stderr, "record batches:     %zu\n", records->batches);
+        fprintf(stderr, "oversized records:  %zu\n", records->oversized);
+        fprintf(stderr, "discarded bytes:    %zu\n", records->discarded);
+    }
+
+    for(size_t i = 0; i < opts->transforms.count; i++)
+    {
+        const struct transform_stage *stage;
+
+        stage = &opts->transforms.stages[i];
+        fprintf(stderr, "stage %zu %-11s %zu spans, %zu bytes in, %zu bytes out\n", i + 1, stage->ops->name, stage->spans, stage->bytes_in, stage->bytes_out);
+
+        if(stage->ops->report != NULL)
+        {
+            stage->ops->report(stderr, stage);
+        }
+    }
+
+    if(opts->perf_events)
+    {
+        char label[PERF_LABEL_SIZE];
+
+        snprintf(label, sizeof(label), "perf %s:", engine_name(opts));
+        perf_totals_print(stderr, label, opts->ip_in && !opts->proxy ? &opts->server_stats.perf : &opts->perf_totals);
+    }
+
+    fprintf(stderr, "pool slab size:     %zu%s\n", pool.slab_size, opts->huge_pages ? " (huge pages)" : "");
+    fprintf(stderr, "pool hits:          %zu\n", pool.hits);
+    fprintf(stderr, "pool misses:        %zu\n", pool.misses);
+    fprintf(stderr, "pool in use:        %zu\n", pool.in_use);
+    fprintf(stderr, "pool high water:    %zu\n", pool.high_water);
+    // NOLINTEND(cert-err33-c)
 }
 
 
@@ -483,6 +1704,29 @@ static void set_signal_handling(const struct dc_env *env, struct dc_error *err,
     sa->sa_flags = 0;
     sa->sa_handler = signal_handler;
     dc_sigaction(env, err, SIGINT, sa, NULL);
+    dc_sigaction(env, err, SIGTERM, sa, NULL);
+}
+
+
+static int somaxconn(void)
+{
+    FILE *stream;
+    int value;
+
+    stream = fopen(SOMAXCONN_PATH, "re");
+    value = SOMAXCONN;
+
+    if(stream != NULL)
+    {
+        if(fscanf(stream, "%d", &value) != 1)   // NOLINT(cert-err34-c)
+        {
+            value = SOMAXCONN;
+        }
+
+        fclose(stream);     // NOLINT(cert-err33-c)
+    }
+
+    return value;
 }
 
 
@@ -490,7 +1734,7 @@ static void set_signal_handling(const struct dc_env *env, struct dc_error *err,
 #pragma GCC diagnostic ignored "-Wunused-parameter"
 static void signal_handler(int sig)
 {
-    running = 0;
+    // nothing to record; the signal only needs to interrupt the blocking read with EINTR so relay() ends
 }
 #pragma GCC diagnostic pop
 
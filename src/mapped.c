@@ -0,0 +1,148 @@
+#include "mapped.h"
+#include "zerocopy.h"
+#include <dc_posix/dc_unistd.h>
+#include <dc_posix/sys/dc_stat.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+
+
+static size_t round_to_page(size_t size, size_t page_size);
+static size_t write_window(const struct dc_env *env, struct dc_error *err, int to_fd, struct zerocopy *zc, const char *window, size_t length, size_t count);
+
+
+void copy_mapped(const struct dc_env *env, struct dc_error *err, int from_fd, int to_fd, size_t count, size_t window, bool zerocopy)
+{
+    struct zerocopy zc;
+    struct stat file_stat;
+    size_t page_size;
+    off_t offset;
+
+    DC_TRACE(env);
+    dc_fstat(env, err, from_fd, &file_stat);
+
+    if(dc_error_has_error(err))
+    {
+        goto STAT_FAIL;
+    }
+
+    if(!S_ISREG(file_stat.st_mode))
+    {
+        DC_ERROR_RAISE_USER(err, "memory mapped input requires a regular file", 2);
+        goto STAT_FAIL;
+    }
+
+    if(zerocopy)
+    {
+        zerocopy_init(env, err, &zc, to_fd);
+    }
+
+    page_size = (size_t)sysconf(_SC_PAGESIZE);
+    window = round_to_page(window, page_size);
+
+    for(offset = 0; offset < file_stat.st_size; offset += (off_t)window)
+    {
+        char *mapping;
+        size_t length;
+        size_t written;
+
+        length = (size_t)(file_stat.st_size - offset);
+
+        if(length > window)
+        {
+            length = window;
+        }
+
+        mapping = mmap(NULL, length, PROT_READ, MAP_SHARED, from_fd, offset);
+
+        if(mapping == MAP_FAILED)
+        {
+            DC_ERROR_RAISE_ERRNO(err, errno);
+            goto MAP_FAIL;
+        }
+
+        madvise(mapping, length, MADV_SEQUENTIAL);
+        madvise(mapping, length, MADV_WILLNEED);
+
+        if(offset + (off_t)length < file_stat.st_size)
+        {
+            posix_fadvise(from_fd, offset + (off_t)length, (off_t)window, POSIX_FADV_WILLNEED);
+        }
+
+        written = write_window(env, err, to_fd, zerocopy ? &zc : NULL, mapping, length, count);
+
+        if(zerocopy && dc_error_has_no_error(err))
+        {
+            zerocopy_wait(env, err, &zc, zc.next_seq);
+        }
+
+        munmap(mapping, length);
+
+        if(dc_error_has_error(err) || written < length)
+        {
+            goto WRITE_FAIL;
+        }
+
+        posix_fadvise(from_fd, offset, (off_t)length, POSIX_FADV_DONTNEED);
+    }
+
+    WRITE_FAIL:
+    MAP_FAIL:
+    STAT_FAIL:
+    {
+    }
+}
+
+static size_t round_to_page(size_t size, size_t page_size)
+{
+    if(size < page_size)
+    {
+        return page_size;
+    }
+
+    return size - (size % page_size);
+}
+
+static size_t write_window(const struct dc_env *env, struct dc_error *err, int to_fd, struct zerocopy *zc, const char *window, size_t length, size_t count)
+{
+    size_t position;
+
+    DC_TRACE(env);
+    position = 0;
+
+    while(position < length)
+    {
+        ssize_t wbytes;
+        size_t nbytes;
+
+        nbytes = length - position;
+
+        if(nbytes > count)
+        {
+            nbytes = count;
+        }
+
+        if(zc)
+        {
+            zerocopy_send(env, err, zc, &window[position], nbytes);
+            wbytes = (ssize_t)nbytes;
+        }
+        else
+        {
+            wbytes = dc_write(env, err, to_fd, &window[position], nbytes);
+        }
+
+        if(dc_error_has_error(err))
+        {
+            if(dc_error_is_errno(err, EINTR))
+            {
+                dc_error_reset(err);
+            }
+
+            break;
+        }
+
+        position += (size_t)wbytes;
+    }
+
+    return position;
+}
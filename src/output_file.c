@@ -0,0 +1,443 @@
+#include "output_file.h"
+#include "buffer_pool.h"
+#include <dc_c/dc_string.h>
+#include <dc_posix/dc_fcntl.h>
+#include <dc_posix/dc_unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <time.h>
+
+
+static void write_out(const struct dc_env *env, struct dc_error *err, struct output_file *file, const char *data, size_t length);
+static void flush(const struct dc_env *env, struct dc_error *err, struct output_file *file);
+static void preallocate(const struct dc_env *env, struct dc_error *err, struct output_file *file, uint64_t end);
+static void write_behind(const struct dc_env *env, struct dc_error *err, struct output_file *file);
+static uint64_t now_ns(void);
+
+
+// NOLINTBEGIN(modernize-macro-to-enum)
+#define OUTPUT_MODE 0644
+#define DIRECT_ALIGNMENT 4096
+#define MIN_STAGING_SIZE (1024 * 1024)
+#define PREALLOCATE_CHUNK (64 * 1024 * 1024)
+#define WRITEBEHIND_CHUNK (8 * 1024 * 1024)
+#define WRITEBEHIND_WINDOW (4 * WRITEBEHIND_CHUNK)
+#define NSEC_PER_SEC 1000000000
+//NOLINTEND(modernize-macro-to-enum)
+
+
+void output_file_open(const struct dc_env *env, struct dc_error *err, struct output_file *file, const char *path, size_t buffer_size, bool direct, uint64_t expected)
+{
+    int flags;
+
+    DC_TRACE(env);
+    dc_memset(env, file, 0, sizeof(*file));
+    file->fd = -1;
+    file->preallocate = true;
+
+    // O_DIRECT wants the buffer, the length and the file offset all on block boundaries, so staging is kept in whole pages
+    file->size = buffer_size > MIN_STAGING_SIZE ? buffer_size : MIN_STAGING_SIZE;
+    file->size = (file->size + DIRECT_ALIGNMENT - 1) / DIRECT_ALIGNMENT * DIRECT_ALIGNMENT;
+    file->buffer = buffer_pool_acquire(env, err, file->size);
+
+    if(dc_error_has_error(err))
+    {
+        return;
+    }
+
+    flags = O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC;
+
+    if(direct)
+    {
+        file->fd = open(path, flags | O_DIRECT, OUTPUT_MODE);
+
+        // tmpfs and some network filesystems refuse O_DIRECT, and the page cache is still better than nothing
+        if(file->fd == -1 && errno != EINVAL)
+        {
+            DC_ERROR_RAISE_ERRNO(err, errno);
+            goto OPEN_FAIL;
+        }
+    }
+
+    file->direct = file->fd != -1;
+
+    if(file->fd == -1)
+    {
+        file->fd = dc_open(env, err, path, flags, OUTPUT_MODE);
+
+        if(dc_error_has_error(err))
+        {
+            file->fd = -1;
+            goto OPEN_FAIL;
+        }
+    }
+
+    // a FILE of known size gets its blocks in one go, which keeps the output in as few extents as possible
+    if(expected > 0)
+    {
+        preallocate(env, err, file, expected);
+    }
+
+    return;
+
+    OPEN_FAIL:
+    buffer_pool_release(env, file->buffer, file->size);
+    file->buffer = NULL;
+}
+
+char *output_file_reserve(struct output_file *file, size_t *available)
+{
+    *available = file->size - file->used;
+
+    return &file->buffer[file->used];
+}
+
+void output_file_commit(const struct dc_env *env, struct dc_error *err, struct output_file *file, size_t count)
+{
+    DC_TRACE(env);
+    file->used += count;
+
+    if(file->used == file->size)
+    {
+        flush(env, err, file);
+    }
+}
+
+void output_file_flush(const struct dc_env *env, struct dc_error *err, struct output_file *file)
+{
+    size_t aligned;
+    int flags;
+
+    DC_TRACE(env);
+
+    if(file->used == 0 || dc_error_has_error(err))
+    {
+        return;
+    }
+
+    if(!file->direct)
+    {
+        flush(env, err, file);
+        return;
+    }
+
+    aligned = file->used - file->used % DIRECT_ALIGNMENT;
+
+    if(aligned > 0)
+    {
+        write_out(env, err, file, file->buffer, aligned);
+
+        if(dc_error_has_error(err))
+        {
+            return;
+        }
+
+        dc_memmove(env, file->buffer, &file->buffer[aligned], file->used - aligned);
+        file->used -= aligned;
+    }
+
+    if(file->used == 0)
+    {
+        return;
+    }
+
+    // the ragged tail goes out through the page cache but stays staged, so its block is rewritten whole, and direct, once it fills
+    flags = fcntl(file->fd, F_GETFL);
+
+    if(flags == -1 || fcntl(file->fd, F_SETFL, flags & ~O_DIRECT) == -1)
+    {
+        DC_ERROR_RAISE_ERRNO(err, errno);
+        return;
+    }
+
+    for(size_t written = 0; written < file->used;)
+    {
+        ssize_t wbytes;
+
+        wbytes = pwrite(file->fd, &file->buffer[written], file->used - written, (off_t)(file->offset + written));
+
+        if(wbytes == -1)
+        {
+            if(errno == EINTR)
+            {
+                continue;
+            }
+
+            DC_ERROR_RAISE_ERRNO(err, errno);
+            break;
+        }
+
+        written += (size_t)wbytes;
+    }
+
+    // a descriptor that won't go back to O_DIRECT carries on through the page cache, as the end of the stream does
+    if(fcntl(file->fd, F_SETFL, flags) == -1)
+    {
+        file->direct = false;
+        file->written_back = file->offset;
+        file->dropped = file->offset;
+    }
+}
+
+void output_file_close(const struct dc_env *env, struct dc_error *err, struct output_file *file)
+{
+    DC_TRACE(env);
+
+    if(file->fd == -1)
+    {
+        return;
+    }
+
+    flush(env, err, file);
+
+    // blocks kept past the end would otherwise stay allocated to the file for good; truncating to the same size frees them
+    if(file->preallocate && file->allocated > file->offset && dc_error_has_no_error(err))
+    {
+        dc_ftruncate(env, err, file->fd, (off_t)file->offset);
+    }
+
+    // start the tail on its way without waiting for it, as the copy loop never did
+    if(!file->direct && file->offset > file->written_back)
+    {
+        sync_file_range(file->fd, (off_t)file->written_back, 0, SYNC_FILE_RANGE_WRITE);
+    }
+
+    dc_close(env, err, file->fd);
+    file->fd = -1;
+    buffer_pool_release(env, file->buffer, file->size);
+    file->buffer = NULL;
+}
+
+void output_file_print(FILE *stream, const struct output_file *file)
+{
+    const struct output_file_stats *stats;
+
+    stats = &file->stats;
+
+    // NOLINTBEGIN(cert-err33-c)
+    fprintf(stream, "output file:        %" PRIu64 " bytes in %zu writes (%zu direct)\n", stats->bytes, stats->writes, stats->direct_writes);
+
+    if(file->preallocate)
+    {
+        fprintf(stream, "preallocated:       %" PRIu64 " bytes\n", stats->preallocated);
+    }
+    else
+    {
+        fprintf(stream, "preallocated:       unsupported by the filesystem\n");
+    }
+
+    fprintf(stream, "writeback:          %zu ranges started, %zu waited on for %.3f s\n", stats->writebacks, stats->waits, (double)stats->wait_ns / NSEC_PER_SEC);
+    // NOLINTEND(cert-err33-c)
+}
+
+void copy_output_file(const struct dc_env *env, struct dc_error *err, int from_fd, struct output_file *file)
+{
+    ssize_t rbytes;
+
+    DC_TRACE(env);
+
+    // the input is read straight into the staging buffer, so the only copy is the one the kernel makes
+    for(;;)
+    {
+        char *buffer;
+        size_t available;
+
+        buffer = output_file_reserve(file, &available);
+        rbytes = dc_read(env, err, from_fd, buffer, available);
+
+        if(dc_error_has_error(err))
+        {
+            if(dc_error_is_errno(err, EINTR))
+            {
+                dc_error_reset(err);
+            }
+
+            break;
+        }
+
+        if(rbytes <= 0)
+        {
+            break;
+        }
+
+        output_file_commit(env, err, file, (size_t)rbytes);
+
+        if(dc_error_has_error(err))
+        {
+            break;
+        }
+    }
+}
+
+static void write_out(const struct dc_env *env, struct dc_error *err, struct output_file *file, const char *data, size_t length)
+{
+    DC_TRACE(env);
+    preallocate(env, err, file, file->offset + length);
+
+    if(dc_error_has_error(err))
+    {
+        return;
+    }
+
+    // the offset only ever covers what reached the file, so the tail's pwrite and the truncate at close land in the right place
+    while(length > 0)
+    {
+        ssize_t wbytes;
+
+        wbytes = dc_write(env, err, file->fd, data, length);
+
+        if(dc_error_has_error(err))
+        {
+            if(!dc_error_is_errno(err, EINTR))
+            {
+                return;
+            }
+
+            dc_error_reset(err);
+            continue;
+        }
+
+        data += wbytes;
+        length -= (size_t)wbytes;
+        file->offset += (uint64_t)wbytes;
+        file->stats.bytes += (uint64_t)wbytes;
+        file->stats.writes++;
+
+        if(file->direct)
+        {
+            file->stats.direct_writes++;
+        }
+    }
+
+    write_behind(env, err, file);
+}
+
+static void flush(const struct dc_env *env, struct dc_error *err, struct output_file *file)
+{
+    size_t aligned;
+    int flags;
+
+    DC_TRACE(env);
+
+    if(file->used == 0 || dc_error_has_error(err))
+    {
+        return;
+    }
+
+    aligned = file->used - file->used % DIRECT_ALIGNMENT;
+
+    if(!file->direct || aligned == file->used)
+    {
+        write_out(env, err, file, file->buffer, file->used);
+        file->used = 0;
+        return;
+    }
+
+    if(aligned > 0)
+    {
+        write_out(env, err, file, file->buffer, aligned);
+
+        if(dc_error_has_error(err))
+        {
+            return;
+        }
+    }
+
+    // only the end of the stream is ragged, and it goes through the page cache rather than being padded
+    flags = fcntl(file->fd, F_GETFL);
+
+    if(flags == -1 || fcntl(file->fd, F_SETFL, flags & ~O_DIRECT) == -1)
+    {
+        DC_ERROR_RAISE_ERRNO(err, errno);
+        return;
+    }
+
+    file->direct = false;
+    file->written_back = file->offset;
+    file->dropped = file->offset;
+    write_out(env, err, file, &file->buffer[aligned], file->used - aligned);
+    file->used = 0;
+}
+
+static void preallocate(const struct dc_env *env, struct dc_error *err, struct output_file *file, uint64_t end)
+{
+    uint64_t length;
+
+    DC_TRACE(env);
+
+    if(!file->preallocate || end <= file->allocated)
+    {
+        return;
+    }
+
+    length = (end - file->allocated + PREALLOCATE_CHUNK - 1) / PREALLOCATE_CHUNK * PREALLOCATE_CHUNK;
+
+    // KEEP_SIZE reserves the blocks without moving EOF, so a reader of the growing file never sees the zeros
+    if(fallocate(file->fd, FALLOC_FL_KEEP_SIZE, (off_t)file->allocated, (off_t)length) == -1)
+    {
+        if(errno == EOPNOTSUPP || errno == ENOSYS)
+        {
+            file->preallocate = false;
+            return;
+        }
+
+        DC_ERROR_RAISE_ERRNO(err, errno);
+        return;
+    }
+
+    file->allocated += length;
+    file->stats.preallocated = file->allocated;
+}
+
+static void write_behind(const struct dc_env *env, struct dc_error *err, struct output_file *file)
+{
+    DC_TRACE(env);
+
+    // O_DIRECT leaves nothing dirty behind it
+    if(file->direct)
+    {
+        return;
+    }
+
+    // start writeback as each chunk fills, instead of letting dirty pages pile up until the kernel throttles us all at once
+    while(file->offset - file->written_back >= WRITEBEHIND_CHUNK)
+    {
+        if(sync_file_range(file->fd, (off_t)file->written_back, WRITEBEHIND_CHUNK, SYNC_FILE_RANGE_WRITE) == -1)
+        {
+            DC_ERROR_RAISE_ERRNO(err, errno);
+            return;
+        }
+
+        file->written_back += WRITEBEHIND_CHUNK;
+        file->stats.writebacks++;
+    }
+
+    // a chunk this far behind has almost always finished, so the wait is short, and its pages can leave the cache
+    while(file->written_back - file->dropped > WRITEBEHIND_WINDOW)
+    {
+        uint64_t start;
+
+        start = now_ns();
+
+        if(sync_file_range(file->fd, (off_t)file->dropped, WRITEBEHIND_CHUNK, SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER) == -1)
+        {
+            DC_ERROR_RAISE_ERRNO(err, errno);
+            return;
+        }
+
+        posix_fadvise(file->fd, (off_t)file->dropped, WRITEBEHIND_CHUNK, POSIX_FADV_DONTNEED);
+        file->dropped += WRITEBEHIND_CHUNK;
+        file->stats.waits++;
+        file->stats.wait_ns += now_ns() - start;
+    }
+}
+
+static uint64_t now_ns(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (uint64_t)now.tv_sec * NSEC_PER_SEC + (uint64_t)now.tv_nsec;
+}
@@ -0,0 +1,224 @@
+#include "perf.h"
+#include <errno.h>
+#include <inttypes.h>
+#include <linux/perf_event.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+
+static int open_event(uint32_t type, uint64_t config, int group_fd);
+static bool read_tracepoint_id(const char *path, uint64_t *id);
+
+
+// NOLINTBEGIN(modernize-macro-to-enum)
+#define BYTES_PER_KB 1024
+#define SYSCALL_TRACEPOINT "/sys/kernel/tracing/events/raw_syscalls/sys_enter/id"
+#define SYSCALL_TRACEPOINT_DEBUGFS "/sys/kernel/debug/tracing/events/raw_syscalls/sys_enter/id"
+//NOLINTEND(modernize-macro-to-enum)
+
+
+static const uint32_t event_types[PERF_EVENT_COUNT] = { PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE, PERF_TYPE_SOFTWARE };
+static const uint64_t event_configs[PERF_EVENT_COUNT] = { PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS, PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_SW_CONTEXT_SWITCHES };
+
+
+void perf_counters_open(const struct dc_env *env, struct dc_error *err, struct perf_counters *counters)
+{
+    int last_errno;
+
+    DC_TRACE(env);
+    counters->leader = -1;
+    counters->opened = 0;
+    counters->available = 0;
+    last_errno = 0;
+
+    // one group so a single read() returns every counter for the same instant
+    for(int i = 0; i < PERF_EVENT_COUNT; i++)
+    {
+        counters->fds[i] = open_event(event_types[i], event_configs[i], counters->leader);
+        counters->slots[i] = -1;
+
+        if(counters->fds[i] == -1)
+        {
+            last_errno = errno;
+            continue;
+        }
+
+        if(counters->leader == -1)
+        {
+            counters->leader = counters->fds[i];
+        }
+
+        counters->slots[i] = (int)counters->opened++;
+        counters->available |= 1U << (unsigned int)i;
+    }
+
+    // hardware counters are often missing in VMs, but with none at all there is nothing to report
+    if(counters->opened == 0)
+    {
+        DC_ERROR_RAISE_ERRNO(err, last_errno);
+    }
+}
+
+void perf_counters_read(const struct perf_counters *counters, struct perf_sample *sample)
+{
+    uint64_t values[PERF_EVENT_COUNT + 1];
+
+    if(read(counters->leader, values, sizeof(values)) < (ssize_t)sizeof(uint64_t))
+    {
+        values[0] = 0;
+    }
+
+    for(int i = 0; i < PERF_EVENT_COUNT; i++)
+    {
+        int slot;
+
+        slot = counters->slots[i];
+        sample->values[i] = slot >= 0 && (uint64_t)slot < values[0] ? values[slot + 1] : 0;
+    }
+}
+
+void perf_counters_close(struct perf_counters *counters)
+{
+    for(int i = 0; i < PERF_EVENT_COUNT; i++)
+    {
+        if(counters->slots[i] >= 0)
+        {
+            close(counters->fds[i]);
+        }
+
+        counters->slots[i] = -1;
+    }
+
+    counters->leader = -1;
+    counters->opened = 0;
+}
+
+void perf_totals_add(struct perf_totals *totals, const struct perf_counters *counters, const struct perf_sample *before, const struct perf_sample *after, uint64_t bytes)
+{
+    for(int i = 0; i < PERF_EVENT_COUNT; i++)
+    {
+        totals->counts.values[i] += after->values[i] - before->values[i];
+    }
+
+    totals->bytes += bytes;
+    totals->spans++;
+    totals->available = counters->available;
+}
+
+void perf_totals_print(FILE *stream, const char *label, const struct perf_totals *totals)
+{
+    const uint64_t *values;
+    double bytes;
+
+    values = totals->counts.values;
+    bytes = (double)totals->bytes;
+
+    // NOLINTBEGIN(cert-err33-c)
+    fprintf(stream, "%-20s", label);
+
+    if((totals->available & (1U << PERF_CYCLES)) && totals->bytes > 0)
+    {
+        fprintf(stream, "%.2f cycles/byte, ", (double)values[PERF_CYCLES] / bytes);
+    }
+    else
+    {
+        fprintf(stream, "n/a cycles/byte, ");
+    }
+
+    if((totals->available & (1U << PERF_CYCLES)) && (totals->available & (1U << PERF_INSTRUCTIONS)) && values[PERF_CYCLES] > 0)
+    {
+        fprintf(stream, "%.2f IPC, ", (double)values[PERF_INSTRUCTIONS] / (double)values[PERF_CYCLES]);
+    }
+    else
+    {
+        fprintf(stream, "n/a IPC, ");
+    }
+
+    if((totals->available & (1U << PERF_CACHE_MISSES)) && totals->bytes > 0)
+    {
+        fprintf(stream, "%.2f cache misses/KB, ", (double)values[PERF_CACHE_MISSES] * BYTES_PER_KB / bytes);
+    }
+    else
+    {
+        fprintf(stream, "n/a cache misses/KB, ");
+    }
+
+    fprintf(stream, "%" PRIu64 " context switches over %" PRIu64 " bytes in %zu spans\n", values[PERF_CONTEXT_SWITCHES], totals->bytes, totals->spans);
+    // NOLINTEND(cert-err33-c)
+}
+
+int perf_syscalls_open(void)
+{
+    struct perf_event_attr attr;
+    uint64_t id;
+
+    if(!read_tracepoint_id(SYSCALL_TRACEPOINT, &id) && !read_tracepoint_id(SYSCALL_TRACEPOINT_DEBUGFS, &id))
+    {
+        return -1;
+    }
+
+    // every syscall this thread enters, whatever its kind, counted where perf trace and strace -c count them
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_TRACEPOINT;
+    attr.config = id;
+
+    return (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, PERF_FLAG_FD_CLOEXEC);
+}
+
+uint64_t perf_syscalls_read(int fd)
+{
+    uint64_t value;
+
+    if(read(fd, &value, sizeof(value)) != (ssize_t)sizeof(value))
+    {
+        return 0;
+    }
+
+    return value;
+}
+
+static int open_event(uint32_t type, uint64_t config, int group_fd)
+{
+    struct perf_event_attr attr;
+    int fd;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = type;
+    attr.config = config;
+    attr.read_format = PERF_FORMAT_GROUP;
+    attr.exclude_hv = 1;
+
+    // this thread only, on any cpu, kernel time included so syscall overhead shows up
+    fd = (int)syscall(SYS_perf_event_open, &attr, 0, -1, group_fd, PERF_FLAG_FD_CLOEXEC);
+
+    // perf_event_paranoid above 1 keeps unprivileged users to user space
+    if(fd == -1 && (errno == EACCES || errno == EPERM))
+    {
+        attr.exclude_kernel = 1;
+        fd = (int)syscall(SYS_perf_event_open, &attr, 0, -1, group_fd, PERF_FLAG_FD_CLOEXEC);
+    }
+
+    return fd;
+}
+
+static bool read_tracepoint_id(const char *path, uint64_t *id)
+{
+    FILE *file;
+    bool found;
+
+    // tracefs is root-only on most systems, and may not be mounted at all
+    file = fopen(path, "re");
+
+    if(file == NULL)
+    {
+        return false;
+    }
+
+    found = fscanf(file, "%" SCNu64, id) == 1;  // NOLINT(cert-err34-c)
+    fclose(file);       // NOLINT(cert-err33-c)
+
+    return found;
+}
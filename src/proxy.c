@@ -0,0 +1,903 @@
+#include "proxy.h"
+#include "conversion.h"
+#include <dc_c/dc_stdlib.h>
+#include <dc_c/dc_string.h>
+#include <dc_posix/arpa/dc_inet.h>
+#include <dc_posix/dc_fcntl.h>
+#include <dc_posix/dc_signal.h>
+#include <dc_posix/dc_string.h>
+#include <dc_posix/dc_unistd.h>
+#include <dc_posix/sys/dc_socket.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+
+
+static void on_accept(const struct dc_env *env, struct dc_error *err, struct event_loop *loop, struct event_source *source, uint32_t events);
+static void on_session(const struct dc_env *env, struct dc_error *err, struct event_loop *loop, struct event_source *source, uint32_t events);
+static void on_clock(const struct dc_env *env, struct dc_error *err, struct event_loop *loop, struct event_source *source, uint32_t events);
+static void on_signal(const struct dc_env *env, struct dc_error *err, struct event_loop *loop, struct event_source *source, uint32_t events);
+static void on_accept_retry(const struct dc_env *env, struct dc_error *err, struct timer *timer);
+static void pause_accepting(const struct dc_env *env, struct dc_error *err, struct proxy *proxy);
+static void resume_accepting(const struct dc_env *env, struct dc_error *err, struct proxy *proxy);
+static void on_connect(const struct dc_env *env, struct dc_error *err, struct event_loop *loop, struct event_source *source, uint32_t events);
+static void on_connect_timeout(const struct dc_env *env, struct dc_error *err, struct timer *timer);
+static void open_session(const struct dc_env *env, struct dc_error *err, struct proxy_route *route, int fd, const struct sockaddr_in *addr);
+static void connect_next(const struct dc_env *env, struct dc_error *err, struct proxy_session *session);
+static void abandon_attempt(const struct dc_env *env, struct dc_error *err, struct proxy_session *session, int error);
+static void attach_session(const struct dc_env *env, struct dc_error *err, struct proxy_session *session);
+static void resolve_targets(const struct dc_env *env, struct dc_error *err, struct proxy_route *route);
+static void parse_target(const struct dc_env *env, struct dc_error *err, struct connect_options *target, char *spec);
+static bool open_flow(struct proxy_flow *flow, int from_fd, int to_fd, size_t pipe_size, uint64_t *bytes);
+static void close_flow(struct proxy_flow *flow);
+static bool pump(struct proxy_flow *flow, size_t *half_closes);
+static void close_session(const struct dc_env *env, struct dc_error *err, struct proxy *proxy, struct proxy_session *session, bool reset);
+static void reap_closed(const struct dc_env *env, struct proxy *proxy);
+static void open_signals(const struct dc_env *env, struct dc_error *err, struct proxy *proxy);
+static void close_signals(const struct dc_env *env, struct dc_error *err, struct proxy *proxy);
+static void abort_socket(int fd);
+
+
+// NOLINTBEGIN(modernize-macro-to-enum)
+#define UPSTREAM 0
+#define DOWNSTREAM 1
+#define SESSION_EVENTS (EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET)
+#define TIMER_TICK_MS 10
+#define ACCEPT_RETRY_MS 100
+//NOLINTEND(modernize-macro-to-enum)
+
+
+void proxy_route_parse(const struct dc_env *env, struct dc_error *err, struct proxy_route *route, const char *spec, const struct connect_options *defaults)
+{
+    char *targets;
+    char *port;
+    char *target;
+    char *next;
+
+    DC_TRACE(env);
+    dc_memset(env, route, 0, sizeof(*route));
+    route->listener.fd = -1;
+    route->spec = dc_strdup(env, err, spec);
+
+    if(dc_error_has_error(err))
+    {
+        return;
+    }
+
+    targets = dc_strchr(env, route->spec, '=');
+
+    if(targets == NULL || targets[1] == '\0')
+    {
+        DC_ERROR_RAISE_USER(err, "a route is [ip:]port=host:port[,host:port...]", 2);
+        return;
+    }
+
+    *targets++ = '\0';
+    port = dc_strrchr(env, route->spec, ':');
+
+    if(port == NULL)
+    {
+        route->listen_ip = "0.0.0.0";
+        port = route->spec;
+    }
+    else
+    {
+        *port++ = '\0';
+        route->listen_ip = route->spec;
+    }
+
+    route->listen_port = parse_port(env, err, port, 10);     // NOLINT(cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers)
+
+    if(dc_error_has_error(err))
+    {
+        return;
+    }
+
+    route->target_count = 1;
+
+    for(const char *c = targets; *c != '\0'; c++)
+    {
+        route->target_count += *c == ',';
+    }
+
+    route->targets = dc_calloc(env, err, route->target_count, sizeof(*route->targets));
+
+    if(dc_error_has_error(err))
+    {
+        return;
+    }
+
+    target = targets;
+
+    for(size_t i = 0; i < route->target_count && dc_error_has_no_error(err); i++)
+    {
+        next = dc_strchr(env, target, ',');
+
+        if(next != NULL)
+        {
+            *next++ = '\0';
+        }
+
+        route->targets[i].options = *defaults;
+        parse_target(env, err, &route->targets[i].options, target);
+        target = next;
+    }
+}
+
+void proxy_route_destroy(const struct dc_env *env, struct dc_error *err, struct proxy_route *route)
+{
+    DC_TRACE(env);
+
+    if(route->listener.fd != -1)
+    {
+        dc_close(env, err, route->listener.fd);
+        route->listener.fd = -1;
+    }
+
+    dc_free(env, route->targets);
+    dc_free(env, route->spec);
+    route->targets = NULL;
+    route->spec = NULL;
+}
+
+void proxy_init(const struct dc_env *env, struct dc_error *err, struct proxy *proxy, struct proxy_route *routes, size_t route_count, size_t pipe_size)
+{
+    struct sigaction ignore;
+    size_t added;
+
+    DC_TRACE(env);
+    dc_memset(env, proxy, 0, sizeof(*proxy));
+    proxy->routes = routes;
+    proxy->route_count = route_count;
+    proxy->pipe_size = pipe_size;
+    proxy->signals.fd = -1;
+    timer_init(&proxy->accept_retry, on_accept_retry, proxy);
+    event_loop_init(env, err, &proxy->loop);
+
+    if(dc_error_has_error(err))
+    {
+        goto LOOP_FAIL;
+    }
+
+    timer_wheel_init(env, err, &proxy->wheel, TIMER_TICK_MS);
+
+    if(dc_error_has_error(err))
+    {
+        goto WHEEL_FAIL;
+    }
+
+    proxy->clock.fd = proxy->wheel.timer_fd;
+    proxy->clock.handler = on_clock;
+    proxy->clock.data = proxy;
+    event_loop_add(env, err, &proxy->loop, &proxy->clock, EPOLLIN);
+
+    if(dc_error_has_error(err))
+    {
+        goto CLOCK_FAIL;
+    }
+
+    open_signals(env, err, proxy);
+
+    if(dc_error_has_error(err))
+    {
+        goto SIGNALS_FAIL;
+    }
+
+    // every route's listener shares the one loop
+    for(added = 0; added < route_count; added++)
+    {
+        // names are looked up once here, since a lookup inside the loop would block every session
+        resolve_targets(env, err, &routes[added]);
+
+        if(dc_error_has_error(err))
+        {
+            goto LISTENER_FAIL;
+        }
+
+        routes[added].proxy = proxy;
+        routes[added].listener.handler = on_accept;
+        routes[added].listener.data = &routes[added];
+        event_loop_add(env, err, &proxy->loop, &routes[added].listener, EPOLLIN);
+
+        if(dc_error_has_error(err))
+        {
+            goto LISTENER_FAIL;
+        }
+
+        routes[added].accepting = true;
+    }
+
+    // a peer that goes away mid-splice must come back as EPIPE for that session, not kill the process
+    dc_memset(env, &ignore, 0, sizeof(ignore));
+    ignore.sa_handler = SIG_IGN;
+    sigaction(SIGPIPE, &ignore, &proxy->saved_pipe);
+
+    return;
+
+    LISTENER_FAIL:
+    while(added > 0)
+    {
+        added--;
+        event_loop_remove(env, err, &proxy->loop, &routes[added].listener);
+    }
+
+    close_signals(env, err, proxy);
+
+    SIGNALS_FAIL:
+    CLOCK_FAIL:
+    timer_wheel_destroy(env, err, &proxy->wheel);
+
+    WHEEL_FAIL:
+    event_loop_destroy(env, err, &proxy->loop);
+
+    LOOP_FAIL:
+    {
+    }
+}
+
+void proxy_run(const struct dc_env *env, struct dc_error *err, struct proxy *proxy)
+{
+    DC_TRACE(env);
+
+    while(proxy->loop.running)
+    {
+        event_loop_poll(env, err, &proxy->loop, -1);
+        reap_closed(env, proxy);
+
+        if(dc_error_has_error(err))
+        {
+            break;
+        }
+    }
+}
+
+void proxy_destroy(const struct dc_env *env, struct dc_error *err, struct proxy *proxy)
+{
+    DC_TRACE(env);
+
+    while(proxy->sessions != NULL)
+    {
+        close_session(env, err, proxy, proxy->sessions, false);
+    }
+
+    reap_closed(env, proxy);
+    sigaction(SIGPIPE, &proxy->saved_pipe, NULL);
+    close_signals(env, err, proxy);
+    timer_wheel_destroy(env, err, &proxy->wheel);
+    event_loop_destroy(env, err, &proxy->loop);
+}
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wunused-parameter"
+static void on_accept(const struct dc_env *env, struct dc_error *err, struct event_loop *loop, struct event_source *source, uint32_t events)
+{
+    struct proxy_route *route;
+
+    DC_TRACE(env);
+    route = source->data;
+
+    for(;;)
+    {
+        struct sockaddr_in addr;
+        socklen_t addr_len;
+        int fd;
+
+        addr_len = sizeof(addr);
+        fd = accept4(source->fd, (struct sockaddr *)&addr, &addr_len, SOCK_NONBLOCK | SOCK_CLOEXEC);
+
+        if(fd == -1)
+        {
+            if(errno == ECONNABORTED || errno == EPROTO)
+            {
+                continue;
+            }
+
+            // descriptors are shared by every route, so running out pauses them all until a session gives some back
+            if(errno == EMFILE || errno == ENFILE || errno == ENOBUFS || errno == ENOMEM)
+            {
+                pause_accepting(env, err, route->proxy);
+                break;
+            }
+
+            if(errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+            {
+                break;
+            }
+
+            // only a listener that is itself broken ends the proxy; anything else failed for one client
+            if(errno == EBADF || errno == EINVAL || errno == ENOTSOCK || errno == EFAULT)
+            {
+                DC_ERROR_RAISE_ERRNO(err, errno);
+                break;
+            }
+
+            route->proxy->stats.dropped++;
+            continue;
+        }
+
+        open_session(env, err, route, fd, &addr);
+
+        if(dc_error_has_error(err))
+        {
+            fprintf(stderr, "Dropping %s:%d: %s\n", dc_inet_ntoa(env, addr.sin_addr), dc_ntohs(env, addr.sin_port), dc_error_get_message(err));    // NOLINT(cert-err33-c,concurrency-mt-unsafe)
+            dc_error_reset(err);
+            route->proxy->stats.dropped++;
+        }
+    }
+}
+
+static void on_connect(const struct dc_env *env, struct dc_error *err, struct event_loop *loop, struct event_source *source, uint32_t events)
+{
+    struct proxy_session *session;
+    int error;
+
+    DC_TRACE(env);
+    session = source->data;
+
+    if(session->closed)
+    {
+        return;
+    }
+
+    error = connect_result(source->fd);
+
+    if(error != 0)
+    {
+        abandon_attempt(env, err, session, error);
+        connect_next(env, err, session);
+        return;
+    }
+
+    attach_session(env, err, session);
+}
+
+static void on_session(const struct dc_env *env, struct dc_error *err, struct event_loop *loop, struct event_source *source, uint32_t events)
+{
+    struct proxy_session *session;
+    struct proxy *proxy;
+
+    DC_TRACE(env);
+    session = source->data;
+    proxy = session->proxy;
+
+    if(session->closed)
+    {
+        return;
+    }
+
+    // edge triggered, so both directions are pumped until neither can move another byte
+    if(!pump(&session->flows[UPSTREAM], &proxy->stats.half_closes) || !pump(&session->flows[DOWNSTREAM], &proxy->stats.half_closes))
+    {
+        close_session(env, err, proxy, session, true);
+        return;
+    }
+
+    if(session->flows[UPSTREAM].shut && session->flows[DOWNSTREAM].shut)
+    {
+        close_session(env, err, proxy, session, false);
+    }
+}
+
+static void on_clock(const struct dc_env *env, struct dc_error *err, struct event_loop *loop, struct event_source *source, uint32_t events)
+{
+    struct proxy *proxy;
+
+    DC_TRACE(env);
+    proxy = source->data;
+    timer_wheel_expire(env, err, &proxy->wheel);
+}
+
+static void on_signal(const struct dc_env *env, struct dc_error *err, struct event_loop *loop, struct event_source *source, uint32_t events)
+{
+    struct signalfd_siginfo info;
+
+    DC_TRACE(env);
+
+    while(read(source->fd, &info, sizeof(info)) == sizeof(info))
+    {
+        loop->running = false;
+    }
+}
+
+static void on_accept_retry(const struct dc_env *env, struct dc_error *err, struct timer *timer)
+{
+    DC_TRACE(env);
+    resume_accepting(env, err, timer->data);
+}
+#pragma GCC diagnostic pop
+
+static void on_connect_timeout(const struct dc_env *env, struct dc_error *err, struct timer *timer)
+{
+    struct proxy_session *session;
+
+    DC_TRACE(env);
+    session = timer->data;
+    abandon_attempt(env, err, session, ETIMEDOUT);
+    connect_next(env, err, session);
+}
+
+static void pause_accepting(const struct dc_env *env, struct dc_error *err, struct proxy *proxy)
+{
+    DC_TRACE(env);
+
+    for(size_t i = 0; i < proxy->route_count && dc_error_has_no_error(err); i++)
+    {
+        if(proxy->routes[i].accepting)
+        {
+            event_loop_remove(env, err, &proxy->loop, &proxy->routes[i].listener);
+            proxy->routes[i].accepting = false;
+        }
+    }
+
+    proxy->paused = true;
+    proxy->stats.accept_pauses++;
+
+    // descriptors freed outside a session close come back without anything here to notice it
+    if(dc_error_has_no_error(err))
+    {
+        timer_wheel_schedule(env, err, &proxy->wheel, &proxy->accept_retry, ACCEPT_RETRY_MS);
+    }
+}
+
+static void resume_accepting(const struct dc_env *env, struct dc_error *err, struct proxy *proxy)
+{
+    DC_TRACE(env);
+
+    if(!proxy->paused || !proxy->loop.running || dc_error_has_error(err))
+    {
+        return;
+    }
+
+    timer_wheel_cancel(env, err, &proxy->wheel, &proxy->accept_retry);
+
+    for(size_t i = 0; i < proxy->route_count && dc_error_has_no_error(err); i++)
+    {
+        if(!proxy->routes[i].accepting)
+        {
+            event_loop_add(env, err, &proxy->loop, &proxy->routes[i].listener, EPOLLIN);
+            proxy->routes[i].accepting = dc_error_has_no_error(err);
+        }
+    }
+
+    proxy->paused = false;
+}
+
+static void open_session(const struct dc_env *env, struct dc_error *err, struct proxy_route *route, int fd, const struct sockaddr_in *addr)
+{
+    struct proxy_session *session;
+    struct proxy *proxy;
+
+    DC_TRACE(env);
+    proxy = route->proxy;
+    printf("Accepted from %s:%d\n", dc_inet_ntoa(env, addr->sin_addr), dc_ntohs(env, addr->sin_port));  // NOLINT(concurrency-mt-unsafe)
+    session = dc_calloc(env, err, 1, sizeof(*session));
+
+    if(dc_error_has_error(err))
+    {
+        abort_socket(fd);
+        return;
+    }
+
+    session->proxy = proxy;
+    session->route = route;
+    session->addr = *addr;
+    session->client.fd = fd;
+    session->client.handler = on_session;
+    session->client.data = session;
+    session->upstream.fd = -1;
+    session->upstream.data = session;
+    timer_init(&session->connect_timer, on_connect_timeout, session);
+
+    // the client waits in its socket buffer, outside the loop, until the upstream connection is up
+    session->next = proxy->sessions;
+
+    if(proxy->sessions != NULL)
+    {
+        proxy->sessions->prev = session;
+    }
+
+    proxy->sessions = session;
+    session->target = route->next;
+    route->next = (route->next + 1) % route->target_count;
+    connect_next(env, err, session);
+}
+
+static void connect_next(const struct dc_env *env, struct dc_error *err, struct proxy_session *session)
+{
+    struct proxy_route *route;
+    struct proxy *proxy;
+
+    DC_TRACE(env);
+    route = session->route;
+    proxy = session->proxy;
+
+    // round robin across the route's targets, moving on to the next one as each attempt fails rather than waiting on it
+    while(session->tried < route->target_count)
+    {
+        const struct proxy_target *target;
+
+        target = &route->targets[session->target];
+
+        while(session->address < target->address_count)
+        {
+            int fd;
+
+            fd = connect_start(env, &target->options, &target->addresses[session->address++], &session->error);
+
+            if(fd == -1)
+            {
+                continue;
+            }
+
+            session->upstream.fd = fd;
+            session->upstream.handler = on_connect;
+            event_loop_add(env, err, &proxy->loop, &session->upstream, EPOLLOUT);
+
+            if(dc_error_has_error(err))
+            {
+                close(fd);
+                session->upstream.fd = -1;
+                close_session(env, err, proxy, session, true);
+                return;
+            }
+
+            if(target->options.timeout_ms > 0)
+            {
+                timer_wheel_schedule(env, err, &proxy->wheel, &session->connect_timer, (size_t)target->options.timeout_ms);
+            }
+
+            return;
+        }
+
+        fprintf(stderr, "Connect to %s:%u failed: %s\n", target->options.host, (unsigned int)target->options.port, strerror(session->error));     // NOLINT(cert-err33-c,concurrency-mt-unsafe)
+        session->tried++;
+        session->address = 0;
+        session->target = (session->target + 1) % route->target_count;
+    }
+
+    proxy->stats.connect_failures++;
+    close_session(env, err, proxy, session, true);
+}
+
+static void abandon_attempt(const struct dc_env *env, struct dc_error *err, struct proxy_session *session, int error)
+{
+    struct proxy *proxy;
+
+    DC_TRACE(env);
+    proxy = session->proxy;
+    session->error = error;
+    timer_wheel_cancel(env, err, &proxy->wheel, &session->connect_timer);
+    event_loop_remove(env, err, &proxy->loop, &session->upstream);
+    close(session->upstream.fd);
+    session->upstream.fd = -1;
+}
+
+static void attach_session(const struct dc_env *env, struct dc_error *err, struct proxy_session *session)
+{
+    struct proxy_route *route;
+    struct proxy *proxy;
+    int fd;
+    int upstream_fd;
+
+    DC_TRACE(env);
+    proxy = session->proxy;
+    route = session->route;
+    fd = session->client.fd;
+    upstream_fd = session->upstream.fd;
+    timer_wheel_cancel(env, err, &proxy->wheel, &session->connect_timer);
+
+    // out of pipes is out of descriptors, which costs this client and not the proxy
+    if(!open_flow(&session->flows[UPSTREAM], fd, upstream_fd, proxy->pipe_size, &proxy->stats.upstream_bytes))
+    {
+        DC_ERROR_RAISE_ERRNO(err, errno);
+        goto UPSTREAM_FLOW_FAIL;
+    }
+
+    if(!open_flow(&session->flows[DOWNSTREAM], upstream_fd, fd, proxy->pipe_size, &proxy->stats.downstream_bytes))
+    {
+        DC_ERROR_RAISE_ERRNO(err, errno);
+        goto DOWNSTREAM_FLOW_FAIL;
+    }
+
+    // modifying rearms the edge, so anything the upstream sent along with its SYN-ACK is not missed
+    session->upstream.handler = on_session;
+    event_loop_modify(env, err, &proxy->loop, &session->upstream, SESSION_EVENTS);
+
+    if(dc_error_has_error(err))
+    {
+        goto UPSTREAM_MODIFY_FAIL;
+    }
+
+    event_loop_add(env, err, &proxy->loop, &session->client, SESSION_EVENTS);
+
+    if(dc_error_has_error(err))
+    {
+        goto UPSTREAM_MODIFY_FAIL;
+    }
+
+    session->connected = true;
+    proxy->active++;
+    proxy->stats.sessions++;
+    route->sessions++;
+
+    if(proxy->active > proxy->stats.max_sessions)
+    {
+        proxy->stats.max_sessions = proxy->active;
+    }
+
+    return;
+
+    UPSTREAM_MODIFY_FAIL:
+    close_flow(&session->flows[DOWNSTREAM]);
+
+    DOWNSTREAM_FLOW_FAIL:
+    close_flow(&session->flows[UPSTREAM]);
+
+    UPSTREAM_FLOW_FAIL:
+    fprintf(stderr, "Dropping %s:%d: %s\n", dc_inet_ntoa(env, session->addr.sin_addr), dc_ntohs(env, session->addr.sin_port), dc_error_get_message(err));    // NOLINT(cert-err33-c,concurrency-mt-unsafe)
+    dc_error_reset(err);
+    proxy->stats.dropped++;
+    close_session(env, err, proxy, session, true);
+}
+
+static void resolve_targets(const struct dc_env *env, struct dc_error *err, struct proxy_route *route)
+{
+    DC_TRACE(env);
+
+    for(size_t i = 0; i < route->target_count; i++)
+    {
+        struct proxy_target *target;
+
+        target = &route->targets[i];
+        target->address_count = connect_resolve(env, err, &target->options, target->addresses, CONNECT_MAX_ADDRESSES);
+
+        if(dc_error_has_error(err))
+        {
+            fprintf(stderr, "Cannot resolve %s\n", target->options.host);     // NOLINT(cert-err33-c)
+            return;
+        }
+    }
+}
+
+static void parse_target(const struct dc_env *env, struct dc_error *err, struct connect_options *target, char *spec)
+{
+    char *port;
+
+    DC_TRACE(env);
+    port = dc_strrchr(env, spec, ':');
+
+    if(port == NULL || port == spec)
+    {
+        DC_ERROR_RAISE_USER(err, "a route target is host:port", 2);
+        return;
+    }
+
+    *port++ = '\0';
+    target->host = spec;
+    target->port = parse_port(env, err, port, 10);     // NOLINT(cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers)
+}
+
+static bool open_flow(struct proxy_flow *flow, int from_fd, int to_fd, size_t pipe_size, uint64_t *bytes)
+{
+    int size;
+
+    flow->from_fd = from_fd;
+    flow->to_fd = to_fd;
+    flow->bytes = bytes;
+
+    if(pipe2(flow->pipe_fds, O_NONBLOCK | O_CLOEXEC) == -1)
+    {
+        return false;
+    }
+
+    // best effort: an unprivileged process may be capped below the requested size
+    fcntl(flow->pipe_fds[1], F_SETPIPE_SZ, (int)pipe_size);
+    size = fcntl(flow->pipe_fds[1], F_GETPIPE_SZ);
+    flow->capacity = size > 0 ? (size_t)size : pipe_size;
+
+    return true;
+}
+
+static void close_flow(struct proxy_flow *flow)
+{
+    close(flow->pipe_fds[0]);
+    close(flow->pipe_fds[1]);
+}
+
+static bool pump(struct proxy_flow *flow, size_t *half_closes)
+{
+    bool progress;
+
+    do
+    {
+        ssize_t nbytes;
+
+        progress = false;
+
+        if(!flow->eof && flow->pending < flow->capacity)
+        {
+            nbytes = splice(flow->from_fd, NULL, flow->pipe_fds[1], NULL, flow->capacity - flow->pending, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+
+            if(nbytes > 0)
+            {
+                flow->pending += (size_t)nbytes;
+                progress = true;
+            }
+            else if(nbytes == 0)
+            {
+                flow->eof = true;
+            }
+            else if(errno != EAGAIN && errno != EINTR)
+            {
+                return false;
+            }
+        }
+
+        if(flow->pending > 0)
+        {
+            nbytes = splice(flow->pipe_fds[0], NULL, flow->to_fd, NULL, flow->pending, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+
+            if(nbytes > 0)
+            {
+                flow->pending -= (size_t)nbytes;
+                *flow->bytes += (uint64_t)nbytes;
+                progress = true;
+            }
+            else if(nbytes == -1 && errno != EAGAIN && errno != EINTR)
+            {
+                return false;
+            }
+        }
+    }
+    while(progress);
+
+    // pass the FIN on only once everything before it has been delivered
+    if(flow->eof && flow->pending == 0 && !flow->shut)
+    {
+        shutdown(flow->to_fd, SHUT_WR);
+        flow->shut = true;
+        (*half_closes)++;
+    }
+
+    return true;
+}
+
+static void close_session(const struct dc_env *env, struct dc_error *err, struct proxy *proxy, struct proxy_session *session, bool reset)
+{
+    DC_TRACE(env);
+    printf("Closing %s:%d\n", dc_inet_ntoa(env, session->addr.sin_addr), dc_ntohs(env, session->addr.sin_port));   // NOLINT(concurrency-mt-unsafe)
+    timer_wheel_cancel(env, err, &proxy->wheel, &session->connect_timer);
+
+    // a session still connecting has only its upstream attempt in the loop, and no flows yet
+    if(session->connected)
+    {
+        event_loop_remove(env, err, &proxy->loop, &session->client);
+        close_flow(&session->flows[UPSTREAM]);
+        close_flow(&session->flows[DOWNSTREAM]);
+        proxy->active--;
+
+        if(reset)
+        {
+            proxy->stats.resets++;
+        }
+    }
+
+    if(session->upstream.fd != -1)
+    {
+        event_loop_remove(env, err, &proxy->loop, &session->upstream);
+    }
+
+    // a reset on one side is passed on as a reset, not a clean close
+    if(reset)
+    {
+        abort_socket(session->client.fd);
+    }
+    else
+    {
+        close(session->client.fd);
+    }
+
+    if(session->upstream.fd != -1)
+    {
+        if(reset)
+        {
+            abort_socket(session->upstream.fd);
+        }
+        else
+        {
+            close(session->upstream.fd);
+        }
+    }
+
+    if(session->prev != NULL)
+    {
+        session->prev->next = session->next;
+    }
+    else
+    {
+        proxy->sessions = session->next;
+    }
+
+    if(session->next != NULL)
+    {
+        session->next->prev = session->prev;
+    }
+
+    session->closed = true;
+    session->next = proxy->closed;
+    proxy->closed = session;
+    resume_accepting(env, err, proxy);
+}
+
+static void reap_closed(const struct dc_env *env, struct proxy *proxy)
+{
+    DC_TRACE(env);
+
+    while(proxy->closed != NULL)
+    {
+        struct proxy_session *session;
+
+        session = proxy->closed;
+        proxy->closed = session->next;
+        dc_free(env, session);
+    }
+}
+
+static void open_signals(const struct dc_env *env, struct dc_error *err, struct proxy *proxy)
+{
+    sigset_t mask;
+
+    DC_TRACE(env);
+    dc_sigemptyset(env, err, &mask);
+    dc_sigaddset(env, err, &mask, SIGINT);
+    dc_sigaddset(env, err, &mask, SIGTERM);
+    dc_sigprocmask(env, err, SIG_BLOCK, &mask, &proxy->saved_mask);
+
+    if(dc_error_has_error(err))
+    {
+        return;
+    }
+
+    proxy->signals.fd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+
+    if(proxy->signals.fd == -1)
+    {
+        DC_ERROR_RAISE_ERRNO(err, errno);
+        dc_sigprocmask(env, err, SIG_SETMASK, &proxy->saved_mask, NULL);
+        return;
+    }
+
+    proxy->signals.handler = on_signal;
+    proxy->signals.data = proxy;
+    event_loop_add(env, err, &proxy->loop, &proxy->signals, EPOLLIN);
+
+    if(dc_error_has_error(err))
+    {
+        close_signals(env, err, proxy);
+    }
+}
+
+static void close_signals(const struct dc_env *env, struct dc_error *err, struct proxy *proxy)
+{
+    DC_TRACE(env);
+
+    if(proxy->signals.fd == -1)
+    {
+        return;
+    }
+
+    dc_close(env, err, proxy->signals.fd);
+    proxy->signals.fd = -1;
+    dc_sigprocmask(env, err, SIG_SETMASK, &proxy->saved_mask, NULL);
+}
+
+static void abort_socket(int fd)
+{
+    struct linger linger;
+
+    linger.l_onoff = 1;
+    linger.l_linger = 0;
+    setsockopt(fd, SOL_SOCKET, SO_LINGER, &linger, sizeof(linger));
+    close(fd);
+}
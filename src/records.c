@@ -0,0 +1,245 @@
+#include "records.h"
+#include "buffer_pool.h"
+#include "copy.h"
+#include <dc_c/dc_string.h>
+#include <dc_posix/dc_unistd.h>
+#include <string.h>
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+
+static record_scanner select_scanner(void);
+static size_t scan_memchr(const char *buffer, size_t start, size_t length, char delimiter, size_t *end);
+#if defined(__x86_64__)
+static size_t scan_sse2(const char *buffer, size_t start, size_t length, char delimiter, size_t *end);
+static size_t scan_avx2(const char *buffer, size_t start, size_t length, char delimiter, size_t *end);
+#endif
+
+
+// NOLINTBEGIN(modernize-macro-to-enum)
+#define SSE2_WIDTH 16
+#define AVX2_WIDTH 32
+//NOLINTEND(modernize-macro-to-enum)
+
+
+void record_framer_init(const struct dc_env *env, struct dc_error *err, struct record_framer *framer, int to_fd, size_t size, char delimiter)
+{
+    DC_TRACE(env);
+    dc_memset(env, framer, 0, sizeof(*framer));
+    framer->to_fd = to_fd;
+    framer->size = size;
+    framer->delimiter = delimiter;
+    framer->scan = select_scanner();
+    framer->buffer = buffer_pool_acquire(env, err, size);
+}
+
+char *record_framer_reserve(struct record_framer *framer, size_t *available)
+{
+    *available = framer->size - framer->used;
+
+    return &framer->buffer[framer->used];
+}
+
+void record_framer_commit(const struct dc_env *env, struct dc_error *err, struct record_framer *framer, size_t count)
+{
+    size_t start;
+    size_t end;
+
+    DC_TRACE(env);
+    start = framer->used;
+    end = 0;
+    framer->used += count;
+
+    // the carried tail holds no delimiter, so only the new bytes need scanning
+    framer->stats.records += framer->scan(framer->buffer, start, framer->used, framer->delimiter, &end);
+
+    if(end == 0)
+    {
+        if(framer->used < framer->size)
+        {
+            return;
+        }
+
+        // a record longer than the buffer can never be held whole
+        framer->stats.oversized++;
+        end = framer->used;
+    }
+
+    write_fully(env, err, framer->to_fd, framer->buffer, end);
+    framer->stats.batches++;
+    framer->used -= end;
+    dc_memmove(env, framer->buffer, &framer->buffer[end], framer->used);
+}
+
+void record_framer_finish(const struct dc_env *env, struct dc_error *err, struct record_framer *framer)
+{
+    DC_TRACE(env);
+
+    if(framer->used == 0)
+    {
+        return;
+    }
+
+    write_fully(env, err, framer->to_fd, framer->buffer, framer->used);
+    framer->stats.records++;
+    framer->stats.batches++;
+    framer->used = 0;
+}
+
+void record_framer_discard(struct record_framer *framer)
+{
+    framer->stats.discarded += framer->used;
+    framer->used = 0;
+}
+
+void record_framer_destroy(const struct dc_env *env, struct record_framer *framer)
+{
+    DC_TRACE(env);
+    buffer_pool_release(env, framer->buffer, framer->size);
+    framer->buffer = NULL;
+}
+
+void copy_records(const struct dc_env *env, struct dc_error *err, int from_fd, int to_fd, size_t count, char delimiter, struct record_stats *stats)
+{
+    struct record_framer framer;
+
+    DC_TRACE(env);
+    record_framer_init(env, err, &framer, to_fd, count, delimiter);
+
+    if(dc_error_has_error(err))
+    {
+        goto INIT_FAIL;
+    }
+
+    for(;;)
+    {
+        char *buffer;
+        size_t nbytes;
+        ssize_t rbytes;
+
+        buffer = record_framer_reserve(&framer, &nbytes);
+        rbytes = dc_read(env, err, from_fd, buffer, nbytes);
+
+        if(dc_error_has_error(err))
+        {
+            if(dc_error_is_errno(err, EINTR))
+            {
+                dc_error_reset(err);
+            }
+
+            goto READ_FAIL;
+        }
+
+        if(rbytes == 0)
+        {
+            record_framer_finish(env, err, &framer);
+            break;
+        }
+
+        record_framer_commit(env, err, &framer, (size_t)rbytes);
+
+        if(dc_error_has_error(err))
+        {
+            goto WRITE_FAIL;
+        }
+    }
+
+    READ_FAIL:
+    WRITE_FAIL:
+    record_framer_discard(&framer);
+    *stats = framer.stats;
+    record_framer_destroy(env, &framer);
+
+    INIT_FAIL:
+    {
+    }
+}
+
+static record_scanner select_scanner(void)
+{
+#if defined(__x86_64__)
+    __builtin_cpu_init();
+
+    if(__builtin_cpu_supports("avx2"))
+    {
+        return scan_avx2;
+    }
+
+    return scan_sse2;
+#else
+    return scan_memchr;
+#endif
+}
+
+static size_t scan_memchr(const char *buffer, size_t start, size_t length, char delimiter, size_t *end)
+{
+    const char *found;
+    size_t records;
+
+    records = 0;
+
+    while(start < length && (found = memchr(&buffer[start], delimiter, length - start)) != NULL)
+    {
+        start = (size_t)(found - buffer) + 1;
+        *end = start;
+        records++;
+    }
+
+    return records;
+}
+
+#if defined(__x86_64__)
+static size_t scan_sse2(const char *buffer, size_t start, size_t length, char delimiter, size_t *end)
+{
+    __m128i needle;
+    size_t records;
+
+    needle = _mm_set1_epi8(delimiter);
+    records = 0;
+
+    for(; start + SSE2_WIDTH <= length; start += SSE2_WIDTH)
+    {
+        __m128i chunk;
+        unsigned int mask;
+
+        chunk = _mm_loadu_si128((const __m128i *)&buffer[start]);     // NOLINT(cppcoreguidelines-pro-type-cstyle-cast)
+        mask = (unsigned int)_mm_movemask_epi8(_mm_cmpeq_epi8(chunk, needle));
+
+        if(mask != 0)
+        {
+            records += (size_t)__builtin_popcount(mask);
+            *end = start + (sizeof(mask) * 8) - (size_t)__builtin_clz(mask);     // NOLINT(cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers)
+        }
+    }
+
+    return records + scan_memchr(buffer, start, length, delimiter, end);
+}
+
+__attribute__((target("avx2")))
+static size_t scan_avx2(const char *buffer, size_t start, size_t length, char delimiter, size_t *end)
+{
+    __m256i needle;
+    size_t records;
+
+    needle = _mm256_set1_epi8(delimiter);
+    records = 0;
+
+    for(; start + AVX2_WIDTH <= length; start += AVX2_WIDTH)
+    {
+        __m256i chunk;
+        unsigned int mask;
+
+        chunk = _mm256_loadu_si256((const __m256i *)&buffer[start]);  // NOLINT(cppcoreguidelines-pro-type-cstyle-cast)
+        mask = (unsigned int)_mm256_movemask_epi8(_mm256_cmpeq_epi8(chunk, needle));
+
+        if(mask != 0)
+        {
+            records += (size_t)__builtin_popcount(mask);
+            *end = start + (sizeof(mask) * 8) - (size_t)__builtin_clz(mask);     // NOLINT(cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers)
+        }
+    }
+
+    return records + scan_memchr(buffer, start, length, delimiter, end);
+}
+#endif
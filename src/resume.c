@@ -0,0 +1,524 @@
+#include "resume.h"
+#include <dc_c/dc_stdlib.h>
+#include <dc_posix/dc_unistd.h>
+#include <dc_posix/sys/dc_stat.h>
+#include <endian.h>
+#include <inttypes.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#include <time.h>
+
+
+struct ack_reader
+{
+    char buffer[sizeof(uint64_t)];
+    size_t have;
+};
+
+
+static bool send_transfer(const struct dc_env *env, struct dc_error *err, int from_fd, int to_fd, uint64_t id, uint64_t total, uint64_t *acked, int timeout_ms);
+static bool read_ack(const struct dc_env *env, struct dc_error *err, int fd, struct ack_reader *reader, uint64_t *acked, bool wait);
+static void read_full(const struct dc_env *env, struct dc_error *err, int fd, void *buffer, size_t count);
+static void queue_ack(struct resume_tail *tail);
+static uint64_t transfer_id(int fd, const char *path, const struct stat *file_stat);
+static uint64_t fnv(uint64_t hash, const void *data, size_t length);
+static void put_u64(char *buffer, uint64_t value);
+static uint64_t get_u64(const char *buffer);
+static void pause_ms(size_t ms);
+
+
+// NOLINTBEGIN(modernize-macro-to-enum)
+#define RESUME_MAGIC "DCSNRSM1"
+#define MAGIC_SIZE 8
+#define SEND_CHUNK (16 * 1024 * 1024)
+#define ACK_INTERVAL (4 * 1024 * 1024)
+#define RETRY_DELAY_MS 500
+#define MAX_RETRY_DELAY_MS 30000
+#define HEAD_DIGEST_SIZE 4096
+#define FNV_OFFSET 14695981039346656037ULL
+#define FNV_PRIME 1099511628211ULL
+#define MSEC_PER_SEC 1000
+#define NSEC_PER_MSEC 1000000
+//NOLINTEND(modernize-macro-to-enum)
+
+
+void copy_resumable(const struct dc_env *env, struct dc_error *err, int from_fd, const char *path, int *to_fd, const struct connect_options *connect, size_t attempts)
+{
+    struct sigaction ignore;
+    struct sigaction saved;
+    struct stat file_stat;
+    uint64_t id;
+    uint64_t acked;
+    size_t failures;
+    size_t delay;
+
+    DC_TRACE(env);
+    dc_fstat(env, err, from_fd, &file_stat);
+
+    if(dc_error_has_error(err))
+    {
+        return;
+    }
+
+    if(!S_ISREG(file_stat.st_mode))
+    {
+        DC_ERROR_RAISE_USER(err, "resumable transfers require a regular file", 2);
+        return;
+    }
+
+    // a dropped connection must come back as EPIPE so it can be retried, not kill the process
+    memset(&ignore, 0, sizeof(ignore));
+    ignore.sa_handler = SIG_IGN;
+    sigaction(SIGPIPE, &ignore, &saved);
+    id = transfer_id(from_fd, path, &file_stat);
+    acked = 0;
+    failures = 0;
+    delay = RETRY_DELAY_MS;
+
+    for(;;)
+    {
+        uint64_t previous;
+
+        previous = acked;
+
+        if(*to_fd == -1)
+        {
+            *to_fd = connect_output(env, err, connect);
+        }
+
+        if(dc_error_has_no_error(err) && send_transfer(env, err, from_fd, *to_fd, id, (uint64_t)file_stat.st_size, &acked, connect->timeout_ms))
+        {
+            break;
+        }
+
+        if(dc_error_is_errno(err, EINTR))
+        {
+            dc_error_reset(err);
+            break;
+        }
+
+        // a peer that never answers the hello is not a tail, and reconnecting to it will not change that
+        if(dc_error_is_errno(err, ETIMEDOUT) && acked == 0 && previous == 0)
+        {
+            break;
+        }
+
+        if(acked > previous)
+        {
+            failures = 0;
+            delay = RETRY_DELAY_MS;
+        }
+
+        if(failures++ >= attempts)
+        {
+            break;
+        }
+
+        fprintf(stderr, "Transfer interrupted at %" PRIu64 " of %" PRIu64 ": %s, retrying\n", acked, (uint64_t)file_stat.st_size, dc_error_get_message(err));   // NOLINT(cert-err33-c)
+        dc_error_reset(err);
+
+        if(*to_fd != -1)
+        {
+            close(*to_fd);
+            *to_fd = -1;
+        }
+
+        pause_ms(delay);
+        delay = delay * 2 > MAX_RETRY_DELAY_MS ? MAX_RETRY_DELAY_MS : delay * 2;
+    }
+
+    sigaction(SIGPIPE, &saved, NULL);
+}
+
+bool resume_accept(const struct dc_env *env, struct dc_error *err, struct resume_tail *tail, struct transfer **transfers, int fd)
+{
+    struct transfer *transfer;
+    ssize_t rbytes;
+    uint64_t id;
+
+    DC_TRACE(env);
+    rbytes = read(fd, &tail->hello[tail->have], sizeof(tail->hello) - tail->have);
+
+    if(rbytes == -1)
+    {
+        return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+    }
+
+    if(rbytes == 0)
+    {
+        return false;
+    }
+
+    tail->have += (size_t)rbytes;
+
+    if(tail->have < sizeof(tail->hello))
+    {
+        return true;
+    }
+
+    if(memcmp(tail->hello, RESUME_MAGIC, MAGIC_SIZE) != 0)
+    {
+        return false;
+    }
+
+    id = get_u64(&tail->hello[MAGIC_SIZE]);
+    tail->total = get_u64(&tail->hello[MAGIC_SIZE + sizeof(uint64_t)]);
+
+    for(transfer = *transfers; transfer != NULL && transfer->id != id; transfer = transfer->next)
+    {
+    }
+
+    if(transfer == NULL)
+    {
+        transfer = dc_calloc(env, err, 1, sizeof(*transfer));
+
+        if(dc_error_has_error(err))
+        {
+            return false;
+        }
+
+        transfer->id = id;
+        transfer->next = *transfers;
+        *transfers = transfer;
+    }
+
+    // finished transfers are remembered too, so a head that lost the final ack learns it has nothing left to send
+    tail->transfer = transfer;
+    tail->offset = transfer->committed;
+    tail->ready = true;
+    resume_ack(env, err, tail, fd);
+
+    return dc_error_has_no_error(err);
+}
+
+size_t resume_limit(const struct resume_tail *tail, size_t count)
+{
+    if(tail->total - tail->offset < count)
+    {
+        return (size_t)(tail->total - tail->offset);
+    }
+
+    return count;
+}
+
+bool resume_advance(struct resume_tail *tail, size_t count)
+{
+    tail->offset += count;
+    tail->transfer->committed = tail->offset;
+
+    return tail->offset == tail->total || tail->offset - tail->acked >= ACK_INTERVAL;
+}
+
+void resume_ack(const struct dc_env *env, struct dc_error *err, struct resume_tail *tail, int fd)
+{
+    DC_TRACE(env);
+    tail->acked = tail->offset;
+    queue_ack(tail);
+    resume_flush(env, err, tail, fd);
+}
+
+void resume_flush(const struct dc_env *env, struct dc_error *err, struct resume_tail *tail, int fd)
+{
+    DC_TRACE(env);
+
+    // whatever the socket will not take now waits for EPOLLOUT; the head blocks on the final ack, so none may be lost
+    while(tail->ack_unsent > 0)
+    {
+        ssize_t wbytes;
+
+        wbytes = write(fd, &tail->ack[sizeof(tail->ack) - tail->ack_unsent], tail->ack_unsent);
+
+        if(wbytes == -1)
+        {
+            if(errno == EINTR)
+            {
+                continue;
+            }
+
+            // a head that is gone will reconnect and resume from what was committed
+            if(errno == EPIPE || errno == ECONNRESET)
+            {
+                tail->ack_unsent = 0;
+                tail->ack_queued = false;
+            }
+            else if(errno != EAGAIN && errno != EWOULDBLOCK)
+            {
+                DC_ERROR_RAISE_ERRNO(err, errno);
+            }
+
+            return;
+        }
+
+        tail->ack_unsent -= (size_t)wbytes;
+
+        if(tail->ack_unsent == 0 && tail->ack_queued)
+        {
+            tail->ack_queued = false;
+            queue_ack(tail);
+        }
+    }
+}
+
+bool resume_ack_pending(const struct resume_tail *tail)
+{
+    return tail->ack_unsent > 0;
+}
+
+void resume_destroy(const struct dc_env *env, struct transfer **transfers)
+{
+    DC_TRACE(env);
+
+    while(*transfers != NULL)
+    {
+        struct transfer *transfer;
+
+        transfer = *transfers;
+        *transfers = transfer->next;
+        dc_free(env, transfer);
+    }
+}
+
+static bool send_transfer(const struct dc_env *env, struct dc_error *err, int from_fd, int to_fd, uint64_t id, uint64_t total, uint64_t *acked, int timeout_ms)
+{
+    struct ack_reader reader;
+    struct pollfd pfd;
+    char hello[RESUME_HELLO_SIZE];
+    char reply[sizeof(uint64_t)];
+    off_t offset;
+    int ready;
+
+    DC_TRACE(env);
+    memcpy(hello, RESUME_MAGIC, MAGIC_SIZE);
+    put_u64(&hello[MAGIC_SIZE], id);
+    put_u64(&hello[MAGIC_SIZE + sizeof(uint64_t)], total);
+    dc_write(env, err, to_fd, hello, sizeof(hello));
+
+    if(dc_error_has_error(err))
+    {
+        return false;
+    }
+
+    // a one-way relay in between swallows the hello and never answers, so the wait is bounded like the connect
+    pfd.fd = to_fd;
+    pfd.events = POLLIN;
+    ready = poll(&pfd, 1, timeout_ms > 0 ? timeout_ms : -1);
+
+    if(ready == -1)
+    {
+        DC_ERROR_RAISE_ERRNO(err, errno);
+        return false;
+    }
+
+    if(ready == 0)
+    {
+        fprintf(stderr, "No reply to the resume hello: -Q needs the receiving dcnetworksnake -Q -i as its direct peer\n");     // NOLINT(cert-err33-c)
+        DC_ERROR_RAISE_ERRNO(err, ETIMEDOUT);
+        return false;
+    }
+
+    read_full(env, err, to_fd, reply, sizeof(reply));
+
+    if(dc_error_has_error(err))
+    {
+        return false;
+    }
+
+    *acked = get_u64(reply);
+
+    if(*acked > total)
+    {
+        DC_ERROR_RAISE_USER(err, "the tail has more of this transfer than the file holds", 2);
+        return false;
+    }
+
+    reader.have = 0;
+    offset = (off_t)*acked;
+
+    while((uint64_t)offset < total)
+    {
+        size_t length;
+
+        length = (size_t)(total - (uint64_t)offset);
+
+        if(length > SEND_CHUNK)
+        {
+            length = SEND_CHUNK;
+        }
+
+        if(sendfile(to_fd, from_fd, &offset, length) == -1)
+        {
+            DC_ERROR_RAISE_ERRNO(err, errno);
+            return false;
+        }
+
+        if(!read_ack(env, err, to_fd, &reader, acked, false))
+        {
+            return false;
+        }
+    }
+
+    // the file is only done once the tail says every byte reached its output
+    while(*acked < total)
+    {
+        if(!read_ack(env, err, to_fd, &reader, acked, true))
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static bool read_ack(const struct dc_env *env, struct dc_error *err, int fd, struct ack_reader *reader, uint64_t *acked, bool wait)
+{
+    DC_TRACE(env);
+
+    for(;;)
+    {
+        ssize_t rbytes;
+
+        rbytes = recv(fd, &reader->buffer[reader->have], sizeof(reader->buffer) - reader->have, wait ? 0 : MSG_DONTWAIT);
+
+        if(rbytes == -1)
+        {
+            if(!wait && (errno == EAGAIN || errno == EWOULDBLOCK))
+            {
+                return true;
+            }
+
+            DC_ERROR_RAISE_ERRNO(err, errno);
+            return false;
+        }
+
+        if(rbytes == 0)
+        {
+            DC_ERROR_RAISE_USER(err, "the tail closed the connection", 2);
+            return false;
+        }
+
+        reader->have += (size_t)rbytes;
+
+        if(reader->have == sizeof(reader->buffer))
+        {
+            *acked = get_u64(reader->buffer);
+            reader->have = 0;
+
+            if(wait)
+            {
+                return true;
+            }
+        }
+    }
+}
+
+static void read_full(const struct dc_env *env, struct dc_error *err, int fd, void *buffer, size_t count)
+{
+    char *position;
+
+    DC_TRACE(env);
+    position = buffer;
+
+    while(count > 0)
+    {
+        ssize_t rbytes;
+
+        rbytes = dc_read(env, err, fd, position, count);
+
+        if(dc_error_has_error(err))
+        {
+            return;
+        }
+
+        if(rbytes == 0)
+        {
+            DC_ERROR_RAISE_USER(err, "the tail closed the connection", 2);
+            return;
+        }
+
+        position += rbytes;
+        count -= (size_t)rbytes;
+    }
+}
+
+static void queue_ack(struct resume_tail *tail)
+{
+    // an ack is only started whole; a newer offset waits for the one in flight, and then the latest goes out
+    if(tail->ack_unsent > 0)
+    {
+        tail->ack_queued = true;
+        return;
+    }
+
+    put_u64(tail->ack, tail->acked);
+    tail->ack_unsent = sizeof(tail->ack);
+}
+
+static uint64_t transfer_id(int fd, const char *path, const struct stat *file_stat)
+{
+    uint64_t fields[5];
+    char head[HEAD_DIGEST_SIZE];
+    ssize_t rbytes;
+    uint64_t hash;
+
+    // the same file, unchanged, always maps to the same transfer so a restarted head finds its checkpoint
+    fields[0] = (uint64_t)file_stat->st_dev;
+    fields[1] = (uint64_t)file_stat->st_ino;
+    fields[2] = (uint64_t)file_stat->st_size;
+    fields[3] = (uint64_t)file_stat->st_mtim.tv_sec;
+    fields[4] = (uint64_t)file_stat->st_mtim.tv_nsec;
+    hash = fnv(FNV_OFFSET, fields, sizeof(fields));
+
+    // inode numbers repeat across hosts, so two heads sharing a tail are told apart by name and content as well
+    hash = fnv(hash, path, strlen(path));
+    rbytes = pread(fd, head, sizeof(head), 0);
+
+    if(rbytes > 0)
+    {
+        hash = fnv(hash, head, (size_t)rbytes);
+    }
+
+    return hash;
+}
+
+static uint64_t fnv(uint64_t hash, const void *data, size_t length)
+{
+    const unsigned char *bytes;
+
+    bytes = data;
+
+    for(size_t i = 0; i < length; i++)
+    {
+        hash ^= bytes[i];
+        hash *= FNV_PRIME;
+    }
+
+    return hash;
+}
+
+static void put_u64(char *buffer, uint64_t value)
+{
+    value = htobe64(value);
+    memcpy(buffer, &value, sizeof(value));
+}
+
+static uint64_t get_u64(const char *buffer)
+{
+    uint64_t value;
+
+    memcpy(&value, buffer, sizeof(value));
+
+    return be64toh(value);
+}
+
+static void pause_ms(size_t ms)
+{
+    struct timespec delay;
+
+    delay.tv_sec = (time_t)(ms / MSEC_PER_SEC);
+    delay.tv_nsec = (long)(ms % MSEC_PER_SEC) * NSEC_PER_MSEC;
+    nanosleep(&delay, NULL);
+}
@@ -0,0 +1,1343 @@
+#include "server.h"
+#include "buffer_pool.h"
+#include "copy.h"
+#include "upgrade.h"
+#include <dc_c/dc_stdlib.h>
+#include <dc_c/dc_string.h>
+#include <dc_posix/arpa/dc_inet.h>
+#include <dc_posix/dc_signal.h>
+#include <dc_posix/dc_unistd.h>
+#include <dc_posix/sys/dc_socket.h>
+#include <limits.h>
+#include <netinet/tcp.h>
+#include <stdio.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/wait.h>
+
+
+static void on_accept(const struct dc_env *env, struct dc_error *err, struct event_loop *loop, struct event_source *source, uint32_t events);
+static void on_readable(const struct dc_env *env, struct dc_error *err, struct event_loop *loop, struct event_source *source, uint32_t events);
+static size_t receive(const struct dc_env *env, struct dc_error *err, struct connection *connection);
+static void on_timer(const struct dc_env *env, struct dc_error *err, struct event_loop *loop, struct event_source *source, uint32_t events);
+static void on_clock(const struct dc_env *env, struct dc_error *err, struct event_loop *loop, struct event_source *source, uint32_t events);
+static void on_signal(const struct dc_env *env, struct dc_error *err, struct event_loop *loop, struct event_source *source, uint32_t events);
+static void on_drain_deadline(const struct dc_env *env, struct dc_error *err, struct timer *timer);
+static void on_tune(const struct dc_env *env, struct dc_error *err, struct timer *timer);
+static void on_accept_retry(const struct dc_env *env, struct dc_error *err, struct timer *timer);
+static void pause_accepting(const struct dc_env *env, struct dc_error *err, struct server *server);
+static void resume_accepting(const struct dc_env *env, struct dc_error *err, struct server *server);
+static void stop_accepting(const struct dc_env *env, struct dc_error *err, struct server *server);
+static void resize_buffer(const struct dc_env *env, struct dc_error *err, struct server *server, uint64_t bdp);
+static void open_signals(const struct dc_env *env, struct dc_error *err, struct server *server);
+static void close_signals(const struct dc_env *env, struct dc_error *err, struct server *server);
+static void begin_drain(const struct dc_env *env, struct dc_error *err, struct server *server);
+static void finish_queue(const struct dc_env *env, struct dc_error *err, struct server *server);
+static void upgrade(const struct dc_env *env, struct dc_error *err, struct server *server);
+static void hand_off_connections(const struct dc_env *env, struct dc_error *err, struct server *server, struct handoff *handoff);
+static void adopt(const struct dc_env *env, struct dc_error *err, struct server *server, int fd);
+static void on_read_timeout(const struct dc_env *env, struct dc_error *err, struct timer *timer);
+static void arm_read_timer(const struct dc_env *env, struct dc_error *err, struct server *server, struct connection *connection);
+static void set_write_timeout(const struct dc_env *env, struct dc_error *err, const struct server *server);
+static void watch_acks(const struct dc_env *env, struct dc_error *err, struct server *server, struct connection *connection);
+static void output_failed(struct dc_error *err, struct server *server);
+static void reap_closed(const struct dc_env *env, struct server *server);
+static void enqueue(const struct dc_env *env, struct dc_error *err, struct server *server, int fd, const struct sockaddr_in *addr);
+static void activate(const struct dc_env *env, struct dc_error *err, struct server *server);
+static void close_connection(const struct dc_env *env, struct dc_error *err, struct server *server, struct connection *connection);
+static void detach_connection(const struct dc_env *env, struct dc_error *err, struct server *server, struct connection *connection);
+static char *output_reserve(const struct dc_env *env, struct dc_error *err, struct server *server, size_t *count);
+static void output_commit(const struct dc_env *env, struct dc_error *err, struct server *server, size_t count);
+static void sample_accept_queue(struct server *server);
+static void read_listen_counters(uint64_t *overflows, uint64_t *drops);
+
+
+// NOLINTBEGIN(modernize-macro-to-enum)
+#define NETSTAT_LINE_SIZE 4096
+#define TIMER_TICK_MS 10
+#define MSEC_PER_SEC 1000
+#define USEC_PER_MSEC 1000
+#define PORT_LABEL_SIZE 7
+#define MAX_TUNED_BUFFER (4 * 1024 * 1024)
+#define MAX_QUEUED_CLIENTS 1024
+#define ACCEPT_RETRY_MS 100
+//NOLINTEND(modernize-macro-to-enum)
+
+
+void server_init(const struct dc_env *env, struct dc_error *err, struct server *server, const struct server_config *config)
+{
+    DC_TRACE(env);
+    dc_memset(env, server, 0, sizeof(*server));
+    server->config = *config;
+    server->timer.fd = -1;
+    server->signals.fd = -1;
+    timer_init(&server->drain_deadline, on_drain_deadline, server);
+    timer_init(&server->tune_timer, on_tune, server);
+    timer_init(&server->accept_retry, on_accept_retry, server);
+    server->stats.buffer_size = config->buffer_size;
+    read_listen_counters(&server->start_overflows, &server->start_drops);
+    event_loop_init(env, err, &server->loop);
+
+    if(dc_error_has_error(err))
+    {
+        goto LOOP_FAIL;
+    }
+
+    timer_wheel_init(env, err, &server->wheel, TIMER_TICK_MS);
+
+    if(dc_error_has_error(err))
+    {
+        goto WHEEL_FAIL;
+    }
+
+    server->clock.fd = server->wheel.timer_fd;
+    server->clock.handler = on_clock;
+    server->clock.data = server;
+    event_loop_add(env, err, &server->loop, &server->clock, EPOLLIN);
+
+    if(dc_error_has_error(err))
+    {
+        goto CLOCK_FAIL;
+    }
+
+    set_write_timeout(env, err, server);
+
+    if(dc_error_has_error(err))
+    {
+        goto CLOCK_FAIL;
+    }
+
+    open_signals(env, err, server);
+
+    if(dc_error_has_error(err))
+    {
+        goto CLOCK_FAIL;
+    }
+
+    server->listener.fd = config->listen_fd;
+    server->listener.handler = on_accept;
+    server->listener.data = server;
+    event_loop_add(env, err, &server->loop, &server->listener, EPOLLIN);
+    server->accepting = dc_error_has_no_error(err);
+
+    if(dc_error_has_error(err))
+    {
+        goto LISTENER_FAIL;
+    }
+
+    if(config->coalesce_size > 0)
+    {
+        coalescer_init(env, err, &server->coalescer, config->fd_out, config->coalesce_size, config->coalesce_deadline);
+
+        if(dc_error_has_error(err))
+        {
+            goto OUTPUT_FAIL;
+        }
+
+        server->timer.fd = server->coalescer.timer_fd;
+        server->timer.handler = on_timer;
+        server->timer.data = server;
+        event_loop_add(env, err, &server->loop, &server->timer, EPOLLIN);
+
+        if(dc_error_has_error(err))
+        {
+            coalescer_destroy(env, err, &server->coalescer);
+            goto OUTPUT_FAIL;
+        }
+    }
+    else if(config->zerocopy)
+    {
+        zerocopy_ring_init(env, err, &server->ring, config->fd_out, config->buffer_size);
+
+        // a peer that stops reading stops the completions too, so waiting on them is bounded like a write
+        if(config->write_stall_timeout > 0)
+        {
+            server->ring.zc.timeout_ms = config->write_stall_timeout > INT_MAX ? INT_MAX : (int)config->write_stall_timeout;
+        }
+    }
+    else if(config->records)
+    {
+        record_framer_init(env, err, &server->framer, config->fd_out, config->buffer_size, config->delimiter);
+    }
+    // a file output reads straight into its own staging buffer
+    else if(config->file_out == NULL)
+    {
+        server->buffer = buffer_pool_acquire(env, err, config->buffer_size);
+    }
+
+    if(dc_error_has_error(err))
+    {
+        goto OUTPUT_FAIL;
+    }
+
+    if(config->tune_interval > 0)
+    {
+        tcp_telemetry_init(&server->stats.output_tcp, config->fd_out, true);
+        timer_wheel_schedule(env, err, &server->wheel, &server->tune_timer, config->tune_interval);
+    }
+
+    for(size_t i = 0; i < config->inherited_count && dc_error_has_no_error(err); i++)
+    {
+        adopt(env, err, server, config->inherited[i]);
+    }
+
+    if(dc_error_has_no_error(err))
+    {
+        activate(env, err, server);
+    }
+
+    return;
+
+    OUTPUT_FAIL:
+    LISTENER_FAIL:
+    close_signals(env, err, server);
+
+    CLOCK_FAIL:
+    timer_wheel_destroy(env, err, &server->wheel);
+
+    WHEEL_FAIL:
+    event_loop_destroy(env, err, &server->loop);
+
+    LOOP_FAIL:
+    {
+    }
+}
+
+void server_run(const struct dc_env *env, struct dc_error *err, struct server *server)
+{
+    DC_TRACE(env);
+
+    while(server->loop.running)
+    {
+        event_loop_poll(env, err, &server->loop, -1);
+        reap_closed(env, server);
+
+        if(dc_error_has_error(err))
+        {
+            break;
+        }
+    }
+}
+
+void server_destroy(const struct dc_env *env, struct dc_error *err, struct server *server)
+{
+    uint64_t overflows;
+    uint64_t drops;
+
+    DC_TRACE(env);
+    sample_accept_queue(server);
+    read_listen_counters(&overflows, &drops);
+    server->stats.listen_overflows = overflows - server->start_overflows;
+    server->stats.listen_drops = drops - server->start_drops;
+
+    for(const struct connection *connection = server->head; server->draining && connection != NULL; connection = connection->next)
+    {
+        server->stats.abandoned++;
+    }
+
+    while(server->head != NULL)
+    {
+        close_connection(env, err, server, server->head);
+    }
+
+    reap_closed(env, server);
+    resume_destroy(env, &server->transfers);
+
+    if(server->config.coalesce_size > 0)
+    {
+        if(dc_error_has_no_error(err))
+        {
+            coalescer_flush(env, err, &server->coalescer);
+        }
+
+        coalescer_destroy(env, err, &server->coalescer);
+    }
+    else if(server->config.zerocopy)
+    {
+        zerocopy_ring_destroy(env, err, &server->ring);
+    }
+    else if(server->config.records)
+    {
+        server->stats.records = server->framer.stats;
+        record_framer_destroy(env, &server->framer);
+    }
+    else
+    {
+        buffer_pool_release(env, server->buffer, server->config.buffer_size);
+    }
+
+    server->stats.buffer_size = server->config.buffer_size;
+    close_signals(env, err, server);
+    timer_wheel_destroy(env, err, &server->wheel);
+    event_loop_destroy(env, err, &server->loop);
+}
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wunused-parameter"
+static void on_accept(const struct dc_env *env, struct dc_error *err, struct event_loop *loop, struct event_source *source, uint32_t events)
+{
+    struct server *server;
+    size_t batch;
+
+    DC_TRACE(env);
+    server = source->data;
+    batch = 0;
+    sample_accept_queue(server);
+
+    for(;;)
+    {
+        struct sockaddr_in addr;
+        socklen_t addr_len;
+        int fd;
+
+        // clients past the cap wait in the kernel's backlog, which has its own bound, rather than in memory here
+        if(server->queued >= MAX_QUEUED_CLIENTS)
+        {
+            pause_accepting(env, err, server);
+            break;
+        }
+
+        addr_len = sizeof(addr);
+        fd = accept4(source->fd, (struct sockaddr *)&addr, &addr_len, SOCK_NONBLOCK | SOCK_CLOEXEC);
+
+        if(fd == -1)
+        {
+            if(errno == ECONNABORTED || errno == EPROTO)
+            {
+                continue;
+            }
+
+            // out of descriptors or memory is a reason to wait, not to exit: the level-triggered listener would spin otherwise
+            if(errno == EMFILE || errno == ENFILE || errno == ENOBUFS || errno == ENOMEM)
+            {
+                pause_accepting(env, err, server);
+                break;
+            }
+
+            if(errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+            {
+                DC_ERROR_RAISE_ERRNO(err, errno);
+            }
+
+            break;
+        }
+
+        batch++;
+        enqueue(env, err, server, fd, &addr);
+
+        if(dc_error_has_error(err))
+        {
+            break;
+        }
+    }
+
+    server->stats.accepted += batch;
+    server->stats.accept_wakeups++;
+
+    if(batch > server->stats.max_accept_batch)
+    {
+        server->stats.max_accept_batch = batch;
+    }
+
+    if(dc_error_has_no_error(err))
+    {
+        activate(env, err, server);
+    }
+}
+
+static void on_readable(const struct dc_env *env, struct dc_error *err, struct event_loop *loop, struct event_source *source, uint32_t events)
+{
+    struct connection *connection;
+    struct server *server;
+    struct perf_sample before;
+    struct perf_sample after;
+    size_t received;
+
+    DC_TRACE(env);
+    connection = source->data;
+    server = connection->server;
+
+    // a timer earlier in this batch may already have closed the connection
+    if(connection->closed)
+    {
+        return;
+    }
+
+    if(server->config.perf == NULL)
+    {
+        receive(env, err, connection);
+        return;
+    }
+
+    // the whole callback is charged to this client: the read, the engine and the write to the output
+    perf_counters_read(server->config.perf, &before);
+    received = receive(env, err, connection);
+    perf_counters_read(server->config.perf, &after);
+    perf_totals_add(&connection->perf, server->config.perf, &before, &after, received);
+    perf_totals_add(&server->stats.perf, server->config.perf, &before, &after, received);
+}
+
+static size_t receive(const struct dc_env *env, struct dc_error *err, struct connection *connection)
+{
+    struct event_source *source;
+    struct server *server;
+    char *buffer;
+    size_t count;
+    ssize_t rbytes;
+
+    DC_TRACE(env);
+    source = &connection->source;
+    server = connection->server;
+
+    // the handshake comes first, since everything after it, resume hello included, is encrypted
+    if(server->config.tls != NULL && !connection->tls.ready)
+    {
+        bool want_write;
+
+        want_write = connection->tls.want_write;
+
+        if(!tls_accept(env, err, server->config.tls, &connection->tls, source->fd))
+        {
+            close_connection(env, err, server, connection);
+            activate(env, err, server);
+            return 0;
+        }
+
+        // a handshake blocked on a full send buffer waits for EPOLLOUT rather than holding up the loop
+        if(connection->tls.want_write != want_write)
+        {
+            event_loop_modify(env, err, &server->loop, source, (connection->tls.want_write ? EPOLLOUT : EPOLLIN) | EPOLLRDHUP);
+        }
+
+        return 0;
+    }
+
+    if(server->config.resumable && !connection->resume.ready)
+    {
+        if(!resume_accept(env, err, &connection->resume, &server->transfers, source->fd))
+        {
+            close_connection(env, err, server, connection);
+            activate(env, err, server);
+            return 0;
+        }
+
+        watch_acks(env, err, server, connection);
+
+        return 0;
+    }
+
+    // an ack the socket would not take earlier goes out before anything more is read
+    if(server->config.resumable && resume_ack_pending(&connection->resume))
+    {
+        resume_flush(env, err, &connection->resume, source->fd);
+        watch_acks(env, err, server, connection);
+
+        if(dc_error_has_error(err))
+        {
+            return 0;
+        }
+    }
+
+    buffer = output_reserve(env, err, server, &count);
+
+    if(dc_error_has_error(err))
+    {
+        output_failed(err, server);
+        return 0;
+    }
+
+    if(server->config.resumable)
+    {
+        count = resume_limit(&connection->resume, count);
+    }
+
+    if(server->config.tls != NULL)
+    {
+        rbytes = tls_read(&connection->tls, source->fd, buffer, count);
+    }
+    else
+    {
+        rbytes = read(source->fd, buffer, count);
+    }
+
+    if(rbytes > 0)
+    {
+        if(server->config.capture != NULL)
+        {
+            capture_write(env, err, server->config.capture, buffer, (size_t)rbytes);
+
+            if(dc_error_has_error(err))
+            {
+                return 0;
+            }
+        }
+
+        output_commit(env, err, server, (size_t)rbytes);
+
+        if(dc_error_has_error(err))
+        {
+            output_failed(err, server);
+            return (size_t)rbytes;
+        }
+
+        connection->received = true;
+        arm_read_timer(env, err, server, connection);
+
+        // only acknowledge what has actually left for the output
+        if(server->config.resumable && resume_advance(&connection->resume, (size_t)rbytes) && dc_error_has_no_error(err))
+        {
+            if(server->config.coalesce_size > 0)
+            {
+                coalescer_flush(env, err, &server->coalescer);
+            }
+
+            resume_ack(env, err, &connection->resume, source->fd);
+            watch_acks(env, err, server, connection);
+        }
+
+        return (size_t)rbytes;
+    }
+
+    if(rbytes == -1 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+    {
+        return 0;
+    }
+
+    // a clean close ends the last record even without a delimiter, and stages release what they held back for this client
+    if(rbytes == 0 && server->config.records)
+    {
+        record_framer_finish(env, err, &server->framer);
+    }
+
+    if(rbytes == 0 && server->config.transforms != NULL && dc_error_has_no_error(err))
+    {
+        transform_pipeline_flush(env, err, server->config.transforms, server->config.fd_out);
+    }
+
+    close_connection(env, err, server, connection);
+    activate(env, err, server);
+
+    return 0;
+}
+
+static void on_timer(const struct dc_env *env, struct dc_error *err, struct event_loop *loop, struct event_source *source, uint32_t events)
+{
+    struct server *server;
+
+    DC_TRACE(env);
+    server = source->data;
+    coalescer_expire(env, err, &server->coalescer);
+    output_failed(err, server);
+}
+
+static void on_clock(const struct dc_env *env, struct dc_error *err, struct event_loop *loop, struct event_source *source, uint32_t events)
+{
+    struct server *server;
+
+    DC_TRACE(env);
+    server = source->data;
+    timer_wheel_expire(env, err, &server->wheel);
+}
+
+static void on_signal(const struct dc_env *env, struct dc_error *err, struct event_loop *loop, struct event_source *source, uint32_t events)
+{
+    struct signalfd_siginfo info;
+    struct server *server;
+
+    DC_TRACE(env);
+    server = source->data;
+
+    while(read(source->fd, &info, sizeof(info)) == sizeof(info))
+    {
+        if(info.ssi_signo == SIGUSR2)
+        {
+            if(!server->draining)
+            {
+                upgrade(env, err, server);
+            }
+
+            continue;
+        }
+
+        // a second signal while draining gives up on the remaining connections
+        if(server->draining)
+        {
+            loop->running = false;
+            return;
+        }
+
+        begin_drain(env, err, server);
+
+        if(dc_error_has_error(err))
+        {
+            return;
+        }
+    }
+}
+#pragma GCC diagnostic pop
+
+static void enqueue(const struct dc_env *env, struct dc_error *err, struct server *server, int fd, const struct sockaddr_in *addr)
+{
+    struct connection *connection;
+
+    DC_TRACE(env);
+    connection = dc_calloc(env, err, 1, sizeof(*connection));
+
+    if(dc_error_has_error(err))
+    {
+        dc_close(env, err, fd);
+        return;
+    }
+
+    connection->source.fd = fd;
+    connection->source.handler = on_readable;
+    connection->source.data = connection;
+    timer_init(&connection->timer, on_read_timeout, connection);
+    connection->server = server;
+    connection->addr = *addr;
+
+    if(server->config.tune_interval > 0)
+    {
+        tcp_telemetry_init(&connection->tcp, fd, false);
+    }
+
+    if(server->tail == NULL)
+    {
+        server->head = connection;
+    }
+    else
+    {
+        server->tail->next = connection;
+    }
+
+    server->tail = connection;
+    server->queued++;
+    printf("Accepted from %s:%d\n", dc_inet_ntoa(env, addr->sin_addr), dc_ntohs(env, addr->sin_port));  // NOLINT(concurrency-mt-unsafe)
+}
+
+static void activate(const struct dc_env *env, struct dc_error *err, struct server *server)
+{
+    DC_TRACE(env);
+
+    if(server->draining && server->head == NULL)
+    {
+        server->loop.running = false;
+        return;
+    }
+
+    if(server->active || server->head == NULL)
+    {
+        return;
+    }
+
+    event_loop_add(env, err, &server->loop, &server->head->source, EPOLLIN | EPOLLRDHUP);
+
+    if(dc_error_has_no_error(err))
+    {
+        server->active = true;
+        arm_read_timer(env, err, server, server->head);
+    }
+}
+
+static void close_connection(const struct dc_env *env, struct dc_error *err, struct server *server, struct connection *connection)
+{
+    DC_TRACE(env);
+    printf("Closing %s:%d\n", dc_inet_ntoa(env, connection->addr.sin_addr), dc_ntohs(env, connection->addr.sin_port));   // NOLINT(concurrency-mt-unsafe)
+
+    if(server->draining && server->loop.running)
+    {
+        server->stats.drained++;
+    }
+
+    // never let a cut-off record or line run into the next client's stream
+    if(server->config.records && connection == server->head)
+    {
+        record_framer_discard(&server->framer);
+    }
+
+    if(server->config.transforms != NULL && connection == server->head)
+    {
+        transform_pipeline_discard(env, server->config.transforms);
+    }
+
+    if(server->config.unpack != NULL && connection == server->head)
+    {
+        bundle_writer_finish(env, server->config.unpack);
+    }
+
+    // a client's bytes should be in the file once it is gone, not only when the staging buffer next fills
+    if(server->config.file_out != NULL && connection == server->head)
+    {
+        output_file_flush(env, err, server->config.file_out);
+    }
+
+    detach_connection(env, err, server, connection);
+}
+
+static void detach_connection(const struct dc_env *env, struct dc_error *err, struct server *server, struct connection *connection)
+{
+    DC_TRACE(env);
+
+    if(connection == server->head && server->active)
+    {
+        event_loop_remove(env, err, &server->loop, &connection->source);
+        server->active = false;
+    }
+
+    timer_wheel_cancel(env, err, &server->wheel, &connection->timer);
+    tls_session_destroy(&connection->tls);
+    dc_close(env, err, connection->source.fd);
+    server->head = connection->next;
+    server->queued--;
+
+    if(server->head == NULL)
+    {
+        server->tail = NULL;
+    }
+
+    // every close frees a descriptor and a queue slot, either of which may be what accepting was waiting for
+    resume_accepting(env, err, server);
+    connection->closed = true;
+    connection->next = server->closed;
+    server->closed = connection;
+}
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wunused-parameter"
+static void on_drain_deadline(const struct dc_env *env, struct dc_error *err, struct timer *timer)
+{
+    struct server *server;
+
+    DC_TRACE(env);
+    server = timer->data;
+    server->loop.running = false;
+}
+#pragma GCC diagnostic pop
+
+static void on_tune(const struct dc_env *env, struct dc_error *err, struct timer *timer)
+{
+    struct server *server;
+    uint64_t bdp;
+
+    DC_TRACE(env);
+    server = timer->data;
+    bdp = 0;
+
+    if(tcp_telemetry_sample(env, err, &server->stats.output_tcp))
+    {
+        tcp_telemetry_tune(env, err, &server->stats.output_tcp);
+        bdp = server->stats.output_tcp.bdp;
+    }
+
+    // queued clients are only measured once they are the one being relayed
+    if(dc_error_has_no_error(err) && server->active && tcp_telemetry_sample(env, err, &server->head->tcp))
+    {
+        tcp_telemetry_tune(env, err, &server->head->tcp);
+
+        if(server->head->tcp.bdp > bdp)
+        {
+            bdp = server->head->tcp.bdp;
+        }
+    }
+
+    if(dc_error_has_no_error(err))
+    {
+        resize_buffer(env, err, server, bdp);
+    }
+
+    if(dc_error_has_no_error(err))
+    {
+        timer_wheel_schedule(env, err, &server->wheel, &server->tune_timer, server->config.tune_interval);
+    }
+}
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wunused-parameter"
+static void on_accept_retry(const struct dc_env *env, struct dc_error *err, struct timer *timer)
+{
+    DC_TRACE(env);
+    resume_accepting(env, err, timer->data);
+}
+#pragma GCC diagnostic pop
+
+static void pause_accepting(const struct dc_env *env, struct dc_error *err, struct server *server)
+{
+    DC_TRACE(env);
+    stop_accepting(env, err, server);
+    server->stats.accept_pauses++;
+
+    // descriptors held elsewhere in the process come back without a close here to notice it
+    if(dc_error_has_no_error(err))
+    {
+        timer_wheel_schedule(env, err, &server->wheel, &server->accept_retry, ACCEPT_RETRY_MS);
+    }
+}
+
+static void resume_accepting(const struct dc_env *env, struct dc_error *err, struct server *server)
+{
+    DC_TRACE(env);
+
+    if(server->accepting || server->draining || !server->loop.running || server->queued >= MAX_QUEUED_CLIENTS || dc_error_has_error(err))
+    {
+        return;
+    }
+
+    timer_wheel_cancel(env, err, &server->wheel, &server->accept_retry);
+    event_loop_add(env, err, &server->loop, &server->listener, EPOLLIN);
+    server->accepting = dc_error_has_no_error(err);
+}
+
+static void stop_accepting(const struct dc_env *env, struct dc_error *err, struct server *server)
+{
+    DC_TRACE(env);
+
+    if(!server->accepting)
+    {
+        return;
+    }
+
+    event_loop_remove(env, err, &server->loop, &server->listener);
+    server->accepting = false;
+}
+
+static void resize_buffer(const struct dc_env *env, struct dc_error *err, struct server *server, uint64_t bdp)
+{
+    size_t size;
+    char *buffer;
+
+    DC_TRACE(env);
+
+    // only the plain path owns a single buffer that is free to swap between reads
+    if(server->buffer == NULL || bdp <= server->config.buffer_size)
+    {
+        return;
+    }
+
+    size = server->config.buffer_size;
+
+    while(size < bdp && size < MAX_TUNED_BUFFER)
+    {
+        size *= 2;
+    }
+
+    if(size == server->config.buffer_size)
+    {
+        return;
+    }
+
+    buffer = buffer_pool_acquire(env, err, size);
+
+    if(dc_error_has_error(err))
+    {
+        return;
+    }
+
+    buffer_pool_release(env, server->buffer, server->config.buffer_size);
+    server->buffer = buffer;
+    server->config.buffer_size = size;
+    server->stats.buffer_resizes++;
+}
+
+static void open_signals(const struct dc_env *env, struct dc_error *err, struct server *server)
+{
+    sigset_t mask;
+
+    DC_TRACE(env);
+    dc_sigemptyset(env, err, &mask);
+    dc_sigaddset(env, err, &mask, SIGINT);
+    dc_sigaddset(env, err, &mask, SIGTERM);
+    dc_sigaddset(env, err, &mask, SIGUSR2);
+    dc_sigprocmask(env, err, SIG_BLOCK, &mask, &server->saved_mask);
+
+    if(dc_error_has_error(err))
+    {
+        return;
+    }
+
+    server->signals.fd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+
+    if(server->signals.fd == -1)
+    {
+        DC_ERROR_RAISE_ERRNO(err, errno);
+        dc_sigprocmask(env, err, SIG_SETMASK, &server->saved_mask, NULL);
+        return;
+    }
+
+    server->signals.handler = on_signal;
+    server->signals.data = server;
+    event_loop_add(env, err, &server->loop, &server->signals, EPOLLIN);
+
+    if(dc_error_has_error(err))
+    {
+        close_signals(env, err, server);
+    }
+}
+
+static void close_signals(const struct dc_env *env, struct dc_error *err, struct server *server)
+{
+    DC_TRACE(env);
+
+    if(server->signals.fd == -1)
+    {
+        return;
+    }
+
+    dc_close(env, err, server->signals.fd);
+    server->signals.fd = -1;
+    dc_sigprocmask(env, err, SIG_SETMASK, &server->saved_mask, NULL);
+}
+
+static void begin_drain(const struct dc_env *env, struct dc_error *err, struct server *server)
+{
+    DC_TRACE(env);
+    server->draining = true;
+
+    // take whatever already completed the handshake so those clients are relayed rather than reset
+    on_accept(env, err, &server->loop, &server->listener, EPOLLIN);
+
+    if(dc_error_has_error(err))
+    {
+        return;
+    }
+
+    stop_accepting(env, err, server);
+
+    if(dc_error_has_no_error(err))
+    {
+        finish_queue(env, err, server);
+    }
+}
+
+static void finish_queue(const struct dc_env *env, struct dc_error *err, struct server *server)
+{
+    DC_TRACE(env);
+
+    if(server->head == NULL)
+    {
+        server->loop.running = false;
+        return;
+    }
+
+    if(server->config.drain_timeout > 0)
+    {
+        timer_wheel_schedule(env, err, &server->wheel, &server->drain_deadline, server->config.drain_timeout);
+    }
+}
+
+static void upgrade(const struct dc_env *env, struct dc_error *err, struct server *server)
+{
+    struct handoff handoff;
+    pid_t pid;
+    int channel;
+
+    DC_TRACE(env);
+    handoff.listen_fd = server->config.listen_fd;
+    handoff.output_fd = -1;
+    handoff.connections = NULL;
+    handoff.count = 0;
+    pid = -1;
+
+    if(server->config.handoff_connections)
+    {
+        hand_off_connections(env, err, server, &handoff);
+
+        if(dc_error_has_error(err))
+        {
+            goto COLLECT_FAIL;
+        }
+    }
+
+    pid = upgrade_spawn(env, err, server->config.argv, &server->saved_mask, &channel);
+
+    if(dc_error_has_error(err))
+    {
+        goto SPAWN_FAIL;
+    }
+
+    upgrade_send(env, err, channel, &handoff);
+    close(channel);
+
+    SPAWN_FAIL:
+    COLLECT_FAIL:
+    dc_free(env, handoff.connections);
+
+    // a failed upgrade must not take the running relay down with it
+    if(dc_error_has_error(err))
+    {
+        fprintf(stderr, "Upgrade failed: %s\n", dc_error_get_message(err));     // NOLINT(cert-err33-c)
+        dc_error_reset(err);
+
+        if(pid > 0)
+        {
+            waitpid(pid, NULL, 0);
+        }
+
+        return;
+    }
+
+    server->draining = true;
+    stop_accepting(env, err, server);
+
+    if(dc_error_has_error(err))
+    {
+        return;
+    }
+
+    if(server->config.handoff_connections)
+    {
+        server->stats.output_handed_off = true;
+
+        while(server->head != NULL)
+        {
+            detach_connection(env, err, server, server->head);
+            server->stats.handed_off++;
+        }
+
+        server->loop.running = false;
+        return;
+    }
+
+    finish_queue(env, err, server);
+}
+
+static void hand_off_connections(const struct dc_env *env, struct dc_error *err, struct server *server, struct handoff *handoff)
+{
+    const struct connection *connection;
+    size_t count;
+
+    DC_TRACE(env);
+
+    // nothing may be left in flight on the output once the new binary starts writing to it
+    if(server->config.coalesce_size > 0)
+    {
+        coalescer_flush(env, err, &server->coalescer);
+    }
+    else if(server->config.zerocopy)
+    {
+        zerocopy_wait(env, err, &server->ring.zc, server->ring.zc.next_seq);
+    }
+
+    if(dc_error_has_error(err))
+    {
+        output_failed(err, server);
+        return;
+    }
+
+    count = 0;
+
+    for(connection = server->head; connection != NULL; connection = connection->next)
+    {
+        count++;
+    }
+
+    if(count > 0)
+    {
+        handoff->connections = dc_calloc(env, err, count, sizeof(*handoff->connections));
+
+        if(dc_error_has_error(err))
+        {
+            return;
+        }
+    }
+
+    for(connection = server->head; connection != NULL; connection = connection->next)
+    {
+        handoff->connections[handoff->count++] = connection->source.fd;
+    }
+
+    handoff->output_fd = server->config.fd_out;
+}
+
+static void adopt(const struct dc_env *env, struct dc_error *err, struct server *server, int fd)
+{
+    struct sockaddr_in addr;
+    socklen_t addr_len;
+
+    DC_TRACE(env);
+    addr_len = sizeof(addr);
+    dc_memset(env, &addr, 0, sizeof(addr));
+    getpeername(fd, (struct sockaddr *)&addr, &addr_len);
+    enqueue(env, err, server, fd, &addr);
+
+    if(dc_error_has_no_error(err))
+    {
+        server->stats.inherited++;
+    }
+}
+
+static void on_read_timeout(const struct dc_env *env, struct dc_error *err, struct timer *timer)
+{
+    struct connection *connection;
+    struct server *server;
+
+    DC_TRACE(env);
+    connection = timer->data;
+    server = connection->server;
+
+    if(connection->received)
+    {
+        server->stats.read_stalls++;
+    }
+    else
+    {
+        server->stats.idle_timeouts++;
+    }
+
+    close_connection(env, err, server, connection);
+    activate(env, err, server);
+}
+
+static void arm_read_timer(const struct dc_env *env, struct dc_error *err, struct server *server, struct connection *connection)
+{
+    size_t timeout;
+
+    DC_TRACE(env);
+    timeout = connection->received ? server->config.read_stall_timeout : server->config.idle_timeout;
+
+    if(timeout > 0)
+    {
+        timer_wheel_schedule(env, err, &server->wheel, &connection->timer, timeout);
+    }
+}
+
+static void set_write_timeout(const struct dc_env *env, struct dc_error *err, const struct server *server)
+{
+    struct timeval timeout;
+
+    DC_TRACE(env);
+
+    if(server->config.write_stall_timeout == 0)
+    {
+        return;
+    }
+
+    timeout.tv_sec = (time_t)(server->config.write_stall_timeout / MSEC_PER_SEC);
+    timeout.tv_usec = (suseconds_t)(server->config.write_stall_timeout % MSEC_PER_SEC) * USEC_PER_MSEC;
+    dc_setsockopt(env, err, server->config.fd_out, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+    // the output may be a pipe or file, which cannot stall in a way SO_SNDTIMEO can bound
+    if(dc_error_is_errno(err, ENOTSOCK))
+    {
+        dc_error_reset(err);
+    }
+}
+
+static void watch_acks(const struct dc_env *env, struct dc_error *err, struct server *server, struct connection *connection)
+{
+    bool pending;
+
+    DC_TRACE(env);
+    pending = resume_ack_pending(&connection->resume);
+
+    if(pending != connection->ack_wait && dc_error_has_no_error(err))
+    {
+        event_loop_modify(env, err, &server->loop, &connection->source, (pending ? EPOLLIN | EPOLLOUT : EPOLLIN) | EPOLLRDHUP);
+        connection->ack_wait = pending;
+    }
+}
+
+static void output_failed(struct dc_error *err, struct server *server)
+{
+    if(server->config.write_stall_timeout == 0 || !(dc_error_is_errno(err, EAGAIN) || dc_error_is_errno(err, EWOULDBLOCK)))
+    {
+        return;
+    }
+
+    // every client shares the output, so moving on to the next one would leave a hole in the stream
+    dc_error_reset(err);
+    server->stats.write_stalls++;
+    DC_ERROR_RAISE_USER(err, "the output made no progress within the write timeout", 2);
+}
+
+static void reap_closed(const struct dc_env *env, struct server *server)
+{
+    DC_TRACE(env);
+
+    while(server->closed != NULL)
+    {
+        struct connection *connection;
+
+        connection = server->closed;
+        server->closed = connection->next;
+
+        // reported here, after the callback that closed it has charged its last span
+        if(server->config.perf != NULL || server->config.tune_interval > 0)
+        {
+            char label[INET_ADDRSTRLEN + PORT_LABEL_SIZE];
+
+            snprintf(label, sizeof(label), "%s:%d", dc_inet_ntoa(env, connection->addr.sin_addr), dc_ntohs(env, connection->addr.sin_port));  // NOLINT(cert-err33-c)
+
+            if(server->config.perf != NULL)
+            {
+                perf_totals_print(stdout, label, &connection->perf);
+            }
+
+            if(server->config.tune_interval > 0)
+            {
+                tcp_telemetry_print(stdout, label, &connection->tcp);
+            }
+        }
+
+        dc_free(env, connection);
+    }
+}
+
+static char *output_reserve(const struct dc_env *env, struct dc_error *err, struct server *server, size_t *count)
+{
+    char *buffer;
+
+    DC_TRACE(env);
+
+    if(server->config.coalesce_size > 0)
+    {
+        buffer = coalescer_reserve(&server->coalescer, count);
+
+        if(*count > server->config.buffer_size)
+        {
+            *count = server->config.buffer_size;
+        }
+    }
+    else if(server->config.zerocopy)
+    {
+        buffer = zerocopy_ring_next(env, err, &server->ring);
+        *count = server->config.buffer_size;
+    }
+    else if(server->config.records)
+    {
+        buffer = record_framer_reserve(&server->framer, count);
+    }
+    else if(server->config.file_out != NULL)
+    {
+        buffer = output_file_reserve(server->config.file_out, count);
+
+        if(*count > server->config.buffer_size)
+        {
+            *count = server->config.buffer_size;
+        }
+    }
+    else
+    {
+        buffer = server->buffer;
+        *count = server->config.buffer_size;
+    }
+
+    return buffer;
+}
+
+static void output_commit(const struct dc_env *env, struct dc_error *err, struct server *server, size_t count)
+{
+    DC_TRACE(env);
+
+    if(server->config.coalesce_size > 0)
+    {
+        coalescer_commit(env, err, &server->coalescer, count);
+    }
+    else if(server->config.zerocopy)
+    {
+        zerocopy_ring_send(env, err, &server->ring, count);
+    }
+    else if(server->config.records)
+    {
+        record_framer_commit(env, err, &server->framer, count);
+    }
+    else if(server->config.sink)
+    {
+        server->stats.sunk += count;
+    }
+    else if(server->config.unpack != NULL)
+    {
+        bundle_writer_write(env, server->config.unpack, server->buffer, count);
+    }
+    else if(server->config.file_out != NULL)
+    {
+        output_file_commit(env, err, server->config.file_out, count);
+    }
+    else if(server->config.transforms != NULL)
+    {
+        struct transform_span span;
+
+        span.data = server->buffer;
+        span.length = count;
+        transform_pipeline_process(env, err, server->config.transforms, &span);
+
+        if(span.length > 0 && dc_error_has_no_error(err))
+        {
+            write_fully(env, err, server->config.fd_out, span.data, span.length);
+        }
+    }
+    else
+    {
+        write_fully(env, err, server->config.fd_out, server->buffer, count);
+    }
+}
+
+static void sample_accept_queue(struct server *server)
+{
+    struct tcp_info info;
+    socklen_t len;
+
+    len = sizeof(info);
+
+    if(getsockopt(server->config.listen_fd, IPPROTO_TCP, TCP_INFO, &info, &len) == -1)
+    {
+        return;
+    }
+
+    server->stats.backlog = info.tcpi_sacked;
+
+    if(info.tcpi_unacked > server->stats.accept_queue_max)
+    {
+        server->stats.accept_queue_max = info.tcpi_unacked;
+    }
+}
+
+static void read_listen_counters(uint64_t *overflows, uint64_t *drops)
+{
+    FILE *stream;
+    char names[NETSTAT_LINE_SIZE];
+    char values[NETSTAT_LINE_SIZE];
+
+    *overflows = 0;
+    *drops = 0;
+    stream = fopen("/proc/net/netstat", "re");
+
+    if(stream == NULL)
+    {
+        return;
+    }
+
+    while(fgets(names, sizeof(names), stream) != NULL && fgets(values, sizeof(values), stream) != NULL)
+    {
+        char *name_state;
+        char *value_state;
+        const char *name;
+        const char *value;
+
+        if(strncmp(names, "TcpExt:", sizeof("TcpExt:") - 1) != 0)
+        {
+            continue;
+        }
+
+        name = strtok_r(names, " \n", &name_state);
+        value = strtok_r(values, " \n", &value_state);
+
+        while(name != NULL && value != NULL)
+        {
+            if(strcmp(name, "ListenOverflows") == 0)
+            {
+                *overflows = strtoull(value, NULL, 10);     // NOLINT(cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers)
+            }
+            else if(strcmp(name, "ListenDrops") == 0)
+            {
+                *drops = strtoull(value, NULL, 10);         // NOLINT(cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers)
+            }
+
+            name = strtok_r(NULL, " \n", &name_state);
+            value = strtok_r(NULL, " \n", &value_state);
+        }
+
+        break;
+    }
+
+    fclose(stream);     // NOLINT(cert-err33-c)
+}
@@ -0,0 +1,273 @@
+#include "telemetry.h"
+#include <errno.h>
+#include <inttypes.h>
+#include <linux/sockios.h>
+#include <linux/tcp.h>
+#include <netinet/in.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <time.h>
+
+
+static enum tcp_limit send_limit(const struct tcp_telemetry *telemetry, const struct tcp_info *info, uint64_t elapsed);
+static enum tcp_limit receive_limit(const struct tcp_telemetry *telemetry);
+static int socket_buffer(int fd, bool sending);
+static uint64_t now_us(void);
+
+
+// NOLINTBEGIN(modernize-macro-to-enum)
+#define USEC_PER_SEC 1000000
+#define NSEC_PER_USEC 1000
+#define USEC_PER_MSEC 1000.0
+#define BYTES_PER_MB (1024.0 * 1024.0)
+#define MAX_SOCKET_BUFFER (64 * 1024 * 1024)
+//NOLINTEND(modernize-macro-to-enum)
+
+
+static const char *const limit_names[TCP_LIMIT_COUNT] =
+{
+    "idle",
+    "application",
+    "congestion window",
+    "receive window",
+    "send buffer",
+    "sender",
+    "receive buffer",
+    "reader",
+};
+
+
+void tcp_telemetry_init(struct tcp_telemetry *telemetry, int fd, bool sending)
+{
+    memset(telemetry, 0, sizeof(*telemetry));
+    telemetry->fd = fd;
+    telemetry->sending = sending;
+    telemetry->buffer = socket_buffer(fd, sending);
+}
+
+bool tcp_telemetry_sample(const struct dc_env *env, struct dc_error *err, struct tcp_telemetry *telemetry)
+{
+    struct tcp_info info;
+    socklen_t len;
+    uint64_t now;
+    uint64_t elapsed;
+    uint64_t bytes;
+    uint32_t rtt;
+
+    DC_TRACE(env);
+
+    if(telemetry->fd == -1)
+    {
+        return false;
+    }
+
+    len = sizeof(info);
+    memset(&info, 0, sizeof(info));
+
+    if(getsockopt(telemetry->fd, IPPROTO_TCP, TCP_INFO, &info, &len) == -1)
+    {
+        // a file or pipe output has nothing to measure, so it is simply left alone
+        if(errno == ENOTSOCK || errno == EOPNOTSUPP)
+        {
+            telemetry->fd = -1;
+            return false;
+        }
+
+        DC_ERROR_RAISE_ERRNO(err, errno);
+        return false;
+    }
+
+    now = now_us();
+    elapsed = telemetry->sampled_at > 0 ? now - telemetry->sampled_at : 0;
+    bytes = telemetry->sending ? info.tcpi_bytes_acked : info.tcpi_bytes_received;
+    telemetry->cwnd = info.tcpi_snd_cwnd;
+    telemetry->retransmits = info.tcpi_total_retrans;
+    telemetry->buffer = socket_buffer(telemetry->fd, telemetry->sending);
+
+    if(telemetry->sending)
+    {
+        rtt = info.tcpi_rtt;
+        telemetry->delivery_rate = info.tcpi_delivery_rate;
+    }
+    else
+    {
+        // the receiver's own estimate, falling back to the one from our (usually tiny) sends
+        rtt = info.tcpi_rcv_rtt > 0 ? info.tcpi_rcv_rtt : info.tcpi_rtt;
+        telemetry->delivery_rate = elapsed > 0 ? (bytes - telemetry->bytes) * USEC_PER_SEC / elapsed : 0;
+    }
+
+    telemetry->rtt = rtt;
+    telemetry->bdp = telemetry->delivery_rate * rtt / USEC_PER_SEC;
+
+    if(elapsed > 0)
+    {
+        if(bytes == telemetry->bytes)
+        {
+            telemetry->limit = TCP_LIMIT_IDLE;
+        }
+        else if(telemetry->sending)
+        {
+            telemetry->limit = send_limit(telemetry, &info, elapsed);
+        }
+        else
+        {
+            telemetry->limit = receive_limit(telemetry);
+        }
+
+        telemetry->limited[telemetry->limit]++;
+        telemetry->samples++;
+    }
+
+    telemetry->sampled_at = now;
+    telemetry->bytes = bytes;
+    telemetry->busy_time = info.tcpi_busy_time;
+    telemetry->rwnd_limited = info.tcpi_rwnd_limited;
+    telemetry->sndbuf_limited = info.tcpi_sndbuf_limited;
+
+    return true;
+}
+
+void tcp_telemetry_tune(const struct dc_env *env, struct dc_error *err, struct tcp_telemetry *telemetry)
+{
+    uint64_t wanted;
+    int size;
+    int before;
+
+    DC_TRACE(env);
+
+    if(telemetry->fd == -1 || telemetry->limit != (telemetry->sending ? TCP_LIMIT_SNDBUF : TCP_LIMIT_RCVBUF))
+    {
+        return;
+    }
+
+    // the kernel doubles the request for bookkeeping, so asking for two BDPs leaves room for about two in flight
+    wanted = telemetry->bdp * 2;
+
+    if(wanted > MAX_SOCKET_BUFFER)
+    {
+        wanted = MAX_SOCKET_BUFFER;
+    }
+
+    if(wanted * 2 <= (uint64_t)telemetry->buffer)
+    {
+        return;
+    }
+
+    size = (int)wanted;
+    before = telemetry->buffer;
+
+    // setting either buffer turns off the kernel's autotuning for it, which is why only a measured shortfall does it
+    if(setsockopt(telemetry->fd, SOL_SOCKET, telemetry->sending ? SO_SNDBUF : SO_RCVBUF, &size, sizeof(size)) == -1)
+    {
+        DC_ERROR_RAISE_ERRNO(err, errno);
+        return;
+    }
+
+    telemetry->buffer = socket_buffer(telemetry->fd, telemetry->sending);
+
+    // net.core.wmem_max and rmem_max cap the request silently, and a capped buffer is not worth counting again
+    if(telemetry->buffer > before)
+    {
+        telemetry->resizes++;
+    }
+}
+
+void tcp_telemetry_print(FILE *stream, const char *label, const struct tcp_telemetry *telemetry)
+{
+    enum tcp_limit mostly;
+
+    mostly = TCP_LIMIT_IDLE;
+
+    // time spent idle says nothing about the link, so it only wins when nothing else was seen
+    for(int i = TCP_LIMIT_IDLE + 1; i < TCP_LIMIT_COUNT; i++)
+    {
+        if(telemetry->limited[i] > (mostly == TCP_LIMIT_IDLE ? 0 : telemetry->limited[mostly]))
+        {
+            mostly = (enum tcp_limit)i;
+        }
+    }
+
+    // NOLINTBEGIN(cert-err33-c)
+    if(telemetry->samples == 0)
+    {
+        fprintf(stream, "%-20snot sampled\n", label);
+        return;
+    }
+
+    fprintf(stream, "%-20srtt %.2f ms, cwnd %" PRIu32 ", %" PRIu32 " retransmits, %.2f MB/s, bdp %" PRIu64 " bytes, %s %d bytes (%zu resizes), limited by %s (mostly %s)\n",
+            label, (double)telemetry->rtt / USEC_PER_MSEC, telemetry->cwnd, telemetry->retransmits, (double)telemetry->delivery_rate / BYTES_PER_MB, telemetry->bdp,
+            telemetry->sending ? "sndbuf" : "rcvbuf", telemetry->buffer, telemetry->resizes, limit_names[telemetry->limit], limit_names[mostly]);
+    // NOLINTEND(cert-err33-c)
+}
+
+static enum tcp_limit send_limit(const struct tcp_telemetry *telemetry, const struct tcp_info *info, uint64_t elapsed)
+{
+    uint64_t busy;
+    uint64_t rwnd;
+    uint64_t sndbuf;
+    uint64_t network;
+    uint64_t starved;
+
+    // busy time already includes the rwnd- and sndbuf-limited time, so what remains is the congestion window
+    busy = info->tcpi_busy_time - telemetry->busy_time;
+    rwnd = info->tcpi_rwnd_limited - telemetry->rwnd_limited;
+    sndbuf = info->tcpi_sndbuf_limited - telemetry->sndbuf_limited;
+    network = busy > rwnd + sndbuf ? busy - rwnd - sndbuf : 0;
+    starved = elapsed > busy ? elapsed - busy : 0;
+
+    if(sndbuf >= rwnd && sndbuf >= network && sndbuf >= starved)
+    {
+        return TCP_LIMIT_SNDBUF;
+    }
+
+    if(rwnd >= network && rwnd >= starved)
+    {
+        return TCP_LIMIT_RWND;
+    }
+
+    return network >= starved ? TCP_LIMIT_CWND : TCP_LIMIT_APPLICATION;
+}
+
+static enum tcp_limit receive_limit(const struct tcp_telemetry *telemetry)
+{
+    int queued;
+
+    // data piling up unread means the relay, not the link, is the bottleneck
+    if(ioctl(telemetry->fd, SIOCINQ, &queued) == 0 && queued >= telemetry->buffer / 4)
+    {
+        return TCP_LIMIT_READER;
+    }
+
+    // about half of the buffer is window, so a BDP beyond that caps what the sender may have in flight
+    if(telemetry->bdp * 2 > (uint64_t)telemetry->buffer)
+    {
+        return TCP_LIMIT_RCVBUF;
+    }
+
+    return TCP_LIMIT_SENDER;
+}
+
+static int socket_buffer(int fd, bool sending)
+{
+    socklen_t len;
+    int size;
+
+    len = sizeof(size);
+
+    if(getsockopt(fd, SOL_SOCKET, sending ? SO_SNDBUF : SO_RCVBUF, &size, &len) == -1)
+    {
+        return 0;
+    }
+
+    return size;
+}
+
+static uint64_t now_us(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (uint64_t)now.tv_sec * USEC_PER_SEC + (uint64_t)now.tv_nsec / NSEC_PER_USEC;
+}
@@ -0,0 +1,273 @@
+#include "timer_wheel.h"
+#include <dc_posix/dc_unistd.h>
+#include <sys/timerfd.h>
+
+
+static void link_timer(struct timer_wheel *wheel, struct timer *timer);
+static void unlink_timer(struct timer *timer);
+static void cascade(struct timer_wheel *wheel, int level);
+static void run_slot(const struct dc_env *env, struct dc_error *err, struct timer_wheel *wheel, struct timer *slot);
+static void set_clock(const struct dc_env *env, struct dc_error *err, const struct timer_wheel *wheel, bool armed);
+
+
+// NOLINTBEGIN(modernize-macro-to-enum)
+#define SLOT_BITS 6
+#define SLOT_MASK (TIMER_WHEEL_SLOTS - 1)
+#define MAX_DELTA ((UINT64_C(1) << (SLOT_BITS * TIMER_WHEEL_LEVELS)) - 1)
+#define MSEC_PER_SEC 1000
+#define NSEC_PER_MSEC 1000000
+//NOLINTEND(modernize-macro-to-enum)
+
+
+void timer_init(struct timer *timer, timer_handler handler, void *data)
+{
+    timer->next = NULL;
+    timer->prev = NULL;
+    timer->expires = 0;
+    timer->handler = handler;
+    timer->data = data;
+}
+
+bool timer_pending(const struct timer *timer)
+{
+    return timer->next != NULL;
+}
+
+void timer_wheel_init(const struct dc_env *env, struct dc_error *err, struct timer_wheel *wheel, size_t tick_ms)
+{
+    DC_TRACE(env);
+
+    for(int level = 0; level < TIMER_WHEEL_LEVELS; level++)
+    {
+        for(int slot = 0; slot < TIMER_WHEEL_SLOTS; slot++)
+        {
+            wheel->slots[level][slot].next = &wheel->slots[level][slot];
+            wheel->slots[level][slot].prev = &wheel->slots[level][slot];
+        }
+    }
+
+    wheel->now = 0;
+    wheel->tick_ms = tick_ms;
+    wheel->pending = 0;
+    wheel->timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+
+    if(wheel->timer_fd == -1)
+    {
+        DC_ERROR_RAISE_ERRNO(err, errno);
+    }
+}
+
+void timer_wheel_schedule(const struct dc_env *env, struct dc_error *err, struct timer_wheel *wheel, struct timer *timer, size_t timeout_ms)
+{
+    uint64_t ticks;
+
+    DC_TRACE(env);
+
+    if(timer_pending(timer))
+    {
+        unlink_timer(timer);
+        wheel->pending--;
+    }
+
+    ticks = (timeout_ms + wheel->tick_ms - 1) / wheel->tick_ms;
+
+    if(ticks == 0)
+    {
+        ticks = 1;
+    }
+    else if(ticks > MAX_DELTA)
+    {
+        ticks = MAX_DELTA;
+    }
+
+    timer->expires = wheel->now + ticks;
+    link_timer(wheel, timer);
+
+    if(wheel->pending++ == 0)
+    {
+        set_clock(env, err, wheel, true);
+    }
+}
+
+void timer_wheel_cancel(const struct dc_env *env, struct dc_error *err, struct timer_wheel *wheel, struct timer *timer)
+{
+    DC_TRACE(env);
+
+    if(!timer_pending(timer))
+    {
+        return;
+    }
+
+    unlink_timer(timer);
+
+    if(--wheel->pending == 0)
+    {
+        set_clock(env, err, wheel, false);
+    }
+}
+
+void timer_wheel_expire(const struct dc_env *env, struct dc_error *err, struct timer_wheel *wheel)
+{
+    uint64_t ticks;
+
+    DC_TRACE(env);
+
+    if(read(wheel->timer_fd, &ticks, sizeof(ticks)) == -1)
+    {
+        if(errno != EAGAIN)
+        {
+            DC_ERROR_RAISE_ERRNO(err, errno);
+        }
+
+        return;
+    }
+
+    while(ticks > 0 && wheel->pending > 0 && dc_error_has_no_error(err))
+    {
+        int level;
+
+        wheel->now++;
+        ticks--;
+
+        for(level = 1; level < TIMER_WHEEL_LEVELS && ((wheel->now >> (SLOT_BITS * (unsigned int)(level - 1))) & SLOT_MASK) == 0; level++)
+        {
+            cascade(wheel, level);
+        }
+
+        run_slot(env, err, wheel, &wheel->slots[0][wheel->now & SLOT_MASK]);
+    }
+
+    wheel->now += ticks;
+}
+
+void timer_wheel_destroy(const struct dc_env *env, struct dc_error *err, struct timer_wheel *wheel)
+{
+    DC_TRACE(env);
+
+    for(int level = 0; level < TIMER_WHEEL_LEVELS; level++)
+    {
+        for(int slot = 0; slot < TIMER_WHEEL_SLOTS; slot++)
+        {
+            while(wheel->slots[level][slot].next != &wheel->slots[level][slot])
+            {
+                unlink_timer(wheel->slots[level][slot].next);
+            }
+        }
+    }
+
+    wheel->pending = 0;
+
+    if(wheel->timer_fd != -1)
+    {
+        dc_close(env, err, wheel->timer_fd);
+        wheel->timer_fd = -1;
+    }
+}
+
+static void link_timer(struct timer_wheel *wheel, struct timer *timer)
+{
+    struct timer *slot;
+    uint64_t delta;
+    unsigned int level;
+
+    delta = timer->expires - wheel->now;
+    level = 0;
+
+    while(level + 1 < TIMER_WHEEL_LEVELS && delta >= (UINT64_C(1) << (SLOT_BITS * (level + 1))))
+    {
+        level++;
+    }
+
+    slot = &wheel->slots[level][(timer->expires >> (SLOT_BITS * level)) & SLOT_MASK];
+    timer->next = slot;
+    timer->prev = slot->prev;
+    slot->prev->next = timer;
+    slot->prev = timer;
+}
+
+static void unlink_timer(struct timer *timer)
+{
+    timer->prev->next = timer->next;
+    timer->next->prev = timer->prev;
+    timer->next = NULL;
+    timer->prev = NULL;
+}
+
+static void cascade(struct timer_wheel *wheel, int level)
+{
+    struct timer *slot;
+
+    slot = &wheel->slots[level][(wheel->now >> (SLOT_BITS * (unsigned int)level)) & SLOT_MASK];
+
+    while(slot->next != slot)
+    {
+        struct timer *timer;
+
+        timer = slot->next;
+        unlink_timer(timer);
+        link_timer(wheel, timer);
+    }
+}
+
+static void run_slot(const struct dc_env *env, struct dc_error *err, struct timer_wheel *wheel, struct timer *slot)
+{
+    struct timer expired;
+
+    DC_TRACE(env);
+
+    if(slot->next == slot)
+    {
+        return;
+    }
+
+    // detach the slot so handlers can freely cancel or reschedule any timer, including ones not yet run
+    expired.next = slot->next;
+    expired.prev = slot->prev;
+    expired.next->prev = &expired;
+    expired.prev->next = &expired;
+    slot->next = slot;
+    slot->prev = slot;
+
+    while(expired.next != &expired)
+    {
+        struct timer *timer;
+
+        timer = expired.next;
+        unlink_timer(timer);
+
+        if(dc_error_has_error(err))
+        {
+            link_timer(wheel, timer);
+            continue;
+        }
+
+        if(--wheel->pending == 0)
+        {
+            set_clock(env, err, wheel, false);
+        }
+
+        timer->handler(env, err, timer);
+    }
+}
+
+static void set_clock(const struct dc_env *env, struct dc_error *err, const struct timer_wheel *wheel, bool armed)
+{
+    struct itimerspec spec;
+
+    DC_TRACE(env);
+    spec.it_value.tv_sec = 0;
+    spec.it_value.tv_nsec = 0;
+
+    if(armed)
+    {
+        spec.it_value.tv_sec = (time_t)(wheel->tick_ms / MSEC_PER_SEC);
+        spec.it_value.tv_nsec = (long)(wheel->tick_ms % MSEC_PER_SEC) * NSEC_PER_MSEC;
+    }
+
+    spec.it_interval = spec.it_value;
+
+    if(timerfd_settime(wheel->timer_fd, 0, &spec, NULL) == -1 && dc_error_has_no_error(err))
+    {
+        DC_ERROR_RAISE_ERRNO(err, errno);
+    }
+}
@@ -0,0 +1,345 @@
+#include "tls.h"
+#include <arpa/inet.h>
+#include <errno.h>
+#include <linux/tls.h>
+#include <openssl/err.h>
+#include <openssl/x509v3.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+
+
+static SSL_CTX *new_context(const struct dc_env *env, struct dc_error *err, const SSL_METHOD *method);
+static bool offloaded(SSL *ssl, bool send, bool receive);
+static void raise_tls(struct dc_error *err, SSL *ssl, const char *fallback);
+static void set_timeout(int fd, int timeout_ms);
+
+
+// NOLINTBEGIN(modernize-macro-to-enum)
+#define TLS12_CIPHERS "ECDHE-ECDSA-AES128-GCM-SHA256:ECDHE-RSA-AES128-GCM-SHA256:ECDHE-ECDSA-AES256-GCM-SHA384:ECDHE-RSA-AES256-GCM-SHA384"
+#define TLS13_CIPHERSUITES "TLS_AES_128_GCM_SHA256:TLS_AES_256_GCM_SHA384"
+#define RECORD_ALERT 21
+#define RECORD_DATA 23
+#define ALERT_WARNING 1
+#define ALERT_CLOSE_NOTIFY 0
+#define MSEC_PER_SEC 1000
+#define USEC_PER_MSEC 1000
+//NOLINTEND(modernize-macro-to-enum)
+
+
+void tls_server_init(const struct dc_env *env, struct dc_error *err, struct tls_context *tls, const char *pem_path)
+{
+    DC_TRACE(env);
+    tls->ctx = new_context(env, err, TLS_server_method());
+
+    if(dc_error_has_error(err))
+    {
+        return;
+    }
+
+    if(SSL_CTX_use_certificate_chain_file(tls->ctx, pem_path) != 1 || SSL_CTX_use_PrivateKey_file(tls->ctx, pem_path, SSL_FILETYPE_PEM) != 1 || SSL_CTX_check_private_key(tls->ctx) != 1)
+    {
+        raise_tls(err, NULL, "cannot load the TLS certificate and key");
+        tls_context_destroy(tls);
+        return;
+    }
+
+    // the session is dropped after the handshake, so there is nothing to resume and no ticket to send
+    SSL_CTX_set_num_tickets(tls->ctx, 0);
+    SSL_CTX_set_options(tls->ctx, SSL_OP_NO_TICKET);
+
+#if OPENSSL_VERSION_NUMBER < 0x30200000L
+    // before 3.2 OpenSSL only offloads TLS 1.3 transmit, and the input needs receive
+    SSL_CTX_set_max_proto_version(tls->ctx, TLS1_2_VERSION);
+#endif
+}
+
+void tls_client_init(const struct dc_env *env, struct dc_error *err, struct tls_context *tls, const char *ca_path)
+{
+    DC_TRACE(env);
+    tls->ctx = new_context(env, err, TLS_client_method());
+
+    if(dc_error_has_error(err))
+    {
+        return;
+    }
+
+    if(SSL_CTX_load_verify_locations(tls->ctx, ca_path, NULL) != 1)
+    {
+        raise_tls(err, NULL, "cannot load the TLS CA certificates");
+        tls_context_destroy(tls);
+        return;
+    }
+
+    SSL_CTX_set_verify(tls->ctx, SSL_VERIFY_PEER, NULL);
+}
+
+void tls_context_destroy(struct tls_context *tls)
+{
+    SSL_CTX_free(tls->ctx);
+    tls->ctx = NULL;
+}
+
+bool tls_accept(const struct dc_env *env, struct dc_error *err, const struct tls_context *tls, struct tls_session *session, int fd)
+{
+    int status;
+
+    DC_TRACE(env);
+
+    if(session->ssl == NULL)
+    {
+        session->ssl = SSL_new(tls->ctx);
+
+        if(session->ssl == NULL || SSL_set_fd(session->ssl, fd) != 1)
+        {
+            ERR_clear_error();
+            return false;
+        }
+    }
+
+    // the socket is non-blocking, so this runs again on every event until the handshake is done, and want_write says which event
+    status = SSL_accept(session->ssl);
+
+    if(status != 1)
+    {
+        switch(SSL_get_error(session->ssl, status))
+        {
+            case SSL_ERROR_WANT_READ:
+            {
+                session->want_write = false;
+                return true;
+            }
+            case SSL_ERROR_WANT_WRITE:
+            {
+                session->want_write = true;
+                return true;
+            }
+            default:
+            {
+                ERR_clear_error();
+                return false;
+            }
+        }
+    }
+
+    session->want_write = false;
+
+    // a client that raced data in behind its Finished would leave bytes the kernel never sees
+    if(SSL_has_pending(session->ssl))
+    {
+        tls_session_destroy(session);
+        return false;
+    }
+
+    if(!offloaded(session->ssl, false, true))
+    {
+        DC_ERROR_RAISE_USER(err, "the kernel did not take over TLS receive (is the tls module loaded?)", 2);
+        tls_session_destroy(session);
+        return false;
+    }
+
+    // from here the kernel decrypts and read() sees plain data, so the SSL object has nothing left to do
+    tls_session_destroy(session);
+    session->ready = true;
+
+    return true;
+}
+
+void tls_connect(const struct dc_env *env, struct dc_error *err, const struct tls_context *tls, int fd, const char *host, int timeout_ms)
+{
+    struct in6_addr addr;
+    SSL *ssl;
+    int status;
+
+    DC_TRACE(env);
+    ssl = SSL_new(tls->ctx);
+
+    if(ssl == NULL || SSL_set_fd(ssl, fd) != 1)
+    {
+        raise_tls(err, NULL, "cannot start a TLS session");
+        SSL_free(ssl);
+        return;
+    }
+
+    // an address is checked against the certificate's IP entries, anything else as a host name
+    if(inet_pton(AF_INET, host, &addr) == 1 || inet_pton(AF_INET6, host, &addr) == 1)
+    {
+        X509_VERIFY_PARAM_set1_ip_asc(SSL_get0_param(ssl), host);
+    }
+    else
+    {
+        SSL_set_tlsext_host_name(ssl, host);
+        SSL_set1_host(ssl, host);
+    }
+
+    set_timeout(fd, timeout_ms);
+    status = SSL_connect(ssl);
+    set_timeout(fd, 0);
+
+    if(status != 1)
+    {
+        raise_tls(err, ssl, "the TLS handshake with the output failed");
+    }
+    else if(!offloaded(ssl, true, false))
+    {
+        DC_ERROR_RAISE_USER(err, "the kernel did not take over TLS transmit (is the tls module loaded?)", 2);
+    }
+
+    // the kernel encrypts whatever is written to fd now, including splice and sendfile
+    SSL_free(ssl);
+}
+
+ssize_t tls_read(struct tls_session *session, int fd, void *buffer, size_t count)
+{
+    struct msghdr msg;
+    struct iovec iov;
+    struct cmsghdr *cmsg;
+    unsigned char *data;
+    char control[CMSG_SPACE(sizeof(unsigned char))];
+    ssize_t rbytes;
+
+    iov.iov_base = buffer;
+    iov.iov_len = count;
+    msg.msg_name = NULL;
+    msg.msg_namelen = 0;
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    msg.msg_flags = 0;
+
+    // with room for the record type the kernel hands over a non-data record instead of failing the read with EIO
+    rbytes = recvmsg(fd, &msg, 0);
+
+    if(rbytes == -1)
+    {
+        return -1;
+    }
+
+    // only close_notify ends the stream cleanly; a bare FIN could be anyone cutting it short
+    if(rbytes == 0)
+    {
+        if(session->closed)
+        {
+            return 0;
+        }
+
+        errno = ECONNABORTED;
+
+        return -1;
+    }
+
+    cmsg = CMSG_FIRSTHDR(&msg);
+
+    if(cmsg == NULL || cmsg->cmsg_level != SOL_TLS || cmsg->cmsg_type != TLS_GET_RECORD_TYPE || *CMSG_DATA(cmsg) == RECORD_DATA)
+    {
+        return rbytes;
+    }
+
+    data = buffer;
+
+    if(*CMSG_DATA(cmsg) == RECORD_ALERT && rbytes == 2 && data[0] == ALERT_WARNING && data[1] == ALERT_CLOSE_NOTIFY)
+    {
+        session->closed = true;
+
+        return 0;
+    }
+
+    // a fatal alert, or a handshake message such as a key update that the kernel cannot act on
+    errno = EPROTO;
+
+    return -1;
+}
+
+void tls_close_notify(const struct dc_env *env, struct dc_error *err, int fd)
+{
+    unsigned char alert[2];
+    struct msghdr msg;
+    struct iovec iov;
+    struct cmsghdr *cmsg;
+    char control[CMSG_SPACE(sizeof(unsigned char))];
+
+    DC_TRACE(env);
+    alert[0] = ALERT_WARNING;
+    alert[1] = ALERT_CLOSE_NOTIFY;
+    iov.iov_base = alert;
+    iov.iov_len = sizeof(alert);
+    msg.msg_name = NULL;
+    msg.msg_namelen = 0;
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    msg.msg_flags = 0;
+    cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_TLS;
+    cmsg->cmsg_type = TLS_SET_RECORD_TYPE;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(unsigned char));
+    *CMSG_DATA(cmsg) = RECORD_ALERT;
+
+    // the SSL object is long gone, so the alert goes out through the kernel like the data before it
+    if(sendmsg(fd, &msg, 0) == -1)
+    {
+        DC_ERROR_RAISE_ERRNO(err, errno);
+    }
+}
+
+void tls_session_destroy(struct tls_session *session)
+{
+    // the descriptor belongs to the caller: SSL_set_fd never closes it
+    SSL_free(session->ssl);
+    session->ssl = NULL;
+}
+
+static SSL_CTX *new_context(const struct dc_env *env, struct dc_error *err, const SSL_METHOD *method)
+{
+    SSL_CTX *ctx;
+
+    DC_TRACE(env);
+    ctx = SSL_CTX_new(method);
+
+    if(ctx == NULL)
+    {
+        raise_tls(err, NULL, "cannot create a TLS context");
+        return NULL;
+    }
+
+    // only AES-GCM is offloaded everywhere, and renegotiation is something the kernel cannot do
+    SSL_CTX_set_options(ctx, SSL_OP_ENABLE_KTLS | SSL_OP_NO_RENEGOTIATION);
+    SSL_CTX_set_min_proto_version(ctx, TLS1_2_VERSION);
+    SSL_CTX_set_cipher_list(ctx, TLS12_CIPHERS);
+    SSL_CTX_set_ciphersuites(ctx, TLS13_CIPHERSUITES);
+
+    return ctx;
+}
+
+static bool offloaded(SSL *ssl, bool send, bool receive)
+{
+    return (!send || BIO_get_ktls_send(SSL_get_wbio(ssl))) && (!receive || BIO_get_ktls_recv(SSL_get_rbio(ssl)));
+}
+
+static void raise_tls(struct dc_error *err, SSL *ssl, const char *fallback)
+{
+    const char *reason;
+    long result;
+
+    reason = ERR_reason_error_string(ERR_get_error());
+    ERR_clear_error();
+
+    // a rejected certificate says why, which is worth more than OpenSSL's generic "certificate verify failed"
+    if(ssl != NULL && (result = SSL_get_verify_result(ssl)) != X509_V_OK)
+    {
+        reason = X509_verify_cert_error_string(result);
+    }
+
+    DC_ERROR_RAISE_USER(err, reason != NULL ? reason : fallback, 2);
+}
+
+static void set_timeout(int fd, int timeout_ms)
+{
+    struct timeval timeout;
+
+    timeout.tv_sec = timeout_ms / MSEC_PER_SEC;
+    timeout.tv_usec = (timeout_ms % MSEC_PER_SEC) * USEC_PER_MSEC;
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+}
@@ -0,0 +1,109 @@
+#include "topology.h"
+#include <ctype.h>
+#include <dirent.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+static int cpu_node(const struct dc_env *env, int cpu);
+static int count_nodes(const struct dc_env *env);
+
+
+// NOLINTBEGIN(modernize-macro-to-enum)
+#define SYSFS_PATH_SIZE 64
+#define NODE_PREFIX_LEN 4
+//NOLINTEND(modernize-macro-to-enum)
+
+
+void topology_pin(const struct dc_env *env, struct dc_error *err, struct topology *topo, int cpu)
+{
+    DC_TRACE(env);
+    topo->pinned = false;
+
+    if(cpu >= 0)
+    {
+        cpu_set_t set;
+
+        CPU_ZERO(&set);
+        CPU_SET((size_t)cpu, &set);
+
+        if(sched_setaffinity(0, sizeof(set), &set) == -1)
+        {
+            DC_ERROR_RAISE_ERRNO(err, errno);
+            return;
+        }
+
+        topo->pinned = true;
+        topo->cpu = cpu;
+    }
+    else
+    {
+        topo->cpu = sched_getcpu();
+    }
+
+    topo->node = cpu_node(env, topo->cpu);
+    topo->nodes = count_nodes(env);
+}
+
+static int cpu_node(const struct dc_env *env, int cpu)
+{
+    char path[SYSFS_PATH_SIZE];
+    DIR *dir;
+    const struct dirent *entry;
+    int node;
+
+    DC_TRACE(env);
+    snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d", cpu);     // NOLINT(cert-err33-c)
+    dir = opendir(path);
+    node = -1;
+
+    if(dir == NULL)
+    {
+        return node;
+    }
+
+    while((entry = readdir(dir)) != NULL)   // NOLINT(concurrency-mt-unsafe)
+    {
+        if(strncmp(entry->d_name, "node", NODE_PREFIX_LEN) == 0)
+        {
+            node = atoi(&entry->d_name[NODE_PREFIX_LEN]);     // NOLINT(cert-err34-c)
+            break;
+        }
+    }
+
+    closedir(dir);
+
+    return node;
+}
+
+static int count_nodes(const struct dc_env *env)
+{
+    DIR *dir;
+    const struct dirent *entry;
+    int nodes;
+
+    DC_TRACE(env);
+    dir = opendir("/sys/devices/system/node");
+    nodes = 1;
+
+    if(dir == NULL)
+    {
+        return nodes;
+    }
+
+    nodes = 0;
+
+    while((entry = readdir(dir)) != NULL)   // NOLINT(concurrency-mt-unsafe)
+    {
+        if(strncmp(entry->d_name, "node", NODE_PREFIX_LEN) == 0 && isdigit((unsigned char)entry->d_name[NODE_PREFIX_LEN]))
+        {
+            nodes++;
+        }
+    }
+
+    closedir(dir);
+
+    return nodes;
+}
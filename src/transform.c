@@ -0,0 +1,635 @@
+#include "transform.h"
+#include "buffer_pool.h"
+#include "conversion.h"
+#include "copy.h"
+#include "dedup.h"
+#include <dc_c/dc_stdlib.h>
+#include <dc_c/dc_string.h>
+#include <dc_posix/dc_string.h>
+#include <dc_posix/dc_unistd.h>
+#include <string.h>
+
+
+struct sample
+{
+    size_t every;
+    size_t line;
+};
+
+
+struct filter
+{
+    char *pattern;
+    size_t pattern_length;
+    bool keep_matches;
+    char *line;
+    size_t line_length;
+    size_t line_capacity;
+    bool streaming;
+    bool keep_line;
+    bool copying;
+    char *out;
+    size_t out_capacity;
+};
+
+
+// NOLINTBEGIN(modernize-macro-to-enum)
+#define FILTER_MAX_LINE (64 * 1024)
+//NOLINTEND(modernize-macro-to-enum)
+
+
+static const struct transform_ops *find_ops(const struct dc_env *env, const char *name, size_t length);
+static void run_stages(const struct dc_env *env, struct dc_error *err, struct transform_pipeline *pipeline, size_t first, struct transform_span *span);
+static void sample_init(const struct dc_env *env, struct dc_error *err, struct transform_stage *stage, const char *arg);
+static void sample_process(const struct dc_env *env, struct dc_error *err, struct transform_stage *stage, struct transform_span *span);
+static void filter_init(const struct dc_env *env, struct dc_error *err, struct transform_stage *stage, const char *arg);
+static void drop_init(const struct dc_env *env, struct dc_error *err, struct transform_stage *stage, const char *arg);
+static void filter_process(const struct dc_env *env, struct dc_error *err, struct transform_stage *stage, struct transform_span *span);
+static void filter_flush(const struct dc_env *env, struct dc_error *err, struct transform_stage *stage, struct transform_span *span);
+static void filter_discard(const struct dc_env *env, struct transform_stage *stage);
+static void filter_destroy(const struct dc_env *env, struct transform_stage *stage);
+static bool filter_keeps(const struct filter *filter, const char *line, size_t length);
+static void filter_copy_out(const struct dc_env *env, struct dc_error *err, struct filter *filter, const struct transform_span *span, size_t used);
+static size_t filter_emit(const struct dc_env *env, struct dc_error *err, struct filter *filter, const struct transform_span *span, const char *line, size_t length, size_t used);
+static void stage_free(const struct dc_env *env, struct transform_stage *stage);
+
+
+static const struct transform_ops builtins[] =
+{
+    { "count",   NULL,         NULL,            NULL,          NULL,            NULL,           NULL         },
+    { "sample",  sample_init,  sample_process,  NULL,          NULL,            stage_free,     NULL         },
+    { "filter",  filter_init,  filter_process,  filter_flush,  filter_discard,  filter_destroy, NULL         },
+    { "drop",    drop_init,    filter_process,  filter_flush,  filter_discard,  filter_destroy, NULL         },
+    { "dedup",   dedup_init,   dedup_process,   dedup_flush,   dedup_discard,   dedup_destroy,  dedup_report },
+    { "undedup", undedup_init, undedup_process, undedup_flush, undedup_discard, dedup_destroy,  dedup_report },
+};
+
+
+void transform_pipeline_add(const struct dc_env *env, struct dc_error *err, struct transform_pipeline *pipeline, const char *spec)
+{
+    struct transform_stage *stage;
+    const char *arg;
+    size_t length;
+
+    DC_TRACE(env);
+
+    if(pipeline->count == TRANSFORM_MAX_STAGES)
+    {
+        DC_ERROR_RAISE_USER(err, "too many transform stages", 2);
+        return;
+    }
+
+    arg = dc_strchr(env, spec, '=');
+    length = arg ? (size_t)(arg - spec) : dc_strlen(env, spec);
+    stage = &pipeline->stages[pipeline->count];
+    dc_memset(env, stage, 0, sizeof(*stage));
+    stage->ops = find_ops(env, spec, length);
+
+    if(stage->ops == NULL)
+    {
+        DC_ERROR_RAISE_USER(err, "unknown transform stage (count, sample=N, filter=TEXT, drop=TEXT, dedup[=MB], undedup[=MB])", 2);
+        return;
+    }
+
+    if(stage->ops->init != NULL)
+    {
+        stage->ops->init(env, err, stage, arg ? arg + 1 : NULL);
+
+        if(dc_error_has_error(err))
+        {
+            return;
+        }
+    }
+
+    pipeline->count++;
+}
+
+void transform_pipeline_process(const struct dc_env *env, struct dc_error *err, struct transform_pipeline *pipeline, struct transform_span *span)
+{
+    DC_TRACE(env);
+    run_stages(env, err, pipeline, 0, span);
+}
+
+void transform_pipeline_flush(const struct dc_env *env, struct dc_error *err, struct transform_pipeline *pipeline, int to_fd)
+{
+    DC_TRACE(env);
+
+    for(size_t i = 0; i < pipeline->count && dc_error_has_no_error(err); i++)
+    {
+        struct transform_stage *stage;
+        struct transform_span span;
+
+        stage = &pipeline->stages[i];
+
+        if(stage->ops->flush == NULL)
+        {
+            continue;
+        }
+
+        span.data = NULL;
+        span.length = 0;
+        stage->ops->flush(env, err, stage, &span);
+        stage->bytes_out += span.length;
+
+        // whatever a stage held back still has to pass the stages after it
+        if(span.length > 0 && dc_error_has_no_error(err))
+        {
+            run_stages(env, err, pipeline, i + 1, &span);
+        }
+
+        if(span.length > 0 && dc_error_has_no_error(err))
+        {
+            write_fully(env, err, to_fd, span.data, span.length);
+        }
+    }
+}
+
+void transform_pipeline_discard(const struct dc_env *env, struct transform_pipeline *pipeline)
+{
+    DC_TRACE(env);
+
+    for(size_t i = 0; i < pipeline->count; i++)
+    {
+        if(pipeline->stages[i].ops->discard != NULL)
+        {
+            pipeline->stages[i].ops->discard(env, &pipeline->stages[i]);
+        }
+    }
+}
+
+void transform_pipeline_destroy(const struct dc_env *env, struct transform_pipeline *pipeline)
+{
+    DC_TRACE(env);
+
+    for(size_t i = 0; i < pipeline->count; i++)
+    {
+        if(pipeline->stages[i].ops->destroy != NULL)
+        {
+            pipeline->stages[i].ops->destroy(env, &pipeline->stages[i]);
+        }
+    }
+}
+
+void transform_buffer_grow(const struct dc_env *env, struct dc_error *err, char **buffer, size_t *capacity, size_t needed)
+{
+    size_t size;
+    char *grown;
+
+    DC_TRACE(env);
+
+    if(needed <= *capacity)
+    {
+        return;
+    }
+
+    size = *capacity ? *capacity : needed;
+
+    while(size < needed)
+    {
+        size *= 2;
+    }
+
+    grown = dc_realloc(env, err, *buffer, size);
+
+    if(dc_error_has_error(err))
+    {
+        return;
+    }
+
+    *buffer = grown;
+    *capacity = size;
+}
+
+void copy_transform(const struct dc_env *env, struct dc_error *err, int from_fd, int to_fd, size_t count, struct transform_pipeline *pipeline)
+{
+    char *buffer;
+    ssize_t rbytes;
+
+    DC_TRACE(env);
+    buffer = buffer_pool_acquire(env, err, count);
+
+    if(dc_error_has_error(err))
+    {
+        goto MALLOC_FAIL;
+    }
+
+    while((rbytes = dc_read(env, err, from_fd, buffer, count)) > 0)
+    {
+        struct transform_span span;
+
+        span.data = buffer;
+        span.length = (size_t)rbytes;
+        transform_pipeline_process(env, err, pipeline, &span);
+
+        if(dc_error_has_error(err))
+        {
+            goto PROCESS_FAIL;
+        }
+
+        if(span.length > 0)
+        {
+            write_fully(env, err, to_fd, span.data, span.length);
+        }
+
+        if(dc_error_has_error(err))
+        {
+            goto WRITE_FAIL;
+        }
+    }
+
+    if(dc_error_has_error(err))
+    {
+        if(dc_error_is_errno(err, EINTR))
+        {
+            dc_error_reset(err);
+        }
+
+        goto READ_FAIL;
+    }
+
+    transform_pipeline_flush(env, err, pipeline, to_fd);
+
+    READ_FAIL:
+    WRITE_FAIL:
+    PROCESS_FAIL:
+    buffer_pool_release(env, buffer, count);
+
+    MALLOC_FAIL:
+    {
+    }
+}
+
+static const struct transform_ops *find_ops(const struct dc_env *env, const char *name, size_t length)
+{
+    DC_TRACE(env);
+
+    for(size_t i = 0; i < sizeof(builtins) / sizeof(builtins[0]); i++)
+    {
+        if(dc_strlen(env, builtins[i].name) == length && dc_strncmp(env, builtins[i].name, name, length) == 0)
+        {
+            return &builtins[i];
+        }
+    }
+
+    return NULL;
+}
+
+static void run_stages(const struct dc_env *env, struct dc_error *err, struct transform_pipeline *pipeline, size_t first, struct transform_span *span)
+{
+    DC_TRACE(env);
+
+    for(size_t i = first; i < pipeline->count && span->length > 0; i++)
+    {
+        struct transform_stage *stage;
+
+        stage = &pipeline->stages[i];
+        stage->spans++;
+        stage->bytes_in += span->length;
+
+        // a stage without a process callback passes the span through untouched
+        if(stage->ops->process != NULL)
+        {
+            stage->ops->process(env, err, stage, span);
+
+            if(dc_error_has_error(err))
+            {
+                span->length = 0;
+                return;
+            }
+        }
+
+        stage->bytes_out += span->length;
+    }
+}
+
+static void sample_init(const struct dc_env *env, struct dc_error *err, struct transform_stage *stage, const char *arg)
+{
+    struct sample *sample;
+    size_t every;
+
+    DC_TRACE(env);
+
+    if(arg == NULL)
+    {
+        DC_ERROR_RAISE_USER(err, "sample needs a line interval (sample=N)", 2);
+        return;
+    }
+
+    every = parse_size_t(env, err, arg, 10);  // NOLINT(cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers)
+
+    if(dc_error_has_error(err))
+    {
+        return;
+    }
+
+    if(every == 0)
+    {
+        DC_ERROR_RAISE_USER(err, "sample interval must be at least 1", 2);
+        return;
+    }
+
+    sample = dc_calloc(env, err, 1, sizeof(*sample));
+
+    if(dc_error_has_error(err))
+    {
+        return;
+    }
+
+    sample->every = every;
+    stage->state = sample;
+}
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wunused-parameter"
+static void sample_process(const struct dc_env *env, struct dc_error *err, struct transform_stage *stage, struct transform_span *span)
+{
+    struct sample *sample;
+    const char *position;
+    const char *end;
+    char *out;
+
+    DC_TRACE(env);
+    sample = stage->state;
+
+    if(sample->every == 1)
+    {
+        return;
+    }
+
+    position = span->data;
+    end = span->data + span->length;
+    out = span->data;
+
+    // the kept lines are a subsequence of the span, so they are compacted in place
+    while(position < end)
+    {
+        const char *newline;
+        size_t length;
+
+        newline = dc_memchr(env, position, '\n', (size_t)(end - position));
+        length = newline ? (size_t)(newline - position) + 1 : (size_t)(end - position);
+
+        if(sample->line % sample->every == 0)
+        {
+            dc_memmove(env, out, position, length);
+            out += length;
+        }
+
+        if(newline != NULL)
+        {
+            sample->line++;
+        }
+
+        position += length;
+    }
+
+    span->length = (size_t)(out - span->data);
+}
+#pragma GCC diagnostic pop
+
+static void filter_init(const struct dc_env *env, struct dc_error *err, struct transform_stage *stage, const char *arg)
+{
+    struct filter *filter;
+
+    DC_TRACE(env);
+
+    if(arg == NULL || *arg == '\0')
+    {
+        DC_ERROR_RAISE_USER(err, "filter and drop need some text to match (filter=TEXT)", 2);
+        return;
+    }
+
+    filter = dc_calloc(env, err, 1, sizeof(*filter));
+
+    if(dc_error_has_error(err))
+    {
+        return;
+    }
+
+    filter->pattern = dc_strdup(env, err, arg);
+
+    if(dc_error_has_error(err))
+    {
+        dc_free(env, filter);
+        return;
+    }
+
+    filter->pattern_length = dc_strlen(env, arg);
+    filter->keep_matches = true;
+    stage->state = filter;
+}
+
+static void drop_init(const struct dc_env *env, struct dc_error *err, struct transform_stage *stage, const char *arg)
+{
+    struct filter *filter;
+
+    DC_TRACE(env);
+    filter_init(env, err, stage, arg);
+
+    if(dc_error_has_error(err))
+    {
+        return;
+    }
+
+    filter = stage->state;
+    filter->keep_matches = false;
+}
+
+static void filter_process(const struct dc_env *env, struct dc_error *err, struct transform_stage *stage, struct transform_span *span)
+{
+    struct filter *filter;
+    const char *position;
+    const char *end;
+    size_t used;
+
+    DC_TRACE(env);
+    filter = stage->state;
+    filter->copying = false;
+    position = span->data;
+    end = span->data + span->length;
+    used = 0;
+
+    while(position < end && dc_error_has_no_error(err))
+    {
+        const char *newline;
+        size_t length;
+
+        newline = dc_memchr(env, position, '\n', (size_t)(end - position));
+        length = newline ? (size_t)(newline - position) + 1 : (size_t)(end - position);
+
+        // the rest of an over-long line follows the verdict its start was given
+        if(filter->streaming)
+        {
+            if(filter->keep_line)
+            {
+                used = filter_emit(env, err, filter, span, position, length, used);
+            }
+
+            filter->streaming = newline == NULL;
+        }
+        // a line split across reads is only judged once it is complete, or once holding more of it would cost too much
+        else if(newline == NULL || filter->line_length > 0)
+        {
+            size_t held;
+
+            held = filter->line_length + length <= FILTER_MAX_LINE ? length : FILTER_MAX_LINE - filter->line_length;
+
+            // a line too long to hold is judged on its start, and nothing of it needs copying when that start is all here
+            if(filter->line_length == 0 && held < length)
+            {
+                filter->keep_line = filter_keeps(filter, position, held);
+
+                if(filter->keep_line)
+                {
+                    used = filter_emit(env, err, filter, span, position, length, used);
+                }
+
+                filter->streaming = true;
+                position += length;
+                continue;
+            }
+
+            transform_buffer_grow(env, err, &filter->line, &filter->line_capacity, filter->line_length + held);
+
+            if(dc_error_has_error(err))
+            {
+                break;
+            }
+
+            dc_memcpy(env, &filter->line[filter->line_length], position, held);
+            filter->line_length += held;
+
+            if(held < length || newline != NULL)
+            {
+                filter->keep_line = filter_keeps(filter, filter->line, filter->line_length);
+
+                if(filter->keep_line)
+                {
+                    filter_copy_out(env, err, filter, span, used);
+                    used = filter_emit(env, err, filter, span, filter->line, filter->line_length, used);
+                    used = filter_emit(env, err, filter, span, position + held, length - held, used);
+                }
+
+                filter->line_length = 0;
+                filter->streaming = newline == NULL;
+            }
+        }
+        else if(filter_keeps(filter, position, length))
+        {
+            used = filter_emit(env, err, filter, span, position, length, used);
+        }
+
+        position += length;
+    }
+
+    if(filter->copying)
+    {
+        span->data = filter->out;
+    }
+
+    span->length = used;
+}
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wunused-parameter"
+static void filter_flush(const struct dc_env *env, struct dc_error *err, struct transform_stage *stage, struct transform_span *span)
+{
+    struct filter *filter;
+
+    DC_TRACE(env);
+    filter = stage->state;
+    filter->streaming = false;
+
+    if(filter->line_length == 0 || !filter_keeps(filter, filter->line, filter->line_length))
+    {
+        filter->line_length = 0;
+        return;
+    }
+
+    span->data = filter->line;
+    span->length = filter->line_length;
+    filter->line_length = 0;
+}
+#pragma GCC diagnostic pop
+
+static void filter_discard(const struct dc_env *env, struct transform_stage *stage)
+{
+    struct filter *filter;
+
+    DC_TRACE(env);
+    filter = stage->state;
+    filter->line_length = 0;
+    filter->streaming = false;
+}
+
+static void filter_destroy(const struct dc_env *env, struct transform_stage *stage)
+{
+    struct filter *filter;
+
+    DC_TRACE(env);
+    filter = stage->state;
+
+    if(filter != NULL)
+    {
+        dc_free(env, filter->pattern);
+        dc_free(env, filter->line);
+        dc_free(env, filter->out);
+    }
+
+    stage_free(env, stage);
+}
+
+static bool filter_keeps(const struct filter *filter, const char *line, size_t length)
+{
+    return (memmem(line, length, filter->pattern, filter->pattern_length) != NULL) == filter->keep_matches;
+}
+
+static void filter_copy_out(const struct dc_env *env, struct dc_error *err, struct filter *filter, const struct transform_span *span, size_t used)
+{
+    DC_TRACE(env);
+
+    if(filter->copying)
+    {
+        return;
+    }
+
+    // a held line can't be put back in front of the span, so this one span is assembled in the filter's own buffer
+    transform_buffer_grow(env, err, &filter->out, &filter->out_capacity, FILTER_MAX_LINE + span->length);
+
+    if(dc_error_has_error(err))
+    {
+        return;
+    }
+
+    dc_memcpy(env, filter->out, span->data, used);
+    filter->copying = true;
+}
+
+static size_t filter_emit(const struct dc_env *env, struct dc_error *err, struct filter *filter, const struct transform_span *span, const char *line, size_t length, size_t used)
+{
+    DC_TRACE(env);
+
+    if(length == 0 || dc_error_has_error(err))
+    {
+        return used;
+    }
+
+    // kept lines are a subsequence of the span, so they are compacted in place as sample does
+    if(filter->copying)
+    {
+        dc_memcpy(env, &filter->out[used], line, length);
+    }
+    else if(line != &span->data[used])
+    {
+        dc_memmove(env, &span->data[used], line, length);
+    }
+
+    return used + length;
+}
+
+static void stage_free(const struct dc_env *env, struct transform_stage *stage)
+{
+    DC_TRACE(env);
+    dc_free(env, stage->state);
+    stage->state = NULL;
+}
@@ -0,0 +1,298 @@
+#include "upgrade.h"
+#include <dc_c/dc_stdlib.h>
+#include <dc_posix/dc_unistd.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+
+
+struct handoff_header
+{
+    int32_t has_output;
+    uint32_t count;
+};
+
+
+static void send_fds(const struct dc_env *env, struct dc_error *err, int channel, void *payload, size_t size, const int *fds, size_t count);
+static size_t receive_fds(const struct dc_env *env, struct dc_error *err, int channel, void *payload, size_t size, int *fds, size_t max);
+
+
+// NOLINTBEGIN(modernize-macro-to-enum)
+#define UPGRADE_ENV "DC_NETWORK_SNAKE_UPGRADE_FD"
+#define HANDOFF_BATCH 250
+#define ENV_VALUE_SIZE 16
+#define EXEC_FAILED 127
+//NOLINTEND(modernize-macro-to-enum)
+
+
+int upgrade_channel(void)
+{
+    const char *value;
+    int channel;
+
+    value = getenv(UPGRADE_ENV);    // NOLINT(concurrency-mt-unsafe)
+
+    if(value == NULL)
+    {
+        return -1;
+    }
+
+    channel = (int)strtol(value, NULL, 10);     // NOLINT(cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers)
+    unsetenv(UPGRADE_ENV);      // NOLINT(concurrency-mt-unsafe)
+
+    return channel;
+}
+
+pid_t upgrade_spawn(const struct dc_env *env, struct dc_error *err, char *argv[], const sigset_t *mask, int *channel)
+{
+    char value[ENV_VALUE_SIZE];
+    int fds[2];
+    pid_t pid;
+
+    DC_TRACE(env);
+
+    if(socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds) == -1)
+    {
+        DC_ERROR_RAISE_ERRNO(err, errno);
+        return -1;
+    }
+
+    snprintf(value, sizeof(value), "%d", fds[1]);       // NOLINT(cert-err33-c)
+    pid = fork();
+
+    if(pid == -1)
+    {
+        DC_ERROR_RAISE_ERRNO(err, errno);
+        close(fds[0]);
+        close(fds[1]);
+        return -1;
+    }
+
+    if(pid == 0)
+    {
+        // the new binary starts with the signal mask the old one had before it took over SIGINT/SIGTERM
+        sigprocmask(SIG_SETMASK, mask, NULL);
+        fcntl(fds[1], F_SETFD, 0);
+        setenv(UPGRADE_ENV, value, 1);      // NOLINT(concurrency-mt-unsafe)
+        execvp(argv[0], argv);
+        _exit(EXEC_FAILED);
+    }
+
+    close(fds[1]);
+    *channel = fds[0];
+
+    return pid;
+}
+
+void upgrade_send(const struct dc_env *env, struct dc_error *err, int channel, const struct handoff *handoff)
+{
+    struct handoff_header header;
+    int fds[2];
+    size_t sent;
+    char ack;
+
+    DC_TRACE(env);
+    header.has_output = handoff->output_fd != -1;
+    header.count = (uint32_t)handoff->count;
+    fds[0] = handoff->listen_fd;
+    fds[1] = handoff->output_fd;
+    send_fds(env, err, channel, &header, sizeof(header), fds, header.has_output ? 2 : 1);
+
+    for(sent = 0; sent < handoff->count && dc_error_has_no_error(err); sent += HANDOFF_BATCH)
+    {
+        size_t batch;
+
+        batch = handoff->count - sent;
+
+        if(batch > HANDOFF_BATCH)
+        {
+            batch = HANDOFF_BATCH;
+        }
+
+        send_fds(env, err, channel, &batch, sizeof(batch), &handoff->connections[sent], batch);
+    }
+
+    if(dc_error_has_error(err))
+    {
+        return;
+    }
+
+    // the new binary owns everything once it acknowledges; until then the old one keeps serving
+    if(read(channel, &ack, sizeof(ack)) != sizeof(ack))
+    {
+        DC_ERROR_RAISE_USER(err, "new binary exited before taking over", 2);
+    }
+}
+
+void upgrade_receive(const struct dc_env *env, struct dc_error *err, int channel, struct handoff *handoff)
+{
+    struct handoff_header header;
+    int fds[2];
+    size_t received;
+    size_t count;
+    char ack;
+
+    DC_TRACE(env);
+    handoff->listen_fd = -1;
+    handoff->output_fd = -1;
+    handoff->connections = NULL;
+    handoff->count = 0;
+    count = receive_fds(env, err, channel, &header, sizeof(header), fds, 2);
+
+    if(count != (header.has_output ? 2U : 1U))
+    {
+        if(dc_error_has_no_error(err))
+        {
+            DC_ERROR_RAISE_USER(err, "malformed upgrade handoff", 2);
+        }
+
+        close(channel);
+        return;
+    }
+
+    handoff->listen_fd = fds[0];
+    handoff->output_fd = header.has_output ? fds[1] : -1;
+
+    if(header.count > 0)
+    {
+        handoff->connections = dc_calloc(env, err, header.count, sizeof(*handoff->connections));
+
+        if(dc_error_has_error(err))
+        {
+            close(channel);
+            return;
+        }
+    }
+
+    for(received = 0; received < header.count;)
+    {
+        size_t batch;
+
+        count = receive_fds(env, err, channel, &batch, sizeof(batch), &handoff->connections[received], header.count - received);
+
+        if(dc_error_has_error(err))
+        {
+            break;
+        }
+
+        if(count == 0 || count != batch)
+        {
+            DC_ERROR_RAISE_USER(err, "malformed upgrade handoff", 2);
+            break;
+        }
+
+        received += count;
+    }
+
+    handoff->count = received;
+
+    if(dc_error_has_no_error(err))
+    {
+        ack = 1;
+        dc_write(env, err, channel, &ack, sizeof(ack));
+    }
+
+    close(channel);
+}
+
+static void send_fds(const struct dc_env *env, struct dc_error *err, int channel, void *payload, size_t size, const int *fds, size_t count)
+{
+    union
+    {
+        char buffer[CMSG_SPACE(sizeof(int) * HANDOFF_BATCH)];
+        struct cmsghdr align;
+    } control;
+    struct msghdr msg;
+    struct iovec iov;
+    struct cmsghdr *cmsg;
+
+    DC_TRACE(env);
+    iov.iov_base = payload;
+    iov.iov_len = size;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buffer;
+    msg.msg_controllen = CMSG_SPACE(sizeof(int) * count);
+    cmsg = &control.align;
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int) * count);
+    memcpy(CMSG_DATA(cmsg), fds, sizeof(int) * count);
+
+    if(sendmsg(channel, &msg, MSG_NOSIGNAL) == -1)
+    {
+        DC_ERROR_RAISE_ERRNO(err, errno);
+    }
+}
+
+static size_t receive_fds(const struct dc_env *env, struct dc_error *err, int channel, void *payload, size_t size, int *fds, size_t max)
+{
+    union
+    {
+        char buffer[CMSG_SPACE(sizeof(int) * HANDOFF_BATCH)];
+        struct cmsghdr align;
+    } control;
+    struct msghdr msg;
+    struct iovec iov;
+    struct cmsghdr *cmsg;
+    ssize_t rbytes;
+    size_t count;
+
+    DC_TRACE(env);
+    memset(payload, 0, size);
+    iov.iov_base = payload;
+    iov.iov_len = size;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buffer;
+    msg.msg_controllen = sizeof(control.buffer);
+    rbytes = recvmsg(channel, &msg, MSG_CMSG_CLOEXEC | MSG_WAITALL);
+
+    if(rbytes == -1)
+    {
+        DC_ERROR_RAISE_ERRNO(err, errno);
+        return 0;
+    }
+
+    count = 0;
+
+    for(cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL; cmsg = CMSG_NXTHDR(&msg, cmsg))
+    {
+        size_t n;
+
+        if(cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS)
+        {
+            continue;
+        }
+
+        n = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+
+        for(size_t i = 0; i < n; i++)
+        {
+            int fd;
+
+            memcpy(&fd, CMSG_DATA(cmsg) + i * sizeof(int), sizeof(fd));
+
+            if(count < max)
+            {
+                fds[count++] = fd;
+            }
+            else
+            {
+                close(fd);
+            }
+        }
+    }
+
+    if((size_t)rbytes != size)
+    {
+        DC_ERROR_RAISE_USER(err, "malformed upgrade handoff", 2);
+    }
+
+    return count;
+}
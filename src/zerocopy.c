@@ -0,0 +1,403 @@
+#include "zerocopy.h"
+#include "buffer_pool.h"
+#include <dc_c/dc_stdlib.h>
+#include <dc_posix/dc_unistd.h>
+#include <dc_posix/sys/dc_socket.h>
+#include <linux/errqueue.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <time.h>
+
+
+static void reap(const struct dc_env *env, struct dc_error *err, struct zerocopy *zc);
+static int reap_completions(struct zerocopy *zc, int timeout_ms);
+static void drain(struct zerocopy *zc, int timeout_ms);
+static bool seq_before(uint32_t a, uint32_t b);
+static size_t in_flight_slots(const struct dc_env *env, struct dc_error *err, int fd, size_t count);
+
+
+// NOLINTBEGIN(modernize-macro-to-enum)
+#define MIN_SLOTS 2
+#define COPIED_FALLBACK_SAMPLE 64
+#define DRAIN_TIMEOUT_MS 2000
+#define MSEC_PER_SEC 1000
+#define NSEC_PER_MSEC 1000000
+//NOLINTEND(modernize-macro-to-enum)
+
+
+void zerocopy_init(const struct dc_env *env, struct dc_error *err, struct zerocopy *zc, int fd)
+{
+    int on;
+
+    DC_TRACE(env);
+    zc->fd = fd;
+    zc->timeout_ms = -1;
+    zc->next_seq = 0;
+    zc->completed = 0;
+    zc->completions = 0;
+    zc->copied = 0;
+    on = 1;
+    dc_setsockopt(env, err, fd, SOL_SOCKET, SO_ZEROCOPY, &on, sizeof(on));
+    zc->enabled = dc_error_has_no_error(err);
+    dc_error_reset(err);
+}
+
+uint32_t zerocopy_send(const struct dc_env *env, struct dc_error *err, struct zerocopy *zc, const void *buffer, size_t count)
+{
+    const char *position;
+
+    DC_TRACE(env);
+    position = buffer;
+
+    while(count > 0)
+    {
+        ssize_t sbytes;
+
+        if(!zc->enabled)
+        {
+            sbytes = dc_write(env, err, zc->fd, position, count);
+
+            if(dc_error_has_error(err))
+            {
+                break;
+            }
+        }
+        else
+        {
+            sbytes = send(zc->fd, position, count, MSG_ZEROCOPY);
+
+            if(sbytes == -1)
+            {
+                if(errno == ENOBUFS)
+                {
+                    reap(env, err, zc);
+
+                    if(dc_error_has_error(err))
+                    {
+                        break;
+                    }
+
+                    continue;
+                }
+
+                DC_ERROR_RAISE_ERRNO(err, errno);
+                break;
+            }
+
+            zc->next_seq++;
+        }
+
+        position += sbytes;
+        count -= (size_t)sbytes;
+    }
+
+    return zc->next_seq;
+}
+
+void zerocopy_wait(const struct dc_env *env, struct dc_error *err, struct zerocopy *zc, uint32_t fence)
+{
+    DC_TRACE(env);
+
+    while(seq_before(zc->completed, fence))
+    {
+        reap(env, err, zc);
+
+        if(dc_error_has_error(err))
+        {
+            break;
+        }
+    }
+}
+
+void zerocopy_ring_init(const struct dc_env *env, struct dc_error *err, struct zerocopy_ring *ring, int fd, size_t count)
+{
+    DC_TRACE(env);
+    zerocopy_init(env, err, &ring->zc, fd);
+    ring->slot = 0;
+    ring->count = count;
+    ring->slots = ring->zc.enabled ? in_flight_slots(env, err, fd, count) : 1;
+    ring->fences = NULL;
+    ring->buffers = dc_calloc(env, err, ring->slots, sizeof(*ring->buffers));
+
+    if(dc_error_has_error(err))
+    {
+        return;
+    }
+
+    ring->fences = dc_calloc(env, err, ring->slots, sizeof(*ring->fences));
+
+    if(dc_error_has_error(err))
+    {
+        dc_free(env, ring->buffers);
+        ring->buffers = NULL;
+    }
+}
+
+char *zerocopy_ring_next(const struct dc_env *env, struct dc_error *err, struct zerocopy_ring *ring)
+{
+    DC_TRACE(env);
+    zerocopy_wait(env, err, &ring->zc, ring->fences[ring->slot]);
+
+    if(dc_error_has_error(err))
+    {
+        return NULL;
+    }
+
+    if(ring->buffers[ring->slot] == NULL)
+    {
+        ring->buffers[ring->slot] = buffer_pool_acquire(env, err, ring->count);
+    }
+
+    return ring->buffers[ring->slot];
+}
+
+void zerocopy_ring_send(const struct dc_env *env, struct dc_error *err, struct zerocopy_ring *ring, size_t count)
+{
+    DC_TRACE(env);
+    ring->fences[ring->slot] = zerocopy_send(env, err, &ring->zc, ring->buffers[ring->slot], count);
+    ring->slot = (ring->slot + 1) % ring->slots;
+}
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wunused-parameter"
+void zerocopy_ring_destroy(const struct dc_env *env, struct dc_error *err, struct zerocopy_ring *ring)
+{
+    DC_TRACE(env);
+
+    if(ring->buffers == NULL)
+    {
+        return;
+    }
+
+    // whatever ended the copy, the kernel may still be sending from these pages, so only completed slots go back to the pool
+    drain(&ring->zc, DRAIN_TIMEOUT_MS);
+
+    for(size_t i = 0; i < ring->slots; i++)
+    {
+        // a send that never completes (a peer that stopped reading) keeps its buffer; leaking it is the only safe choice
+        if(!seq_before(ring->zc.completed, ring->fences[i]))
+        {
+            buffer_pool_release(env, ring->buffers[i], ring->count);
+        }
+    }
+
+    dc_free(env, ring->fences);
+    dc_free(env, ring->buffers);
+    ring->fences = NULL;
+    ring->buffers = NULL;
+}
+#pragma GCC diagnostic pop
+
+void copy_zerocopy(const struct dc_env *env, struct dc_error *err, int from_fd, int to_fd, size_t count, struct zerocopy *result)
+{
+    struct zerocopy_ring ring;
+
+    DC_TRACE(env);
+    zerocopy_ring_init(env, err, &ring, to_fd, count);
+
+    if(dc_error_has_error(err))
+    {
+        goto INIT_FAIL;
+    }
+
+    for(;;)
+    {
+        char *buffer;
+        ssize_t rbytes;
+
+        buffer = zerocopy_ring_next(env, err, &ring);
+
+        if(dc_error_has_error(err))
+        {
+            goto NEXT_FAIL;
+        }
+
+        rbytes = dc_read(env, err, from_fd, buffer, count);
+
+        if(dc_error_has_error(err))
+        {
+            if(dc_error_is_errno(err, EINTR))
+            {
+                dc_error_reset(err);
+            }
+
+            goto READ_FAIL;
+        }
+
+        if(rbytes == 0)
+        {
+            break;
+        }
+
+        zerocopy_ring_send(env, err, &ring, (size_t)rbytes);
+
+        if(dc_error_has_error(err))
+        {
+            goto WRITE_FAIL;
+        }
+    }
+
+    READ_FAIL:
+    WRITE_FAIL:
+    NEXT_FAIL:
+    zerocopy_ring_destroy(env, err, &ring);
+
+    // the caller may want to know whether the kernel really avoided the copy
+    if(result != NULL)
+    {
+        *result = ring.zc;
+    }
+
+    INIT_FAIL:
+    {
+    }
+}
+
+static void reap(const struct dc_env *env, struct dc_error *err, struct zerocopy *zc)
+{
+    int error;
+
+    DC_TRACE(env);
+    error = reap_completions(zc, zc->timeout_ms);
+
+    if(error != 0)
+    {
+        DC_ERROR_RAISE_ERRNO(err, error);
+    }
+}
+
+static void drain(struct zerocopy *zc, int timeout_ms)
+{
+    struct timespec start;
+    struct timespec now;
+    long elapsed_ms;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    elapsed_ms = 0;
+
+    while(seq_before(zc->completed, zc->next_seq) && elapsed_ms < timeout_ms)
+    {
+        int error;
+
+        error = reap_completions(zc, (int)(timeout_ms - elapsed_ms));
+
+        if(error != 0 && error != EINTR)
+        {
+            break;
+        }
+
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        elapsed_ms = (now.tv_sec - start.tv_sec) * MSEC_PER_SEC + (now.tv_nsec - start.tv_nsec) / NSEC_PER_MSEC;
+    }
+}
+
+static int reap_completions(struct zerocopy *zc, int timeout_ms)
+{
+    struct pollfd pfd;
+
+    pfd.fd = zc->fd;
+    pfd.events = 0;
+
+    switch(poll(&pfd, 1, timeout_ms))
+    {
+        case -1:
+        {
+            return errno;
+        }
+        case 0:
+        {
+            // nothing completed in time, which a caller with a write timeout reports as a stalled write
+            return EAGAIN;
+        }
+        default:
+        {
+            break;
+        }
+    }
+
+    for(;;)
+    {
+        struct msghdr msg;
+        struct cmsghdr *cmsg;
+        char control[CMSG_SPACE(sizeof(struct sock_extended_err))];
+
+        msg.msg_name = NULL;
+        msg.msg_namelen = 0;
+        msg.msg_iov = NULL;
+        msg.msg_iovlen = 0;
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        msg.msg_flags = 0;
+
+        if(recvmsg(zc->fd, &msg, MSG_ERRQUEUE) == -1)
+        {
+            if(errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+            {
+                return errno;
+            }
+
+            return 0;
+        }
+
+        for(cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL; cmsg = CMSG_NXTHDR(&msg, cmsg))
+        {
+            const struct sock_extended_err *serr;
+
+            if(!((cmsg->cmsg_level == SOL_IP && cmsg->cmsg_type == IP_RECVERR) ||
+                 (cmsg->cmsg_level == SOL_IPV6 && cmsg->cmsg_type == IPV6_RECVERR)))
+            {
+                continue;
+            }
+
+            serr = (const struct sock_extended_err *)CMSG_DATA(cmsg);     // NOLINT(cppcoreguidelines-pro-type-cstyle-cast)
+
+            if(serr->ee_errno != 0 || serr->ee_origin != SO_EE_ORIGIN_ZEROCOPY)
+            {
+                continue;
+            }
+
+            zc->completions += serr->ee_data - serr->ee_info + 1;
+
+            if(serr->ee_code & SO_EE_CODE_ZEROCOPY_COPIED)
+            {
+                zc->copied += serr->ee_data - serr->ee_info + 1;
+            }
+
+            if(seq_before(zc->completed, serr->ee_data + 1))
+            {
+                zc->completed = serr->ee_data + 1;
+            }
+        }
+
+        if(zc->enabled && zc->completions >= COPIED_FALLBACK_SAMPLE && zc->copied == zc->completions)
+        {
+            zc->enabled = false;
+        }
+    }
+}
+
+static bool seq_before(uint32_t a, uint32_t b)
+{
+    return (int32_t)(a - b) < 0;
+}
+
+static size_t in_flight_slots(const struct dc_env *env, struct dc_error *err, int fd, size_t count)
+{
+    int sndbuf;
+    socklen_t len;
+    size_t slots;
+
+    DC_TRACE(env);
+    len = sizeof(sndbuf);
+    dc_getsockopt(env, err, fd, SOL_SOCKET, SO_SNDBUF, &sndbuf, &len);
+
+    if(dc_error_has_error(err))
+    {
+        dc_error_reset(err);
+        sndbuf = 0;
+    }
+
+    slots = ((size_t)sndbuf / count) + MIN_SLOTS;
+
+    return slots;
+}